@@ -0,0 +1,139 @@
+#!/usr/bin/awk -f
+#
+# Compare gbmtest results (-j <file>.csv) with a baseline, see make bench:
+#
+#	awk -v latency_pct=10 -v rate_pct=5 -v min_us=20 \
+#		-f bench/compare.awk baseline.csv results.csv
+#
+# Runs are matched by their label.  A regression is a stage whose p50 or
+# p99 grew by more than latency_pct percent and by more than min_us
+# microseconds, a rate (cycles/s, fps) that dropped by more than rate_pct
+# percent, a run that failed or a baseline run that did not run at all.
+# The exit status is 1 with any regression.  A changed environment (kernel,
+# driver, EGL, GL) is listed but is no regression by itself.
+
+# one CSV line into f[1..4]: run, label, metric, value
+function parse(line,    n, i, c, field, quoted) {
+	n = 1
+	field = ""
+	quoted = 0
+	for (i = 1; i <= length(line); i++) {
+		c = substr(line, i, 1)
+		if (quoted) {
+			if (c != "\"") {
+				field = field c
+			} else if (substr(line, i + 1, 1) == "\"") {
+				field = field c
+				i++
+			} else {
+				quoted = 0
+			}
+		} else if (c == "\"") {
+			quoted = 1
+		} else if (c == "," && n < 4) {
+			f[n++] = field
+			field = ""
+		} else {
+			field = field c
+		}
+	}
+	f[n] = field
+	return n
+}
+
+function change(b, c) {
+	return b ? sprintf("%+.1f%%", 100 * (c - b) / b) : "new"
+}
+
+function result(what, label, metric, b, c) {
+	printf "%-10s %s: %s %.3f -> %.3f (%s)\n", what, label, metric, b, c,
+		change(b, c)
+	if (what == "REGRESSED")
+		regressions++
+	else
+		improvements++
+}
+
+BEGIN {
+	if (latency_pct == "")
+		latency_pct = 10
+	if (rate_pct == "")
+		rate_pct = 5
+	if (min_us == "")
+		min_us = 20
+}
+
+FNR == 1 {
+	file++
+}
+
+/^run,label,metric,value$/ {
+	next
+}
+
+{
+	if (parse($0) != 4)
+		next
+	key = f[2] SUBSEP f[3]
+	if (file == 1) {
+		base[key] = f[4]
+		if (f[2] != "")
+			base_run[f[2]] = 1
+	} else {
+		cur[key] = f[4]
+		if (f[2] != "")
+			cur_run[f[2]] = 1
+	}
+}
+
+END {
+	for (key in base) {
+		split(key, k, SUBSEP)
+		label = k[1]
+		metric = k[2]
+		if (!(key in cur))
+			continue
+
+		if (label == "") {
+			if (cur[key] != base[key])
+				printf "%-10s %s: \"%s\" -> \"%s\"\n", "ENV", metric,
+					base[key], cur[key]
+			continue
+		}
+
+		b = base[key] + 0
+		c = cur[key] + 0
+		if (metric ~ /^stage\..*\.p(50|99)_us$/) {
+			if (c - b > min_us && c > b * (1 + latency_pct / 100))
+				result("REGRESSED", label, metric, b, c)
+			else if (b - c > min_us && c < b * (1 - latency_pct / 100))
+				result("improved", label, metric, b, c)
+		} else if (metric ~ /(cycles_per_s|\.fps)$/) {
+			if (c < b * (1 - rate_pct / 100))
+				result("REGRESSED", label, metric, b, c)
+			else if (c > b * (1 + rate_pct / 100))
+				result("improved", label, metric, b, c)
+		}
+	}
+
+	for (key in cur) {
+		split(key, k, SUBSEP)
+		if (k[2] == "counter.status" && cur[key] != 0) {
+			printf "%-10s %s: exit status %s\n", "FAILED", k[1], cur[key]
+			regressions++
+		}
+	}
+	for (label in base_run) {
+		if (!(label in cur_run)) {
+			printf "%-10s %s\n", "MISSING", label
+			regressions++
+		}
+	}
+	for (label in cur_run)
+		if (!(label in base_run))
+			printf "%-10s %s: not in the baseline\n", "NEW", label
+
+	printf "### bench: %d regressions, %d improvements (latency %s%% and %s us, rate %s%%)\n",
+		regressions, improvements, latency_pct, min_us, rate_pct
+	exit regressions > 0
+}
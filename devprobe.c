@@ -0,0 +1,192 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libudev.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "devprobe.h"
+
+/* a primary node is only useful for scanout if it has CRTCs */
+static bool has_kms(int fd)
+{
+	drmModeRes *res = drmModeGetResources(fd);
+	bool kms = res && res->count_crtcs > 0;
+
+	if (res)
+		drmModeFreeResources(res);
+
+	return kms;
+}
+
+/*
+ * Open the first DRM primary node (or render node) whose driver name,
+ * device node or sysfs path matches match, or the first one at all if
+ * match is NULL.  Returns the fd and the device node, or -1.
+ */
+int devprobe_open(const char *match, bool render_node, char *devnode, int len)
+{
+	struct udev *udev;
+	struct udev_enumerate *en;
+	struct udev_list_entry *entry;
+	int fd = -1;
+
+	udev = udev_new();
+	if (!udev) {
+		printf("failed to create udev context\n");
+		return -1;
+	}
+
+	en = udev_enumerate_new(udev);
+	udev_enumerate_add_match_subsystem(en, "drm");
+	udev_enumerate_add_match_sysname(en, render_node ? "renderD[0-9]*" : "card[0-9]*");
+	udev_enumerate_scan_devices(en);
+
+	udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(en)) {
+		struct udev_device *dev, *parent;
+		const char *node, *driver, *syspath;
+
+		dev = udev_device_new_from_syspath(udev, udev_list_entry_get_name(entry));
+		if (!dev)
+			continue;
+
+		node = udev_device_get_devnode(dev);
+		syspath = udev_device_get_syspath(dev);
+		parent = udev_device_get_parent(dev);
+		driver = parent ? udev_device_get_driver(parent) : NULL;
+
+		printf("### DRM device %s: driver %s, %s\n", node ? node : "(none)",
+				driver ? driver : "(none)", syspath);
+
+		if (node && (!match || (driver && !strcmp(driver, match)) ||
+		    !strcmp(node, match) || strstr(syspath, match))) {
+			fd = open(node, O_RDWR | O_CLOEXEC);
+			if (fd < 0) {
+				printf("failed to open %s: %s\n", node, strerror(errno));
+			} else if (!render_node && !has_kms(fd)) {
+				close(fd);
+				fd = -1;
+			} else {
+				snprintf(devnode, len, "%s", node);
+			}
+		}
+
+		udev_device_unref(dev);
+		if (fd >= 0)
+			break;
+	}
+
+	udev_enumerate_unref(en);
+	udev_unref(udev);
+
+	if (fd < 0)
+		printf("no DRM device%s%s found\n", match ? " matching " : "",
+				match ? match : "");
+
+	return fd;
+}
+
+/* open the device of the last run, if it is still driven by the same driver */
+int devprobe_open_cached(const struct drm_choice *choice)
+{
+	drmVersionPtr version;
+	bool same;
+	int fd;
+
+	if (!choice->devnode[0])
+		return -1;
+
+	fd = open(choice->devnode, O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	version = drmGetVersion(fd);
+	same = version && !strcmp(version->name, choice->driver);
+	if (version)
+		drmFreeVersion(version);
+
+	if (!same) {
+		printf("cached device %s is no longer driven by %s\n",
+				choice->devnode, choice->driver);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int devprobe_cache_load(const char *file, struct drm_choice *choice)
+{
+	FILE *f;
+	int n;
+
+	memset(choice, 0, sizeof(*choice));
+
+	f = fopen(file, "r");
+	if (!f)
+		return -1;
+
+	n = fscanf(f, "device %63s\ndriver %31s\nconnector %u\ncrtc %u\nmode %31s %u %u %u\n",
+			choice->devnode, choice->driver, &choice->connector_id,
+			&choice->crtc_id, choice->mode_name, &choice->hdisplay,
+			&choice->vdisplay, &choice->vrefresh);
+	fclose(f);
+
+	if (n != 8) {
+		printf("ignoring malformed device cache %s\n", file);
+		memset(choice, 0, sizeof(*choice));
+		return -1;
+	}
+
+	return 0;
+}
+
+int devprobe_cache_store(const char *file, const struct drm_choice *choice)
+{
+	char tmp[256];
+	FILE *f;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+	f = fopen(tmp, "w");
+	if (!f) {
+		printf("failed to write device cache %s: %s\n", tmp, strerror(errno));
+		return -1;
+	}
+
+	fprintf(f, "device %s\ndriver %s\nconnector %u\ncrtc %u\nmode %s %u %u %u\n",
+			choice->devnode, choice->driver, choice->connector_id,
+			choice->crtc_id, choice->mode_name, choice->hdisplay,
+			choice->vdisplay, choice->vrefresh);
+
+	if (fclose(f) || rename(tmp, file)) {
+		printf("failed to write device cache %s: %s\n", file, strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,49 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _KMSCUBE_DEVPROBE_H_
+#define _KMSCUBE_DEVPROBE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <xf86drmMode.h>
+
+/*
+ * DRM device discovery through udev instead of drmOpen() probing kernel
+ * modules by name, and a small cache file remembering the device,
+ * connector, CRTC and mode picked by the last run.
+ */
+struct drm_choice {
+	char devnode[64];
+	char driver[32];
+	uint32_t connector_id, crtc_id;
+	char mode_name[DRM_DISPLAY_MODE_LEN];
+	uint32_t hdisplay, vdisplay, vrefresh;
+};
+
+int devprobe_open(const char *match, bool render_node, char *devnode,
+		int len);
+int devprobe_open_cached(const struct drm_choice *choice);
+int devprobe_cache_load(const char *file, struct drm_choice *choice);
+int devprobe_cache_store(const char *file, const struct drm_choice *choice);
+
+#endif /* _KMSCUBE_DEVPROBE_H_ */
@@ -0,0 +1,372 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <xf86drm.h>
+#include <drm_fourcc.h>
+
+#include "dmabuf.h"
+
+int dmabuf_consumer_init(struct dmabuf_consumer *c, int drm_fd)
+{
+	static const EGLint config_attribs[] = {
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+		EGL_NONE
+	};
+	static const EGLint context_attribs[] = {
+		EGL_CONTEXT_CLIENT_VERSION, 2,
+		EGL_NONE
+	};
+	const char *ext;
+	EGLConfig config;
+	EGLint major, minor, n;
+	char *name;
+
+	memset(c, 0, sizeof(*c));
+	c->fd = -1;
+	c->display = EGL_NO_DISPLAY;
+	c->context = EGL_NO_CONTEXT;
+	stats_init(&c->export_, "export");
+	stats_init(&c->import, "import");
+	stats_init(&c->sample, "sample");
+
+	/* a file of its own: a dma-buf from the producer's file has to be
+	 * imported, nothing is shared through the GEM handle namespace */
+	name = drmGetRenderDeviceNameFromFd(drm_fd);
+	if (!name)
+		name = drmGetDeviceNameFromFd2(drm_fd);
+	if (!name) {
+		printf("dmabuf: failed to find the DRM device node\n");
+		return -1;
+	}
+	c->fd = open(name, O_RDWR | O_CLOEXEC);
+	if (c->fd < 0) {
+		printf("dmabuf: failed to open %s: %s\n", name, strerror(errno));
+		free(name);
+		return -1;
+	}
+	free(name);
+
+	c->gbm = gbm_create_device(c->fd);
+	if (!c->gbm) {
+		printf("dmabuf: failed to create the consumer gbm device\n");
+		goto fail;
+	}
+
+	c->display = eglGetDisplay((EGLNativeDisplayType)c->gbm);
+	if (!eglInitialize(c->display, &major, &minor)) {
+		printf("dmabuf: failed to initialize the consumer EGL display\n");
+		goto fail;
+	}
+
+	ext = eglQueryString(c->display, EGL_EXTENSIONS);
+	if (!strstr(ext, "EGL_EXT_image_dma_buf_import") ||
+	    !strstr(ext, "EGL_KHR_surfaceless_context")) {
+		printf("dmabuf: needs EGL_EXT_image_dma_buf_import and EGL_KHR_surfaceless_context\n");
+		goto fail;
+	}
+	c->modifiers = strstr(ext, "EGL_EXT_image_dma_buf_import_modifiers") != NULL;
+
+	if (!eglBindAPI(EGL_OPENGL_ES_API) ||
+	    !eglChooseConfig(c->display, config_attribs, &config, 1, &n) || n != 1) {
+		printf("dmabuf: failed to choose a consumer config\n");
+		goto fail;
+	}
+
+	c->context = eglCreateContext(c->display, config, EGL_NO_CONTEXT,
+			context_attribs);
+	if (c->context == EGL_NO_CONTEXT) {
+		printf("dmabuf: failed to create the consumer context\n");
+		goto fail;
+	}
+
+	c->create_image = (PFNEGLCREATEIMAGEKHRPROC)
+			eglGetProcAddress("eglCreateImageKHR");
+	c->destroy_image = (PFNEGLDESTROYIMAGEKHRPROC)
+			eglGetProcAddress("eglDestroyImageKHR");
+	c->image_target_texture = (PFNGLEGLIMAGETARGETTEXTURE2DOESPROC)
+			eglGetProcAddress("glEGLImageTargetTexture2DOES");
+	if (!c->create_image || !c->destroy_image || !c->image_target_texture) {
+		printf("dmabuf: failed to get the EGLImage entry points\n");
+		goto fail;
+	}
+
+	return 0;
+
+fail:
+	dmabuf_consumer_fini(c);
+	return -1;
+}
+
+static int make_current(struct dmabuf_consumer *c)
+{
+	if (!eglMakeCurrent(c->display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+			c->context)) {
+		printf("dmabuf: eglMakeCurrent failed: 0x%x\n", eglGetError());
+		return -1;
+	}
+
+	return 0;
+}
+
+static void release_import(struct dmabuf_consumer *c, struct dmabuf_import *imp)
+{
+	if (imp->fbo)
+		glDeleteFramebuffers(1, &imp->fbo);
+	if (imp->tex)
+		glDeleteTextures(1, &imp->tex);
+	if (imp->image != EGL_NO_IMAGE_KHR)
+		c->destroy_image(c->display, imp->image);
+	memset(imp, 0, sizeof(*imp));
+}
+
+/*
+ * Export the BO as a dma-buf and import that into an EGLImage, a texture
+ * and a framebuffer object of the consumer.  The image keeps its own
+ * reference to the buffer, the fd is closed right away.
+ */
+static int import_fb(struct dmabuf_consumer *c, struct dmabuf_import *imp,
+		const struct drm_fb *fb)
+{
+	static const EGLint plane_attribs[4][5] = {
+		{ EGL_DMA_BUF_PLANE0_FD_EXT, EGL_DMA_BUF_PLANE0_OFFSET_EXT,
+		  EGL_DMA_BUF_PLANE0_PITCH_EXT, EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT,
+		  EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT },
+		{ EGL_DMA_BUF_PLANE1_FD_EXT, EGL_DMA_BUF_PLANE1_OFFSET_EXT,
+		  EGL_DMA_BUF_PLANE1_PITCH_EXT, EGL_DMA_BUF_PLANE1_MODIFIER_LO_EXT,
+		  EGL_DMA_BUF_PLANE1_MODIFIER_HI_EXT },
+		{ EGL_DMA_BUF_PLANE2_FD_EXT, EGL_DMA_BUF_PLANE2_OFFSET_EXT,
+		  EGL_DMA_BUF_PLANE2_PITCH_EXT, EGL_DMA_BUF_PLANE2_MODIFIER_LO_EXT,
+		  EGL_DMA_BUF_PLANE2_MODIFIER_HI_EXT },
+		{ EGL_DMA_BUF_PLANE3_FD_EXT, EGL_DMA_BUF_PLANE3_OFFSET_EXT,
+		  EGL_DMA_BUF_PLANE3_PITCH_EXT, EGL_DMA_BUF_PLANE3_MODIFIER_LO_EXT,
+		  EGL_DMA_BUF_PLANE3_MODIFIER_HI_EXT },
+	};
+	EGLint attribs[6 + 4 * 10 + 1];
+	uint64_t start;
+	int fd, i, n = 0;
+
+	start = stats_now_ns();
+	fd = gbm_bo_get_fd(fb->bo);
+	if (fd < 0) {
+		printf("dmabuf: failed to export the BO\n");
+		return -1;
+	}
+	stats_add(&c->export_, stats_now_ns() - start);
+
+	start = stats_now_ns();
+	attribs[n++] = EGL_WIDTH;
+	attribs[n++] = fb->width;
+	attribs[n++] = EGL_HEIGHT;
+	attribs[n++] = fb->height;
+	attribs[n++] = EGL_LINUX_DRM_FOURCC_EXT;
+	attribs[n++] = fb->format;
+	for (i = 0; i < fb->nplanes; i++) {
+		attribs[n++] = plane_attribs[i][0];
+		attribs[n++] = fd;
+		attribs[n++] = plane_attribs[i][1];
+		attribs[n++] = gbm_bo_get_offset(fb->bo, i);
+		attribs[n++] = plane_attribs[i][2];
+		attribs[n++] = gbm_bo_get_stride_for_plane(fb->bo, i);
+		if (c->modifiers && fb->modifier != DRM_FORMAT_MOD_INVALID) {
+			attribs[n++] = plane_attribs[i][3];
+			attribs[n++] = fb->modifier & 0xffffffff;
+			attribs[n++] = plane_attribs[i][4];
+			attribs[n++] = fb->modifier >> 32;
+		}
+	}
+	attribs[n] = EGL_NONE;
+
+	imp->image = c->create_image(c->display, EGL_NO_CONTEXT,
+			EGL_LINUX_DMA_BUF_EXT, NULL, attribs);
+	close(fd);
+	if (imp->image == EGL_NO_IMAGE_KHR) {
+		printf("dmabuf: failed to import a %ux%u buffer: 0x%x\n",
+				fb->width, fb->height, eglGetError());
+		return -1;
+	}
+
+	glGenTextures(1, &imp->tex);
+	glBindTexture(GL_TEXTURE_2D, imp->tex);
+	c->image_target_texture(GL_TEXTURE_2D, imp->image);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	glGenFramebuffers(1, &imp->fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, imp->fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			GL_TEXTURE_2D, imp->tex, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		printf("dmabuf: the imported buffer can't be read\n");
+		return -1;
+	}
+	stats_add(&c->import, stats_now_ns() - start);
+
+	return 0;
+}
+
+static struct dmabuf_import *lookup(struct dmabuf_consumer *c,
+		const struct drm_fb *fb)
+{
+	int i;
+
+	for (i = 0; i < DMABUF_CACHE_SLOTS; i++)
+		if (c->slot[i].bo == fb->bo && c->slot[i].serial == fb->serial)
+			return &c->slot[i];
+
+	return NULL;
+}
+
+/* an empty slot, or the least recently used one */
+static struct dmabuf_import *get_slot(struct dmabuf_consumer *c)
+{
+	struct dmabuf_import *lru = NULL;
+	int i;
+
+	for (i = 0; i < DMABUF_CACHE_SLOTS; i++) {
+		if (!c->slot[i].bo)
+			return &c->slot[i];
+		if (!lru || c->slot[i].last_use < lru->last_use)
+			lru = &c->slot[i];
+	}
+
+	c->evictions++;
+	release_import(c, lru);
+
+	return lru;
+}
+
+/*
+ * Hand a rendered buffer to the consumer and read back its first pixel,
+ * which the producer stamped with the frame number.  A fresh import that
+ * doesn't show the stamp wasn't synchronized with the rendering; a cached
+ * one that shows an older frame is a copy made at import time, not the
+ * buffer itself.
+ */
+int dmabuf_consume(struct dmabuf_consumer *c, const struct drm_fb *fb,
+		const uint8_t stamp[3])
+{
+	struct dmabuf_import *imp;
+	GLubyte px[4];
+	uint64_t start;
+	bool cached;
+	int i;
+
+	if (make_current(c))
+		return -1;
+
+	c->frames++;
+	imp = lookup(c, fb);
+	cached = imp != NULL;
+	if (cached) {
+		c->hits++;
+	} else {
+		c->misses++;
+		imp = get_slot(c);
+		if (import_fb(c, imp, fb)) {
+			release_import(c, imp);
+			return -1;
+		}
+		imp->bo = fb->bo;
+		imp->serial = fb->serial;
+	}
+	imp->last_use = ++c->tick;
+
+	start = stats_now_ns();
+	glBindFramebuffer(GL_FRAMEBUFFER, imp->fbo);
+	glReadPixels(0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, px);
+	stats_add(&c->sample, stats_now_ns() - start);
+
+	/* loose enough for 16 bpp buffers */
+	for (i = 0; i < 3; i++) {
+		if (abs(px[i] - stamp[i]) > 8) {
+			if (cached)
+				c->copies++;
+			else
+				c->stale++;
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/* drop all imports, e.g. once the buffers they came from are gone */
+void dmabuf_cache_flush(struct dmabuf_consumer *c)
+{
+	int i;
+
+	if (c->context == EGL_NO_CONTEXT || make_current(c))
+		return;
+
+	for (i = 0; i < DMABUF_CACHE_SLOTS; i++)
+		if (c->slot[i].bo)
+			release_import(c, &c->slot[i]);
+
+	eglMakeCurrent(c->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
+
+void dmabuf_report(const struct dmabuf_consumer *c)
+{
+	if (!c->frames)
+		return;
+
+	printf("### dma-buf sharing: %u frames, %u imports, %u cache hits, %u evictions%s\n",
+			c->frames, c->misses, c->hits, c->evictions,
+			c->modifiers ? "" : " (no modifier support)");
+	stats_print_header();
+	stats_print(&c->export_);
+	stats_print(&c->import);
+	stats_print(&c->sample);
+
+	if (c->copies)
+		printf("### dma-buf sharing: %u cached imports showed an older frame, the import copies the buffer\n",
+				c->copies);
+	else if (c->hits)
+		printf("### dma-buf sharing: zero-copy, cached imports followed every frame\n");
+	if (c->stale)
+		printf("### dma-buf sharing: %u fresh imports were read before the rendering finished\n",
+				c->stale);
+}
+
+void dmabuf_consumer_fini(struct dmabuf_consumer *c)
+{
+	dmabuf_cache_flush(c);
+
+	if (c->context != EGL_NO_CONTEXT)
+		eglDestroyContext(c->display, c->context);
+	if (c->display != EGL_NO_DISPLAY)
+		eglTerminate(c->display);
+	if (c->gbm)
+		gbm_device_destroy(c->gbm);
+	if (c->fd >= 0)
+		close(c->fd);
+	memset(c, 0, sizeof(*c));
+	c->fd = -1;
+	c->context = EGL_NO_CONTEXT;
+	c->display = EGL_NO_DISPLAY;
+}
@@ -0,0 +1,84 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _KMSCUBE_DMABUF_H_
+#define _KMSCUBE_DMABUF_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <gbm.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+#include "fbcache.h"
+#include "stats.h"
+
+#define DMABUF_CACHE_SLOTS	(8)
+
+/*
+ * A rendered buffer as the consumer sees it: imported from a dma-buf into
+ * an EGLImage, bound to a texture and attached to a framebuffer object to
+ * sample it.  Entries are keyed by the BO and the serial the fb cache gave
+ * it, so a recycled BO pointer is never mistaken for an imported one.
+ */
+struct dmabuf_import {
+	struct gbm_bo *bo;
+	uint64_t serial;
+	EGLImageKHR image;
+	GLuint tex, fbo;
+	uint64_t last_use;
+};
+
+/*
+ * The second consumer of the rendered buffers: its own DRM file, gbm
+ * device, EGLDisplay and context, so every buffer goes through a real
+ * PRIME export and import, as it does when handed to another process.
+ */
+struct dmabuf_consumer {
+	int fd;
+	struct gbm_device *gbm;
+	EGLDisplay display;
+	EGLContext context;
+	bool modifiers;		/* EGL_EXT_image_dma_buf_import_modifiers */
+
+	PFNEGLCREATEIMAGEKHRPROC create_image;
+	PFNEGLDESTROYIMAGEKHRPROC destroy_image;
+	PFNGLEGLIMAGETARGETTEXTURE2DOESPROC image_target_texture;
+
+	struct dmabuf_import slot[DMABUF_CACHE_SLOTS];
+	uint64_t tick;
+
+	struct stage_stats export_, import, sample;
+	unsigned int frames, hits, misses, evictions;
+	unsigned int stale, copies;	/* samples without the expected stamp */
+};
+
+int dmabuf_consumer_init(struct dmabuf_consumer *c, int drm_fd);
+int dmabuf_consume(struct dmabuf_consumer *c, const struct drm_fb *fb,
+		const uint8_t stamp[3]);
+void dmabuf_cache_flush(struct dmabuf_consumer *c);
+void dmabuf_report(const struct dmabuf_consumer *c);
+void dmabuf_consumer_fini(struct dmabuf_consumer *c);
+
+#endif /* _KMSCUBE_DMABUF_H_ */
@@ -0,0 +1,282 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+
+#include "fbcache.h"
+
+void fb_cache_init(struct fb_cache *c, int fd, bool scanout)
+{
+	uint64_t cap = 0;
+	int i;
+
+	memset(c, 0, sizeof(*c));
+	c->fd = fd;
+	c->scanout = scanout;
+	c->modifiers = scanout &&
+			!drmGetCap(fd, DRM_CAP_ADDFB2_MODIFIERS, &cap) && cap;
+
+	for (i = 0; i < FB_CACHE_SLOTS; i++)
+		c->slot[i].cache = c;
+}
+
+static int fb_add(struct fb_cache *c, struct drm_fb *fb)
+{
+	uint32_t handles[4] = {0}, pitches[4] = {0}, offsets[4] = {0};
+	uint64_t modifiers[4] = {0};
+	int i, ret;
+
+	fb->serial = ++c->serial;
+	fb->width = gbm_bo_get_width(fb->bo);
+	fb->height = gbm_bo_get_height(fb->bo);
+	fb->format = gbm_bo_get_format(fb->bo);
+	fb->modifier = gbm_bo_get_modifier(fb->bo);
+	fb->nplanes = gbm_bo_get_plane_count(fb->bo);
+	if (fb->nplanes < 1 || fb->nplanes > 4)
+		fb->nplanes = 1;
+
+	for (i = 0; i < fb->nplanes; i++) {
+		handles[i] = gbm_bo_get_handle_for_plane(fb->bo, i).u32;
+		pitches[i] = gbm_bo_get_stride_for_plane(fb->bo, i);
+		offsets[i] = gbm_bo_get_offset(fb->bo, i);
+		modifiers[i] = fb->modifier;
+	}
+
+	/* headless: the geometry is all the ring needs */
+	if (!c->scanout)
+		return 0;
+
+	c->addfb++;
+	if (c->modifiers && fb->modifier != DRM_FORMAT_MOD_INVALID)
+		ret = drmModeAddFB2WithModifiers(c->fd, fb->width, fb->height,
+				fb->format, handles, pitches, offsets, modifiers,
+				&fb->fb_id, DRM_MODE_FB_MODIFIERS);
+	else
+		ret = drmModeAddFB2(c->fd, fb->width, fb->height, fb->format,
+				handles, pitches, offsets, &fb->fb_id, 0);
+	if (ret) {
+		printf("failed to create fb: %s\n", strerror(errno));
+		fb->fb_id = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void fb_clear(struct drm_fb *fb)
+{
+	struct fb_cache *c = fb->cache;
+
+	memset(fb, 0, sizeof(*fb));
+	fb->cache = c;
+}
+
+static void fb_remove(struct drm_fb *fb)
+{
+	struct fb_cache *c = fb->cache;
+
+	if (fb->fb_id) {
+		drmModeRmFB(c->fd, fb->fb_id);
+		c->rmfb++;
+	}
+
+	if (fb->owned)
+		gbm_bo_destroy(fb->bo);
+	else if (fb->bo)
+		gbm_bo_set_user_data(fb->bo, NULL, NULL);
+
+	fb_clear(fb);
+}
+
+/* libgbm is destroying a gbm_surface buffer we have a framebuffer for */
+static void fb_bo_destroyed(struct gbm_bo *bo, void *data)
+{
+	struct drm_fb *fb = data;
+
+	if (fb->fb_id) {
+		drmModeRmFB(fb->cache->fd, fb->fb_id);
+		fb->cache->rmfb++;
+	}
+	fb_clear(fb);
+}
+
+/* an empty slot, or the least recently used one that is not busy */
+static struct drm_fb *fb_get_slot(struct fb_cache *c)
+{
+	struct drm_fb *lru = NULL;
+	int i;
+
+	for (i = 0; i < FB_CACHE_SLOTS; i++) {
+		struct drm_fb *fb = &c->slot[i];
+
+		if (!fb->bo)
+			return fb;
+		if (!fb->busy && (!lru || fb->last_use < lru->last_use))
+			lru = fb;
+	}
+
+	if (!lru) {
+		printf("fb cache: all %d slots are busy\n", FB_CACHE_SLOTS);
+		return NULL;
+	}
+
+	c->evictions++;
+	fb_remove(lru);
+
+	return lru;
+}
+
+/* framebuffer for a buffer locked from a gbm_surface */
+struct drm_fb *fb_cache_lookup(struct fb_cache *c, struct gbm_bo *bo)
+{
+	struct drm_fb *fb = gbm_bo_get_user_data(bo);
+
+	if (fb && fb->cache == c && fb->bo == bo) {
+		c->hits++;
+		goto out;
+	}
+
+	c->misses++;
+	fb = fb_get_slot(c);
+	if (!fb)
+		return NULL;
+
+	fb->bo = bo;
+	if (fb_add(c, fb)) {
+		fb_clear(fb);
+		return NULL;
+	}
+	gbm_bo_set_user_data(bo, fb, fb_bo_destroyed);
+
+out:
+	fb->busy = true;
+	fb->last_use = ++c->tick;
+	return fb;
+}
+
+static bool modifier_allowed(uint64_t modifier, const uint64_t *modifiers,
+		unsigned int nmodifiers)
+{
+	unsigned int i;
+
+	if (!nmodifiers)
+		return true;
+
+	for (i = 0; i < nmodifiers; i++)
+		if (modifiers[i] == modifier)
+			return true;
+
+	return false;
+}
+
+/*
+ * Hand out an idle ring buffer of the given geometry, allocating one with
+ * its framebuffer only when none is free.
+ */
+struct drm_fb *fb_cache_acquire(struct fb_cache *c, struct gbm_device *dev,
+		uint32_t width, uint32_t height, uint32_t format,
+		const uint64_t *modifiers, unsigned int nmodifiers)
+{
+	struct drm_fb *fb;
+	int i;
+
+	for (i = 0; i < FB_CACHE_SLOTS; i++) {
+		fb = &c->slot[i];
+
+		if (fb->owned && !fb->busy && fb->width == width &&
+		    fb->height == height && fb->format == format &&
+		    modifier_allowed(fb->modifier, modifiers, nmodifiers)) {
+			c->hits++;
+			goto out;
+		}
+	}
+
+	c->misses++;
+	fb = fb_get_slot(c);
+	if (!fb)
+		return NULL;
+
+	if (nmodifiers)
+		fb->bo = gbm_bo_create_with_modifiers(dev, width, height, format,
+				modifiers, nmodifiers);
+	else
+		fb->bo = gbm_bo_create(dev, width, height, format,
+				c->scanout ? GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING :
+				GBM_BO_USE_RENDERING);
+	if (!fb->bo) {
+		printf("failed to allocate %ux%u %s buffer\n", width, height,
+				c->scanout ? "scanout" : "render");
+		return NULL;
+	}
+	c->allocs++;
+	fb->owned = true;
+
+	if (fb_add(c, fb)) {
+		fb_remove(fb);
+		return NULL;
+	}
+
+out:
+	fb->busy = true;
+	fb->last_use = ++c->tick;
+	return fb;
+}
+
+/* the buffer left the screen and may be reused or evicted */
+void fb_cache_release(struct drm_fb *fb)
+{
+	fb->busy = false;
+}
+
+/* free the ring buffers, e.g. before their gbm_device goes away */
+void fb_cache_drop_owned(struct fb_cache *c)
+{
+	int i;
+
+	for (i = 0; i < FB_CACHE_SLOTS; i++)
+		if (c->slot[i].owned)
+			fb_remove(&c->slot[i]);
+}
+
+void fb_cache_report(const struct fb_cache *c)
+{
+	if (!c->hits && !c->misses)
+		return;
+
+	printf("### FB cache: %u hits, %u misses, %u AddFB, %u RmFB, %u evictions, %u ring buffers allocated%s\n",
+			c->hits, c->misses, c->addfb, c->rmfb, c->evictions,
+			c->allocs, c->modifiers ? "" : " (no modifier support)");
+}
+
+void fb_cache_fini(struct fb_cache *c)
+{
+	int i;
+
+	for (i = 0; i < FB_CACHE_SLOTS; i++)
+		if (c->slot[i].bo)
+			fb_remove(&c->slot[i]);
+}
@@ -0,0 +1,70 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _KMSCUBE_FBCACHE_H_
+#define _KMSCUBE_FBCACHE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <gbm.h>
+
+#define FB_CACHE_SLOTS	(16)
+
+/*
+ * A DRM framebuffer wrapping a gbm_bo.  Slots either track a buffer owned
+ * by a gbm_surface (dropped when libgbm destroys the BO), or own their BO
+ * ("ring" buffers), which then outlives any gbm_surface of the same
+ * geometry.  A busy slot is on screen or queued and is never evicted.
+ */
+struct drm_fb {
+	struct gbm_bo *bo;
+	uint32_t fb_id;
+	uint32_t width, height, format;
+	uint64_t modifier;
+	int nplanes;
+	bool owned;
+	bool busy;
+	uint64_t last_use;
+	uint64_t serial;	/* new for every BO the slot takes */
+	struct fb_cache *cache;
+};
+
+struct fb_cache {
+	int fd;
+	bool scanout;		/* false: plain render buffers, no framebuffers */
+	bool modifiers;		/* DRM_CAP_ADDFB2_MODIFIERS */
+	struct drm_fb slot[FB_CACHE_SLOTS];
+	uint64_t tick, serial;
+	unsigned int hits, misses, addfb, rmfb, evictions, allocs;
+};
+
+void fb_cache_init(struct fb_cache *c, int fd, bool scanout);
+struct drm_fb *fb_cache_lookup(struct fb_cache *c, struct gbm_bo *bo);
+struct drm_fb *fb_cache_acquire(struct fb_cache *c, struct gbm_device *dev,
+		uint32_t width, uint32_t height, uint32_t format,
+		const uint64_t *modifiers, unsigned int nmodifiers);
+void fb_cache_release(struct drm_fb *fb);
+void fb_cache_drop_owned(struct fb_cache *c);
+void fb_cache_report(const struct fb_cache *c);
+void fb_cache_fini(struct fb_cache *c);
+
+#endif /* _KMSCUBE_FBCACHE_H_ */
@@ -0,0 +1,196 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+
+#include "formats.h"
+
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+
+/* what the cube may scan out, in order of preference */
+static const struct {
+	uint32_t format;
+	int cpp;
+} candidates[] = {
+	{ DRM_FORMAT_XRGB8888, 4 },
+	{ DRM_FORMAT_ARGB8888, 4 },
+	{ DRM_FORMAT_RGB565, 2 },
+};
+
+static int candidate_index(uint32_t format)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(candidates); i++)
+		if (candidates[i].format == format)
+			return i;
+	return -1;
+}
+
+bool format_scanout_candidate(uint32_t format)
+{
+	return candidate_index(format) >= 0;
+}
+
+/* frame buffer compression, listed as the headers know it */
+static const uint64_t compressed_modifiers[] = {
+	I915_FORMAT_MOD_Y_TILED_CCS,
+	I915_FORMAT_MOD_Yf_TILED_CCS,
+#ifdef I915_FORMAT_MOD_Y_TILED_GEN12_RC_CCS
+	I915_FORMAT_MOD_Y_TILED_GEN12_RC_CCS,
+	I915_FORMAT_MOD_Y_TILED_GEN12_MC_CCS,
+#endif
+#ifdef I915_FORMAT_MOD_Y_TILED_GEN12_RC_CCS_CC
+	I915_FORMAT_MOD_Y_TILED_GEN12_RC_CCS_CC,
+#endif
+};
+
+enum modifier_class modifier_class(uint64_t modifier)
+{
+	uint64_t vendor = modifier >> 56;
+	int i;
+
+	if (modifier == DRM_FORMAT_MOD_LINEAR || modifier == DRM_FORMAT_MOD_INVALID)
+		return MOD_CLASS_LINEAR;
+
+	/* AFBC, the ARM type 0 modifiers, whatever its block layout */
+	if (vendor == DRM_FORMAT_MOD_VENDOR_ARM &&
+	    ((modifier >> 52) & DRM_FORMAT_MOD_ARM_TYPE_MASK) == DRM_FORMAT_MOD_ARM_TYPE_AFBC)
+		return MOD_CLASS_COMPRESSED;
+#ifdef AMD_FMT_MOD_DCC_SHIFT
+	if (vendor == DRM_FORMAT_MOD_VENDOR_AMD && AMD_FMT_MOD_GET(DCC, modifier))
+		return MOD_CLASS_COMPRESSED;
+#endif
+	/* the compression bits of the NVIDIA block linear layouts */
+	if (vendor == DRM_FORMAT_MOD_VENDOR_NVIDIA && (modifier & 0x10) &&
+	    ((modifier >> 23) & 0x7))
+		return MOD_CLASS_COMPRESSED;
+	for (i = 0; i < ARRAY_SIZE(compressed_modifiers); i++)
+		if (modifier == compressed_modifiers[i])
+			return MOD_CLASS_COMPRESSED;
+
+	return MOD_CLASS_TILED;
+}
+
+const char *modifier_class_name(uint64_t modifier)
+{
+	static const char *names[] = {
+		[MOD_CLASS_LINEAR] = "linear",
+		[MOD_CLASS_TILED] = "tiled",
+		[MOD_CLASS_COMPRESSED] = "compressed",
+	};
+
+	if (modifier == DRM_FORMAT_MOD_INVALID)
+		return "implicit";
+	return names[modifier_class(modifier)];
+}
+
+static int compare_pairs(const void *pa, const void *pb)
+{
+	const struct format_mod *a = pa, *b = pb;
+	int ia = candidate_index(a->format), ib = candidate_index(b->format);
+	int ca = modifier_class(a->modifier), cb = modifier_class(b->modifier);
+
+	if (candidates[ia].cpp != candidates[ib].cpp)
+		return candidates[ib].cpp - candidates[ia].cpp;
+	if (ca != cb)
+		return cb - ca;
+	return ia - ib;
+}
+
+void format_mods_sort(struct format_mod *pairs, int n)
+{
+	qsort(pairs, n, sizeof(*pairs), compare_pairs);
+}
+
+int format_mods_from_blob(int fd, uint32_t blob_id, struct format_mod *pairs,
+		int max)
+{
+	const struct drm_format_modifier_blob *hdr;
+	const struct drm_format_modifier *mods;
+	drmModePropertyBlobPtr blob;
+	const uint32_t *formats;
+	uint32_t i, j;
+	int n = 0;
+
+	blob = drmModeGetPropertyBlob(fd, blob_id);
+	if (!blob)
+		return -1;
+
+	/* each modifier lists its formats as a bitmask from an offset */
+	hdr = blob->data;
+	formats = (const uint32_t *)((const char *)hdr + hdr->formats_offset);
+	mods = (const struct drm_format_modifier *)((const char *)hdr +
+			hdr->modifiers_offset);
+	for (i = 0; i < hdr->count_modifiers; i++) {
+		for (j = 0; j < 64 && n < max; j++) {
+			if (!(mods[i].formats & (1ull << j)) ||
+			    mods[i].offset + j >= hdr->count_formats ||
+			    !format_scanout_candidate(formats[mods[i].offset + j]))
+				continue;
+			pairs[n].format = formats[mods[i].offset + j];
+			pairs[n].modifier = mods[i].modifier;
+			n++;
+		}
+	}
+	drmModeFreePropertyBlob(blob);
+
+	format_mods_sort(pairs, n);
+
+	return n;
+}
+
+int format_mod_parse(const char *arg, struct format_mod *fm)
+{
+	char *end;
+
+	if (strlen(arg) < 4 || (arg[4] && arg[4] != ':'))
+		return -1;
+
+	fm->format = fourcc_code(arg[0], arg[1], arg[2], arg[3]);
+	fm->modifier = DRM_FORMAT_MOD_INVALID;
+	if (!arg[4])
+		return 0;
+
+	if (!strcmp(arg + 5, "linear")) {
+		fm->modifier = DRM_FORMAT_MOD_LINEAR;
+		return 0;
+	}
+	fm->modifier = strtoull(arg + 5, &end, 16);
+	return *end || end == arg + 5 ? -1 : 0;
+}
+
+const char *fourcc_str(uint32_t format, char buf[5])
+{
+	buf[0] = format & 0xff;
+	buf[1] = (format >> 8) & 0xff;
+	buf[2] = (format >> 16) & 0xff;
+	buf[3] = format >> 24;
+	buf[4] = '\0';
+
+	return buf;
+}
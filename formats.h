@@ -0,0 +1,61 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _KMSCUBE_FORMATS_H_
+#define _KMSCUBE_FORMATS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define FORMATS_MAX_PAIRS	(64)
+
+/* DRM_FORMAT_MOD_INVALID as modifier: none given, the driver's choice */
+struct format_mod {
+	uint32_t format;
+	uint64_t modifier;
+};
+
+enum modifier_class {
+	MOD_CLASS_LINEAR,
+	MOD_CLASS_TILED,
+	MOD_CLASS_COMPRESSED,
+};
+
+enum modifier_class modifier_class(uint64_t modifier);
+const char *modifier_class_name(uint64_t modifier);
+bool format_scanout_candidate(uint32_t format);
+
+/*
+ * The pairs of a plane IN_FORMATS blob that are scanout candidates, in
+ * the order of the memory bandwidth they cost: the deepest candidate
+ * format first, then compressed before tiled before linear layouts, then
+ * the format preference.  Returns how many went into pairs, -1 if the
+ * blob can't be read.
+ */
+int format_mods_from_blob(int fd, uint32_t blob_id, struct format_mod *pairs,
+		int max);
+void format_mods_sort(struct format_mod *pairs, int n);
+
+/* "<fourcc>[:<modifier>]", the modifier in hex or "linear" */
+int format_mod_parse(const char *arg, struct format_mod *fm);
+const char *fourcc_str(uint32_t format, char buf[5]);
+
+#endif /* _KMSCUBE_FORMATS_H_ */
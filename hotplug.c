@@ -0,0 +1,105 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <libudev.h>
+
+#include "hotplug.h"
+
+int hotplug_init(struct hotplug *h, int drm_fd)
+{
+	struct stat st;
+
+	memset(h, 0, sizeof(*h));
+	h->fd = -1;
+
+	if (fstat(drm_fd, &st)) {
+		printf("failed to stat the DRM device: %s\n", strerror(errno));
+		return -1;
+	}
+	h->devnum = st.st_rdev;
+
+	h->udev = udev_new();
+	if (!h->udev)
+		return -1;
+
+	h->mon = udev_monitor_new_from_netlink(h->udev, "udev");
+	if (!h->mon ||
+	    udev_monitor_filter_add_match_subsystem_devtype(h->mon, "drm", "drm_minor") ||
+	    udev_monitor_enable_receiving(h->mon)) {
+		printf("failed to set up the udev hotplug monitor\n");
+		hotplug_fini(h);
+		return -1;
+	}
+	h->fd = udev_monitor_get_fd(h->mon);
+
+	return 0;
+}
+
+/*
+ * Wait up to timeout_ms (0: just check) for hotplug events on our device
+ * and drain them all; true if there was at least one.
+ */
+bool hotplug_poll(struct hotplug *h, int timeout_ms)
+{
+	struct pollfd pfd = { .fd = h->fd, .events = POLLIN };
+	struct udev_device *dev;
+	const char *hotplug;
+	bool changed = false;
+
+	if (h->fd < 0)
+		return false;
+
+	while (poll(&pfd, 1, timeout_ms) > 0) {
+		dev = udev_monitor_receive_device(h->mon);
+		if (!dev)
+			break;
+
+		hotplug = udev_device_get_property_value(dev, "HOTPLUG");
+		if (udev_device_get_devnum(dev) == h->devnum &&
+		    hotplug && !strcmp(hotplug, "1")) {
+			h->events++;
+			changed = true;
+		}
+		udev_device_unref(dev);
+
+		/* only the first wait blocks, then drain what is queued */
+		timeout_ms = 0;
+	}
+
+	return changed;
+}
+
+void hotplug_fini(struct hotplug *h)
+{
+	if (h->mon)
+		udev_monitor_unref(h->mon);
+	if (h->udev)
+		udev_unref(h->udev);
+	h->mon = NULL;
+	h->udev = NULL;
+	h->fd = -1;
+}
@@ -0,0 +1,45 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _KMSCUBE_HOTPLUG_H_
+#define _KMSCUBE_HOTPLUG_H_
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/*
+ * udev monitor for connector hotplug on one DRM device.  The kernel sends
+ * a "change" uevent with HOTPLUG=1 when connectors come or go; all events
+ * pending at a poll are folded into one.
+ */
+struct hotplug {
+	struct udev *udev;
+	struct udev_monitor *mon;
+	int fd;
+	dev_t devnum;
+	unsigned int events;
+};
+
+int hotplug_init(struct hotplug *h, int drm_fd);
+bool hotplug_poll(struct hotplug *h, int timeout_ms);
+void hotplug_fini(struct hotplug *h);
+
+#endif /* _KMSCUBE_HOTPLUG_H_ */
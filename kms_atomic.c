@@ -0,0 +1,395 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "kms_atomic.h"
+
+static uint32_t find_prop_id(struct atomic_kms *kms, uint32_t obj_id,
+		uint32_t obj_type, const char *name)
+{
+	uint32_t prop_id = prop_cache_id(kms->props, obj_id, obj_type, name);
+
+	if (!prop_id)
+		printf("object %u has no %s property\n", obj_id, name);
+
+	return prop_id;
+}
+
+void atomic_init(struct atomic_kms *kms, int fd, struct prop_cache *props)
+{
+	memset(kms, 0, sizeof(*kms));
+	kms->fd = fd;
+	kms->props = props;
+}
+
+/* returns the output index, or -1 */
+int atomic_add_output(struct atomic_kms *kms, uint32_t crtc_id,
+		uint32_t connector_id, uint32_t plane_id, drmModeModeInfo *mode)
+{
+	struct atomic_output *out;
+	int fd = kms->fd;
+
+	if (kms->noutputs == ATOMIC_MAX_OUTPUTS)
+		return -1;
+
+	out = &kms->output[kms->noutputs];
+	memset(out, 0, sizeof(*out));
+	out->crtc_id = crtc_id;
+	out->connector_id = connector_id;
+	out->plane_id = plane_id;
+	out->mode = mode;
+	out->in_fence_fd = -1;
+	out->out_fence_fd = -1;
+
+	if (!plane_id) {
+		printf("atomic: no primary plane for CRTC %u\n", crtc_id);
+		return -1;
+	}
+
+	out->prop.crtc_mode_id = find_prop_id(kms, crtc_id, DRM_MODE_OBJECT_CRTC, "MODE_ID");
+	out->prop.crtc_active = find_prop_id(kms, crtc_id, DRM_MODE_OBJECT_CRTC, "ACTIVE");
+	out->prop.conn_crtc_id = find_prop_id(kms, connector_id, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID");
+	out->prop.fb_id = find_prop_id(kms, plane_id, DRM_MODE_OBJECT_PLANE, "FB_ID");
+	out->prop.crtc_id = find_prop_id(kms, plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_ID");
+	out->prop.src_x = find_prop_id(kms, plane_id, DRM_MODE_OBJECT_PLANE, "SRC_X");
+	out->prop.src_y = find_prop_id(kms, plane_id, DRM_MODE_OBJECT_PLANE, "SRC_Y");
+	out->prop.src_w = find_prop_id(kms, plane_id, DRM_MODE_OBJECT_PLANE, "SRC_W");
+	out->prop.src_h = find_prop_id(kms, plane_id, DRM_MODE_OBJECT_PLANE, "SRC_H");
+	out->prop.crtc_x = find_prop_id(kms, plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_X");
+	out->prop.crtc_y = find_prop_id(kms, plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_Y");
+	out->prop.crtc_w = find_prop_id(kms, plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_W");
+	out->prop.crtc_h = find_prop_id(kms, plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_H");
+	/* optional, without it the whole plane is assumed damaged */
+	out->prop.fb_damage_clips = prop_cache_id(kms->props, plane_id,
+			DRM_MODE_OBJECT_PLANE, "FB_DAMAGE_CLIPS");
+
+	if (!out->prop.crtc_mode_id || !out->prop.crtc_active ||
+	    !out->prop.conn_crtc_id || !out->prop.fb_id || !out->prop.crtc_id ||
+	    !out->prop.src_w || !out->prop.src_h || !out->prop.crtc_w ||
+	    !out->prop.crtc_h)
+		return -1;
+
+	if (drmModeCreatePropertyBlob(fd, mode, sizeof(*mode), &out->mode_blob_id)) {
+		printf("failed to create mode blob: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return kms->noutputs++;
+}
+
+void atomic_set_fb(struct atomic_kms *kms, int output, uint32_t fb_id,
+		uint32_t fb_w, uint32_t fb_h)
+{
+	struct atomic_output *out = &kms->output[output];
+
+	out->fb_id = fb_id;
+	out->fb_w = fb_w;
+	out->fb_h = fb_h;
+}
+
+/* explicit fencing needs IN_FENCE_FD on the planes, OUT_FENCE_PTR on the CRTCs */
+int atomic_enable_fences(struct atomic_kms *kms)
+{
+	int i;
+
+	for (i = 0; i < kms->noutputs; i++) {
+		struct atomic_output *out = &kms->output[i];
+
+		out->prop.in_fence_fd = find_prop_id(kms, out->plane_id,
+				DRM_MODE_OBJECT_PLANE, "IN_FENCE_FD");
+		out->prop.out_fence_ptr = find_prop_id(kms, out->crtc_id,
+				DRM_MODE_OBJECT_CRTC, "OUT_FENCE_PTR");
+		if (!out->prop.in_fence_fd || !out->prop.out_fence_ptr)
+			return -1;
+	}
+
+	kms->fences = true;
+	return 0;
+}
+
+/* fence_fd stays the caller's, it is only needed until atomic_commit() */
+void atomic_set_in_fence(struct atomic_kms *kms, int output, int fence_fd)
+{
+	kms->output[output].in_fence_fd = fence_fd;
+}
+
+/*
+ * The framebuffer rectangles that changed since the last commit, for
+ * displays that can then skip uploading or refreshing the rest.
+ */
+int atomic_set_damage(struct atomic_kms *kms, int output,
+		const struct drm_mode_rect *clips, int nclips)
+{
+	struct atomic_output *out = &kms->output[output];
+
+	if (!out->prop.fb_damage_clips)
+		return -1;
+
+	if (out->damage_blob_id)
+		drmModeDestroyPropertyBlob(kms->fd, out->damage_blob_id);
+	out->damage_blob_id = 0;
+
+	if (drmModeCreatePropertyBlob(kms->fd, clips, nclips * sizeof(*clips),
+			&out->damage_blob_id)) {
+		printf("failed to create damage blob: %s\n", strerror(errno));
+		out->damage_blob_id = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Put a framebuffer on an overlay plane above the output's primary plane,
+ * or switch the plane off again with fb_id 0.  The next commit validates
+ * the new configuration.
+ */
+int atomic_set_layer(struct atomic_kms *kms, int output, int layer,
+		uint32_t plane_id, uint32_t fb_id, uint32_t width, uint32_t height,
+		int32_t x, int32_t y, bool set_zpos, uint64_t zpos)
+{
+	struct atomic_output *out = &kms->output[output];
+	struct atomic_layer *l;
+
+	if (layer >= ATOMIC_MAX_LAYERS)
+		return -1;
+	l = &out->layer[layer];
+
+	if (l->plane_id != plane_id) {
+		memset(l, 0, sizeof(*l));
+		l->prop.fb_id = find_prop_id(kms, plane_id, DRM_MODE_OBJECT_PLANE, "FB_ID");
+		l->prop.crtc_id = find_prop_id(kms, plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_ID");
+		l->prop.src_x = find_prop_id(kms, plane_id, DRM_MODE_OBJECT_PLANE, "SRC_X");
+		l->prop.src_y = find_prop_id(kms, plane_id, DRM_MODE_OBJECT_PLANE, "SRC_Y");
+		l->prop.src_w = find_prop_id(kms, plane_id, DRM_MODE_OBJECT_PLANE, "SRC_W");
+		l->prop.src_h = find_prop_id(kms, plane_id, DRM_MODE_OBJECT_PLANE, "SRC_H");
+		l->prop.crtc_x = find_prop_id(kms, plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_X");
+		l->prop.crtc_y = find_prop_id(kms, plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_Y");
+		l->prop.crtc_w = find_prop_id(kms, plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_W");
+		l->prop.crtc_h = find_prop_id(kms, plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_H");
+		l->prop.zpos = prop_cache_id(kms->props, plane_id,
+				DRM_MODE_OBJECT_PLANE, "zpos");
+		if (!l->prop.fb_id || !l->prop.crtc_id || !l->prop.src_w ||
+		    !l->prop.src_h || !l->prop.crtc_w || !l->prop.crtc_h)
+			return -1;
+		l->plane_id = plane_id;
+	}
+
+	l->fb_id = fb_id;
+	l->width = width;
+	l->height = height;
+	l->x = x;
+	l->y = y;
+	l->set_zpos = set_zpos && l->prop.zpos;
+	l->zpos = zpos;
+	if (layer >= out->nlayers)
+		out->nlayers = layer + 1;
+	out->valid_w = out->valid_h = 0;
+
+	return 0;
+}
+
+static void add_layer_state(drmModeAtomicReq *req, struct atomic_output *out,
+		struct atomic_layer *l)
+{
+	drmModeAtomicAddProperty(req, l->plane_id, l->prop.fb_id, l->fb_id);
+	drmModeAtomicAddProperty(req, l->plane_id, l->prop.crtc_id,
+			l->fb_id ? out->crtc_id : 0);
+	if (!l->fb_id)
+		return;
+
+	drmModeAtomicAddProperty(req, l->plane_id, l->prop.src_x, 0);
+	drmModeAtomicAddProperty(req, l->plane_id, l->prop.src_y, 0);
+	drmModeAtomicAddProperty(req, l->plane_id, l->prop.src_w, (uint64_t)l->width << 16);
+	drmModeAtomicAddProperty(req, l->plane_id, l->prop.src_h, (uint64_t)l->height << 16);
+	drmModeAtomicAddProperty(req, l->plane_id, l->prop.crtc_x, l->x);
+	drmModeAtomicAddProperty(req, l->plane_id, l->prop.crtc_y, l->y);
+	drmModeAtomicAddProperty(req, l->plane_id, l->prop.crtc_w, l->width);
+	drmModeAtomicAddProperty(req, l->plane_id, l->prop.crtc_h, l->height);
+	if (l->set_zpos)
+		drmModeAtomicAddProperty(req, l->plane_id, l->prop.zpos, l->zpos);
+}
+
+static void add_output_state(drmModeAtomicReq *req, struct atomic_output *out,
+		bool modeset)
+{
+	int i;
+
+	if (modeset) {
+		drmModeAtomicAddProperty(req, out->connector_id, out->prop.conn_crtc_id, out->crtc_id);
+		drmModeAtomicAddProperty(req, out->crtc_id, out->prop.crtc_mode_id, out->mode_blob_id);
+		drmModeAtomicAddProperty(req, out->crtc_id, out->prop.crtc_active, 1);
+	}
+
+	drmModeAtomicAddProperty(req, out->plane_id, out->prop.fb_id, out->fb_id);
+	drmModeAtomicAddProperty(req, out->plane_id, out->prop.crtc_id, out->crtc_id);
+	drmModeAtomicAddProperty(req, out->plane_id, out->prop.src_x, 0);
+	drmModeAtomicAddProperty(req, out->plane_id, out->prop.src_y, 0);
+	drmModeAtomicAddProperty(req, out->plane_id, out->prop.src_w, (uint64_t)out->fb_w << 16);
+	drmModeAtomicAddProperty(req, out->plane_id, out->prop.src_h, (uint64_t)out->fb_h << 16);
+	drmModeAtomicAddProperty(req, out->plane_id, out->prop.crtc_x, 0);
+	drmModeAtomicAddProperty(req, out->plane_id, out->prop.crtc_y, 0);
+	drmModeAtomicAddProperty(req, out->plane_id, out->prop.crtc_w, out->mode->hdisplay);
+	drmModeAtomicAddProperty(req, out->plane_id, out->prop.crtc_h, out->mode->vdisplay);
+
+	if (out->in_fence_fd >= 0)
+		drmModeAtomicAddProperty(req, out->plane_id, out->prop.in_fence_fd,
+				out->in_fence_fd);
+
+	if (out->damage_blob_id)
+		drmModeAtomicAddProperty(req, out->plane_id, out->prop.fb_damage_clips,
+				out->damage_blob_id);
+
+	for (i = 0; i < out->nlayers; i++)
+		if (out->layer[i].plane_id)
+			add_layer_state(req, out, &out->layer[i]);
+}
+
+/*
+ * Show the framebuffers set with atomic_set_fb() on all their outputs at
+ * once.  The commit does not block; completion of every CRTC is reported
+ * through its own page flip event carrying user_data.
+ */
+/*
+ * Check whether the state set up so far would be accepted as a modeset,
+ * without applying it.  Rejections aren't printed, the caller looks for
+ * a configuration that works.
+ */
+int atomic_test(struct atomic_kms *kms)
+{
+	drmModeAtomicReq *req;
+	int i, ret;
+
+	req = drmModeAtomicAlloc();
+	if (!req)
+		return -1;
+
+	for (i = 0; i < kms->noutputs; i++)
+		if (kms->output[i].fb_id)
+			add_output_state(req, &kms->output[i], true);
+
+	kms->tests++;
+	ret = drmModeAtomicCommit(kms->fd, req,
+			DRM_MODE_ATOMIC_TEST_ONLY | DRM_MODE_ATOMIC_ALLOW_MODESET, NULL);
+	if (ret)
+		kms->test_failures++;
+
+	drmModeAtomicFree(req);
+	return ret;
+}
+
+int atomic_commit(struct atomic_kms *kms, bool modeset, void *user_data)
+{
+	drmModeAtomicReq *req;
+	uint32_t flags = DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT;
+	bool validate = modeset;
+	int i, ret;
+
+	req = drmModeAtomicAlloc();
+	if (!req)
+		return -1;
+
+	if (modeset)
+		flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+
+	for (i = 0; i < kms->noutputs; i++) {
+		struct atomic_output *out = &kms->output[i];
+
+		if (!out->fb_id)
+			continue;
+		add_output_state(req, out, modeset);
+		out->out_fence_fd = -1;
+		if (kms->fences)
+			drmModeAtomicAddProperty(req, out->crtc_id, out->prop.out_fence_ptr,
+					(uint64_t)(uintptr_t)&out->out_fence_fd);
+		if (out->fb_w != out->valid_w || out->fb_h != out->valid_h)
+			validate = true;
+	}
+
+	if (validate) {
+		kms->tests++;
+		ret = drmModeAtomicCommit(kms->fd, req,
+				DRM_MODE_ATOMIC_TEST_ONLY | (flags & DRM_MODE_ATOMIC_ALLOW_MODESET),
+				NULL);
+		if (ret) {
+			kms->test_failures++;
+			printf("atomic TEST_ONLY commit rejected: %s\n", strerror(errno));
+			drmModeAtomicFree(req);
+			return -1;
+		}
+
+		for (i = 0; i < kms->noutputs; i++) {
+			kms->output[i].valid_w = kms->output[i].fb_w;
+			kms->output[i].valid_h = kms->output[i].fb_h;
+		}
+	}
+
+	kms->commits++;
+	ret = drmModeAtomicCommit(kms->fd, req, flags, user_data);
+	if (ret)
+		printf("atomic commit failed: %s\n", strerror(errno));
+
+	/* in fences and damage only apply to the commit they were set for;
+	 * the plane state holds its own reference to the damage blob */
+	for (i = 0; i < kms->noutputs; i++) {
+		struct atomic_output *out = &kms->output[i];
+
+		out->in_fence_fd = -1;
+		if (!out->damage_blob_id)
+			continue;
+		if (!ret && out->fb_id)
+			kms->damage_commits++;
+		drmModeDestroyPropertyBlob(kms->fd, out->damage_blob_id);
+		out->damage_blob_id = 0;
+	}
+
+	drmModeAtomicFree(req);
+	return ret;
+}
+
+void atomic_report(const struct atomic_kms *kms)
+{
+	if (!kms->commits && !kms->tests)
+		return;
+
+	printf("### Atomic KMS: %d outputs, %u nonblocking commits, %u TEST_ONLY checks (%u rejected), %u plane updates with damage clips\n",
+			kms->noutputs, kms->commits, kms->tests, kms->test_failures,
+			kms->damage_commits);
+}
+
+void atomic_fini(struct atomic_kms *kms)
+{
+	int i;
+
+	for (i = 0; i < kms->noutputs; i++) {
+		if (kms->output[i].mode_blob_id)
+			drmModeDestroyPropertyBlob(kms->fd, kms->output[i].mode_blob_id);
+		if (kms->output[i].damage_blob_id)
+			drmModeDestroyPropertyBlob(kms->fd, kms->output[i].damage_blob_id);
+	}
+	kms->noutputs = 0;
+}
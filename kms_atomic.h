@@ -0,0 +1,122 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _KMSCUBE_KMS_ATOMIC_H_
+#define _KMSCUBE_KMS_ATOMIC_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <xf86drmMode.h>
+
+#include "propcache.h"
+
+#define ATOMIC_MAX_OUTPUTS	(4)
+#define ATOMIC_MAX_LAYERS	(3)
+
+/* an overlay plane showing a whole framebuffer somewhere on the CRTC */
+struct atomic_layer {
+	uint32_t plane_id;
+	uint32_t fb_id;			/* 0: switch the plane off */
+	uint32_t width, height;
+	int32_t x, y;
+	bool set_zpos;
+	uint64_t zpos;
+
+	struct {
+		uint32_t fb_id, crtc_id;
+		uint32_t src_x, src_y, src_w, src_h;
+		uint32_t crtc_x, crtc_y, crtc_w, crtc_h;
+		uint32_t zpos;
+	} prop;
+};
+
+/*
+ * Atomic modesetting backend: each output is a CRTC driven through its
+ * primary plane, and all outputs are updated together in one commit.
+ * Every commit is DRM_MODE_ATOMIC_NONBLOCK with a page flip event per
+ * CRTC, and a TEST_ONLY commit validates each new configuration (modeset,
+ * or a framebuffer of a different size) before it is applied.
+ */
+struct atomic_output {
+	uint32_t crtc_id, connector_id, plane_id;
+	drmModeModeInfo *mode;
+	uint32_t mode_blob_id;
+
+	struct {
+		uint32_t crtc_mode_id, crtc_active;
+		uint32_t conn_crtc_id;
+		uint32_t fb_id, crtc_id;
+		uint32_t src_x, src_y, src_w, src_h;
+		uint32_t crtc_x, crtc_y, crtc_w, crtc_h;
+		uint32_t in_fence_fd, out_fence_ptr;
+		uint32_t fb_damage_clips;	/* 0: not supported */
+	} prop;
+
+	/* framebuffer the next commit puts on this output, 0: leave alone */
+	uint32_t fb_id, fb_w, fb_h;
+
+	/*
+	 * Explicit fencing: the next commit scans out only once in_fence_fd
+	 * (-1: none) signals, and returns a fence for its own completion in
+	 * out_fence_fd, which the caller then owns.
+	 */
+	int in_fence_fd;
+	int32_t out_fence_fd;
+
+	/* FB_DAMAGE_CLIPS blob for the next commit only, 0: all of it */
+	uint32_t damage_blob_id;
+
+	int nlayers;
+	struct atomic_layer layer[ATOMIC_MAX_LAYERS];
+
+	/* geometry of the last validated plane state */
+	uint32_t valid_w, valid_h;
+};
+
+struct atomic_kms {
+	int fd;
+	struct prop_cache *props;
+	int noutputs;
+	struct atomic_output output[ATOMIC_MAX_OUTPUTS];
+	bool fences;			/* request OUT_FENCE_PTR on every commit */
+
+	unsigned int commits, tests, test_failures, damage_commits;
+};
+
+void atomic_init(struct atomic_kms *kms, int fd, struct prop_cache *props);
+int atomic_add_output(struct atomic_kms *kms, uint32_t crtc_id,
+		uint32_t connector_id, uint32_t plane_id, drmModeModeInfo *mode);
+void atomic_set_fb(struct atomic_kms *kms, int output, uint32_t fb_id,
+		uint32_t fb_w, uint32_t fb_h);
+int atomic_enable_fences(struct atomic_kms *kms);
+void atomic_set_in_fence(struct atomic_kms *kms, int output, int fence_fd);
+int atomic_set_damage(struct atomic_kms *kms, int output,
+		const struct drm_mode_rect *clips, int nclips);
+int atomic_set_layer(struct atomic_kms *kms, int output, int layer,
+		uint32_t plane_id, uint32_t fb_id, uint32_t width, uint32_t height,
+		int32_t x, int32_t y, bool set_zpos, uint64_t zpos);
+int atomic_test(struct atomic_kms *kms);
+int atomic_commit(struct atomic_kms *kms, bool modeset, void *user_data);
+void atomic_report(const struct atomic_kms *kms);
+void atomic_fini(struct atomic_kms *kms);
+
+#endif /* _KMSCUBE_KMS_ATOMIC_H_ */
@@ -32,16 +32,37 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <errno.h>
 #include <signal.h>
+#include <stdarg.h>
+#include <pthread.h>
 
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 #include <drm_fourcc.h>
 #include <gbm.h>
 #include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "devprobe.h"
+#include "dmabuf.h"
+#include "fbcache.h"
+#include "formats.h"
+#include "hotplug.h"
+#include "kms_atomic.h"
+#include "leak.h"
+#include "matrix.h"
+#include "overlay.h"
+#include "perfmem.h"
+#include "progcache.h"
+#include "propcache.h"
+#include "report.h"
+#include "stats.h"
+#include "timeline.h"
 
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
 
@@ -49,41 +70,410 @@
 uint8_t DISP_ID = 0;
 uint8_t all_display = 0;
 int8_t connector_id = -1;
+static int verbose;
 
-static struct {
+/*
+ * Persistent EGL: keep the gbm_device, EGLDisplay, context, program and VBO
+ * across lifecycle cycles and only recreate the gbm_surface / EGLSurface.
+ */
+static bool egl_persistent;
+
+/*
+ * Headless (-H <w>x<h>): a render node instead of a KMS device, and
+ * offscreen buffers of the given size that are never scanned out.
+ */
+static bool headless;
+
+/* -m: scanout format and optionally modifier instead of the cheapest */
+static bool scanout_override;
+static struct format_mod scanout_choice;
+static drmModeModeInfo headless_mode;
+
+/* program binary cache, enabled with -b <dir> */
+static struct program_cache program_cache;
+
+/*
+ * EGL/GL and GBM state of one rendering instance: the main one below, or
+ * a stress worker (-T) sharing the gbm_device and EGLDisplay with it.
+ */
+struct gl_state {
 	EGLDisplay display;
 	EGLConfig config;
 	EGLContext context;
-	EGLSurface surface;
+	EGLSurface surface[MAX_DISPLAYS];
+	EGLSurface current;		/* surface bound to the context */
 	GLuint program;
-	GLint modelviewmatrix, modelviewprojectionmatrix, normalmatrix;
-	GLuint vbo;
-	GLuint positionsoffset, colorsoffset, normalsoffset;
+	GLint projectionmatrix;
+	GLuint vbo, ibo;
+	GLuint instances;		/* per cube modelview matrices */
 	GLuint vertex_shader, fragment_shader;
-} gl;
+	bool surfaceless;
+};
 
-static struct {
+struct gbm_state {
 	struct gbm_device *dev;
-	struct gbm_surface *surface;
-} gbm;
+	struct gbm_surface *surface[MAX_DISPLAYS];
+};
+
+static struct gl_state gl;
+static struct gbm_state gbm;
+
+/* progcache keeps one in-memory binary, workers take turns with it */
+static pthread_mutex_t program_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const EGLint context_attribs[] = {
+	EGL_CONTEXT_CLIENT_VERSION, 2,
+	EGL_NONE
+};
 
 static struct {
 	int fd;
 	uint32_t ndisp;
 	uint32_t crtc_id[MAX_DISPLAYS];
+	uint32_t crtc_index[MAX_DISPLAYS];
+	uint32_t plane_id[MAX_DISPLAYS];
 	uint32_t connector_id[MAX_DISPLAYS];
-	uint32_t resource_id;
-	uint32_t encoder[MAX_DISPLAYS];
+	uintptr_t resource_id;
+	uintptr_t encoder[MAX_DISPLAYS];
 	uint32_t format[MAX_DISPLAYS];
+	uint64_t modifier[MAX_DISPLAYS];	/* DRM_FORMAT_MOD_INVALID: implicit */
+	struct format_mod scanout[MAX_DISPLAYS][FORMATS_MAX_PAIRS];
+	int nscanout[MAX_DISPLAYS];		/* candidates, cheapest first */
+	bool negotiated[MAX_DISPLAYS];
 	drmModeModeInfo *mode[MAX_DISPLAYS];
 	drmModeConnector *connectors[MAX_DISPLAYS];
 } drm;
 
-struct drm_fb {
+static struct fb_cache fb_cache;
+static struct prop_cache prop_cache;
+
+/* DRM device selection (-D) and the device/connector/mode cache (-C) */
+static const char *drm_device;
+static const char *drm_cache_file;
+static struct drm_choice drm_choice;
+
+/* -P: follow connector hotplug instead of needing a restart */
+static bool hotplug_enabled;
+static struct hotplug hotplug;
+static struct stage_stats hotplug_reconfig;
+
+/* KMS backend: legacy SetCrtc/PageFlip, or atomic commits (-K atomic) */
+static bool kms_atomic;
+static struct atomic_kms atomic;
+static int atomic_idx[MAX_DISPLAYS];	/* atomic output of each display */
+
+/*
+ * Ring rendering (-R): draw into an FBO backed by a cached scanout buffer
+ * instead of the gbm_surface, so the buffers and their framebuffers are
+ * not tied to the surface lifecycle.  The GL side of each cache slot is
+ * kept here and rebuilt when the slot gets a different BO.
+ */
+static bool fb_ring;
+
+static struct {
 	struct gbm_bo *bo;
-	uint32_t fb_id;
+	EGLImageKHR image;
+	GLuint rb, fbo;
+} ring_gl[FB_CACHE_SLOTS];
+
+static struct drm_fb *ring_fb[MAX_DISPLAYS];	/* ring buffers being rendered */
+
+/*
+ * dma-buf sharing (the "share" stage): every swapped buffer is exported
+ * and imported by a second consumer on its own DRM file, which checks it
+ * sees the frame stamp the draw stage left in the buffer.  A surface
+ * buffer the stage locked is kept for a flip stage after it.
+ */
+static bool dmabuf_sharing;
+static struct dmabuf_consumer consumer;
+static struct drm_fb *share_fb[MAX_DISPLAYS];
+
+/*
+ * Cube load (-N <n>): n lit, rotating cubes in a grid over the frame, in
+ * -o layers drawn back to front over each other, each cube -S percent of
+ * its grid cell.  One instanced draw per frame where GL_EXT_ or
+ * GL_ANGLE_instanced_arrays allow it (unless -i), one draw per cube
+ * otherwise.
+ */
+static struct {
+	int cubes, layers, size;
+	bool instanced;
+	PFNGLVERTEXATTRIBDIVISOREXTPROC attrib_divisor;
+	PFNGLDRAWELEMENTSINSTANCEDEXTPROC draw_instanced;
+	struct transform_batch xf;	/* per cube and layer */
+	struct mat4_batch mv;
+	GLfloat *modelview;		/* mv as uploaded */
+	uint64_t frames, draws;
+	uint64_t cube_px;		/* unrotated cube area, summed */
+} load = {
+	.layers = 1,
+	.size = 80,
+	.instanced = true,
+};
+
+/*
+ * Frame timeline (-X <file>): per frame the CPU time of the draw, swap,
+ * lock and flip stages, the vblank of its flip and, with
+ * GL_EXT_disjoint_timer_query, the GPU time of its draw.  The queries go
+ * round a small pool and are read back once available, a frame finding
+ * no free query goes without rather than stall.
+ */
+static const char *timeline_file;
+static struct timeline timeline;
+
+/* machine-readable results of every run (-j <file>) */
+static const char *report_file;
+static struct report report;
+
+#define GPU_QUERIES	(8)
+
+static struct {
+	bool checked, supported;
+	PFNGLGENQUERIESEXTPROC gen;
+	PFNGLDELETEQUERIESEXTPROC delete;
+	PFNGLBEGINQUERYEXTPROC begin;
+	PFNGLENDQUERYEXTPROC end;
+	PFNGLGETQUERYOBJECTUIVEXTPROC get_uiv;
+	PFNGLGETQUERYOBJECTUI64VEXTPROC get_ui64v;
+	GLuint id[GPU_QUERIES];
+	uint32_t seq[GPU_QUERIES];	/* timeline frame of each query */
+	bool busy[GPU_QUERIES];
+	int next;
+	bool active;
+} gpu_timer;
+
+/*
+ * Damage tracking (-d <w>x<h>): a static scene with a <w>x<h> ticker
+ * moving across it.  Only what changed in the buffer since it was last
+ * drawn (EGL_EXT_buffer_age) is redrawn, announced up front with
+ * eglSetDamageRegionKHR, and what changed since the last frame goes to
+ * eglSwapBuffersWithDamage and to KMS as the plane FB_DAMAGE_CLIPS.
+ */
+static bool damage_tracking;
+
+/*
+ * Overlay layers (-L <n>): n extra layers on the primary display, a NV12
+ * video frame and then RGB UI elements.  They go on overlay planes as far
+ * as a TEST_ONLY commit accepts them and are composited into the frame by
+ * GL otherwise; -O gl composites all of them.
+ */
+static int overlay_layers;
+static bool overlay_gl_only;
+static struct overlay overlay;
+
+static struct {
+	GLuint program, vbo;
+	EGLImageKHR image[OVERLAY_MAX_LAYERS];
+	GLuint tex[OVERLAY_MAX_LAYERS];
+	uint64_t frames, px;		/* composited by GL */
+} comp;
+
+struct rect {
+	int x, y, w, h;		/* GL window coordinates, origin bottom left */
+};
+
+static struct {
+	struct rect ticker;	/* size of the ticker */
+	bool buffer_age;
+	PFNEGLSETDAMAGEREGIONKHRPROC set_damage_region;
+	PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC swap_with_damage;
+	uint32_t next_frame[MAX_DISPLAYS];	/* last drawn + 1, 0: none */
+	struct rect dirty[MAX_DISPLAYS][2];	/* since the last frame */
+	int ndirty[MAX_DISPLAYS];		/* 0: all of it */
+	uint64_t frames, full_redraws;
+	uint64_t fill_px, frame_px;		/* drawn, and in the frames */
+	uint64_t clip_px, scanout_px;		/* sent to KMS as damage */
+	uint64_t commits;
+} damage;
+
+/*
+ * Lifecycle scenario engine: a scenario is a list of stages run once
+ * ("setup") followed by a list of stages run every cycle ("loop"),
+ * written as "[setup/]loop", e.g. "init_gbm/init_gl,exit_gl".
+ */
+enum stage_id {
+	STAGE_INIT_GBM,
+	STAGE_INIT_GL,
+	STAGE_DRAW,
+	STAGE_SWAP,
+	STAGE_LOCK,
+	STAGE_SHARE,
+	STAGE_FLIP,
+	STAGE_EXIT_GL,
+	STAGE_EXIT_GBM,
+	STAGE_COUNT
+};
+
+static const char *stage_names[STAGE_COUNT] = {
+	[STAGE_INIT_GBM]	= "init_gbm",
+	[STAGE_INIT_GL]		= "init_gl",
+	[STAGE_DRAW]		= "draw",
+	[STAGE_SWAP]		= "swap",
+	[STAGE_LOCK]		= "lock",
+	[STAGE_SHARE]		= "share",
+	[STAGE_FLIP]		= "flip",
+	[STAGE_EXIT_GL]		= "exit_gl",
+	[STAGE_EXIT_GBM]	= "exit_gbm",
+};
+
+/* the setup stage whose allocations a stage releases, for leak attribution */
+static const int stage_owner[STAGE_COUNT] = {
+	[STAGE_INIT_GBM]	= STAGE_INIT_GBM,
+	[STAGE_INIT_GL]		= STAGE_INIT_GL,
+	[STAGE_DRAW]		= STAGE_DRAW,
+	[STAGE_SWAP]		= STAGE_SWAP,
+	[STAGE_LOCK]		= STAGE_LOCK,
+	[STAGE_SHARE]		= STAGE_SHARE,
+	[STAGE_FLIP]		= STAGE_FLIP,
+	[STAGE_EXIT_GL]		= STAGE_INIT_GL,
+	[STAGE_EXIT_GBM]	= STAGE_INIT_GBM,
+};
+
+/* what the frame timeline records each stage as */
+static const int stage_event[STAGE_COUNT] = {
+	[STAGE_INIT_GBM]	= TL_NONE,
+	[STAGE_INIT_GL]		= TL_NONE,
+	[STAGE_DRAW]		= TL_DRAW,
+	[STAGE_SWAP]		= TL_SWAP,
+	[STAGE_LOCK]		= TL_LOCK,
+	[STAGE_SHARE]		= TL_NONE,
+	[STAGE_FLIP]		= TL_FLIP,
+	[STAGE_EXIT_GL]		= TL_NONE,
+	[STAGE_EXIT_GBM]	= TL_NONE,
+};
+
+/* the former compile-time TEST1..TEST4 blocks */
+static const struct {
+	const char *name;
+	const char *stages;
+} scenario_presets[] = {
+	{ "test1", "init_gbm,exit_gbm" },
+	{ "test2", "init_gbm,init_gl,exit_gl,exit_gbm" },
+	{ "test3", "init_gbm,init_gl,draw,swap,lock,exit_gl,exit_gbm" },
+	{ "test4", "init_gbm/init_gl,exit_gl" },
+	{ "flip", "init_gbm,init_gl/draw,swap,flip" },
+	{ "share", "init_gbm,init_gl/draw,swap,share" },
 };
 
+#define MAX_STAGES	(32)
+
+static struct {
+	const char *name;
+	int setup[MAX_STAGES];
+	int nsetup;
+	int loop[MAX_STAGES];
+	int nloop;
+	bool gbm_up, gl_up;
+	uint32_t frame;
+	struct stage_stats stage[STAGE_COUNT];
+	struct stage_stats cycle;
+	struct leak_monitor leak;
+	bool quiet;			/* sweep runs: no per-run reports */
+	int warmup;			/* first cycles left out of the stats */
+	uint64_t cycles, elapsed_ns;	/* of the last run */
+	int64_t mem_bytes;		/* memory traffic of its loop, -1: none */
+} scn;
+
+/*
+ * -B: run the flip scenario on the primary display in every mode of its
+ * connector and every format/modifier pair of its plane.  The memory
+ * controller counters are only open during a sweep.
+ */
+static bool bandwidth_sweep;
+static struct perf_mem perf_mem = { .fd = { -1, -1 } };
+
+/*
+ * Scanout state of the flip stage.  All active displays flip as one
+ * group per cycle; the kernel timestamps delivered to page_flip_handler()
+ * give the flip latency, the missed vblanks and the skew between the
+ * displays of a group.
+ */
+struct disp_flip {
+	struct drm_fb *fb;		/* buffer currently on screen */
+	bool pending;
+	uint64_t vblank_ns;		/* vblank of the current group, 0: none yet */
+	uint64_t last_vblank_ns;
+	unsigned int last_seq;
+	uint32_t timeline_seq;		/* timeline frame of the pending flip */
+	uint64_t flips, missed;
+	struct stage_stats latency;
+	struct stage_stats interval;
+};
+
+static struct {
+	bool crtc_set;
+	bool monotonic;			/* vblank timestamps are CLOCK_MONOTONIC */
+	uint64_t submit_ns;
+	uint64_t groups;
+	struct stage_stats submit;	/* time spent in the flip/commit ioctls */
+	struct stage_stats skew;	/* first to last vblank of a group */
+	struct stage_stats wait;	/* CPU blocked on flips and fences */
+	bool skew_due;			/* group completes in the next flip */
+	uint64_t submitted, completed;	/* flip submissions, never reset */
+	struct disp_flip disp[MAX_DISPLAYS];
+	/*
+	 * Lost displays whose buffer may still be on a CRTC taken over.
+	 * There is one at most per CRTC in use: a flip on it, once complete,
+	 * frees its entry, and so does switching it off.
+	 */
+	struct {
+		uint32_t crtc_id;
+		struct gbm_surface *gbm_surface;
+		EGLSurface egl_surface;
+		struct drm_fb *fb;
+		uint64_t after;		/* free once a later flip completed */
+	} retired[MAX_DISPLAYS];
+	int nretired;
+} flip;
+
+/*
+ * Explicit fencing (-F explicit, atomic only): the GL work of a frame is
+ * exported as a native fence fd and committed as the plane IN_FENCE_FD,
+ * and the OUT_FENCE_PTR fence of the commit is waited on by the GPU
+ * before it renders into the buffers that commit took off screen.  The
+ * previous buffers go back to their surfaces right after the commit and
+ * the flip stage no longer blocks until the vblank.
+ */
+static bool explicit_fences;
+
+static struct {
+	PFNEGLCREATESYNCKHRPROC create_sync;
+	PFNEGLDESTROYSYNCKHRPROC destroy_sync;
+	PFNEGLWAITSYNCKHRPROC wait_sync;
+	PFNEGLDUPNATIVEFENCEFDANDROIDPROC dup_fence_fd;
+	int gpu_fd;				/* rendering of the next flip */
+	EGLSyncKHR kms_sync[MAX_DISPLAYS];	/* out fences of the last commit */
+} fence = { .gpu_fd = -1 };
+
+static volatile sig_atomic_t quit_requested;
+
+/* -a drives every connected display, otherwise only DISP_ID */
+static bool disp_active(int d)
+{
+	return all_display ? d < drm.ndisp : d == DISP_ID;
+}
+
+#define for_each_display(d) \
+	for ((d) = 0; (d) < drm.ndisp; (d)++) \
+		if (disp_active(d))
+
+static bool crtc_in_use(uint32_t crtc_id)
+{
+	int d;
+
+	for (d = 0; d < drm.ndisp; d++)
+		if (drm.crtc_id[d] == crtc_id)
+			return true;
+	return false;
+}
+
+static uint32_t gbm_usage(void)
+{
+	if (headless)
+		return GBM_BO_USE_RENDERING;
+	return GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING;
+}
+
 static uint32_t drm_fmt_to_gbm_fmt(uint32_t fmt)
 {
 	switch (fmt) {
@@ -99,58 +489,68 @@ static uint32_t drm_fmt_to_gbm_fmt(uint32_t fmt)
 	}
 }
 
-static bool search_plane_format(uint32_t desired_format, int formats_count, uint32_t* formats)
-{
-	int i;
+/* the value an object's property had when it went into the cache */
+int get_drm_prop_val(uint32_t obj_id, uint32_t obj_type,
+	                 const char *name, unsigned int *p_val) {
+	uint64_t val;
 
-	for ( i = 0; i < formats_count; i++)
-	{
-		if (desired_format == formats[i])
-			return true;
+	if (prop_cache_value(&prop_cache, obj_id, obj_type, name, &val)) {
+		printf("Could not find %s property\n", name);
+		return(-1);
 	}
 
-	return false;
+	*p_val = val;
+	return 0;
 }
 
-int get_drm_prop_val(int fd, drmModeObjectPropertiesPtr props,
-	                 const char *name, unsigned int *p_val) {
-	drmModePropertyPtr p;
-	unsigned int i, prop_id = 0; /* Property ID should always be > 0 */
-
-	for (i = 0; !prop_id && i < props->count_props; i++) {
-		p = drmModeGetProperty(fd, props->props[i]);
-		if (!strcmp(p->name, name)){
-			prop_id = p->prop_id;
-			break;
+/*
+ * The format/modifier pairs display drm.ndisp may scan out from its
+ * primary plane: the IN_FORMATS pairs where the plane has them, the
+ * formats with an implicit modifier otherwise, narrowed down to -m.
+ */
+static int scanout_candidates(drmModePlane *plane)
+{
+	struct format_mod *pairs = drm.scanout[drm.ndisp];
+	uint64_t blob_id;
+	int i, n = -1, k = 0;
+
+	if (!prop_cache_value(&prop_cache, plane->plane_id, DRM_MODE_OBJECT_PLANE,
+			"IN_FORMATS", &blob_id) && blob_id)
+		n = format_mods_from_blob(drm.fd, blob_id, pairs, FORMATS_MAX_PAIRS);
+	if (n <= 0) {
+		for (i = n = 0; i < plane->count_formats && n < FORMATS_MAX_PAIRS; i++) {
+			if (!format_scanout_candidate(plane->formats[i]))
+				continue;
+			pairs[n].format = plane->formats[i];
+			pairs[n].modifier = DRM_FORMAT_MOD_INVALID;
+			n++;
 		}
-		drmModeFreeProperty(p);
+		format_mods_sort(pairs, n);
 	}
 
-	if (!prop_id) {
-		printf("Could not find %s property\n", name);
-		return(-1);
+	for (i = 0; i < n; i++) {
+		if (scanout_override && (pairs[i].format != scanout_choice.format ||
+		    (scanout_choice.modifier != DRM_FORMAT_MOD_INVALID &&
+		     pairs[i].modifier != scanout_choice.modifier)))
+			continue;
+		pairs[k++] = pairs[i];
 	}
+	if (n > 0 && !k)
+		printf("plane %u can't scan out the -m format and modifier\n",
+				plane->plane_id);
 
-	drmModeFreeProperty(p);
-	*p_val = props->prop_values[i];
-	return 0;
+	return k;
 }
 
 static bool set_drm_format(void)
 {
-	/* desired DRM format in order */
-	static const uint32_t drm_formats[] = {DRM_FORMAT_XRGB8888, DRM_FORMAT_ARGB8888, DRM_FORMAT_RGB565};
 	drmModePlaneRes *plane_res;
-	bool found = false;
 	int i,k;
 
-	drmSetClientCap(drm.fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
-
 	plane_res  = drmModeGetPlaneResources(drm.fd);
 
 	if (!plane_res) {
 		printf("drmModeGetPlaneResources failed: %s\n", strerror(errno));
-		drmSetClientCap(drm.fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 0);
 		return false;
 	}
 
@@ -161,53 +561,43 @@ static bool set_drm_format(void)
 	for (i = 0; i < plane_res->count_planes; i++)
 	{
 		drmModePlane *plane = drmModeGetPlane(drm.fd, plane_res->planes[i]);
-		drmModeObjectProperties *props;
 		unsigned int plane_type;
 
 		if(plane == NULL)
 			continue;
 
-		props = drmModeObjectGetProperties(drm.fd, plane->plane_id, DRM_MODE_OBJECT_PLANE);
-
-		if(props == NULL){
-			printf("plane (%d) properties not found\n",  plane->plane_id);
-			drmModeFreePlane(plane);
-			continue;
-		}
-
-		if(get_drm_prop_val(drm.fd, props, "type",  &plane_type) < 0)
+		/* "type" is immutable, the cached value is current */
+		if(get_drm_prop_val(plane->plane_id, DRM_MODE_OBJECT_PLANE, "type",  &plane_type) < 0)
 		{
 			printf("plane (%d) type value not found\n",  plane->plane_id);
-			drmModeFreeObjectProperties(props);
 			drmModeFreePlane(plane);
 			continue;
 		}
 
 		if (plane_type != DRM_PLANE_TYPE_PRIMARY)
 		{
-			drmModeFreeObjectProperties(props);
 			drmModeFreePlane(plane);
 			continue;
 		}
-		else if (!plane->crtc_id)
+		else if (!plane->crtc_id &&
+			 (plane->possible_crtcs & (1 << drm.crtc_index[drm.ndisp])))
 		{
 			plane->crtc_id = drm.crtc_id[drm.ndisp];
 		}
 
-		drmModeFreeObjectProperties(props);
-
 		if (plane->crtc_id == drm.crtc_id[drm.ndisp])
 		{
-			for (k = 0; k < ARRAY_SIZE(drm_formats); k++)
+			k = scanout_candidates(plane);
+			if (k > 0)
 			{
-				if (search_plane_format(drm_formats[k], plane->count_formats, plane->formats))
-				{
-					drm.format[drm.ndisp] = drm_formats[k];
-					drmModeFreePlane(plane);
-					drmModeFreePlaneResources(plane_res);
-					drmSetClientCap(drm.fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 0);
-					return true;
-				}
+				drm.nscanout[drm.ndisp] = k;
+				drm.format[drm.ndisp] = drm.scanout[drm.ndisp][0].format;
+				drm.modifier[drm.ndisp] = DRM_FORMAT_MOD_INVALID;
+				drm.negotiated[drm.ndisp] = false;
+				drm.plane_id[drm.ndisp] = plane->plane_id;
+				drmModeFreePlane(plane);
+				drmModeFreePlaneResources(plane_res);
+				return true;
 			}
 		}
 
@@ -215,166 +605,235 @@ static bool set_drm_format(void)
 	}
 
 	drmModeFreePlaneResources(plane_res);
-	drmSetClientCap(drm.fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 0);
 	return false;
 }
 
-static int init_drm(void)
+/*
+ * Set up display drm.ndisp on a connector.  Returns 0 if it was added, 1 if
+ * the connector can't be used and -1 on a fatal error.
+ */
+static int probe_connector(drmModeRes *resources, uint32_t conn_id)
 {
-	static const char *modules[] = {
-			"omapdrm", "tilcdc", "i915", "radeon", "nouveau", "vmwgfx", "exynos"
-	};
-	drmModeRes *resources;
-	drmModeConnector *connector = NULL;
+	drmModeConnector *connector;
 	drmModeEncoder *encoder = NULL;
 	drmModeCrtc *crtc = NULL;
-
-	int i, j, k;
 	uint32_t maxRes, curRes;
+	int j, k;
+
+	connector = drmModeGetConnector(drm.fd, conn_id);
+	if (!connector)
+		return 1;
+	if (connector->connection != DRM_MODE_CONNECTED || !connector->count_modes) {
+		drmModeFreeConnector(connector);
+		return 1;
+	}
+
+	/* find the matched encoders */
+	for (j=0; j<connector->count_encoders; j++) {
+		encoder = drmModeGetEncoder(drm.fd, connector->encoders[j]);
+
+		/* Take the fisrt one, if none is assigned */
+		if (!connector->encoder_id)
+		{
+			connector->encoder_id = encoder->encoder_id;
+		}
+
+		if (encoder->encoder_id == connector->encoder_id)
+		{
+			/* find the first valid CRTC if not assigned */
+			if (!encoder->crtc_id)
+			{
+				/* the CRTC the last run used, if it still fits */
+				for (k = 0; k < resources->count_crtcs; ++k)
+					if (resources->crtcs[k] == drm_choice.crtc_id &&
+					    connector->connector_id == drm_choice.connector_id &&
+					    (encoder->possible_crtcs & (1 << k)) &&
+					    !crtc_in_use(resources->crtcs[k]))
+						encoder->crtc_id = resources->crtcs[k];
+
+				for (k = 0; !encoder->crtc_id && k < resources->count_crtcs; ++k) {
+					/* check whether this CRTC works with the encoder */
+					if (!(encoder->possible_crtcs & (1 << k)))
+						continue;
+					/* every display needs a CRTC of its own */
+					if (crtc_in_use(resources->crtcs[k]))
+						continue;
+
+					encoder->crtc_id = resources->crtcs[k];
+					break;
+				}
+
+				if (!encoder->crtc_id)
+				{
+					printf("Encoder(%d): no CRTC find!\n", encoder->encoder_id);
+					drmModeFreeEncoder(encoder);
+					encoder = NULL;
+					continue;
+				}
+			}
 
-	for (i = 0; i < ARRAY_SIZE(modules); i++) {
-		printf("trying to load module %s...", modules[i]);
-		drm.fd = drmOpen(modules[i], NULL);
-		if (drm.fd < 0) {
-			printf("failed.\n");
-		} else {
-			printf("success.\n");
 			break;
 		}
+
+		drmModeFreeEncoder(encoder);
+		encoder = NULL;
 	}
 
-	if (drm.fd < 0) {
-		printf("could not open drm device\n");
-		return -1;
+	if (!encoder) {
+		printf("Connector (%d): no encoder!\n", connector->connector_id);
+		drmModeFreeConnector(connector);
+		return 1;
 	}
 
-	resources = drmModeGetResources(drm.fd);
-	if (!resources) {
-		printf("drmModeGetResources failed: %s\n", strerror(errno));
-		return -1;
+	/* the mode the last run used, else the current or first supported one */
+	drm.mode[drm.ndisp] = NULL;
+	for (j = 0; connector->connector_id == drm_choice.connector_id &&
+			j < connector->count_modes; j++) {
+		if (!strcmp(connector->modes[j].name, drm_choice.mode_name) &&
+		    connector->modes[j].hdisplay == drm_choice.hdisplay &&
+		    connector->modes[j].vdisplay == drm_choice.vdisplay &&
+		    connector->modes[j].vrefresh == drm_choice.vrefresh) {
+			drm.mode[drm.ndisp] = &connector->modes[j];
+			break;
+		}
+	}
+
+	crtc = drmModeGetCrtc(drm.fd, encoder->crtc_id);
+	for (j = 0; !drm.mode[drm.ndisp] && crtc && j < connector->count_modes; j++)
+	{
+		if (crtc->mode_valid)
+		{
+			if ((connector->modes[j].hdisplay == crtc->width) &&
+			(connector->modes[j].vdisplay == crtc->height))
+			{
+				drm.mode[drm.ndisp] = &connector->modes[j];
+				break;
+			}
+		}
+		else
+		{
+			if ((connector->modes[j].hdisplay == crtc->x) &&
+			   (connector->modes[j].vdisplay == crtc->y))
+			{
+				drm.mode[drm.ndisp] = &connector->modes[j];
+				break;
+			}
+		}
 	}
-	drm.resource_id = (uint32_t) resources;
 
-	/* find a connected connector: */
-	for (i = 0; i < resources->count_connectors; i++) {
-		connector = drmModeGetConnector(drm.fd, resources->connectors[i]);
-		if (connector->connection == DRM_MODE_CONNECTED) {
+	if (crtc)
+		drmModeFreeCrtc(crtc);
 
-			/* find the matched encoders */
-			for (j=0; j<connector->count_encoders; j++) {
-				encoder = drmModeGetEncoder(drm.fd, connector->encoders[j]);
+	if (!drm.mode[drm.ndisp])
+		drm.mode[drm.ndisp] = &connector->modes[0];
 
-				/* Take the fisrt one, if none is assigned */
-				if (!connector->encoder_id)
-				{
-					connector->encoder_id = encoder->encoder_id;
-				}
+	drm.connector_id[drm.ndisp] = connector->connector_id;
 
-				if (encoder->encoder_id == connector->encoder_id)
-				{
-					/* find the first valid CRTC if not assigned */
-					if (!encoder->crtc_id)
-					{
-						for (k = 0; k < resources->count_crtcs; ++k) {
-							/* check whether this CRTC works with the encoder */
-							if (!(encoder->possible_crtcs & (1 << k)))
-								continue;
-
-							encoder->crtc_id = resources->crtcs[k];
-							break;
-						}
-
-						if (!encoder->crtc_id)
-						{
-							printf("Encoder(%d): no CRTC find!\n", encoder->encoder_id);
-							drmModeFreeEncoder(encoder);
-							encoder = NULL;
-							continue;
-						}
-					}
+	drm.encoder[drm.ndisp]  = (uintptr_t) encoder;
+	drm.crtc_id[drm.ndisp] = encoder->crtc_id;
+	for (k = 0; k < resources->count_crtcs; k++)
+		if (resources->crtcs[k] == encoder->crtc_id)
+			drm.crtc_index[drm.ndisp] = k;
+	drm.connectors[drm.ndisp] = connector;
 
-					break;
-				}
+	if (!set_drm_format())
+	{
+		// Error handling
+		printf("No desired pixel format found!\n");
+		return -1;
+	}
 
-				drmModeFreeEncoder(encoder);
-				encoder = NULL;
-			}
+	printf("### Display [%d]: CRTC = %d, Connector = %d, format = 0x%x\n", drm.ndisp, drm.crtc_id[drm.ndisp], drm.connector_id[drm.ndisp], drm.format[drm.ndisp]);
+	printf("\tMode chosen [%s] : Clock => %d, Vertical refresh => %d, Type => %d\n", drm.mode[drm.ndisp]->name, drm.mode[drm.ndisp]->clock, drm.mode[drm.ndisp]->vrefresh, drm.mode[drm.ndisp]->type);
+	printf("\tHorizontal => %d, %d, %d, %d, %d\n", drm.mode[drm.ndisp]->hdisplay, drm.mode[drm.ndisp]->hsync_start, drm.mode[drm.ndisp]->hsync_end, drm.mode[drm.ndisp]->htotal, drm.mode[drm.ndisp]->hskew);
+	printf("\tVertical => %d, %d, %d, %d, %d\n", drm.mode[drm.ndisp]->vdisplay, drm.mode[drm.ndisp]->vsync_start, drm.mode[drm.ndisp]->vsync_end, drm.mode[drm.ndisp]->vtotal, drm.mode[drm.ndisp]->vscan);
+	if (verbose) {
+		prop_cache_dump(&prop_cache, drm.crtc_id[drm.ndisp], DRM_MODE_OBJECT_CRTC);
+		prop_cache_dump(&prop_cache, drm.plane_id[drm.ndisp], DRM_MODE_OBJECT_PLANE);
+		prop_cache_dump(&prop_cache, drm.connector_id[drm.ndisp], DRM_MODE_OBJECT_CONNECTOR);
+	}
 
-			if (!encoder) {
-				printf("Connector (%d): no encoder!\n", connector->connector_id);
-				drmModeFreeConnector(connector);
-				continue;
-			}
+	/* If a connector_id is specified, use the corresponding display */
+	if ((connector_id != -1) && (connector_id == drm.connector_id[drm.ndisp]))
+		DISP_ID = drm.ndisp;
 
-			/* choose the current or first supported mode */
-			crtc = drmModeGetCrtc(drm.fd, encoder->crtc_id);
-			for (j = 0; j < connector->count_modes; j++)
-			{
-				if (crtc->mode_valid)
-				{
-					if ((connector->modes[j].hdisplay == crtc->width) &&
-					(connector->modes[j].vdisplay == crtc->height))
-					{
-						drm.mode[drm.ndisp] = &connector->modes[j];
-						break;
-					}
-				}
-				else
-				{
-					if ((connector->modes[j].hdisplay == crtc->x) &&
-					   (connector->modes[j].vdisplay == crtc->y))
-					{
-						drm.mode[drm.ndisp] = &connector->modes[j];
-						break;
-					}
-				}
-			}
+	/* If all displays are enabled, choose the connector with maximum
+	* resolution as the primary display */
+	if (all_display) {
+		maxRes = drm.mode[DISP_ID]->vdisplay * drm.mode[DISP_ID]->hdisplay;
+		curRes = drm.mode[drm.ndisp]->vdisplay * drm.mode[drm.ndisp]->hdisplay;
 
-			if(j >= connector->count_modes)
-				drm.mode[drm.ndisp] = &connector->modes[0];
+		if (curRes > maxRes)
+			DISP_ID = drm.ndisp;
+	}
 
-			drm.connector_id[drm.ndisp] = connector->connector_id;
+	drm.ndisp++;
 
-			drm.encoder[drm.ndisp]  = (uint32_t) encoder;
-			drm.crtc_id[drm.ndisp] = encoder->crtc_id;
-			drm.connectors[drm.ndisp] = connector;
+	return 0;
+}
 
-			if (!set_drm_format())
-			{
-				// Error handling
-				printf("No desired pixel format found!\n");
-				return -1;
-			}
+/*
+ * Find connected connectors; without -a the first usable one, or the one
+ * asked for with -c, is enough.
+ */
+static int scan_connectors(drmModeRes *resources)
+{
+	int i;
 
-			printf("### Display [%d]: CRTC = %d, Connector = %d, format = 0x%x\n", drm.ndisp, drm.crtc_id[drm.ndisp], drm.connector_id[drm.ndisp], drm.format[drm.ndisp]);
-			printf("\tMode chosen [%s] : Clock => %d, Vertical refresh => %d, Type => %d\n", drm.mode[drm.ndisp]->name, drm.mode[drm.ndisp]->clock, drm.mode[drm.ndisp]->vrefresh, drm.mode[drm.ndisp]->type);
-			printf("\tHorizontal => %d, %d, %d, %d, %d\n", drm.mode[drm.ndisp]->hdisplay, drm.mode[drm.ndisp]->hsync_start, drm.mode[drm.ndisp]->hsync_end, drm.mode[drm.ndisp]->htotal, drm.mode[drm.ndisp]->hskew);
-			printf("\tVertical => %d, %d, %d, %d, %d\n", drm.mode[drm.ndisp]->vdisplay, drm.mode[drm.ndisp]->vsync_start, drm.mode[drm.ndisp]->vsync_end, drm.mode[drm.ndisp]->vtotal, drm.mode[drm.ndisp]->vscan);
+	for (i = 0; i < resources->count_connectors && drm.ndisp < MAX_DISPLAYS; i++) {
+		if (drm.ndisp && !all_display &&
+		    (connector_id == -1 || drm.connector_id[DISP_ID] == connector_id))
+			break;
+		if (probe_connector(resources, resources->connectors[i]) < 0)
+			return -1;
+	}
 
-			/* If a connector_id is specified, use the corresponding display */
-			if ((connector_id != -1) && (connector_id == drm.connector_id[drm.ndisp]))
-				DISP_ID = drm.ndisp;
+	return 0;
+}
 
-			/* If all displays are enabled, choose the connector with maximum
-			* resolution as the primary display */
-			if (all_display) {
-				maxRes = drm.mode[DISP_ID]->vdisplay * drm.mode[DISP_ID]->hdisplay;
-				curRes = drm.mode[drm.ndisp]->vdisplay * drm.mode[drm.ndisp]->hdisplay;
+/* forget the displays found by the last scan */
+static void free_displays(void)
+{
+	int d;
+
+	for (d = 0; d < drm.ndisp; d++) {
+		drmModeFreeEncoder((struct _drmModeEncoder *)drm.encoder[d]);
+		drmModeFreeConnector(drm.connectors[d]);
+		drm.encoder[d] = 0;
+		drm.connectors[d] = NULL;
+		drm.crtc_id[d] = 0;
+		drm.mode[d] = NULL;
+	}
+	drm.ndisp = 0;
+	DISP_ID = 0;
+}
 
-				if (curRes > maxRes)
-					DISP_ID = drm.ndisp;
-			}
+/* re-read the connectors; with -P wait for one if none is connected */
+static int rescan_connectors(void)
+{
+	drmModeRes *resources;
 
-			drm.ndisp++;
-		} else {
-			drmModeFreeConnector(connector);
+	for (;;) {
+		free_displays();
+		if (drm.resource_id)
+			drmModeFreeResources((drmModeRes *)drm.resource_id);
+		resources = drmModeGetResources(drm.fd);
+		drm.resource_id = (uintptr_t) resources;
+		if (!resources) {
+			printf("drmModeGetResources failed: %s\n", strerror(errno));
+			return -1;
 		}
+
+		if (scan_connectors(resources))
+			return -1;
+		if (drm.ndisp || !hotplug_enabled || quit_requested)
+			break;
+
+		printf("no connected connector, waiting for hotplug\n");
+		hotplug_poll(&hotplug, -1);
 	}
 
 	if (drm.ndisp == 0) {
-		/* we could be fancy and listen for hotplug events and wait for
-		 * a connector..
-		 */
 		printf("no connected connector!\n");
 		return -1;
 	}
@@ -382,199 +841,568 @@ static int init_drm(void)
 	return 0;
 }
 
-static int init_gbm(void)
+/*
+ * Headless: a render node, or a card without a render node such as vkms,
+ * and a made-up mode that only gives the buffer size.
+ */
+static int init_headless(void)
 {
-	printf("enter init_gbm\n");
-	gbm.dev = gbm_create_device(drm.fd);
+	char devnode[64];
 
-	gbm.surface = gbm_surface_create(gbm.dev,
-			drm.mode[DISP_ID]->hdisplay, drm.mode[DISP_ID]->vdisplay,
-			drm_fmt_to_gbm_fmt(drm.format[DISP_ID]),
-			GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING);
-	if (!gbm.surface) {
-		printf("failed to create gbm surface\n");
+	drm.fd = devprobe_open(drm_device, true, devnode, sizeof(devnode));
+	if (drm.fd < 0)
+		drm.fd = devprobe_open(drm_device, false, devnode, sizeof(devnode));
+	if (drm.fd < 0) {
+		printf("could not open a render node\n");
 		return -1;
 	}
 
+	snprintf(headless_mode.name, sizeof(headless_mode.name), "%ux%u",
+			headless_mode.hdisplay, headless_mode.vdisplay);
+	drm.mode[0] = &headless_mode;
+	drm.format[0] = DRM_FORMAT_XRGB8888;
+	drm.modifier[0] = DRM_FORMAT_MOD_INVALID;
+	drm.nscanout[0] = 0;
+	drm.negotiated[0] = false;
+	drm.ndisp = 1;
+	DISP_ID = 0;
+
+	printf("### Headless: %s, %ux%u offscreen buffers\n", devnode,
+			headless_mode.hdisplay, headless_mode.vdisplay);
+
 	return 0;
 }
 
-static int init_gl(void)
+static int init_drm(void)
 {
-	EGLint major, minor, n;
-	GLint ret;
-	printf("enter init_gl\n");
-	static const GLfloat vVertices[] = {
-			// front
-			-1.0f, -1.0f, +1.0f, // point blue
-			+1.0f, -1.0f, +1.0f, // point magenta
-			-1.0f, +1.0f, +1.0f, // point cyan
-			+1.0f, +1.0f, +1.0f, // point white
-			// back
-			+1.0f, -1.0f, -1.0f, // point red
-			-1.0f, -1.0f, -1.0f, // point black
-			+1.0f, +1.0f, -1.0f, // point yellow
-			-1.0f, +1.0f, -1.0f, // point green
-			// right
-			+1.0f, -1.0f, +1.0f, // point magenta
-			+1.0f, -1.0f, -1.0f, // point red
-			+1.0f, +1.0f, +1.0f, // point white
-			+1.0f, +1.0f, -1.0f, // point yellow
-			// left
-			-1.0f, -1.0f, -1.0f, // point black
-			-1.0f, -1.0f, +1.0f, // point blue
-			-1.0f, +1.0f, -1.0f, // point green
-			-1.0f, +1.0f, +1.0f, // point cyan
-			// top
-			-1.0f, +1.0f, +1.0f, // point cyan
-			+1.0f, +1.0f, +1.0f, // point white
-			-1.0f, +1.0f, -1.0f, // point green
-			+1.0f, +1.0f, -1.0f, // point yellow
-			// bottom
-			-1.0f, -1.0f, -1.0f, // point black
-			+1.0f, -1.0f, -1.0f, // point red
-			-1.0f, -1.0f, +1.0f, // point blue
-			+1.0f, -1.0f, +1.0f  // point magenta
-	};
-
-	static const GLfloat vColors[] = {
-			// front
-			0.0f,  0.0f,  1.0f, // blue
-			1.0f,  0.0f,  1.0f, // magenta
-			0.0f,  1.0f,  1.0f, // cyan
-			1.0f,  1.0f,  1.0f, // white
-			// back
-			1.0f,  0.0f,  0.0f, // red
-			0.0f,  0.0f,  0.0f, // black
-			1.0f,  1.0f,  0.0f, // yellow
-			0.0f,  1.0f,  0.0f, // green
-			// right
-			1.0f,  0.0f,  1.0f, // magenta
-			1.0f,  0.0f,  0.0f, // red
-			1.0f,  1.0f,  1.0f, // white
-			1.0f,  1.0f,  0.0f, // yellow
-			// left
-			0.0f,  0.0f,  0.0f, // black
-			0.0f,  0.0f,  1.0f, // blue
-			0.0f,  1.0f,  0.0f, // green
-			0.0f,  1.0f,  1.0f, // cyan
-			// top
-			0.0f,  1.0f,  1.0f, // cyan
-			1.0f,  1.0f,  1.0f, // white
-			0.0f,  1.0f,  0.0f, // green
-			1.0f,  1.0f,  0.0f, // yellow
-			// bottom
-			0.0f,  0.0f,  0.0f, // black
-			1.0f,  0.0f,  0.0f, // red
-			0.0f,  0.0f,  1.0f, // blue
-			1.0f,  0.0f,  1.0f  // magenta
-	};
+	drmModeRes *resources;
+	char devnode[64];
+	drmVersionPtr version;
+
+	if (headless)
+		return init_headless();
+
+	drm.fd = -1;
+	if (drm_cache_file && !devprobe_cache_load(drm_cache_file, &drm_choice)) {
+		drm.fd = devprobe_open_cached(&drm_choice);
+		if (drm.fd >= 0)
+			printf("### Using cached DRM device %s (%s)\n",
+					drm_choice.devnode, drm_choice.driver);
+		else
+			memset(&drm_choice, 0, sizeof(drm_choice));
+	}
 
-	static const GLfloat vNormals[] = {
-			// front
-			+0.0f, +0.0f, +1.0f, // forward
-			+0.0f, +0.0f, +1.0f, // forward
-			+0.0f, +0.0f, +1.0f, // forward
-			+0.0f, +0.0f, +1.0f, // forward
-			// back
-			+0.0f, +0.0f, -1.0f, // backbard
-			+0.0f, +0.0f, -1.0f, // backbard
-			+0.0f, +0.0f, -1.0f, // backbard
-			+0.0f, +0.0f, -1.0f, // backbard
-			// right
-			+1.0f, +0.0f, +0.0f, // right
-			+1.0f, +0.0f, +0.0f, // right
-			+1.0f, +0.0f, +0.0f, // right
-			+1.0f, +0.0f, +0.0f, // right
-			// left
-			-1.0f, +0.0f, +0.0f, // left
-			-1.0f, +0.0f, +0.0f, // left
-			-1.0f, +0.0f, +0.0f, // left
-			-1.0f, +0.0f, +0.0f, // left
-			// top
-			+0.0f, +1.0f, +0.0f, // up
-			+0.0f, +1.0f, +0.0f, // up
-			+0.0f, +1.0f, +0.0f, // up
-			+0.0f, +1.0f, +0.0f, // up
-			// bottom
-			+0.0f, -1.0f, +0.0f, // down
-			+0.0f, -1.0f, +0.0f, // down
-			+0.0f, -1.0f, +0.0f, // down
-			+0.0f, -1.0f, +0.0f  // down
-	};
+	if (drm.fd < 0) {
+		drm.fd = devprobe_open(drm_device, false, devnode, sizeof(devnode));
+		if (drm.fd < 0) {
+			printf("could not open drm device\n");
+			return -1;
+		}
 
-	static const EGLint context_attribs[] = {
-		EGL_CONTEXT_CLIENT_VERSION, 2,
-		EGL_NONE
-	};
+		version = drmGetVersion(drm.fd);
+		snprintf(drm_choice.devnode, sizeof(drm_choice.devnode), "%s", devnode);
+		snprintf(drm_choice.driver, sizeof(drm_choice.driver), "%s",
+				version ? version->name : "unknown");
+		if (version)
+			drmFreeVersion(version);
+		printf("### Using DRM device %s (%s)\n", drm_choice.devnode,
+				drm_choice.driver);
+	}
 
-	static const EGLint config_attribs[] = {
-		EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
-		EGL_RED_SIZE, 1,
-		EGL_GREEN_SIZE, 1,
-		EGL_BLUE_SIZE, 1,
-		EGL_ALPHA_SIZE, 0,
-		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
-		EGL_NONE
-	};
+	if (hotplug_enabled && hotplug_init(&hotplug, drm.fd)) {
+		printf("hotplug monitoring disabled\n");
+		hotplug_enabled = false;
+	}
 
-	static const char *vertex_shader_source =
-			"uniform mat4 modelviewMatrix;      \n"
-			"uniform mat4 modelviewprojectionMatrix;\n"
-			"uniform mat3 normalMatrix;         \n"
-			"                                   \n"
-			"attribute vec4 in_position;        \n"
-			"attribute vec3 in_normal;          \n"
-			"attribute vec4 in_color;           \n"
-			"\n"
-			"vec4 lightSource = vec4(2.0, 2.0, 20.0, 0.0);\n"
-			"                                   \n"
-			"varying vec4 vVaryingColor;        \n"
-			"                                   \n"
-			"void main()                        \n"
-			"{                                  \n"
-			"    gl_Position = modelviewprojectionMatrix * in_position;\n"
-			"    vec3 vEyeNormal = normalMatrix * in_normal;\n"
-			"    vec4 vPosition4 = modelviewMatrix * in_position;\n"
-			"    vec3 vPosition3 = vPosition4.xyz / vPosition4.w;\n"
-			"    vec3 vLightDir = normalize(lightSource.xyz - vPosition3);\n"
-			"    float diff = max(0.0, dot(vEyeNormal, vLightDir));\n"
-			"    vVaryingColor = vec4(diff * in_color.rgb, 1.0);\n"
-			"}                                  \n";
+	/*
+	 * Plane lookups need the primary planes exposed; leave that on for the
+	 * whole run, the atomic backend depends on it anyway.
+	 */
+	drmSetClientCap(drm.fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
+	if (kms_atomic && drmSetClientCap(drm.fd, DRM_CLIENT_CAP_ATOMIC, 1)) {
+		printf("atomic modesetting not supported: %s\n", strerror(errno));
+		return -1;
+	}
 
-	static const char *fragment_shader_source =
-			"precision mediump float;           \n"
-			"                                   \n"
-			"varying vec4 vVaryingColor;        \n"
-			"                                   \n"
-			"void main()                        \n"
-			"{                                  \n"
-			"    gl_FragColor = vVaryingColor;  \n"
-			"}                                  \n";
+	resources = drmModeGetResources(drm.fd);
+	if (!resources) {
+		printf("drmModeGetResources failed: %s\n", strerror(errno));
+		return -1;
+	}
+	drm.resource_id = (uintptr_t) resources;
+
+	/* after the client caps, they decide which planes and properties exist */
+	if (prop_cache_init(&prop_cache, drm.fd))
+		return -1;
+
+	/* single display: try the connector of the last run before the walk */
+	if (drm_choice.connector_id && !all_display &&
+	    (connector_id == -1 || connector_id == drm_choice.connector_id)) {
+		if (probe_connector(resources, drm_choice.connector_id) < 0)
+			return -1;
+	}
+
+	if (scan_connectors(resources))
+		return -1;
+
+	/* nothing connected: rescan, with -P once a connector shows up */
+	if (drm.ndisp == 0 && rescan_connectors())
+		return -1;
+
+	if (drm_cache_file) {
+		drm_choice.connector_id = drm.connector_id[DISP_ID];
+		drm_choice.crtc_id = drm.crtc_id[DISP_ID];
+		snprintf(drm_choice.mode_name, sizeof(drm_choice.mode_name), "%s",
+				drm.mode[DISP_ID]->name);
+		drm_choice.hdisplay = drm.mode[DISP_ID]->hdisplay;
+		drm_choice.vdisplay = drm.mode[DISP_ID]->vdisplay;
+		drm_choice.vrefresh = drm.mode[DISP_ID]->vrefresh;
+		devprobe_cache_store(drm_cache_file, &drm_choice);
+	}
+
+	return 0;
+}
+
+static int init_gbm_surfaces(void);
+
+static int init_gbm(void)
+{
+	if (verbose)
+		printf("enter init_gbm\n");
+	if (!(egl_persistent && gbm.dev))
+		gbm.dev = gbm_create_device(drm.fd);
+
+	return init_gbm_surfaces();
+}
+
+/* a gbm_surface for each display that doesn't have one yet */
+static struct gbm_surface *create_gbm_surface(int d, uint32_t format,
+		uint64_t modifier)
+{
+	if (modifier == DRM_FORMAT_MOD_INVALID)
+		return gbm_surface_create(gbm.dev, drm.mode[d]->hdisplay,
+				drm.mode[d]->vdisplay, drm_fmt_to_gbm_fmt(format),
+				gbm_usage());
+	return gbm_surface_create_with_modifiers(gbm.dev, drm.mode[d]->hdisplay,
+			drm.mode[d]->vdisplay, drm_fmt_to_gbm_fmt(format),
+			&modifier, 1);
+}
+
+/* whether EGL renders to format with modifier, true when there's no telling */
+static bool egl_renders(EGLDisplay display, uint32_t format, uint64_t modifier)
+{
+	PFNEGLQUERYDMABUFMODIFIERSEXTPROC query_modifiers;
+	EGLuint64KHR *modifiers;
+	EGLBoolean *external;
+	const char *ext;
+	EGLint i, n = 0;
+	bool renders = false;
+
+	ext = eglQueryString(display, EGL_EXTENSIONS);
+	if (modifier == DRM_FORMAT_MOD_LINEAR || !ext ||
+	    !strstr(ext, "EGL_EXT_image_dma_buf_import_modifiers"))
+		return true;
+
+	query_modifiers = (PFNEGLQUERYDMABUFMODIFIERSEXTPROC)
+			eglGetProcAddress("eglQueryDmaBufModifiersEXT");
+	if (!query_modifiers(display, format, 0, NULL, NULL, &n))
+		return true;
+	if (n < 1)
+		return false;
+
+	modifiers = calloc(n, sizeof(*modifiers));
+	external = calloc(n, sizeof(*external));
+	if (!modifiers || !external ||
+	    !query_modifiers(display, format, n, modifiers, external, &n)) {
+		free(modifiers);
+		free(external);
+		return true;
+	}
+
+	/* external only: sampled through an external texture, no rendering */
+	for (i = 0; i < n; i++) {
+		if (modifiers[i] == modifier) {
+			renders = !external[i];
+			break;
+		}
+	}
+	free(modifiers);
+	free(external);
+	return renders;
+}
+
+/*
+ * Create the first surface of display d in the cheapest scanout layout
+ * that works: the plane's candidate pairs, less those EGL does not
+ * render to, tried until GBM allocates one.  Without candidate modifiers
+ * GBM picks as it always did.
+ */
+static int negotiate_scanout(int d)
+{
+	const struct format_mod *c = drm.scanout[d];
+	EGLDisplay display = EGL_NO_DISPLAY;
+	char fourcc[5];
+	int i;
+
+	for (i = 0; i < drm.nscanout[d] && !gbm.surface[d]; i++) {
+		if (c[i].modifier == DRM_FORMAT_MOD_INVALID)
+			break;
+		/* a display of its own unless the context is up */
+		if (display == EGL_NO_DISPLAY) {
+			if (gl.context != EGL_NO_CONTEXT) {
+				display = gl.display;
+			} else {
+				display = eglGetDisplay((EGLNativeDisplayType)gbm.dev);
+				if (!eglInitialize(display, NULL, NULL))
+					break;
+			}
+		}
+		/* one EGL config renders all displays, so all in one format */
+		if (d != DISP_ID && c[i].format != drm.format[DISP_ID])
+			continue;
+		if (!egl_renders(display, c[i].format, c[i].modifier))
+			continue;
+
+		gbm.surface[d] = create_gbm_surface(d, c[i].format, c[i].modifier);
+		if (gbm.surface[d]) {
+			drm.format[d] = c[i].format;
+			drm.modifier[d] = c[i].modifier;
+		}
+	}
+	if (display != EGL_NO_DISPLAY && display != gl.display)
+		eglTerminate(display);
+
+	if (!gbm.surface[d]) {
+		if (d != DISP_ID)
+			drm.format[d] = drm.format[DISP_ID];
+		else if (drm.nscanout[d])
+			drm.format[d] = c[i < drm.nscanout[d] ? i : 0].format;
+		drm.modifier[d] = DRM_FORMAT_MOD_INVALID;
+		gbm.surface[d] = create_gbm_surface(d, drm.format[d],
+				DRM_FORMAT_MOD_INVALID);
+	}
+	if (!gbm.surface[d])
+		return -1;
+
+	drm.negotiated[d] = true;
+	printf("### Display [%d]: scanout %s, modifier 0x%016llx (%s), %d candidate pairs\n",
+			d, fourcc_str(drm.format[d], fourcc),
+			(unsigned long long)drm.modifier[d],
+			modifier_class_name(drm.modifier[d]), drm.nscanout[d]);
+	if (verbose)
+		for (i = 0; i < drm.nscanout[d]; i++)
+			printf("\t%s 0x%016llx (%s)\n", fourcc_str(c[i].format, fourcc),
+					(unsigned long long)c[i].modifier,
+					modifier_class_name(c[i].modifier));
+
+	return 0;
+}
+
+static int init_gbm_surfaces(void)
+{
+	int d;
+
+	for_each_display(d) {
+		if (gbm.surface[d])
+			continue;
+		if (!drm.negotiated[d]) {
+			if (negotiate_scanout(d)) {
+				printf("failed to create gbm surface for display %d\n", d);
+				return -1;
+			}
+			continue;
+		}
+		gbm.surface[d] = create_gbm_surface(d, drm.format[d],
+				drm.modifier[d]);
+		if (!gbm.surface[d]) {
+			printf("failed to create gbm surface for display %d\n", d);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int wait_for_flip(void);
+
+/* partial updates are optional, the damage then only goes to KMS */
+static void init_damage(void)
+{
+	const char *ext = eglQueryString(gl.display, EGL_EXTENSIONS);
+
+	damage.buffer_age = strstr(ext, "EGL_EXT_buffer_age") ||
+			strstr(ext, "EGL_KHR_partial_update");
+
+	damage.set_damage_region = NULL;
+	if (strstr(ext, "EGL_KHR_partial_update"))
+		damage.set_damage_region = (PFNEGLSETDAMAGEREGIONKHRPROC)
+				eglGetProcAddress("eglSetDamageRegionKHR");
+
+	damage.swap_with_damage = NULL;
+	if (strstr(ext, "EGL_KHR_swap_buffers_with_damage"))
+		damage.swap_with_damage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)
+				eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+	else if (strstr(ext, "EGL_EXT_swap_buffers_with_damage"))
+		damage.swap_with_damage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)
+				eglGetProcAddress("eglSwapBuffersWithDamageEXT");
+}
+
+static int init_fences(void)
+{
+	const char *ext = eglQueryString(gl.display, EGL_EXTENSIONS);
+
+	if (!strstr(ext, "EGL_ANDROID_native_fence_sync") ||
+	    !strstr(ext, "EGL_KHR_wait_sync")) {
+		printf("explicit fencing needs EGL_ANDROID_native_fence_sync and EGL_KHR_wait_sync\n");
+		return -1;
+	}
+
+	fence.create_sync = (PFNEGLCREATESYNCKHRPROC)
+			eglGetProcAddress("eglCreateSyncKHR");
+	fence.destroy_sync = (PFNEGLDESTROYSYNCKHRPROC)
+			eglGetProcAddress("eglDestroySyncKHR");
+	fence.wait_sync = (PFNEGLWAITSYNCKHRPROC)
+			eglGetProcAddress("eglWaitSyncKHR");
+	fence.dup_fence_fd = (PFNEGLDUPNATIVEFENCEFDANDROIDPROC)
+			eglGetProcAddress("eglDupNativeFenceFDANDROID");
+	if (!fence.create_sync || !fence.destroy_sync || !fence.wait_sync ||
+	    !fence.dup_fence_fd) {
+		printf("failed to get the EGL fence entry points\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* an EGLSync for a native fence fd, or for the GL commands so far with -1 */
+static EGLSyncKHR fence_create(int fd)
+{
+	EGLint attribs[] = {
+		EGL_SYNC_NATIVE_FENCE_FD_ANDROID, fd,
+		EGL_NONE
+	};
+	EGLSyncKHR sync;
+
+	sync = fence.create_sync(gl.display, EGL_SYNC_NATIVE_FENCE_ANDROID, attribs);
+	if (sync == EGL_NO_SYNC_KHR) {
+		printf("failed to create fence: 0x%x\n", eglGetError());
+		if (fd >= 0)
+			close(fd);
+	}
+
+	return sync;
+}
+
+/* the fd of a flushed GPU fence becomes the in fence of the next commit */
+static int fence_export(EGLSyncKHR sync)
+{
+	if (fence.gpu_fd >= 0)
+		close(fence.gpu_fd);
+	fence.gpu_fd = fence.dup_fence_fd(gl.display, sync);
+	fence.destroy_sync(gl.display, sync);
+	if (fence.gpu_fd < 0) {
+		printf("failed to export GPU fence: 0x%x\n", eglGetError());
+		return -1;
+	}
 
-	gl.display = eglGetDisplay((int)gbm.dev);
+	return 0;
+}
+
+/* the out fences of a successful commit, one per display */
+static int fence_import(void)
+{
+	struct atomic_output *out;
+	int d, ret = 0;
+
+	for_each_display(d) {
+		out = &atomic.output[atomic_idx[d]];
+		if (out->out_fence_fd < 0) {
+			printf("commit returned no out fence for display %d\n", d);
+			ret = -1;
+			continue;
+		}
+		fence.kms_sync[d] = fence_create(out->out_fence_fd);
+		out->out_fence_fd = -1;
+		if (fence.kms_sync[d] == EGL_NO_SYNC_KHR)
+			ret = -1;
+	}
+
+	return ret;
+}
+
+/*
+ * Make the current context wait for the buffers of the last commit.  The
+ * wait is queued in the context, the syncs aren't needed after that.
+ */
+static void fence_gpu_wait(void)
+{
+	int d;
+
+	for (d = 0; d < MAX_DISPLAYS; d++) {
+		if (!fence.kms_sync[d])
+			continue;
+		fence.wait_sync(gl.display, fence.kms_sync[d], 0);
+		fence.destroy_sync(gl.display, fence.kms_sync[d]);
+		fence.kms_sync[d] = NULL;
+	}
+}
+
+/*
+ * Let the last commit complete: a nonblocking commit can't be queued on
+ * top of it and its buffers can't go away under it.  Returns with no
+ * flip pending and the out fences dropped.
+ */
+static int fence_complete(void)
+{
+	int d, ret;
+
+	ret = wait_for_flip();
+	for (d = 0; d < MAX_DISPLAYS; d++) {
+		if (fence.kms_sync[d])
+			fence.destroy_sync(gl.display, fence.kms_sync[d]);
+		fence.kms_sync[d] = NULL;
+	}
+
+	return ret;
+}
+
+static void fence_finish(void)
+{
+	if (!explicit_fences)
+		return;
+
+	fence_complete();
+	if (fence.gpu_fd >= 0)
+		close(fence.gpu_fd);
+	fence.gpu_fd = -1;
+}
+
+static EGLint config_attrib(EGLConfig config, EGLint attrib)
+{
+	EGLint value = 0;
+
+	eglGetConfigAttrib(gl.display, config, attrib, &value);
+	return value;
+}
+
+/*
+ * The config for rendering into GBM buffers of format: its native visual
+ * has to be the GBM format itself, anything else gets converted by a
+ * blit on every swap or fails surface creation.  Of those, the one with
+ * the least multisampling, depth and stencil, which the cube doesn't use
+ * but the driver would still allocate and resolve.
+ */
+static int choose_config(uint32_t format)
+{
+	static const EGLint config_attribs[] = {
+		EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+		EGL_RED_SIZE, 1,
+		EGL_GREEN_SIZE, 1,
+		EGL_BLUE_SIZE, 1,
+		EGL_ALPHA_SIZE, 0,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+		EGL_NONE
+	};
+	/*
+	 * Lower is better.  The caveat goes first: EGL_NONE sorts below
+	 * EGL_SLOW_CONFIG and EGL_NON_CONFORMANT_CONFIG, so a software config
+	 * never wins over an accelerated one on a closer buffer match.
+	 */
+	static const EGLint rank_attribs[] = {
+		EGL_CONFIG_CAVEAT, EGL_SAMPLES, EGL_DEPTH_SIZE, EGL_STENCIL_SIZE,
+	};
+	static EGLint printed_id;
+	EGLint visual = drm_fmt_to_gbm_fmt(format);
+	EGLConfig *configs;
+	EGLint i, j, n = 0, best = -1, a = 0, b = 0;
+	char fourcc[5];
+
+	if (!eglChooseConfig(gl.display, config_attribs, NULL, 0, &n) || n < 1) {
+		printf("failed to choose config: %d\n", n);
+		return -1;
+	}
+
+	configs = calloc(n, sizeof(*configs));
+	if (!configs)
+		return -1;
+	eglChooseConfig(gl.display, config_attribs, configs, n, &n);
+
+	for (i = 0; i < n; i++) {
+		if (config_attrib(configs[i], EGL_NATIVE_VISUAL_ID) != visual)
+			continue;
+		for (j = 0; best >= 0 && j < ARRAY_SIZE(rank_attribs); j++) {
+			a = config_attrib(configs[i], rank_attribs[j]);
+			b = config_attrib(configs[best], rank_attribs[j]);
+			if (a != b)
+				break;
+		}
+		if (best < 0 || (j < ARRAY_SIZE(rank_attribs) && a < b))
+			best = i;
+	}
+
+	if (best < 0) {
+		printf("no EGL config renders %s, %d configs checked\n",
+				fourcc_str(visual, fourcc), n);
+		free(configs);
+		return -1;
+	}
+	gl.config = configs[best];
+	free(configs);
+
+	/* once per config, the scenario engine comes back here every cycle */
+	if (verbose || config_attrib(gl.config, EGL_CONFIG_ID) != printed_id) {
+		printf("### EGL config 0x%x: %s, RGBA %d%d%d%d, depth %d, stencil %d, samples %d, caveat 0x%x\n",
+				config_attrib(gl.config, EGL_CONFIG_ID),
+				fourcc_str(visual, fourcc),
+				config_attrib(gl.config, EGL_RED_SIZE),
+				config_attrib(gl.config, EGL_GREEN_SIZE),
+				config_attrib(gl.config, EGL_BLUE_SIZE),
+				config_attrib(gl.config, EGL_ALPHA_SIZE),
+				config_attrib(gl.config, EGL_DEPTH_SIZE),
+				config_attrib(gl.config, EGL_STENCIL_SIZE),
+				config_attrib(gl.config, EGL_SAMPLES),
+				config_attrib(gl.config, EGL_CONFIG_CAVEAT));
+		printed_id = config_attrib(gl.config, EGL_CONFIG_ID);
+	}
+
+	return 0;
+}
+
+static int init_egl(void)
+{
+	EGLint major, minor;
+	static bool egl_info_printed;
+
+	gl.display = eglGetDisplay((EGLNativeDisplayType)gbm.dev);
 
 	if (!eglInitialize(gl.display, &major, &minor)) {
 		printf("failed to initialize\n");
 		return -1;
 	}
 
-	printf("Using display %p with EGL version %d.%d\n",
-			gl.display, major, minor);
+	/* the scenario engine re-initializes EGL every cycle, only dump it once */
+	if (verbose || !egl_info_printed) {
+		printf("Using display %p with EGL version %d.%d\n",
+				gl.display, major, minor);
+
+		printf("EGL Version \"%s\"\n", eglQueryString(gl.display, EGL_VERSION));
+		printf("EGL Vendor \"%s\"\n", eglQueryString(gl.display, EGL_VENDOR));
+		printf("EGL Extensions \"%s\"\n", eglQueryString(gl.display, EGL_EXTENSIONS));
+		egl_info_printed = true;
 
-	printf("EGL Version \"%s\"\n", eglQueryString(gl.display, EGL_VERSION));
-	printf("EGL Vendor \"%s\"\n", eglQueryString(gl.display, EGL_VENDOR));
-	printf("EGL Extensions \"%s\"\n", eglQueryString(gl.display, EGL_EXTENSIONS));
+		report_env(&report, "egl_version", eglQueryString(gl.display, EGL_VERSION));
+		report_env(&report, "egl_vendor", eglQueryString(gl.display, EGL_VENDOR));
+		report_env(&report, "egl_extensions",
+				eglQueryString(gl.display, EGL_EXTENSIONS));
+	}
 
 	if (!eglBindAPI(EGL_OPENGL_ES_API)) {
 		printf("failed to bind api EGL_OPENGL_ES_API\n");
 		return -1;
 	}
 
-	if (!eglChooseConfig(gl.display, config_attribs, &gl.config, 1, &n) || n != 1) {
-		printf("failed to choose config: %d\n", n);
+	if (choose_config(drm.format[DISP_ID]))
 		return -1;
-	}
 
 	gl.context = eglCreateContext(gl.display, gl.config,
 			EGL_NO_CONTEXT, context_attribs);
@@ -583,223 +1411,3291 @@ static int init_gl(void)
 		return -1;
 	}
 
-	gl.surface = eglCreateWindowSurface(gl.display, gl.config, gbm.surface, NULL);
-	if (gl.surface == EGL_NO_SURFACE) {
-		printf("failed to create egl surface\n");
+	gl.surfaceless = strstr(eglQueryString(gl.display, EGL_EXTENSIONS),
+			"EGL_KHR_surfaceless_context") != NULL;
+
+	if (explicit_fences && init_fences())
+		return -1;
+
+	if (damage_tracking)
+		init_damage();
+
+	return 0;
+}
+
+/* bind the context to the surface of display d, if it isn't already */
+static int make_current(int d)
+{
+	if (gl.current == gl.surface[d])
+		return 0;
+
+	if (!eglMakeCurrent(gl.display, gl.surface[d], gl.surface[d], gl.context)) {
+		printf("eglMakeCurrent failed for display %d: 0x%x\n", d, eglGetError());
+		return -1;
+	}
+	gl.current = gl.surface[d];
+
+	return 0;
+}
+
+/* one window surface per display, all sharing the one context */
+static int init_egl_surface(void)
+{
+	EGLint visual = config_attrib(gl.config, EGL_NATIVE_VISUAL_ID);
+	char fourcc[5], config_fourcc[5];
+	int d;
+
+	for_each_display(d) {
+		if (gl.surface[d] != EGL_NO_SURFACE)
+			continue;
+		/* a persistent context keeps the config of another format */
+		if (drm_fmt_to_gbm_fmt(drm.format[d]) != visual) {
+			printf("display %d scans out %s, the EGL config renders %s\n",
+					d, fourcc_str(drm.format[d], fourcc),
+					fourcc_str(visual, config_fourcc));
+			return -1;
+		}
+		gl.surface[d] = eglCreateWindowSurface(gl.display, gl.config,
+				gbm.surface[d], NULL);
+		if (gl.surface[d] == EGL_NO_SURFACE) {
+			printf("failed to create egl surface for display %d\n", d);
+			return -1;
+		}
+	}
+
+	/* connect the context to the primary surface */
+	return make_current(DISP_ID);
+}
+
+static void destroy_egl_surfaces(void)
+{
+	int d;
+
+	for (d = 0; d < MAX_DISPLAYS; d++) {
+		if (gl.surface[d] != EGL_NO_SURFACE)
+			eglDestroySurface(gl.display, gl.surface[d]);
+		gl.surface[d] = EGL_NO_SURFACE;
+	}
+	gl.current = EGL_NO_SURFACE;
+}
+
+/* compile both shaders and link them into g->program */
+static int compile_program(struct gl_state *g, const char *vs_source,
+		const char *fs_source)
+{
+	GLint ret;
+
+	g->vertex_shader = glCreateShader(GL_VERTEX_SHADER);
+
+	glShaderSource(g->vertex_shader, 1, &vs_source, NULL);
+	glCompileShader(g->vertex_shader);
+
+	glGetShaderiv(g->vertex_shader, GL_COMPILE_STATUS, &ret);
+	if (!ret) {
+		char *log;
+
+		printf("vertex shader compilation failed!:\n");
+		glGetShaderiv(g->vertex_shader, GL_INFO_LOG_LENGTH, &ret);
+		if (ret > 1) {
+			log = malloc(ret);
+			if (log) {
+				glGetShaderInfoLog(g->vertex_shader, ret, NULL, log);
+				printf("%s", log);
+				free(log);
+			}
+		}
+
 		return -1;
 	}
 
-	/* connect the context to the surface */
-	eglMakeCurrent(gl.display, gl.surface, gl.surface, gl.context);
+	g->fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
+
+	glShaderSource(g->fragment_shader, 1, &fs_source, NULL);
+	glCompileShader(g->fragment_shader);
+
+	glGetShaderiv(g->fragment_shader, GL_COMPILE_STATUS, &ret);
+	if (!ret) {
+		char *log;
+
+		printf("fragment shader compilation failed!:\n");
+		glGetShaderiv(g->fragment_shader, GL_INFO_LOG_LENGTH, &ret);
+
+		if (ret > 1) {
+			log = malloc(ret);
+			if (log) {
+				glGetShaderInfoLog(g->fragment_shader, ret, NULL, log);
+				printf("%s", log);
+				free(log);
+			}
+		}
+
+		return -1;
+	}
+
+	glAttachShader(g->program, g->vertex_shader);
+	glAttachShader(g->program, g->fragment_shader);
+
+	glLinkProgram(g->program);
+
+	glGetProgramiv(g->program, GL_LINK_STATUS, &ret);
+	if (!ret) {
+		char *log;
+
+		printf("program linking failed!:\n");
+		glGetProgramiv(g->program, GL_INFO_LOG_LENGTH, &ret);
+
+		if (ret > 1) {
+			log = malloc(ret);
+			if (log) {
+				glGetProgramInfoLog(g->program, ret, NULL, log);
+				printf("%s", log);
+				free(log);
+			}
+		}
+
+		return -1;
+	}
+
+	return 0;
+}
+
+/* the cube: per face four vertices, drawn as two triangles */
+struct cube_vertex {
+	GLfloat position[3];
+	GLfloat normal[3];
+	GLfloat color[3];
+};
+
+#define CUBE_INDICES	(6 * 6)
+
+/* create the cube program, VBO and IBO in the context current on this thread */
+static int init_gl_program(struct gl_state *g)
+{
+	static const struct cube_vertex vertices[] = {
+			// front, forward
+			{ { -1.0f, -1.0f, +1.0f }, { +0.0f, +0.0f, +1.0f }, { 0.0f, 0.0f, 1.0f } }, // blue
+			{ { +1.0f, -1.0f, +1.0f }, { +0.0f, +0.0f, +1.0f }, { 1.0f, 0.0f, 1.0f } }, // magenta
+			{ { -1.0f, +1.0f, +1.0f }, { +0.0f, +0.0f, +1.0f }, { 0.0f, 1.0f, 1.0f } }, // cyan
+			{ { +1.0f, +1.0f, +1.0f }, { +0.0f, +0.0f, +1.0f }, { 1.0f, 1.0f, 1.0f } }, // white
+			// back, backward
+			{ { +1.0f, -1.0f, -1.0f }, { +0.0f, +0.0f, -1.0f }, { 1.0f, 0.0f, 0.0f } }, // red
+			{ { -1.0f, -1.0f, -1.0f }, { +0.0f, +0.0f, -1.0f }, { 0.0f, 0.0f, 0.0f } }, // black
+			{ { +1.0f, +1.0f, -1.0f }, { +0.0f, +0.0f, -1.0f }, { 1.0f, 1.0f, 0.0f } }, // yellow
+			{ { -1.0f, +1.0f, -1.0f }, { +0.0f, +0.0f, -1.0f }, { 0.0f, 1.0f, 0.0f } }, // green
+			// right
+			{ { +1.0f, -1.0f, +1.0f }, { +1.0f, +0.0f, +0.0f }, { 1.0f, 0.0f, 1.0f } }, // magenta
+			{ { +1.0f, -1.0f, -1.0f }, { +1.0f, +0.0f, +0.0f }, { 1.0f, 0.0f, 0.0f } }, // red
+			{ { +1.0f, +1.0f, +1.0f }, { +1.0f, +0.0f, +0.0f }, { 1.0f, 1.0f, 1.0f } }, // white
+			{ { +1.0f, +1.0f, -1.0f }, { +1.0f, +0.0f, +0.0f }, { 1.0f, 1.0f, 0.0f } }, // yellow
+			// left
+			{ { -1.0f, -1.0f, -1.0f }, { -1.0f, +0.0f, +0.0f }, { 0.0f, 0.0f, 0.0f } }, // black
+			{ { -1.0f, -1.0f, +1.0f }, { -1.0f, +0.0f, +0.0f }, { 0.0f, 0.0f, 1.0f } }, // blue
+			{ { -1.0f, +1.0f, -1.0f }, { -1.0f, +0.0f, +0.0f }, { 0.0f, 1.0f, 0.0f } }, // green
+			{ { -1.0f, +1.0f, +1.0f }, { -1.0f, +0.0f, +0.0f }, { 0.0f, 1.0f, 1.0f } }, // cyan
+			// top, up
+			{ { -1.0f, +1.0f, +1.0f }, { +0.0f, +1.0f, +0.0f }, { 0.0f, 1.0f, 1.0f } }, // cyan
+			{ { +1.0f, +1.0f, +1.0f }, { +0.0f, +1.0f, +0.0f }, { 1.0f, 1.0f, 1.0f } }, // white
+			{ { -1.0f, +1.0f, -1.0f }, { +0.0f, +1.0f, +0.0f }, { 0.0f, 1.0f, 0.0f } }, // green
+			{ { +1.0f, +1.0f, -1.0f }, { +0.0f, +1.0f, +0.0f }, { 1.0f, 1.0f, 0.0f } }, // yellow
+			// bottom, down
+			{ { -1.0f, -1.0f, -1.0f }, { +0.0f, -1.0f, +0.0f }, { 0.0f, 0.0f, 0.0f } }, // black
+			{ { +1.0f, -1.0f, -1.0f }, { +0.0f, -1.0f, +0.0f }, { 1.0f, 0.0f, 0.0f } }, // red
+			{ { -1.0f, -1.0f, +1.0f }, { +0.0f, -1.0f, +0.0f }, { 0.0f, 0.0f, 1.0f } }, // blue
+			{ { +1.0f, -1.0f, +1.0f }, { +0.0f, -1.0f, +0.0f }, { 1.0f, 0.0f, 1.0f } }, // magenta
+	};
+
+	/*
+	 * Per object modelview as a mat4 attribute rather than uniforms, so
+	 * that it can come from an instanced array; one draw per cube sets it
+	 * as a constant attribute instead.  The normal matrix is its upper
+	 * 3x3, the transforms being rotations and uniform scales only.
+	 */
+	static const char *vertex_shader_source =
+			"uniform mat4 projectionMatrix;     \n"
+			"                                   \n"
+			"attribute vec4 in_position;        \n"
+			"attribute vec3 in_normal;          \n"
+			"attribute vec4 in_color;           \n"
+			"attribute mat4 in_modelview;       \n"
+			"\n"
+			"vec4 lightSource = vec4(2.0, 2.0, 20.0, 0.0);\n"
+			"                                   \n"
+			"varying vec4 vVaryingColor;        \n"
+			"                                   \n"
+			"void main()                        \n"
+			"{                                  \n"
+			"    vec4 vPosition4 = in_modelview * in_position;\n"
+			"    gl_Position = projectionMatrix * vPosition4;\n"
+			"    mat3 normalMatrix = mat3(in_modelview[0].xyz, in_modelview[1].xyz,\n"
+			"            in_modelview[2].xyz);\n"
+			"    vec3 vEyeNormal = normalize(normalMatrix * in_normal);\n"
+			"    vec3 vPosition3 = vPosition4.xyz / vPosition4.w;\n"
+			"    vec3 vLightDir = normalize(lightSource.xyz - vPosition3);\n"
+			"    float diff = max(0.0, dot(vEyeNormal, vLightDir));\n"
+			"    vVaryingColor = vec4(diff * in_color.rgb, 1.0);\n"
+			"}                                  \n";
+
+	static const char *fragment_shader_source =
+			"precision mediump float;           \n"
+			"                                   \n"
+			"varying vec4 vVaryingColor;        \n"
+			"                                   \n"
+			"void main()                        \n"
+			"{                                  \n"
+			"    gl_FragColor = vVaryingColor;  \n"
+			"}                                  \n";
+
+	GLushort indices[CUBE_INDICES];
+	int i;
+
+	g->program = glCreateProgram();
+
+	glBindAttribLocation(g->program, 0, "in_position");
+	glBindAttribLocation(g->program, 1, "in_normal");
+	glBindAttribLocation(g->program, 2, "in_color");
+	glBindAttribLocation(g->program, 3, "in_modelview");	/* 3 to 6 */
+
+	pthread_mutex_lock(&program_cache_lock);
+	if (!program_cache.dir[0] ||
+	    !progcache_load(&program_cache, g->program,
+			vertex_shader_source, fragment_shader_source)) {
+		if (compile_program(g, vertex_shader_source, fragment_shader_source)) {
+			pthread_mutex_unlock(&program_cache_lock);
+			return -1;
+		}
+		if (program_cache.dir[0])
+			progcache_store(&program_cache, g->program);
+	}
+	pthread_mutex_unlock(&program_cache_lock);
+
+	glUseProgram(g->program);
+
+	g->projectionmatrix = glGetUniformLocation(g->program, "projectionMatrix");
+
+	glEnable(GL_CULL_FACE);
+
+	/* the face strips of the vertex list, as triangles */
+	for (i = 0; i < 6; i++) {
+		indices[i * 6 + 0] = i * 4 + 0;
+		indices[i * 6 + 1] = i * 4 + 1;
+		indices[i * 6 + 2] = i * 4 + 2;
+		indices[i * 6 + 3] = i * 4 + 2;
+		indices[i * 6 + 4] = i * 4 + 1;
+		indices[i * 6 + 5] = i * 4 + 3;
+	}
+
+	glGenBuffers(1, &g->ibo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g->ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+
+	glGenBuffers(1, &g->vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, g->vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(struct cube_vertex),
+			(const GLvoid *)offsetof(struct cube_vertex, position));
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(struct cube_vertex),
+			(const GLvoid *)offsetof(struct cube_vertex, normal));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(struct cube_vertex),
+			(const GLvoid *)offsetof(struct cube_vertex, color));
+	glEnableVertexAttribArray(2);
+
+	glGenBuffers(1, &g->instances);
+
+	return 0;
+}
+
+static void exit_gl_program(struct gl_state *g)
+{
+	glDeleteProgram(g->program);
+	glDeleteBuffers(1, &g->vbo);
+	glDeleteBuffers(1, &g->ibo);
+	glDeleteBuffers(1, &g->instances);
+	glDeleteShader(g->fragment_shader);
+	glDeleteShader(g->vertex_shader);
+	g->program = 0;
+	g->vbo = 0;
+	g->ibo = 0;
+	g->instances = 0;
+	g->vertex_shader = 0;
+	g->fragment_shader = 0;
+}
+
+static const char *comp_vertex_shader_source =
+		"attribute vec2 in_position;\n"
+		"uniform float ydir;\n"
+		"varying vec2 uv;\n"
+		"void main()\n"
+		"{\n"
+		"    gl_Position = vec4(in_position, 0.0, 1.0);\n"
+		"    uv = vec2(in_position.x, in_position.y * ydir) * 0.5 + 0.5;\n"
+		"}\n";
+
+static const char *comp_fragment_shader_source =
+		"#extension GL_OES_EGL_image_external : require\n"
+		"precision mediump float;\n"
+		"uniform samplerExternalOES tex;\n"
+		"varying vec2 uv;\n"
+		"void main()\n"
+		"{\n"
+		"    gl_FragColor = texture2D(tex, uv);\n"
+		"}\n";
+
+/* the layer buffers as external textures, and a program to draw them */
+static int init_composition(void)
+{
+	static const EGLint plane_attribs[2][3] = {
+		{ EGL_DMA_BUF_PLANE0_FD_EXT, EGL_DMA_BUF_PLANE0_OFFSET_EXT,
+		  EGL_DMA_BUF_PLANE0_PITCH_EXT },
+		{ EGL_DMA_BUF_PLANE1_FD_EXT, EGL_DMA_BUF_PLANE1_OFFSET_EXT,
+		  EGL_DMA_BUF_PLANE1_PITCH_EXT },
+	};
+	static const GLfloat quad[] = { -1, -1, 1, -1, -1, 1, 1, 1 };
+	PFNEGLCREATEIMAGEKHRPROC create_image = (PFNEGLCREATEIMAGEKHRPROC)
+			eglGetProcAddress("eglCreateImageKHR");
+	PFNGLEGLIMAGETARGETTEXTURE2DOESPROC image_target_texture =
+			(PFNGLEGLIMAGETARGETTEXTURE2DOESPROC)
+			eglGetProcAddress("glEGLImageTargetTexture2DOES");
+	struct gl_state g = { 0 };
+	EGLint attribs[6 + 2 * 6 + 1];
+	struct layer *l;
+	int i, j, n, fd;
+
+	g.program = glCreateProgram();
+	glBindAttribLocation(g.program, 3, "in_position");
+	if (compile_program(&g, comp_vertex_shader_source,
+			comp_fragment_shader_source)) {
+		exit_gl_program(&g);
+		return -1;
+	}
+	glDeleteShader(g.vertex_shader);
+	glDeleteShader(g.fragment_shader);
+	comp.program = g.program;
+
+	glGenBuffers(1, &comp.vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, comp.vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, gl.vbo);
+
+	for (i = 0; i < overlay.nlayers; i++) {
+		l = &overlay.layer[i];
+		fd = overlay_export(&overlay, l);
+		if (fd < 0)
+			return -1;
+
+		n = 0;
+		attribs[n++] = EGL_WIDTH;
+		attribs[n++] = l->width;
+		attribs[n++] = EGL_HEIGHT;
+		attribs[n++] = l->height;
+		attribs[n++] = EGL_LINUX_DRM_FOURCC_EXT;
+		attribs[n++] = l->format;
+		for (j = 0; j < l->nplanes; j++) {
+			attribs[n++] = plane_attribs[j][0];
+			attribs[n++] = fd;
+			attribs[n++] = plane_attribs[j][1];
+			attribs[n++] = l->offsets[j];
+			attribs[n++] = plane_attribs[j][2];
+			attribs[n++] = l->pitches[j];
+		}
+		attribs[n] = EGL_NONE;
+
+		comp.image[i] = create_image(gl.display, EGL_NO_CONTEXT,
+				EGL_LINUX_DMA_BUF_EXT, NULL, attribs);
+		close(fd);
+		if (comp.image[i] == EGL_NO_IMAGE_KHR) {
+			printf("failed to import layer %d for composition: 0x%x\n",
+					i, eglGetError());
+			return -1;
+		}
+
+		glGenTextures(1, &comp.tex[i]);
+		glBindTexture(GL_TEXTURE_EXTERNAL_OES, comp.tex[i]);
+		image_target_texture(GL_TEXTURE_EXTERNAL_OES, comp.image[i]);
+		glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+
+	glUseProgram(gl.program);
+
+	return 0;
+}
+
+static void exit_composition(void)
+{
+	PFNEGLDESTROYIMAGEKHRPROC destroy_image = (PFNEGLDESTROYIMAGEKHRPROC)
+			eglGetProcAddress("eglDestroyImageKHR");
+	int i;
+
+	if (!comp.program)
+		return;
+
+	for (i = 0; i < OVERLAY_MAX_LAYERS; i++) {
+		if (comp.tex[i])
+			glDeleteTextures(1, &comp.tex[i]);
+		if (comp.image[i] != EGL_NO_IMAGE_KHR)
+			destroy_image(gl.display, comp.image[i]);
+		comp.tex[i] = 0;
+		comp.image[i] = EGL_NO_IMAGE_KHR;
+	}
+	glDeleteBuffers(1, &comp.vbo);
+	glDeleteProgram(comp.program);
+	comp.vbo = 0;
+	comp.program = 0;
+}
+
+/*
+ * Draw the layers no plane took into the frame of display d.  The cube
+ * program and its attributes are left as they were.
+ */
+static int compose_layers(int d)
+{
+	int h = drm.mode[d]->vdisplay;
+	struct layer *l;
+	int i, n = 0;
+
+	for (i = 0; i < overlay.nlayers; i++) {
+		l = &overlay.layer[i];
+		if (l->plane_id)
+			continue;
+
+		if (!comp.program && init_composition())
+			return -1;
+		if (!n++) {
+			glUseProgram(comp.program);
+			/* surface buffers are upside down, the ring FBOs aren't */
+			glUniform1f(glGetUniformLocation(comp.program, "ydir"),
+					fb_ring ? 1.0 : -1.0);
+			glBindBuffer(GL_ARRAY_BUFFER, comp.vbo);
+			glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, 0, NULL);
+			glEnableVertexAttribArray(3);
+		}
+
+		glViewport(l->x, fb_ring ? l->y : h - l->y - (int)l->height,
+				l->width, l->height);
+		glBindTexture(GL_TEXTURE_EXTERNAL_OES, comp.tex[i]);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		comp.px += (uint64_t)l->width * l->height;
+	}
+
+	comp.frames++;
+	if (!n)
+		return 0;
+
+	glDisableVertexAttribArray(3);
+	glBindBuffer(GL_ARRAY_BUFFER, gl.vbo);
+	glUseProgram(gl.program);
+	glViewport(0, 0, drm.mode[d]->hdisplay, h);
+
+	return 0;
+}
+
+/* pick the instanced path, once the first context is current */
+static int init_load(void)
+{
+	const char *ext = (const char *)glGetString(GL_EXTENSIONS);
+
+	int n = load.cubes * load.layers;
+
+	load.modelview = malloc(n * 16 * sizeof(GLfloat));
+	if (!load.modelview || transform_batch_init(&load.xf, n) ||
+	    mat4_batch_init(&load.mv, n))
+		return -1;
+
+	if (!load.instanced || !ext)
+		load.instanced = false;
+	else if (strstr(ext, "GL_EXT_instanced_arrays")) {
+		load.attrib_divisor = (PFNGLVERTEXATTRIBDIVISOREXTPROC)
+				eglGetProcAddress("glVertexAttribDivisorEXT");
+		load.draw_instanced = (PFNGLDRAWELEMENTSINSTANCEDEXTPROC)
+				eglGetProcAddress("glDrawElementsInstancedEXT");
+	} else if (strstr(ext, "GL_ANGLE_instanced_arrays")) {
+		load.attrib_divisor = (PFNGLVERTEXATTRIBDIVISOREXTPROC)
+				eglGetProcAddress("glVertexAttribDivisorANGLE");
+		load.draw_instanced = (PFNGLDRAWELEMENTSINSTANCEDEXTPROC)
+				eglGetProcAddress("glDrawElementsInstancedANGLE");
+	}
+	if (!load.attrib_divisor || !load.draw_instanced)
+		load.instanced = false;
+
+	printf("Cube load: %d cubes in %d layers, %s\n", load.cubes,
+			load.layers, load.instanced ? "instanced" : "one draw per cube");
+
+	return 0;
+}
+
+/* the draw timer queries, in the context just made current */
+static void init_gpu_timer(void)
+{
+	const char *ext;
+
+	if (!gpu_timer.checked) {
+		gpu_timer.checked = true;
+		ext = (const char *)glGetString(GL_EXTENSIONS);
+		gpu_timer.supported = ext && strstr(ext, "GL_EXT_disjoint_timer_query");
+		if (!gpu_timer.supported) {
+			printf("no GL_EXT_disjoint_timer_query, the timeline has no GPU times\n");
+			return;
+		}
+		gpu_timer.gen = (PFNGLGENQUERIESEXTPROC)
+				eglGetProcAddress("glGenQueriesEXT");
+		gpu_timer.delete = (PFNGLDELETEQUERIESEXTPROC)
+				eglGetProcAddress("glDeleteQueriesEXT");
+		gpu_timer.begin = (PFNGLBEGINQUERYEXTPROC)
+				eglGetProcAddress("glBeginQueryEXT");
+		gpu_timer.end = (PFNGLENDQUERYEXTPROC)
+				eglGetProcAddress("glEndQueryEXT");
+		gpu_timer.get_uiv = (PFNGLGETQUERYOBJECTUIVEXTPROC)
+				eglGetProcAddress("glGetQueryObjectuivEXT");
+		gpu_timer.get_ui64v = (PFNGLGETQUERYOBJECTUI64VEXTPROC)
+				eglGetProcAddress("glGetQueryObjectui64vEXT");
+	}
+
+	if (gpu_timer.supported && !gpu_timer.id[0])
+		gpu_timer.gen(GPU_QUERIES, gpu_timer.id);
+}
+
+/* hand the finished queries to the timeline, wait for all of them if wait */
+static void gpu_timer_collect(bool wait)
+{
+	GLuint available;
+	GLuint64 ns;
+	GLint disjoint;
+	int i;
+
+	for (i = 0; i < GPU_QUERIES; i++) {
+		if (!gpu_timer.busy[i])
+			continue;
+		if (!wait) {
+			gpu_timer.get_uiv(gpu_timer.id[i],
+					GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+			if (!available)
+				continue;
+		}
+		gpu_timer.get_ui64v(gpu_timer.id[i], GL_QUERY_RESULT_EXT, &ns);
+		gpu_timer.busy[i] = false;
+
+		/* e.g. a GPU clock change in between makes the result garbage */
+		disjoint = 0;
+		glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+		if (!disjoint)
+			timeline_gpu(&timeline, gpu_timer.seq[i], ns);
+	}
+}
+
+static void gpu_timer_begin(void)
+{
+	int i = gpu_timer.next;
+
+	if (!gpu_timer.id[0] || gpu_timer.active)
+		return;
+
+	gpu_timer_collect(false);
+	if (gpu_timer.busy[i]) {
+		timeline.gpu_skipped++;
+		return;
+	}
+
+	gpu_timer.begin(GL_TIME_ELAPSED_EXT, gpu_timer.id[i]);
+	gpu_timer.seq[i] = timeline.next - 1;
+	gpu_timer.active = true;
+}
+
+static void gpu_timer_end(void)
+{
+	if (!gpu_timer.active)
+		return;
+
+	gpu_timer.end(GL_TIME_ELAPSED_EXT);
+	gpu_timer.busy[gpu_timer.next] = true;
+	gpu_timer.next = (gpu_timer.next + 1) % GPU_QUERIES;
+	gpu_timer.active = false;
+}
+
+/* the queries die with the context, their last results are waited for */
+static void exit_gpu_timer(void)
+{
+	if (!gpu_timer.id[0])
+		return;
+
+	gpu_timer_collect(true);
+	gpu_timer.delete(GPU_QUERIES, gpu_timer.id);
+	memset(gpu_timer.id, 0, sizeof(gpu_timer.id));
+	gpu_timer.next = 0;
+}
+
+static int init_gl(void)
+{
+	if (verbose)
+		printf("enter init_gl\n");
+
+	if (gl.context == EGL_NO_CONTEXT && init_egl())
+		return -1;
+
+	if (init_egl_surface())
+		return -1;
+
+	/* persistent EGL: the program and VBO survived in the context */
+	if (!gl.program && init_gl_program(&gl))
+		return -1;
+
+	if (load.cubes && !load.modelview && init_load())
+		return -1;
+
+	if (timeline.ring)
+		init_gpu_timer();
+
+	glViewport(0, 0, drm.mode[DISP_ID]->hdisplay, drm.mode[DISP_ID]->vdisplay);
+
+	return 0;
+}
+
+/* hand a buffer that left display d back to its surface and the cache */
+static void release_fb(int d, struct drm_fb *fb)
+{
+	if (!fb->owned)
+		gbm_surface_release_buffer(gbm.surface[d], fb->bo);
+	fb_cache_release(fb);
+}
+
+/*
+ * Free what lost displays left on a CRTC another display took over, once
+ * a flip submitted after that completed or once crtc_id is switched off,
+ * or all of it on teardown.
+ */
+static void release_retired(bool all, uint32_t crtc_id)
+{
+	int i, n = 0;
+
+	for (i = 0; i < flip.nretired; i++) {
+		if (!all && flip.completed <= flip.retired[i].after &&
+		    (!crtc_id || flip.retired[i].crtc_id != crtc_id)) {
+			flip.retired[n++] = flip.retired[i];
+			continue;
+		}
+		if (!flip.retired[i].fb->owned)
+			gbm_surface_release_buffer(flip.retired[i].gbm_surface,
+					flip.retired[i].fb->bo);
+		fb_cache_release(flip.retired[i].fb);
+		if (flip.retired[i].egl_surface != EGL_NO_SURFACE)
+			eglDestroySurface(gl.display, flip.retired[i].egl_surface);
+		if (flip.retired[i].gbm_surface)
+			gbm_surface_destroy(flip.retired[i].gbm_surface);
+	}
+	flip.nretired = n;
+}
+
+static void exit_gbm_device(void)
+{
+	int d;
+
+	/* ring buffers are allocated from the device */
+	for (d = 0; d < MAX_DISPLAYS; d++) {
+		if (flip.disp[d].fb && flip.disp[d].fb->owned) {
+			fb_cache_release(flip.disp[d].fb);
+			flip.disp[d].fb = NULL;
+			flip.crtc_set = false;
+		}
+	}
+	fb_cache_drop_owned(&fb_cache);
+
+	gbm_device_destroy(gbm.dev);
+	gbm.dev = NULL;
+}
+
+static void exit_gbm(void)
+{
+	int d;
+
+	if (verbose)
+		printf("enter exit_gbm\n");
+	release_retired(true, 0);
+        for (d = 0; d < MAX_DISPLAYS; d++) {
+                /* a surface buffer on screen goes away with the surface, and
+                 * so does the framebuffer the CRTC points at; ring buffers
+                 * stay */
+                if (flip.disp[d].fb && !flip.disp[d].fb->owned) {
+                        release_fb(d, flip.disp[d].fb);
+                        flip.disp[d].fb = NULL;
+                        flip.crtc_set = false;
+                }
+                if (gbm.surface[d])
+                        gbm_surface_destroy(gbm.surface[d]);
+                gbm.surface[d] = NULL;
+        }
+        if (!egl_persistent)
+                exit_gbm_device();
+
+	/* the consumer's imports would keep the buffers alive */
+	if (dmabuf_sharing)
+		dmabuf_cache_flush(&consumer);
+        return;
+}
+
+static void exit_ring_gl(void)
+{
+	PFNEGLDESTROYIMAGEKHRPROC destroy_image = (PFNEGLDESTROYIMAGEKHRPROC)
+			eglGetProcAddress("eglDestroyImageKHR");
+	int i;
+
+	for (i = 0; i < FB_CACHE_SLOTS; i++) {
+		if (!ring_gl[i].bo)
+			continue;
+		glDeleteFramebuffers(1, &ring_gl[i].fbo);
+		glDeleteRenderbuffers(1, &ring_gl[i].rb);
+		destroy_image(gl.display, ring_gl[i].image);
+		memset(&ring_gl[i], 0, sizeof(ring_gl[i]));
+	}
+}
+
+static void exit_gl_context(void)
+{
+	exit_gpu_timer();
+	exit_ring_gl();
+	exit_composition();
+	/* the stress run's context never had a program, or anything current */
+	if (gl.program)
+		exit_gl_program(&gl);
+	eglMakeCurrent(gl.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	destroy_egl_surfaces();
+	eglDestroyContext(gl.display, gl.context);
+	eglTerminate(gl.display);
+	gl.context = EGL_NO_CONTEXT;
+}
+
+static void exit_gl(void)
+{
+	int d;
+
+	if (verbose)
+		printf("enter exit_gl\n");
+
+	/* the out fences are EGL objects, and nothing may stay in flight */
+	fence_finish();
+	release_retired(true, 0);
+
+	/* rendered but never flipped */
+	for (d = 0; d < MAX_DISPLAYS; d++) {
+		if (ring_fb[d])
+			fb_cache_release(ring_fb[d]);
+		ring_fb[d] = NULL;
+		if (share_fb[d])
+			release_fb(d, share_fb[d]);
+		share_fb[d] = NULL;
+	}
+
+	if (!egl_persistent) {
+		exit_gl_context();
+		return;
+	}
+
+	/*
+	 * Keep the context current without a surface so the next init_gl
+	 * only has to bind a new one.  Without EGL_KHR_surfaceless_context
+	 * the context is released instead, its objects survive either way.
+	 */
+	eglMakeCurrent(gl.display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+			gl.surfaceless ? gl.context : EGL_NO_CONTEXT);
+	destroy_egl_surfaces();
+}
+
+/* tear down what persistent EGL mode kept alive after the last cycle */
+static void exit_persistent(void)
+{
+	if (gl.context != EGL_NO_CONTEXT)
+		exit_gl_context();
+	if (gbm.dev)
+		exit_gbm_device();
+}
+
+static void exit_drm(void)
+{
+
+        drmModeRes *resources;
+
+        resources = (drmModeRes *)drm.resource_id;
+        free_displays();
+        /* headless runs never get the KMS resources */
+        if (resources)
+                drmModeFreeResources(resources);
+        drm.resource_id = 0;
+        if (hotplug_enabled)
+                hotplug_fini(&hotplug);
+        prop_cache_fini(&prop_cache);
+        drmClose(drm.fd);
+        return;
+}
+
+void cleanup_kmscube(void)
+{
+	if (scn.gl_up)
+		exit_gl();
+	if (scn.gbm_up)
+		exit_gbm();
+	exit_persistent();
+	fb_cache_fini(&fb_cache);
+	exit_drm();
+	printf("Cleanup of GL, GBM and DRM completed\n");
+	return;
+}
+
+/*
+ * The modelview matrices of frame i on display d: a grid of cells about
+ * as wide as high over an orthographic view of the frame, a cube turning
+ * in each, its phase by cell and layer.  They are computed as one batch.
+ */
+static void update_cubes(int d, uint32_t i, GLfloat *projection)
+{
+	float aspect = (float)drm.mode[d]->hdisplay / drm.mode[d]->vdisplay;
+	float cell_w, cell_h, scale;
+	struct transform_batch *t = &load.xf;
+	int cols, rows, c, l, k = 0;
+
+	for (cols = 1; cols * cols < load.cubes * aspect; cols++)
+		;
+	rows = (load.cubes + cols - 1) / cols;
+	cell_w = 2.0f * aspect / cols;
+	cell_h = 2.0f / rows;
+	scale = (cell_w < cell_h ? cell_w : cell_h) / 2 * load.size / 100;
+
+	mat4_ortho(projection, -aspect, aspect, -1.0f, 1.0f, 1.0f, 10.0f);
+
+	for (l = 0; l < load.layers; l++) {
+		for (c = 0; c < load.cubes; c++, k++) {
+			t->x[k] = -aspect + (c % cols + 0.5f) * cell_w;
+			t->y[k] = 1.0f - (c / cols + 0.5f) * cell_h;
+			t->z[k] = -2.0f - l;
+			t->scale[k] = scale;
+			t->rx[k] = 45.0f + 0.25f * i + 7 * c + 30 * l;
+			t->ry[k] = 45.0f - 0.5f * i + 11 * c;
+		}
+	}
+	mat4_batch_compose(&load.mv, t);
+	mat4_batch_store(&load.mv, load.modelview);
+
+	load.cube_px += (uint64_t)load.cubes * load.layers * scale * scale *
+			drm.mode[d]->vdisplay * drm.mode[d]->vdisplay;
+}
+
+static void draw_cubes(int d, uint32_t i)
+{
+	int n = load.cubes * load.layers;
+	GLfloat projection[16];
+	int c, col;
+
+	update_cubes(d, i, projection);
+	glUniformMatrix4fv(gl.projectionmatrix, 1, GL_FALSE, projection);
+
+	if (load.instanced) {
+		/* one upload of all of them, one draw */
+		glBindBuffer(GL_ARRAY_BUFFER, gl.instances);
+		glBufferData(GL_ARRAY_BUFFER, n * 16 * sizeof(GLfloat),
+				load.modelview, GL_STREAM_DRAW);
+		for (col = 0; col < 4; col++) {
+			glVertexAttribPointer(3 + col, 4, GL_FLOAT, GL_FALSE,
+					16 * sizeof(GLfloat),
+					(const GLvoid *)(col * 4 * sizeof(GLfloat)));
+			glEnableVertexAttribArray(3 + col);
+			load.attrib_divisor(3 + col, 1);
+		}
+		load.draw_instanced(GL_TRIANGLES, CUBE_INDICES,
+				GL_UNSIGNED_SHORT, NULL, n);
+		/* composition reuses attribute 3 */
+		for (col = 0; col < 4; col++) {
+			load.attrib_divisor(3 + col, 0);
+			glDisableVertexAttribArray(3 + col);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, gl.vbo);
+		load.draws++;
+	} else {
+		for (c = 0; c < n; c++) {
+			for (col = 0; col < 4; col++)
+				glVertexAttrib4fv(3 + col,
+						&load.modelview[c * 16 + col * 4]);
+			glDrawElements(GL_TRIANGLES, CUBE_INDICES,
+					GL_UNSIGNED_SHORT, NULL);
+		}
+		load.draws += n;
+	}
+
+	load.frames++;
+}
+
+static void draw(int d, uint32_t i)
+{
+	/* clear the color buffer */
+	glClearColor(0.5, 0.5, 0.5, 1.0);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	if (load.cubes)
+		draw_cubes(d, i);
+}
+
+/* where the ticker is in a frame on display d */
+static struct rect ticker_rect(int d, uint32_t frame)
+{
+	int w = drm.mode[d]->hdisplay, h = drm.mode[d]->vdisplay;
+	struct rect r = damage.ticker;
+
+	if (r.w > w)
+		r.w = w;
+	if (r.h > h)
+		r.h = h;
+	r.x = w > r.w ? frame * 8 % (w - r.w) : 0;
+	r.y = (h - r.h) / 8;
+
+	return r;
+}
+
+static void fill_rect(const struct rect *r, GLfloat red, GLfloat green,
+		GLfloat blue)
+{
+	glScissor(r->x, r->y, r->w, r->h);
+	glClearColor(red, green, blue, 1.0);
+	glClear(GL_COLOR_BUFFER_BIT);
+	damage.fill_px += (uint64_t)r->w * r->h;
+}
+
+/*
+ * draw() with damage tracking: bring the buffer from the frame it holds
+ * to this one, which only takes erasing the ticker where it was then and
+ * drawing it where it is now.  Buffers of unknown age are redrawn.
+ */
+static void draw_damaged(int d, uint32_t frame)
+{
+	struct rect full = { 0, 0, drm.mode[d]->hdisplay, drm.mode[d]->vdisplay };
+	struct rect repair[2];
+	EGLint age = 0, rects[8];
+	int i, n;
+
+	if (damage.buffer_age && !fb_ring)
+		eglQuerySurface(gl.display, gl.surface[d], EGL_BUFFER_AGE_EXT, &age);
+
+	/* content undefined, or older than the run */
+	if (age <= 0 || (uint32_t)age > frame) {
+		repair[0] = full;
+		n = 1;
+		damage.full_redraws++;
+	} else {
+		repair[0] = ticker_rect(d, frame - age);
+		repair[1] = ticker_rect(d, frame);
+		n = 2;
+	}
+
+	if (damage.set_damage_region && !fb_ring) {
+		for (i = 0; i < n; i++) {
+			rects[i * 4] = repair[i].x;
+			rects[i * 4 + 1] = repair[i].y;
+			rects[i * 4 + 2] = repair[i].w;
+			rects[i * 4 + 3] = repair[i].h;
+		}
+		damage.set_damage_region(gl.display, gl.surface[d], rects, n);
+	}
+
+	glEnable(GL_SCISSOR_TEST);
+	fill_rect(&repair[0], 0.5, 0.5, 0.5);
+	repair[1] = ticker_rect(d, frame);
+	fill_rect(&repair[1], (frame % 64) / 63.0, 0.2, 0.8);
+	glDisable(GL_SCISSOR_TEST);
+
+	/* what the next swap and flip report, relative to the last frame */
+	if (frame && damage.next_frame[d] == frame) {
+		damage.dirty[d][0] = ticker_rect(d, frame - 1);
+		damage.dirty[d][1] = repair[1];
+		damage.ndirty[d] = 2;
+	} else {
+		damage.ndirty[d] = 0;
+	}
+	damage.next_frame[d] = frame + 1;
+
+	damage.frames++;
+	damage.frame_px += (uint64_t)full.w * full.h;
+}
+
+static int swap_buffers(int d)
+{
+	EGLint rects[8];
+	int i;
+
+	if (!damage_tracking || !damage.swap_with_damage || !damage.ndirty[d])
+		return eglSwapBuffers(gl.display, gl.surface[d]) ? 0 : -1;
+
+	for (i = 0; i < damage.ndirty[d]; i++) {
+		rects[i * 4] = damage.dirty[d][i].x;
+		rects[i * 4 + 1] = damage.dirty[d][i].y;
+		rects[i * 4 + 2] = damage.dirty[d][i].w;
+		rects[i * 4 + 3] = damage.dirty[d][i].h;
+	}
+
+	return damage.swap_with_damage(gl.display, gl.surface[d], rects,
+			damage.ndirty[d]) ? 0 : -1;
+}
+
+/* bind an FBO rendering into the next free ring buffer of display d */
+static int begin_ring_frame(int d)
+{
+	static PFNEGLCREATEIMAGEKHRPROC create_image;
+	static PFNGLEGLIMAGETARGETRENDERBUFFERSTORAGEOESPROC image_target_rb;
+	struct drm_fb *fb;
+	int i;
+
+	if (!create_image) {
+		create_image = (PFNEGLCREATEIMAGEKHRPROC)
+				eglGetProcAddress("eglCreateImageKHR");
+		image_target_rb = (PFNGLEGLIMAGETARGETRENDERBUFFERSTORAGEOESPROC)
+				eglGetProcAddress("glEGLImageTargetRenderbufferStorageOES");
+		if (!create_image || !image_target_rb) {
+			printf("ring rendering needs EGL_KHR_image_base and GL_OES_EGL_image\n");
+			return -1;
+		}
+	}
+
+	if (ring_fb[d])
+		fb_cache_release(ring_fb[d]);
+
+	ring_fb[d] = fb = fb_cache_acquire(&fb_cache, gbm.dev,
+			drm.mode[d]->hdisplay, drm.mode[d]->vdisplay,
+			drm_fmt_to_gbm_fmt(drm.format[d]), &drm.modifier[d],
+			drm.modifier[d] != DRM_FORMAT_MOD_INVALID);
+	if (!fb)
+		return -1;
+
+	i = fb - fb_cache.slot;
+	if (ring_gl[i].bo != fb->bo) {
+		if (ring_gl[i].bo) {
+			PFNEGLDESTROYIMAGEKHRPROC destroy_image = (PFNEGLDESTROYIMAGEKHRPROC)
+					eglGetProcAddress("eglDestroyImageKHR");
+
+			glDeleteFramebuffers(1, &ring_gl[i].fbo);
+			glDeleteRenderbuffers(1, &ring_gl[i].rb);
+			destroy_image(gl.display, ring_gl[i].image);
+		}
+
+		ring_gl[i].image = create_image(gl.display, EGL_NO_CONTEXT,
+				EGL_NATIVE_PIXMAP_KHR, (EGLClientBuffer)fb->bo, NULL);
+		if (ring_gl[i].image == EGL_NO_IMAGE_KHR) {
+			printf("failed to create EGLImage for ring buffer: 0x%x\n", eglGetError());
+			ring_gl[i].bo = NULL;
+			return -1;
+		}
+
+		glGenRenderbuffers(1, &ring_gl[i].rb);
+		glBindRenderbuffer(GL_RENDERBUFFER, ring_gl[i].rb);
+		image_target_rb(GL_RENDERBUFFER, ring_gl[i].image);
+
+		glGenFramebuffers(1, &ring_gl[i].fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, ring_gl[i].fbo);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+				GL_RENDERBUFFER, ring_gl[i].rb);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			printf("ring buffer FBO is incomplete\n");
+			return -1;
+		}
+		ring_gl[i].bo = fb->bo;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, ring_gl[i].fbo);
+
+	return 0;
+}
+
+static void page_flip_handler(int fd, unsigned int frame,
+		  unsigned int sec, unsigned int usec, unsigned int crtc_id,
+		  void *data)
+{
+	uint64_t vblank_ns = (uint64_t)sec * 1000000000ull + usec * 1000ull;
+	struct disp_flip *df = NULL;
+	int d;
+
+	/* kernels without crtc_id in the event leave it 0: legacy flips
+	 * carry their display as user data, atomic ones complete in order */
+	for_each_display(d)
+		if (crtc_id ? drm.crtc_id[d] == crtc_id : data == &flip.disp[d])
+			df = &flip.disp[d];
+	for_each_display(d)
+		if (!df && flip.disp[d].pending)
+			df = &flip.disp[d];
+	if (!df)
+		return;
+
+	df->pending = false;
+	df->vblank_ns = vblank_ns;
+
+	/* only consecutive flips, not the gap across a modeset */
+	if (df->last_vblank_ns) {
+		if (frame > df->last_seq + 1)
+			df->missed += frame - df->last_seq - 1;
+		stats_add(&df->interval, vblank_ns - df->last_vblank_ns);
+	}
+
+	if (flip.monotonic && vblank_ns > flip.submit_ns)
+		stats_add(&df->latency, vblank_ns - flip.submit_ns);
+	if (flip.monotonic)
+		timeline_vblank(&timeline, df->timeline_seq, vblank_ns);
+
+	df->last_seq = frame;
+	df->last_vblank_ns = vblank_ns;
+	df->flips++;
+}
+
+static bool flip_pending(void)
+{
+	int d;
+
+	for_each_display(d)
+		if (flip.disp[d].pending)
+			return true;
+	return false;
+}
+
+static int wait_for_flip(void)
+{
+	drmEventContext evctx = {
+			.version = DRM_EVENT_CONTEXT_VERSION,
+			.page_flip_handler2 = page_flip_handler,
+	};
+	fd_set fds;
+
+	while (flip_pending()) {
+		struct timeval timeout = { .tv_sec = 1 };
+		int ret;
+
+		FD_ZERO(&fds);
+		FD_SET(drm.fd, &fds);
+
+		ret = select(drm.fd + 1, &fds, NULL, NULL, &timeout);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			printf("select err: %s\n", strerror(errno));
+			return -1;
+		} else if (ret == 0) {
+			printf("page flip timed out\n");
+			return -1;
+		}
+
+		drmHandleEvent(drm.fd, &evctx);
+	}
+
+	flip.completed = flip.submitted;
+	return 0;
+}
+
+/* the buffer to show next on display d */
+static struct drm_fb *front_buffer(int d)
+{
+	struct gbm_bo *bo;
+	struct drm_fb *fb;
+
+	if (fb_ring) {
+		fb = ring_fb[d];
+		ring_fb[d] = NULL;
+		if (!fb)
+			printf("no ring buffer rendered to flip on display %d\n", d);
+		return fb;
+	}
+
+	/* the share stage locked it already */
+	if (share_fb[d]) {
+		fb = share_fb[d];
+		share_fb[d] = NULL;
+		return fb;
+	}
+
+	bo = gbm_surface_lock_front_buffer(gbm.surface[d]);
+	if (!bo) {
+		printf("failed to lock front buffer\n");
+		return NULL;
+	}
+
+	fb = fb_cache_lookup(&fb_cache, bo);
+	if (!fb)
+		gbm_surface_release_buffer(gbm.surface[d], bo);
+
+	return fb;
+}
+
+/* spread of the vblanks the displays of the last group flipped on */
+static void record_flip_skew(void)
+{
+	uint64_t first = UINT64_MAX, last = 0;
+	int d, n = 0;
+
+	for_each_display(d) {
+		if (!flip.disp[d].vblank_ns)
+			continue;
+		if (flip.disp[d].vblank_ns < first)
+			first = flip.disp[d].vblank_ns;
+		if (flip.disp[d].vblank_ns > last)
+			last = flip.disp[d].vblank_ns;
+		n++;
+	}
+
+	if (n > 1)
+		stats_add(&flip.skew, last - first);
+}
+
+/* a video frame, then UI elements in two corners of the primary display */
+static int init_layers(void)
+{
+	int w = drm.mode[DISP_ID]->hdisplay, h = drm.mode[DISP_ID]->vdisplay;
+	int i, ret = 0;
+
+	if (overlay_init(&overlay, drm.fd, &prop_cache))
+		return -1;
+	overlay_print_planes(&overlay, drm.crtc_index[DISP_ID]);
+
+	for (i = 0; i < overlay_layers && ret >= 0; i++) {
+		if (i == 0)
+			ret = overlay_add_layer(&overlay, DRM_FORMAT_NV12,
+					w / 2, h / 2, w / 8, h / 8);
+		else if (i == 1)
+			ret = overlay_add_layer(&overlay, DRM_FORMAT_XRGB8888,
+					w / 4, h / 8, w * 11 / 16, h / 16);
+		else
+			ret = overlay_add_layer(&overlay, DRM_FORMAT_XRGB8888,
+					w / 4, h / 8, w / 16, h * 13 / 16);
+	}
+	if (ret < 0)
+		return -1;
+
+	if (!overlay_gl_only)
+		overlay_assign(&overlay, drm.crtc_index[DISP_ID], drm.plane_id[DISP_ID]);
+
+	return 0;
+}
+
+/* hand the layers that have a plane to the atomic state */
+static int set_layers(void)
+{
+	struct layer *l;
+	int i;
+
+	for (i = 0; i < overlay.nlayers; i++) {
+		l = &overlay.layer[i];
+		if (l->plane_id &&
+		    atomic_set_layer(&atomic, atomic_idx[DISP_ID], i, l->plane_id,
+				l->fb_id, l->width, l->height, l->x, l->y,
+				l->set_zpos, l->zpos))
+			return -1;
+	}
+
+	return 0;
+}
+
+/* take layer i off its plane, the plane goes off with the next commit */
+static void compose_layer(int i)
+{
+	struct layer *l = &overlay.layer[i];
+
+	atomic_set_layer(&atomic, atomic_idx[DISP_ID], i, l->plane_id, 0,
+			0, 0, 0, 0, false, 0);
+	l->plane_id = 0;
+}
+
+/*
+ * With the framebuffers of a modeset in place, check the layer planes
+ * with TEST_ONLY commits, moving the topmost plane layer over to GL
+ * composition until the driver accepts the rest.  Layers moved here miss
+ * from this one frame.
+ */
+static void place_layers(void)
+{
+	int i;
+
+	while (atomic_test(&atomic)) {
+		for (i = overlay.nlayers - 1; i >= 0; i--)
+			if (overlay.layer[i].plane_id)
+				break;
+		if (i < 0)
+			return;
+
+		printf("### Layer %d: plane %u rejected by TEST_ONLY, composited by GL\n",
+				i, overlay.layer[i].plane_id);
+		compose_layer(i);
+	}
+}
+
+static void print_overlay_report(void)
+{
+	struct layer *l;
+	int i;
+
+	if (!overlay.nlayers)
+		return;
+
+	printf("### Overlay layers:\n");
+	for (i = 0; i < overlay.nlayers; i++) {
+		l = &overlay.layer[i];
+		printf("\tlayer %d: %ux%u %c%c%c%c at %d,%d => ", i, l->width,
+				l->height, l->format & 0xff, (l->format >> 8) & 0xff,
+				(l->format >> 16) & 0xff, l->format >> 24, l->x, l->y);
+		if (l->plane_id)
+			printf("plane %u, zpos %llu\n", l->plane_id,
+					(unsigned long long)l->zpos);
+		else
+			printf("GL composition\n");
+	}
+	if (comp.frames)
+		printf("\tGL composited %.2f Mpx/frame\n",
+				comp.px / 1e6 / comp.frames);
+}
+
+/* the damage of the last frame as FB_DAMAGE_CLIPS, in framebuffer coordinates */
+static void set_kms_damage(int d, const struct drm_fb *fb)
+{
+	struct drm_mode_rect clips[2];
+	const struct rect *r;
+	int i, n = damage.ndirty[d];
+
+	damage.commits++;
+	damage.scanout_px += (uint64_t)fb->width * fb->height;
+	if (!n) {
+		damage.clip_px += (uint64_t)fb->width * fb->height;
+		return;
+	}
+
+	/* surface buffers are upside down, the ring FBOs aren't */
+	for (i = 0; i < n; i++) {
+		r = &damage.dirty[d][i];
+		clips[i].x1 = r->x;
+		clips[i].x2 = r->x + r->w;
+		clips[i].y1 = fb_ring ? r->y : (int)fb->height - (r->y + r->h);
+		clips[i].y2 = clips[i].y1 + r->h;
+	}
+
+	if (atomic_set_damage(&atomic, atomic_idx[d], clips, n))
+		damage.clip_px += (uint64_t)fb->width * fb->height;
+	else
+		for (i = 0; i < n; i++)
+			damage.clip_px += (uint64_t)damage.dirty[d][i].w *
+					damage.dirty[d][i].h;
+}
+
+/*
+ * Put the last swapped buffer of every active display on screen: the
+ * first time with a modeset, then with vsync'd page flips.  With the
+ * atomic backend all displays go into one commit; the legacy backend
+ * queues one flip per CRTC and waits for the whole group.  The previous
+ * buffers go back to their gbm_surfaces once the group has completed,
+ * or with explicit fencing right after the commit, guarded by its out
+ * fences; that group then completes at the start of the next flip.
+ */
+static int flip_front_buffer(void)
+{
+	struct drm_fb *fb[MAX_DISPLAYS] = { NULL };
+	bool shown[MAX_DISPLAYS] = { false };
+	uint64_t cap = 0, wait_start;
+	bool modeset;
+	int d, ret = 0;
+
+	if (explicit_fences) {
+		wait_start = stats_now_ns();
+		if (fence_complete())
+			return -1;
+		stats_add(&flip.wait, stats_now_ns() - wait_start);
+		if (flip.skew_due)
+			record_flip_skew();
+		flip.skew_due = false;
+	}
+
+	for_each_display(d) {
+		fb[d] = front_buffer(d);
+		if (!fb[d]) {
+			ret = -1;
+			break;
+		}
+	}
+
+	modeset = !flip.crtc_set;
+	if (modeset) {
+		for_each_display(d)
+			flip.disp[d].last_vblank_ns = 0;
+		flip.monotonic = !drmGetCap(drm.fd, DRM_CAP_TIMESTAMP_MONOTONIC, &cap) && cap;
+	}
+	for_each_display(d) {
+		flip.disp[d].vblank_ns = 0;
+		flip.disp[d].timeline_seq = timeline.next - 1;
+	}
+
+	flip.submit_ns = stats_now_ns();
+	if (ret) {
+		/* a display had nothing to show, submit nothing */
+	} else if (kms_atomic) {
+		/* atomic commits never block, not even the modeset */
+		for_each_display(d) {
+			atomic_set_fb(&atomic, atomic_idx[d], fb[d]->fb_id,
+					fb[d]->width, fb[d]->height);
+			if (explicit_fences)
+				atomic_set_in_fence(&atomic, atomic_idx[d], fence.gpu_fd);
+			if (damage_tracking && !modeset)
+				set_kms_damage(d, fb[d]);
+		}
+		if (overlay.nlayers && modeset)
+			place_layers();
+		ret = atomic_commit(&atomic, modeset, &flip);
+		for_each_display(d)
+			flip.disp[d].pending = shown[d] = !ret;
+		if (explicit_fences) {
+			/* the kernel holds its own reference to the in fence */
+			if (fence.gpu_fd >= 0)
+				close(fence.gpu_fd);
+			fence.gpu_fd = -1;
+			if (!ret)
+				ret = fence_import();
+		}
+	} else {
+		for_each_display(d) {
+			if (modeset) {
+				ret = drmModeSetCrtc(drm.fd, drm.crtc_id[d], fb[d]->fb_id, 0, 0,
+						&drm.connector_id[d], 1, drm.mode[d]);
+				if (ret)
+					printf("failed to set mode: %s\n", strerror(errno));
+			} else {
+				ret = drmModePageFlip(drm.fd, drm.crtc_id[d], fb[d]->fb_id,
+						DRM_MODE_PAGE_FLIP_EVENT, &flip.disp[d]);
+				if (ret)
+					printf("failed to queue page flip: %s\n", strerror(errno));
+				else
+					flip.disp[d].pending = true;
+			}
+			if (ret)
+				break;
+			shown[d] = true;
+		}
+	}
+
+	if (!ret)
+		flip.submitted++;
+	if (!ret && !modeset)
+		stats_add(&flip.submit, stats_now_ns() - flip.submit_ns);
+
+	if (explicit_fences && !ret) {
+		flip.skew_due = !modeset;
+	} else {
+		/* even after a failure, flips already queued have to complete */
+		wait_start = stats_now_ns();
+		if (wait_for_flip()) {
+			/* the buffers may still be scanned out, don't hand them back */
+			return -1;
+		}
+		if (!ret)
+			stats_add(&flip.wait, stats_now_ns() - wait_start);
+	}
+
+	for_each_display(d) {
+		if (!fb[d])
+			continue;
+		if (!shown[d]) {
+			release_fb(d, fb[d]);
+			continue;
+		}
+		if (flip.disp[d].fb)
+			release_fb(d, flip.disp[d].fb);
+		flip.disp[d].fb = fb[d];
+	}
+	release_retired(false, 0);
+
+	if (ret)
+		return -1;
+
+	flip.crtc_set = true;
+	flip.groups++;
+	if (!modeset && !explicit_fences)
+		record_flip_skew();
+
+	return 0;
+}
+
+static void print_flip_report(void)
+{
+	struct disp_flip *df;
+	double fps;
+	int d;
+
+	if (!flip.groups)
+		return;
+
+	printf("### Page flips: %llu groups\n", (unsigned long long)flip.groups);
+	stats_print_header();
+	stats_print(&flip.submit);
+	if (flip.skew.count)
+		stats_print(&flip.skew);
+	stats_print(&flip.wait);
+
+	for_each_display(d) {
+		df = &flip.disp[d];
+		fps = 0;
+		if (df->interval.count)
+			fps = 1e9 * df->interval.count / df->interval.total_ns;
+
+		printf("### Display [%d] (connector %u): %llu flips, %.2f fps, %llu missed vblanks\n",
+				d, drm.connector_id[d], (unsigned long long)df->flips,
+				fps, (unsigned long long)df->missed);
+		stats_print(&df->interval);
+		if (flip.monotonic)
+			stats_print(&df->latency);
+	}
+	if (!flip.monotonic)
+		printf("\tvblank timestamps are not CLOCK_MONOTONIC, no flip latency\n");
+}
+
+static int parse_stage_list(const char *list, int *stages, int *count)
+{
+	const char *p = list;
+
+	*count = 0;
+	while (*p) {
+		size_t len = strcspn(p, ",");
+		int i;
+
+		for (i = 0; i < STAGE_COUNT; i++) {
+			if (strlen(stage_names[i]) == len &&
+			    !strncmp(p, stage_names[i], len))
+				break;
+		}
+
+		if (i == STAGE_COUNT) {
+			printf("Unknown stage \"%.*s\"\n", (int)len, p);
+			return -1;
+		}
+
+		if (*count == MAX_STAGES) {
+			printf("Too many stages in \"%s\"\n", list);
+			return -1;
+		}
+
+		stages[(*count)++] = i;
+		p += len;
+		if (*p == ',')
+			p++;
+	}
+
+	return 0;
+}
+
+/* returns false if stage cannot run with the current gbm/gl state */
+static bool stage_step_state(int stage, bool *gbm_up, bool *gl_up)
+{
+	switch (stage) {
+	case STAGE_INIT_GBM:
+		if (*gbm_up)
+			return false;
+		*gbm_up = true;
+		return true;
+	case STAGE_INIT_GL:
+		if (!*gbm_up || *gl_up)
+			return false;
+		*gl_up = true;
+		return true;
+	case STAGE_DRAW:
+	case STAGE_SWAP:
+	case STAGE_LOCK:
+	case STAGE_SHARE:
+	case STAGE_FLIP:
+		return *gl_up;
+	case STAGE_EXIT_GL:
+		if (!*gl_up)
+			return false;
+		*gl_up = false;
+		return true;
+	case STAGE_EXIT_GBM:
+		if (!*gbm_up || *gl_up)
+			return false;
+		*gbm_up = false;
+		return true;
+	}
+
+	return false;
+}
+
+static int parse_scenario(const char *arg)
+{
+	const char *spec = arg, *loop;
+	char setup[256];
+	bool gbm_up = false, gl_up = false;
+	int i, pass;
+
+	for (i = 0; i < ARRAY_SIZE(scenario_presets); i++) {
+		if (!strcmp(arg, scenario_presets[i].name)) {
+			spec = scenario_presets[i].stages;
+			break;
+		}
+	}
+
+	scn.name = arg;
+	scn.nsetup = 0;
+
+	loop = strchr(spec, '/');
+	if (loop) {
+		if (loop - spec >= sizeof(setup)) {
+			printf("Scenario setup too long\n");
+			return -1;
+		}
+		memcpy(setup, spec, loop - spec);
+		setup[loop - spec] = '\0';
+		if (parse_stage_list(setup, scn.setup, &scn.nsetup))
+			return -1;
+		loop++;
+	} else {
+		loop = spec;
+	}
+
+	if (parse_stage_list(loop, scn.loop, &scn.nloop))
+		return -1;
+
+	if (!scn.nloop) {
+		printf("Scenario \"%s\" has no loop stages\n", arg);
+		return -1;
+	}
+
+	/*
+	 * Dry-run setup and two loop passes, so that a scenario which would
+	 * only break on its second cycle is rejected before touching the driver.
+	 */
+	for (i = 0; i < scn.nsetup; i++) {
+		if (!stage_step_state(scn.setup[i], &gbm_up, &gl_up)) {
+			printf("Scenario \"%s\": stage %s is not valid here\n",
+					arg, stage_names[scn.setup[i]]);
+			return -1;
+		}
+	}
+
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < scn.nloop; i++) {
+			if (!stage_step_state(scn.loop[i], &gbm_up, &gl_up)) {
+				printf("Scenario \"%s\": stage %s is not valid on cycle %d\n",
+						arg, stage_names[scn.loop[i]], pass + 1);
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static bool scenario_has_stage(int stage)
+{
+	int i;
+
+	for (i = 0; i < scn.nsetup; i++)
+		if (scn.setup[i] == stage)
+			return true;
+	for (i = 0; i < scn.nloop; i++)
+		if (scn.loop[i] == stage)
+			return true;
+	return false;
+}
+
+/* 64 frames told apart in the top bits, which survive 16 bpp buffers */
+static void frame_stamp(uint32_t frame, uint8_t stamp[3])
+{
+	stamp[0] = (frame % 8) * 32 + 16;
+	stamp[1] = (frame / 8 % 8) * 32 + 16;
+	stamp[2] = 0x80;
+}
+
+/* the first pixel of the first and the last row, whichever way up it is */
+static void stamp_frame(int d, uint32_t frame)
+{
+	uint8_t stamp[3];
+
+	frame_stamp(frame, stamp);
+	glEnable(GL_SCISSOR_TEST);
+	glClearColor(stamp[0] / 255.0, stamp[1] / 255.0, stamp[2] / 255.0, 1.0);
+	glScissor(0, 0, 1, 1);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glScissor(0, drm.mode[d]->vdisplay - 1, 1, 1);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glDisable(GL_SCISSOR_TEST);
+}
+
+/* hand the last swapped buffer of every display to the dma-buf consumer */
+static int share_front_buffers(void)
+{
+	struct drm_fb *fb;
+	struct gbm_bo *bo;
+	uint8_t stamp[3];
+	int d, ret = 0;
+
+	frame_stamp(scn.frame - 1, stamp);
+	for_each_display(d) {
+		if (fb_ring) {
+			fb = ring_fb[d];
+			if (!fb) {
+				printf("no ring buffer rendered to share on display %d\n", d);
+				ret = -1;
+				break;
+			}
+		} else {
+			/* not flipped since the last share stage */
+			if (share_fb[d])
+				release_fb(d, share_fb[d]);
+			share_fb[d] = NULL;
+
+			bo = gbm_surface_lock_front_buffer(gbm.surface[d]);
+			if (!bo) {
+				printf("failed to lock front buffer\n");
+				ret = -1;
+				break;
+			}
+			fb = fb_cache_lookup(&fb_cache, bo);
+			if (!fb) {
+				gbm_surface_release_buffer(gbm.surface[d], bo);
+				ret = -1;
+				break;
+			}
+			share_fb[d] = fb;
+		}
+
+		if (dmabuf_consume(&consumer, fb, stamp)) {
+			ret = -1;
+			break;
+		}
+	}
+
+	/* the consumer took over the thread, bind the context back */
+	gl.current = EGL_NO_SURFACE;
+	if (make_current(DISP_ID))
+		ret = -1;
+
+	return ret;
+}
+
+static int run_stage(int stage)
+{
+	EGLSyncKHR sync = EGL_NO_SYNC_KHR;
+	struct gbm_bo *bo;
+	uint64_t start, end;
+	int d, ret = 0;
+
+	start = stats_now_ns();
+
+	switch (stage) {
+	case STAGE_INIT_GBM:
+		ret = init_gbm();
+		if (ret)
+			printf("failed to initialize GBM\n");
+		else
+			scn.gbm_up = true;
+		break;
+	case STAGE_INIT_GL:
+		ret = init_gl();
+		if (ret)
+			printf("failed to initialize EGL\n");
+		else
+			scn.gl_up = true;
+		break;
+	case STAGE_DRAW:
+		/* the same frame on every display */
+		for_each_display(d) {
+			if (make_current(d) || (fb_ring && begin_ring_frame(d))) {
+				ret = -1;
+				break;
+			}
+			if (explicit_fences)
+				fence_gpu_wait();
+			/* one query over the draws of all displays */
+			gpu_timer_begin();
+			glViewport(0, 0, drm.mode[d]->hdisplay, drm.mode[d]->vdisplay);
+			if (damage_tracking)
+				draw_damaged(d, scn.frame);
+			else
+				draw(d, scn.frame);
+			if (dmabuf_sharing)
+				stamp_frame(d, scn.frame);
+			if (overlay.nlayers && d == DISP_ID && compose_layers(d)) {
+				ret = -1;
+				break;
+			}
+		}
+		gpu_timer_end();
+		scn.frame++;
+		break;
+	case STAGE_SWAP:
+		/* the fence covers the frame on all displays, the swaps flush it */
+		if (explicit_fences) {
+			sync = fence_create(EGL_NO_NATIVE_FENCE_FD_ANDROID);
+			if (sync == EGL_NO_SYNC_KHR) {
+				ret = -1;
+				break;
+			}
+		}
+		if (fb_ring) {
+			/* no implicit sync through eglSwapBuffers for the FBO */
+			if (explicit_fences)
+				glFlush();
+			else
+				glFinish();
+		}
+		for_each_display(d) {
+			if (fb_ring)
+				break;
+			if (make_current(d) || swap_buffers(d)) {
+				printf("eglSwapBuffers failed: 0x%x\n", eglGetError());
+				ret = -1;
+				break;
+			}
+		}
+		if (explicit_fences && fence_export(sync))
+			ret = -1;
+		break;
+	case STAGE_LOCK:
+		for_each_display(d) {
+			if (fb_ring) {
+				if (ring_fb[d])
+					fb_cache_release(ring_fb[d]);
+				ring_fb[d] = NULL;
+				continue;
+			}
+			bo = gbm_surface_lock_front_buffer(gbm.surface[d]);
+			if (!bo) {
+				printf("failed to lock front buffer\n");
+				ret = -1;
+				break;
+			}
+			gbm_surface_release_buffer(gbm.surface[d], bo);
+		}
+		break;
+	case STAGE_SHARE:
+		ret = share_front_buffers();
+		break;
+	case STAGE_FLIP:
+		ret = flip_front_buffer();
+		break;
+	case STAGE_EXIT_GL:
+		exit_gl();
+		scn.gl_up = false;
+		break;
+	case STAGE_EXIT_GBM:
+		exit_gbm();
+		scn.gbm_up = false;
+		break;
+	}
+
+	if (!ret) {
+		end = stats_now_ns();
+		stats_add(&scn.stage[stage], end - start);
+		timeline_mark(&timeline, stage_event[stage], start, end);
+	}
+
+	return ret;
+}
+
+static int init_atomic_outputs(void)
+{
+	int d;
+
+	atomic_fini(&atomic);
+	atomic_init(&atomic, drm.fd, &prop_cache);
+	if (!kms_atomic)
+		return 0;
+
+	for_each_display(d) {
+		atomic_idx[d] = atomic_add_output(&atomic, drm.crtc_id[d],
+				drm.connector_id[d], drm.plane_id[d], drm.mode[d]);
+		if (atomic_idx[d] < 0) {
+			printf("failed to initialize atomic KMS for display %d\n", d);
+			return -1;
+		}
+	}
+
+	if (explicit_fences && atomic_enable_fences(&atomic)) {
+		printf("explicit fencing needs IN_FENCE_FD and OUT_FENCE_PTR\n");
+		return -1;
+	}
+
+	if (set_layers()) {
+		printf("failed to set up the layer planes\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void describe_displays(char *buf, int len)
+{
+	int d, n = 0;
+
+	buf[0] = '\0';
+	for_each_display(d)
+		if (n < len)
+			n += snprintf(buf + n, len - n, "%s%u", n ? "," : "",
+					drm.connector_id[d]);
+	if (!n)
+		snprintf(buf, len, "none");
+}
+
+/*
+ * Connectors changed: re-scan them and rebuild the display set.  The
+ * gbm_device, EGL context, program and ring buffers stay.  A display
+ * whose connector, mode size and format survived keeps its gbm/EGL
+ * surfaces and the buffer it shows; the others get new surfaces, CRTCs
+ * left without a display are switched off, and the next flip modesets.
+ */
+static int reconfigure_displays(void)
+{
+	struct {
+		uint32_t connector_id, crtc_id, width, height, format;
+		uint64_t modifier;
+		struct gbm_surface *gbm_surface;
+		EGLSurface egl_surface;
+		struct disp_flip flip;
+		bool reused;
+	} old[MAX_DISPLAYS];
+	char from[64], to[64];
+	uint64_t start = stats_now_ns();
+	struct drm_fb *fb;
+	int d, i, nold = 0;
+
+	/* nothing in flight, only the entries still on screen stay */
+	fence_finish();
+	release_retired(false, 0);
+	describe_displays(from, sizeof(from));
+	for_each_display(d) {
+		old[nold].connector_id = drm.connector_id[d];
+		old[nold].crtc_id = drm.crtc_id[d];
+		old[nold].width = drm.mode[d]->hdisplay;
+		old[nold].height = drm.mode[d]->vdisplay;
+		old[nold].format = drm.format[d];
+		old[nold].modifier = drm.modifier[d];
+		old[nold].gbm_surface = gbm.surface[d];
+		old[nold].egl_surface = gl.surface[d];
+		old[nold].flip = flip.disp[d];
+		nold++;
+	}
+
+	for (d = 0; d < MAX_DISPLAYS; d++) {
+		if (ring_fb[d])
+			fb_cache_release(ring_fb[d]);
+		ring_fb[d] = NULL;
+		if (share_fb[d])
+			release_fb(d, share_fb[d]);
+		share_fb[d] = NULL;
+		gbm.surface[d] = NULL;
+		gl.surface[d] = EGL_NO_SURFACE;
+		memset(&flip.disp[d], 0, sizeof(flip.disp[d]));
+	}
+
+	if (scn.gl_up) {
+		eglMakeCurrent(gl.display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+				gl.surfaceless ? gl.context : EGL_NO_CONTEXT);
+		gl.current = EGL_NO_SURFACE;
+	}
+
+	if (rescan_connectors())
+		return -1;
+
+	/* hand the surviving displays their surfaces back */
+	for_each_display(d) {
+		for (i = 0; i < nold; i++) {
+			if (old[i].connector_id == drm.connector_id[d] &&
+			    old[i].width == drm.mode[d]->hdisplay &&
+			    old[i].height == drm.mode[d]->vdisplay &&
+			    old[i].format == drm.format[d])
+				break;
+		}
+
+		if (i == nold) {
+			stats_init(&flip.disp[d].latency, "flip_latency");
+			stats_init(&flip.disp[d].interval, "vblank");
+			continue;
+		}
+
+		gbm.surface[d] = old[i].gbm_surface;
+		gl.surface[d] = old[i].egl_surface;
+		drm.modifier[d] = old[i].modifier;
+		drm.negotiated[d] = true;
+		flip.disp[d] = old[i].flip;
+		old[i].connector_id = 0;
+	}
+
+	/*
+	 * CRTCs no display drives any more go dark, also those a surviving
+	 * display moved away from, and the buffers they showed are free.
+	 */
+	for (i = 0; i < nold; i++) {
+		old[i].reused = false;
+		for_each_display(d)
+			if (drm.crtc_id[d] == old[i].crtc_id)
+				old[i].reused = true;
+		if (old[i].reused)
+			continue;
+		drmModeSetCrtc(drm.fd, old[i].crtc_id, 0, 0, 0, NULL, 0, NULL);
+		release_retired(false, old[i].crtc_id);
+	}
+
+	/* the rest lost their display */
+	for (i = 0; i < nold; i++) {
+		if (!old[i].connector_id)
+			continue;
+
+		/*
+		 * Another display took the CRTC over and still scans this
+		 * buffer out until its first flip has completed; removing the
+		 * framebuffer before that would switch the CRTC off.
+		 */
+		fb = old[i].flip.fb;
+		if (old[i].reused && fb) {
+			flip.retired[flip.nretired].crtc_id = old[i].crtc_id;
+			flip.retired[flip.nretired].gbm_surface = old[i].gbm_surface;
+			flip.retired[flip.nretired].egl_surface = old[i].egl_surface;
+			flip.retired[flip.nretired].fb = fb;
+			flip.retired[flip.nretired].after = flip.submitted;
+			flip.nretired++;
+			continue;
+		}
+
+		if (fb && !fb->owned)
+			gbm_surface_release_buffer(old[i].gbm_surface, fb->bo);
+		if (fb)
+			fb_cache_release(fb);
+		if (old[i].egl_surface != EGL_NO_SURFACE)
+			eglDestroySurface(gl.display, old[i].egl_surface);
+		if (old[i].gbm_surface)
+			gbm_surface_destroy(old[i].gbm_surface);
+	}
+
+	if (init_atomic_outputs())
+		return -1;
+	if (scn.gbm_up && init_gbm_surfaces())
+		return -1;
+	if (scn.gl_up && init_egl_surface())
+		return -1;
+	flip.crtc_set = false;
+
+	stats_add(&hotplug_reconfig, stats_now_ns() - start);
+	describe_displays(to, sizeof(to));
+	printf("### Hotplug: connectors [%s] -> [%s], reconfigured in %.2f ms\n",
+			from, to, (stats_now_ns() - start) / 1e6);
+
+	return 0;
+}
+
+static void print_scenario_report(uint64_t cycles, uint64_t elapsed_ns)
+{
+	double secs = elapsed_ns / 1e9;
+	int i;
+
+	printf("### Scenario \"%s\": %llu cycles in %.3f s => %.1f cycles/s\n",
+			scn.name, (unsigned long long)cycles, secs,
+			secs > 0 ? cycles / secs : 0.0);
+
+	stats_print_header();
+	for (i = 0; i < STAGE_COUNT; i++)
+		stats_print(&scn.stage[i]);
+	stats_print(&scn.cycle);
+	if (hotplug_reconfig.count)
+		stats_print(&hotplug_reconfig);
+}
+
+/*
+ * Pixels drawn and sent to the display as damage, against redrawing and
+ * sending whole frames; the bandwidth assumes 4 bytes per pixel.
+ */
+static void print_damage_report(uint64_t elapsed_ns)
+{
+	double secs = elapsed_ns / 1e9;
+
+	if (!damage.frames || secs <= 0)
+		return;
+
+	printf("### Damage tracking: %llu frames, %llu full redraws (buffer age: %s, partial update: %s, swap with damage: %s)\n",
+			(unsigned long long)damage.frames,
+			(unsigned long long)damage.full_redraws,
+			damage.buffer_age ? "yes" : "no",
+			damage.set_damage_region ? "yes" : "no",
+			damage.swap_with_damage ? "yes" : "no");
+	printf("\tfill: %.1f%% of the frame pixels, %.1f MB/s instead of %.1f MB/s\n",
+			100.0 * damage.fill_px / damage.frame_px,
+			damage.fill_px * 4 / secs / 1e6,
+			damage.frame_px * 4 / secs / 1e6);
+	if (damage.commits)
+		printf("\tscanout damage: %.1f%% of the plane, %.1f MB/s instead of %.1f MB/s\n",
+				100.0 * damage.clip_px / damage.scanout_px,
+				damage.clip_px * 4 / secs / 1e6,
+				damage.scanout_px * 4 / secs / 1e6);
+	else if (!kms_atomic && scenario_has_stage(STAGE_FLIP))
+		printf("\tscanout damage: needs FB_DAMAGE_CLIPS, i.e. -K atomic\n");
+}
+
+/* the refresh period of the primary display, 0 without one */
+static uint64_t refresh_ns(void)
+{
+	if (headless || !drm.mode[DISP_ID]->vrefresh)
+		return 0;
+	return 1000000000ull / drm.mode[DISP_ID]->vrefresh;
+}
+
+static void print_load_report(uint64_t elapsed_ns)
+{
+	double secs = elapsed_ns / 1e9;
+	uint64_t cubes = load.frames * load.cubes * load.layers;
+
+	if (!load.frames || secs <= 0)
+		return;
+
+	printf("### Cube load: %d cubes x %d layers at %d%% of a cell, %s\n",
+			load.cubes, load.layers, load.size,
+			load.instanced ? "instanced" : "one draw per cube");
+	printf("\t%.0f cubes/s, %.2f Mtriangles/s, %.1f draws/frame\n",
+			cubes / secs, cubes * CUBE_INDICES / 3 / secs / 1e6,
+			(double)load.draws / load.frames);
+	printf("\tfill: about %.1f Mpx/frame of cube faces, %.1f Mpx/s\n",
+			load.cube_px / 1e6 / load.frames, load.cube_px / 1e6 / secs);
+}
+
+static void label_add(char *buf, size_t len, const char *fmt, ...)
+{
+	size_t n = strlen(buf);
+	va_list ap;
+
+	if (n >= len - 1)
+		return;
+	va_start(ap, fmt);
+	vsnprintf(buf + n, len - n, fmt, ap);
+	va_end(ap);
+}
+
+/*
+ * What tells this run from the others: the scenario and the knobs that
+ * change its numbers.  A baseline comparison matches runs by it.
+ */
+static void run_label(char *buf, size_t len, const char *what)
+{
+	const drmModeModeInfo *mode = drm.mode[DISP_ID];
+	uint64_t modifier = drm.modifier[DISP_ID];
+	char fourcc[5];
+
+	snprintf(buf, len, "%s %s", what,
+			headless ? "headless" : kms_atomic ? "atomic" : "legacy");
+	if (mode) {
+		label_add(buf, len, " %ux%u", mode->hdisplay, mode->vdisplay);
+		if (mode->vrefresh)
+			label_add(buf, len, "@%u", mode->vrefresh);
+	}
+	label_add(buf, len, " %s", fourcc_str(drm.format[DISP_ID], fourcc));
+	if (modifier == DRM_FORMAT_MOD_INVALID || modifier == DRM_FORMAT_MOD_LINEAR)
+		label_add(buf, len, ":%s", modifier_class_name(modifier));
+	else
+		label_add(buf, len, ":0x%llx", (unsigned long long)modifier);
+	if (all_display)
+		label_add(buf, len, " %d-displays", drm.ndisp);
+	if (egl_persistent)
+		label_add(buf, len, " persistent");
+	if (explicit_fences)
+		label_add(buf, len, " explicit-fences");
+	if (fb_ring)
+		label_add(buf, len, " ring");
+	if (damage_tracking)
+		label_add(buf, len, " damage");
+	if (overlay_layers)
+		label_add(buf, len, " layers=%d%s", overlay_layers,
+				overlay_gl_only ? "/gl" : "");
+	if (load.cubes)
+		label_add(buf, len, " cubes=%dx%d%s", load.cubes, load.layers,
+				load.instanced ? "" : "/single");
+}
+
+/* the device and driver, once the report is open */
+static void report_drm_env(void)
+{
+	drmVersionPtr version;
+	char buf[64];
+	char *node;
+
+	node = drmGetDeviceNameFromFd2(drm.fd);
+	if (node) {
+		report_env(&report, "drm_device", node);
+		free(node);
+	}
+
+	version = drmGetVersion(drm.fd);
+	if (!version)
+		return;
+	report_env(&report, "drm_driver", version->name);
+	snprintf(buf, sizeof(buf), "%d.%d.%d %s", version->version_major,
+			version->version_minor, version->version_patchlevel,
+			version->date);
+	report_env(&report, "drm_driver_version", buf);
+	drmFreeVersion(version);
+}
+
+/* GL only answers in a current context, the first run that has one tells */
+static void report_gl_env(void)
+{
+	static bool reported;
+	const char *s;
+
+	if (reported || eglGetCurrentContext() == EGL_NO_CONTEXT)
+		return;
+	reported = true;
+
+	if ((s = (const char *)glGetString(GL_VENDOR)))
+		report_env(&report, "gl_vendor", s);
+	if ((s = (const char *)glGetString(GL_RENDERER)))
+		report_env(&report, "gl_renderer", s);
+	if ((s = (const char *)glGetString(GL_VERSION)))
+		report_env(&report, "gl_version", s);
+	if ((s = (const char *)glGetString(GL_EXTENSIONS)))
+		report_env(&report, "gl_extensions", s);
+}
+
+/* the run that just ended into the results file, ret is its status */
+static void report_scenario(int ret)
+{
+	double secs = scn.elapsed_ns / 1e9;
+	char label[256], key[64], fourcc[5];
+	struct disp_flip *df;
+	int i, d;
+
+	if (!report_enabled(&report))
+		return;
+
+	report_gl_env();
+
+	run_label(label, sizeof(label), scn.name);
+	report_run_begin(&report, label);
+	report_config(&report, "scenario", scn.name);
+	report_config(&report, "kms", headless ? "headless" :
+			kms_atomic ? "atomic" : "legacy");
+	snprintf(key, sizeof(key), "%ux%u", drm.mode[DISP_ID]->hdisplay,
+			drm.mode[DISP_ID]->vdisplay);
+	if (drm.mode[DISP_ID]->vrefresh)
+		label_add(key, sizeof(key), "@%u", drm.mode[DISP_ID]->vrefresh);
+	report_config(&report, "mode", key);
+	report_config(&report, "format", fourcc_str(drm.format[DISP_ID], fourcc));
+	snprintf(key, sizeof(key), "0x%016llx",
+			(unsigned long long)drm.modifier[DISP_ID]);
+	report_config(&report, "modifier", key);
+	report_config(&report, "egl", egl_persistent ? "persistent" : "full");
+	report_config(&report, "fences", explicit_fences ? "explicit" : "implicit");
+
+	for (i = 0; i < STAGE_COUNT; i++)
+		report_stage(&report, NULL, &scn.stage[i]);
+	report_stage(&report, NULL, &scn.cycle);
+	report_stage(&report, NULL, &hotplug_reconfig);
+	report_stage(&report, NULL, &flip.submit);
+	report_stage(&report, NULL, &flip.skew);
+	report_stage(&report, NULL, &flip.wait);
+	report_stage(&report, NULL, &timeline.gpu);
+	for_each_display(d) {
+		snprintf(key, sizeof(key), "display%d.", d);
+		report_stage(&report, key, &flip.disp[d].interval);
+		if (flip.monotonic)
+			report_stage(&report, key, &flip.disp[d].latency);
+	}
+
+	report_counter(&report, "status", ret);
+	report_counter(&report, "cycles", scn.cycles);
+	report_counter(&report, "elapsed_s", secs);
+	report_counter(&report, "cycles_per_s", secs > 0 ? scn.cycles / secs : 0);
+	for_each_display(d) {
+		df = &flip.disp[d];
+		if (!df->flips)
+			continue;
+		snprintf(key, sizeof(key), "display%d.flips", d);
+		report_counter(&report, key, df->flips);
+		snprintf(key, sizeof(key), "display%d.missed_vblanks", d);
+		report_counter(&report, key, df->missed);
+		snprintf(key, sizeof(key), "display%d.fps", d);
+		report_counter(&report, key, df->interval.count ?
+				1e9 * df->interval.count / df->interval.total_ns : 0);
+	}
+	if (scn.mem_bytes >= 0) {
+		report_counter(&report, "mem_bytes", scn.mem_bytes);
+		report_counter(&report, "mem_mb_per_s",
+				secs > 0 ? scn.mem_bytes / secs / 1e6 : 0);
+	}
+	report_counter(&report, "fb_cache.hits", fb_cache.hits);
+	report_counter(&report, "fb_cache.misses", fb_cache.misses);
+	report_counter(&report, "fb_cache.addfb", fb_cache.addfb);
+	report_counter(&report, "fb_cache.rmfb", fb_cache.rmfb);
+	report_counter(&report, "fb_cache.evictions", fb_cache.evictions);
+	report_counter(&report, "fb_cache.allocs", fb_cache.allocs);
+	if (dmabuf_sharing) {
+		report_counter(&report, "dmabuf.frames", consumer.frames);
+		report_counter(&report, "dmabuf.hits", consumer.hits);
+		report_counter(&report, "dmabuf.misses", consumer.misses);
+		report_counter(&report, "dmabuf.evictions", consumer.evictions);
+		report_counter(&report, "dmabuf.stale", consumer.stale);
+	}
+	if (kms_atomic) {
+		report_counter(&report, "atomic.commits", atomic.commits);
+		report_counter(&report, "atomic.tests", atomic.tests);
+		report_counter(&report, "atomic.test_failures", atomic.test_failures);
+	}
+	if (program_cache.supported > 0) {
+		report_counter(&report, "program_cache.hits", program_cache.hits);
+		report_counter(&report, "program_cache.misses", program_cache.misses);
+	}
+	if (timeline.gpu_results || timeline.gpu_skipped) {
+		report_counter(&report, "gpu.results", timeline.gpu_results);
+		report_counter(&report, "gpu.skipped", timeline.gpu_skipped);
+	}
+	if (load.frames) {
+		report_counter(&report, "load.draws_per_frame",
+				(double)load.draws / load.frames);
+		report_counter(&report, "load.cubes_per_s", secs > 0 ?
+				load.frames * load.cubes * load.layers / secs : 0);
+	}
+	if (damage.frames && damage.frame_px) {
+		report_counter(&report, "damage.full_redraws", damage.full_redraws);
+		report_counter(&report, "damage.fill_pct",
+				100.0 * damage.fill_px / damage.frame_px);
+	}
+	if (scn.leak.nsamples) {
+		for (i = 0; i < LEAK_NMETRICS; i++) {
+			if (scn.leak.last.v[i] < 0)
+				continue;
+			snprintf(key, sizeof(key), "leak.%s", leak_metric_name(i));
+			report_counter(&report, key, scn.leak.last.v[i]);
+			snprintf(key, sizeof(key), "leak.%s_per_cycle",
+					leak_metric_name(i));
+			report_counter(&report, key, leak_slope(&scn.leak, i));
+		}
+	}
+	report_run_end(&report);
+}
+
+/* what the loop measures, setup stages keep their samples */
+static void reset_loop_stats(void)
+{
+	int i;
+
+	for (i = 0; i < scn.nloop; i++)
+		stats_init(&scn.stage[scn.loop[i]], stage_names[scn.loop[i]]);
+	stats_init(&scn.cycle, "cycle");
+	stats_init(&hotplug_reconfig, "reconfig");
+	stats_init(&flip.submit, "flip_submit");
+	stats_init(&flip.skew, "flip_skew");
+	stats_init(&flip.wait, "flip_wait");
+	flip.groups = 0;
+	damage.frames = damage.full_redraws = damage.commits = 0;
+	damage.fill_px = damage.frame_px = 0;
+	damage.clip_px = damage.scanout_px = 0;
+	comp.frames = comp.px = 0;
+	load.frames = load.draws = load.cube_px = 0;
+	for (i = 0; i < MAX_DISPLAYS; i++) {
+		stats_init(&flip.disp[i].latency, "flip_latency");
+		stats_init(&flip.disp[i].interval, "vblank");
+		flip.disp[i].flips = flip.disp[i].missed = 0;
+	}
+}
+
+/*
+ * Run the scenario for max_cycles cycles (-1: unbounded) or until
+ * duration_s seconds have elapsed (0: unbounded), whichever comes first,
+ * after scn.warmup cycles whose samples are dropped.
+ * With leak_interval > 0 resources are sampled every leak_interval cycles
+ * and the run stops with 2 once one grows faster than leak_threshold.
+ */
+static int run_scenario(int max_cycles, double duration_s,
+		int leak_interval, double leak_threshold)
+{
+	struct leak_sample before, after;
+	uint64_t start, deadline = 0, cycles = 0, first = 0, cycle_start;
+	int i, ret = 0, leaking = -1;
+	bool warming = scn.warmup > 0, sampled;
+
+	for (i = 0; i < STAGE_COUNT; i++)
+		stats_init(&scn.stage[i], stage_names[i]);
+	reset_loop_stats();
+	flip.skew_due = false;
+	timeline_reset(&timeline);
+	leak_monitor_init(&scn.leak, drm.fd, leak_interval, leak_threshold,
+			stage_names, stage_owner, STAGE_COUNT);
+
+	for (i = 0; i < scn.nsetup && !ret; i++)
+		ret = run_stage(scn.setup[i]);
+
+	perf_mem_start(&perf_mem);
+	start = stats_now_ns();
+	if (duration_s > 0)
+		deadline = start + (uint64_t)(duration_s * 1e9);
+
+	while (!ret && !quit_requested) {
+		if (max_cycles >= 0 && !warming && cycles - first >= max_cycles)
+			break;
+
+		if (hotplug_enabled && hotplug_poll(&hotplug, 0) &&
+		    reconfigure_displays()) {
+			ret = -1;
+			break;
+		}
+
+		sampled = leak_sample_due(&scn.leak, cycles);
+		if (sampled)
+			leak_sample_read(&scn.leak, &before);
+
+		cycle_start = stats_now_ns();
+		timeline_begin(&timeline, cycle_start);
+		for (i = 0; i < scn.nloop && !ret; i++) {
+			ret = run_stage(scn.loop[i]);
+			if (sampled && !ret) {
+				leak_sample_read(&scn.leak, &after);
+				leak_stage_account(&scn.leak, scn.loop[i], &before, &after);
+				before = after;
+			}
+		}
+		if (ret)
+			break;
+
+		/* sampled cycles include the telemetry reads, keep them out */
+		if (!sampled)
+			stats_add(&scn.cycle, stats_now_ns() - cycle_start);
+		cycles++;
+
+		if (sampled) {
+			leaking = leak_monitor_add(&scn.leak, cycles, &before);
+			if (leaking >= 0) {
+				ret = 2;
+				break;
+			}
+		}
+
+		/* e.g. the modeset of the first flip: measure from here on */
+		if (warming && cycles == scn.warmup) {
+			warming = false;
+			first = cycles;
+			reset_loop_stats();
+			perf_mem_stop(&perf_mem);
+			perf_mem_start(&perf_mem);
+			start = stats_now_ns();
+			if (duration_s > 0)
+				deadline = start + (uint64_t)(duration_s * 1e9);
+			continue;
+		}
+
+		if (deadline && stats_now_ns() >= deadline)
+			break;
+	}
+
+	scn.mem_bytes = perf_mem_stop(&perf_mem);
+	scn.cycles = cycles - first;
+	scn.elapsed_ns = stats_now_ns() - start;
+
+	if (gpu_timer.id[0])
+		gpu_timer_collect(true);
+	report_scenario(ret);
+	if (!scn.quiet) {
+		print_scenario_report(scn.cycles, scn.elapsed_ns);
+		print_flip_report();
+		print_damage_report(scn.elapsed_ns);
+		print_load_report(scn.elapsed_ns);
+		timeline_report(&timeline, refresh_ns());
+		if (timeline_file)
+			timeline_write(&timeline, timeline_file, refresh_ns());
+		print_overlay_report();
+		fb_cache_report(&fb_cache);
+		dmabuf_report(&consumer);
+		atomic_report(&atomic);
+		leak_monitor_report(&scn.leak, leaking);
+		progcache_report(&program_cache);
+	}
+
+	if (scn.gl_up)
+		run_stage(STAGE_EXIT_GL);
+	if (scn.gbm_up)
+		run_stage(STAGE_EXIT_GBM);
+	exit_persistent();
+
+	return ret;
+}
+
+/* what a comparison keeps of the first of its two scenario runs */
+struct run_stats {
+	struct stage_stats stage[STAGE_COUNT];
+	struct stage_stats cycle;
+	struct stage_stats flip_wait;
+};
+
+static void save_run_stats(struct run_stats *r)
+{
+	memcpy(r->stage, scn.stage, sizeof(r->stage));
+	r->cycle = scn.cycle;
+	r->flip_wait = flip.wait;
+}
+
+/* the p50/p99 of every stage of run a next to those of the last run */
+static void print_run_comparison(const struct run_stats *a,
+		const char *a_label, const char *b_label)
+{
+	const struct stage_stats *sa, *sb;
+	char a50[16], b50[16], a99[16], b99[16];
+	int i;
+
+	snprintf(a50, sizeof(a50), "%s p50", a_label);
+	snprintf(b50, sizeof(b50), "%s p50", b_label);
+	snprintf(a99, sizeof(a99), "%s p99", a_label);
+	snprintf(b99, sizeof(b99), "%s p99", b_label);
+
+	printf("\t%-12s %12s %12s %12s %12s %12s\n", "stage",
+			a50, b50, "saved(us)", a99, b99);
+	for (i = 0; i <= STAGE_COUNT + 1; i++) {
+		if (i < STAGE_COUNT) {
+			sa = &a->stage[i];
+			sb = &scn.stage[i];
+		} else if (i == STAGE_COUNT) {
+			sa = &a->cycle;
+			sb = &scn.cycle;
+		} else {
+			sa = &a->flip_wait;
+			sb = &flip.wait;
+		}
+		if (!sa->count || !sb->count)
+			continue;
+
+		printf("\t%-12s %12.1f %12.1f %12.1f %12.1f %12.1f\n", sa->name,
+				stats_percentile(sa, 50.0) / 1000.0,
+				stats_percentile(sb, 50.0) / 1000.0,
+				((double)stats_percentile(sa, 50.0) -
+				 (double)stats_percentile(sb, 50.0)) / 1000.0,
+				stats_percentile(sa, 99.0) / 1000.0,
+				stats_percentile(sb, 99.0) / 1000.0);
+	}
+}
+
+/*
+ * Run the scenario with full EGL teardown and then with persistent EGL,
+ * and print what keeping the display/context alive saves per stage.
+ */
+static int run_egl_comparison(int max_cycles, double duration_s,
+		int leak_interval, double leak_threshold)
+{
+	static struct run_stats full;
+	int ret;
+
+	printf("### EGL mode: full teardown\n");
+	egl_persistent = false;
+	ret = run_scenario(max_cycles, duration_s, leak_interval, leak_threshold);
+	if (ret)
+		return ret;
+
+	save_run_stats(&full);
+
+	printf("### EGL mode: persistent\n");
+	egl_persistent = true;
+	ret = run_scenario(max_cycles, duration_s, leak_interval, leak_threshold);
+	if (ret)
+		return ret;
+
+	printf("### Persistent EGL vs full teardown:\n");
+	print_run_comparison(&full, "full", "pers");
+
+	return 0;
+}
+
+/*
+ * Layers on planes against GL composition of all of them: the difference
+ * is what the planes save the GPU.  The planes the first run used are
+ * switched off by the first commit of the second.
+ */
+static int run_overlay_comparison(int max_cycles, double duration_s,
+		int leak_interval, double leak_threshold)
+{
+	static struct run_stats planes;
+	double planes_px;
+	int i, ret;
+
+	printf("### Layers: overlay planes\n");
+	ret = run_scenario(max_cycles, duration_s, leak_interval, leak_threshold);
+	if (ret)
+		return ret;
+
+	save_run_stats(&planes);
+	planes_px = comp.frames ? comp.px / 1e6 / comp.frames : 0;
+
+	printf("### Layers: GL composition\n");
+	overlay_gl_only = true;
+	for (i = 0; i < overlay.nlayers; i++)
+		if (overlay.layer[i].plane_id)
+			compose_layer(i);
+	ret = run_scenario(max_cycles, duration_s, leak_interval, leak_threshold);
+	if (ret)
+		return ret;
+
+	printf("### Overlay planes vs GL composition:\n");
+	print_run_comparison(&planes, "plns", "gl");
+	if (comp.frames)
+		printf("\tGL composition: %.2f Mpx/frame with planes, %.2f Mpx/frame without\n",
+				planes_px, comp.px / 1e6 / comp.frames);
 
+	return 0;
+}
 
-	gl.vertex_shader = glCreateShader(GL_VERTEX_SHADER);
+/*
+ * Implicit against explicit fencing.  flip_wait is the CPU time the flip
+ * stage blocks on the display, the other stages show where any of it
+ * moved to.
+ */
+static int run_fence_comparison(int max_cycles, double duration_s,
+		int leak_interval, double leak_threshold)
+{
+	static struct run_stats impl;
+	double impl_ms, expl_ms;
+	int ret;
 
-	glShaderSource(gl.vertex_shader, 1, &vertex_shader_source, NULL);
-	glCompileShader(gl.vertex_shader);
+	printf("### Fencing: implicit\n");
+	explicit_fences = false;
+	ret = init_atomic_outputs();
+	if (!ret)
+		ret = run_scenario(max_cycles, duration_s, leak_interval, leak_threshold);
+	if (ret)
+		return ret;
 
-	glGetShaderiv(gl.vertex_shader, GL_COMPILE_STATUS, &ret);
-	if (!ret) {
-		char *log;
+	save_run_stats(&impl);
 
-		printf("vertex shader compilation failed!:\n");
-		glGetShaderiv(gl.vertex_shader, GL_INFO_LOG_LENGTH, &ret);
-		if (ret > 1) {
-			log = malloc(ret);
-			glGetShaderInfoLog(gl.vertex_shader, ret, NULL, log);
-			printf("%s", log);
-		}
+	printf("### Fencing: explicit\n");
+	explicit_fences = true;
+	ret = init_atomic_outputs();
+	if (!ret)
+		ret = run_scenario(max_cycles, duration_s, leak_interval, leak_threshold);
+	if (ret)
+		return ret;
 
-		return -1;
+	printf("### Explicit vs implicit fencing:\n");
+	print_run_comparison(&impl, "impl", "expl");
+
+	if (impl.flip_wait.count && flip.wait.count) {
+		impl_ms = impl.flip_wait.total_ns / 1e6 / impl.flip_wait.count;
+		expl_ms = flip.wait.total_ns / 1e6 / flip.wait.count;
+		printf("\tCPU blocked in flip: %.3f ms/frame implicit, %.3f ms/frame explicit, %.3f ms/frame saved\n",
+				impl_ms, expl_ms, impl_ms - expl_ms);
 	}
 
-	gl.fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
+	return 0;
+}
 
-	glShaderSource(gl.fragment_shader, 1, &fragment_shader_source, NULL);
-	glCompileShader(gl.fragment_shader);
+#define SWEEP_DEFAULT_CYCLES	(300)
+#define SWEEP_MAX_RESULTS	(256)
+/* the modeset and the first flips of a new mode, format or modifier */
+#define SWEEP_WARMUP_CYCLES	(5)
+
+struct sweep_result {
+	const drmModeModeInfo *mode;
+	struct format_mod pair;
+	bool ok;
+	double refresh;
+	double fps;
+	double mean_ms, stddev_ms, p99_ms;
+	uint64_t missed;
+	double mb_s;			/* <0: not counted */
+};
 
-	glGetShaderiv(gl.fragment_shader, GL_COMPILE_STATUS, &ret);
-	if (!ret) {
-		char *log;
+/* the exact refresh rate, vrefresh is rounded */
+static double mode_refresh(const drmModeModeInfo *mode)
+{
+	if (!mode->htotal || !mode->vtotal)
+		return mode->vrefresh;
+	return mode->clock * 1000.0 / mode->htotal / mode->vtotal;
+}
 
-		printf("fragment shader compilation failed!:\n");
-		glGetShaderiv(gl.fragment_shader, GL_INFO_LOG_LENGTH, &ret);
+static bool sweep_sustained(const struct sweep_result *r)
+{
+	return r->ok && r->fps >= r->refresh * 0.98;
+}
 
-		if (ret > 1) {
-			log = malloc(ret);
-			glGetShaderInfoLog(gl.fragment_shader, ret, NULL, log);
-			printf("%s", log);
+/*
+ * Working combinations first.  Of those that keep up with the refresh
+ * rate the one moving the fewest bytes wins, or without counters the
+ * steadiest one; the others rank by frame rate.
+ */
+static int sweep_compare(const void *pa, const void *pb)
+{
+	const struct sweep_result *a = pa, *b = pb;
+	bool sa = sweep_sustained(a), sb = sweep_sustained(b);
+
+	if (a->ok != b->ok)
+		return a->ok ? -1 : 1;
+	if (sa != sb)
+		return sa ? -1 : 1;
+	if (sa && a->mb_s >= 0 && b->mb_s >= 0 && a->mb_s != b->mb_s)
+		return a->mb_s < b->mb_s ? -1 : 1;
+	if (!sa && a->fps != b->fps)
+		return a->fps > b->fps ? -1 : 1;
+	if (a->stddev_ms != b->stddev_ms)
+		return a->stddev_ms < b->stddev_ms ? -1 : 1;
+	if (a->p99_ms != b->p99_ms)
+		return a->p99_ms < b->p99_ms ? -1 : 1;
+	return 0;
+}
+
+static void print_sweep_report(struct sweep_result *res, int n)
+{
+	char fourcc[5], mode[32], mb[16];
+	int i;
+
+	qsort(res, n, sizeof(*res), sweep_compare);
+
+	printf("### Sweep: %d combinations, memory traffic %s%s\n", n,
+			perf_mem.pmu[0] ? "from " : "not counted",
+			perf_mem.pmu);
+	printf("\t%-4s %-16s %-6s %-18s %-9s %7s %9s %9s %9s %7s %9s\n",
+			"rank", "mode", "format", "modifier", "layout", "fps",
+			"mean(ms)", "sdev(ms)", "p99(ms)", "missed", "MB/s");
+	for (i = 0; i < n; i++) {
+		const struct sweep_result *r = &res[i];
+
+		snprintf(mode, sizeof(mode), "%ux%u@%.2f", r->mode->hdisplay,
+				r->mode->vdisplay, r->refresh);
+		printf("\t%-4d %-16s %-6s 0x%016llx %-9s ", i + 1, mode,
+				fourcc_str(r->pair.format, fourcc),
+				(unsigned long long)r->pair.modifier,
+				modifier_class_name(r->pair.modifier));
+		if (!r->ok) {
+			printf("%7s\n", "failed");
+			continue;
 		}
+		if (r->mb_s >= 0)
+			snprintf(mb, sizeof(mb), "%.1f", r->mb_s);
+		else
+			snprintf(mb, sizeof(mb), "-");
+		printf("%7.2f %9.3f %9.3f %9.3f %7llu %9s%s\n", r->fps,
+				r->mean_ms, r->stddev_ms, r->p99_ms,
+				(unsigned long long)r->missed, mb,
+				sweep_sustained(r) ? "" : " (below refresh)");
+	}
+}
 
-		return -1;
+/*
+ * Bandwidth sweep (-B): every distinct mode of the primary connector
+ * against every scanout pair of its plane, each running the same draw
+ * and flip scenario, ranked at the end.  A combination the driver or
+ * EGL turns down is listed as failed and the sweep moves on.
+ */
+static int run_sweep(int max_cycles, double duration_s)
+{
+	static struct sweep_result res[SWEEP_MAX_RESULTS];
+	drmModeConnector *conn = drm.connectors[DISP_ID];
+	drmModeModeInfo *mode, *orig_mode = drm.mode[DISP_ID];
+	uint32_t orig_format = drm.format[DISP_ID];
+	uint64_t orig_modifier = drm.modifier[DISP_ID];
+	bool orig_negotiated = drm.negotiated[DISP_ID];
+	struct format_mod pairs[FORMATS_MAX_PAIRS];
+	struct sweep_result *r;
+	struct stage_stats *vblank;
+	int i, j, m, n = 0, npairs = drm.nscanout[DISP_ID];
+	char fourcc[5];
+	double secs;
+
+	if (max_cycles < 0 && duration_s <= 0)
+		max_cycles = SWEEP_DEFAULT_CYCLES;
+
+	memcpy(pairs, drm.scanout[DISP_ID], npairs * sizeof(pairs[0]));
+	/* a plane without IN_FORMATS or candidates: what GBM picks */
+	if (!npairs) {
+		pairs[0].format = drm.format[DISP_ID];
+		pairs[0].modifier = DRM_FORMAT_MOD_INVALID;
+		npairs = 1;
 	}
 
-	gl.program = glCreateProgram();
+	if (perf_mem_open(&perf_mem))
+		printf("### Sweep: no memory controller counters (uncore data_read/data_write)\n");
+
+	scn.quiet = !verbose;
+	scn.warmup = SWEEP_WARMUP_CYCLES;
+	for (m = 0; m < conn->count_modes && !quit_requested; m++) {
+		mode = &conn->modes[m];
+
+		/* one run per size and refresh rate */
+		for (i = 0; i < m; i++)
+			if (conn->modes[i].hdisplay == mode->hdisplay &&
+			    conn->modes[i].vdisplay == mode->vdisplay &&
+			    conn->modes[i].vrefresh == mode->vrefresh)
+				break;
+		if (i < m)
+			continue;
+
+		for (j = 0; j < npairs && n < SWEEP_MAX_RESULTS && !quit_requested; j++) {
+			r = &res[n++];
+			memset(r, 0, sizeof(*r));
+			r->mode = mode;
+			r->pair = pairs[j];
+			r->refresh = mode_refresh(mode);
+
+			printf("### Sweep %d: %ux%u@%.2f %s 0x%016llx (%s)\n", n,
+					mode->hdisplay, mode->vdisplay, r->refresh,
+					fourcc_str(pairs[j].format, fourcc),
+					(unsigned long long)pairs[j].modifier,
+					modifier_class_name(pairs[j].modifier));
+
+			drm.mode[DISP_ID] = mode;
+			drm.format[DISP_ID] = pairs[j].format;
+			drm.modifier[DISP_ID] = pairs[j].modifier;
+			drm.negotiated[DISP_ID] = true;
+			flip.crtc_set = false;
+
+			if (init_atomic_outputs() ||
+			    run_scenario(max_cycles, duration_s, 0, 0) ||
+			    !scn.cycle.count)
+				continue;
 
-	glAttachShader(gl.program, gl.vertex_shader);
-	glAttachShader(gl.program, gl.fragment_shader);
+			/* what reached the screen, cycles can outrun a stalled flip */
+			secs = scn.elapsed_ns / 1e9;
+			vblank = &flip.disp[DISP_ID].interval;
+			r->ok = true;
+			r->fps = vblank->count ?
+					1e9 * vblank->count / vblank->total_ns : 0;
+			r->mean_ms = scn.cycle.total_ns / 1e6 / scn.cycle.count;
+			r->stddev_ms = stats_stddev(&scn.cycle) / 1e6;
+			r->p99_ms = stats_percentile(&scn.cycle, 99.0) / 1e6;
+			r->missed = flip.disp[DISP_ID].missed;
+			r->mb_s = scn.mem_bytes >= 0 && secs > 0 ?
+					scn.mem_bytes / secs / 1e6 : -1;
+		}
+	}
+	scn.quiet = false;
+	scn.warmup = 0;
+	perf_mem_close(&perf_mem);
 
-	glBindAttribLocation(gl.program, 0, "in_position");
-	glBindAttribLocation(gl.program, 1, "in_normal");
-	glBindAttribLocation(gl.program, 2, "in_color");
+	drm.mode[DISP_ID] = orig_mode;
+	drm.format[DISP_ID] = orig_format;
+	drm.modifier[DISP_ID] = orig_modifier;
+	drm.negotiated[DISP_ID] = orig_negotiated;
 
-	glLinkProgram(gl.program);
+	print_sweep_report(res, n);
 
-	glGetProgramiv(gl.program, GL_LINK_STATUS, &ret);
-	if (!ret) {
-		char *log;
+	return init_atomic_outputs();
+}
 
-		printf("program linking failed!:\n");
-		glGetProgramiv(gl.program, GL_INFO_LOG_LENGTH, &ret);
+/*
+ * Concurrent lifecycle stress (-T <threads>): worker threads run their own
+ * gbm_surface, EGL surface, context and program through init, draw and
+ * teardown cycles against the shared gbm_device and EGLDisplay.  The run
+ * is repeated with 1, 2, 4 ... threads up to the requested count to show
+ * where the stack stops scaling.  Each worker clears to its own color and
+ * reads a pixel back, so state leaking between threads shows up as
+ * corrupt frames; a worker that makes no progress is reported as stalled.
+ */
+#define MAX_WORKERS		(64)
+#define WORKER_DEFAULT_CYCLES	(100)
+#define WORKER_STALL_S		(10)
+
+struct worker {
+	pthread_t thread;
+	int id;
+	int max_cycles;
+	struct gbm_state gbm;
+	struct gl_state gl;
+	const char * volatile step;	/* what the worker is doing right now */
+	volatile uint64_t cycles;
+	volatile bool done;
+	unsigned int corrupt;
+	int ret;
+	char name[16];
+	struct stage_stats init, frame, exit, cycle;
+};
 
-		if (ret > 1) {
-			log = malloc(ret);
-			glGetProgramInfoLog(gl.program, ret, NULL, log);
-			printf("%s", log);
-		}
+static volatile bool workers_stop;
 
+static int worker_init(struct worker *w)
+{
+	const drmModeModeInfo *mode = drm.mode[DISP_ID];
+
+	w->step = "gbm_surface_create";
+	w->gbm.surface[0] = gbm_surface_create(gbm.dev, mode->hdisplay,
+			mode->vdisplay, drm_fmt_to_gbm_fmt(drm.format[DISP_ID]),
+			gbm_usage());
+	if (!w->gbm.surface[0]) {
+		printf("worker %d: failed to create gbm surface\n", w->id);
 		return -1;
 	}
 
-	glUseProgram(gl.program);
+	w->step = "eglCreateWindowSurface";
+	w->gl.surface[0] = eglCreateWindowSurface(gl.display, gl.config,
+			w->gbm.surface[0], NULL);
+	if (w->gl.surface[0] == EGL_NO_SURFACE) {
+		printf("worker %d: failed to create egl surface: 0x%x\n",
+				w->id, eglGetError());
+		return -1;
+	}
 
-	gl.modelviewmatrix = glGetUniformLocation(gl.program, "modelviewMatrix");
-	gl.modelviewprojectionmatrix = glGetUniformLocation(gl.program, "modelviewprojectionMatrix");
-	gl.normalmatrix = glGetUniformLocation(gl.program, "normalMatrix");
+	w->step = "eglCreateContext";
+	w->gl.context = eglCreateContext(gl.display, gl.config,
+			EGL_NO_CONTEXT, context_attribs);
+	if (w->gl.context == EGL_NO_CONTEXT) {
+		printf("worker %d: failed to create context: 0x%x\n",
+				w->id, eglGetError());
+		return -1;
+	}
 
-	glViewport(0, 0, drm.mode[DISP_ID]->hdisplay, drm.mode[DISP_ID]->vdisplay);
-	glEnable(GL_CULL_FACE);
+	w->step = "eglMakeCurrent";
+	if (!eglMakeCurrent(gl.display, w->gl.surface[0], w->gl.surface[0],
+			w->gl.context)) {
+		printf("worker %d: eglMakeCurrent failed: 0x%x\n",
+				w->id, eglGetError());
+		return -1;
+	}
 
-	gl.positionsoffset = 0;
-	gl.colorsoffset = sizeof(vVertices);
-	gl.normalsoffset = sizeof(vVertices) + sizeof(vColors);
-	glGenBuffers(1, &gl.vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, gl.vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vVertices) + sizeof(vColors) + sizeof(vNormals), 0, GL_STATIC_DRAW);
-	glBufferSubData(GL_ARRAY_BUFFER, gl.positionsoffset, sizeof(vVertices), &vVertices[0]);
-	glBufferSubData(GL_ARRAY_BUFFER, gl.colorsoffset, sizeof(vColors), &vColors[0]);
-	glBufferSubData(GL_ARRAY_BUFFER, gl.normalsoffset, sizeof(vNormals), &vNormals[0]);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (const GLvoid*)gl.positionsoffset);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (const GLvoid*)gl.normalsoffset);
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (const GLvoid*)gl.colorsoffset);
-	glEnableVertexAttribArray(2);
+	w->step = "init_gl_program";
+	if (init_gl_program(&w->gl))
+		return -1;
+	glViewport(0, 0, mode->hdisplay, mode->vdisplay);
 
 	return 0;
 }
 
-static void exit_gbm(void)
+static int worker_frame(struct worker *w)
 {
-	printf("enter exit_gbm\n");
-        gbm_surface_destroy(gbm.surface);
-        gbm_device_destroy(gbm.dev);
-        return;
-}
+	/* 8 bits of the worker id in each channel */
+	GLubyte want[3] = { (w->id * 97) & 0xff, (w->id * 61 + 128) & 0xff,
+			(w->id * 23 + 64) & 0xff };
+	GLubyte px[4];
+	struct gbm_bo *bo;
+	int i;
 
-static void exit_gl(void)
-{
-	printf("enter exit_gl\n");
-        glDeleteProgram(gl.program);
-        glDeleteBuffers(1, &gl.vbo);
-        glDeleteShader(gl.fragment_shader);
-        glDeleteShader(gl.vertex_shader);
-        eglDestroySurface(gl.display, gl.surface);
-        eglDestroyContext(gl.display, gl.context);
-        eglTerminate(gl.display);
-        return;
-}
+	w->step = "draw";
+	glClearColor(want[0] / 255.0, want[1] / 255.0, want[2] / 255.0, 1.0);
+	glClear(GL_COLOR_BUFFER_BIT);
 
-static void exit_drm(void)
-{
+	w->step = "glReadPixels";
+	glReadPixels(0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, px);
+	/* loose enough for 16 bpp surfaces */
+	for (i = 0; i < 3; i++) {
+		if (abs(px[i] - want[i]) > 8) {
+			w->corrupt++;
+			break;
+		}
+	}
 
-        drmModeRes *resources;
-        int i;
+	w->step = "eglSwapBuffers";
+	if (!eglSwapBuffers(gl.display, w->gl.surface[0])) {
+		printf("worker %d: eglSwapBuffers failed: 0x%x\n",
+				w->id, eglGetError());
+		return -1;
+	}
 
-        resources = (drmModeRes *)drm.resource_id;
-        for (i = 0; i < resources->count_connectors; i++) {
-                drmModeFreeEncoder((struct _drmModeEncoder *)drm.encoder[i]);
-                drmModeFreeConnector(drm.connectors[i]);
-        }
-        drmModeFreeResources((struct _drmModeRes *)drm.resource_id);
-        drmClose(drm.fd);
-        return;
+	w->step = "gbm_surface_lock_front_buffer";
+	bo = gbm_surface_lock_front_buffer(w->gbm.surface[0]);
+	if (!bo) {
+		printf("worker %d: failed to lock front buffer\n", w->id);
+		return -1;
+	}
+	gbm_surface_release_buffer(w->gbm.surface[0], bo);
+
+	return 0;
 }
 
-void cleanup_kmscube(void)
+/* tear down whatever worker_init() got to */
+static void worker_exit(struct worker *w)
 {
-	exit_gl();
-	exit_gbm();
-	exit_drm();
-	printf("Cleanup of GL, GBM and DRM completed\n");
-	return;
+	w->step = "exit_gl_program";
+	if (w->gl.program)
+		exit_gl_program(&w->gl);
+
+	w->step = "eglMakeCurrent";
+	eglMakeCurrent(gl.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+
+	w->step = "eglDestroyContext";
+	if (w->gl.context != EGL_NO_CONTEXT)
+		eglDestroyContext(gl.display, w->gl.context);
+	w->gl.context = EGL_NO_CONTEXT;
+
+	w->step = "eglDestroySurface";
+	if (w->gl.surface[0] != EGL_NO_SURFACE)
+		eglDestroySurface(gl.display, w->gl.surface[0]);
+	w->gl.surface[0] = EGL_NO_SURFACE;
+
+	w->step = "gbm_surface_destroy";
+	if (w->gbm.surface[0])
+		gbm_surface_destroy(w->gbm.surface[0]);
+	w->gbm.surface[0] = NULL;
 }
 
-static void draw(uint32_t i)
+static void *worker_main(void *arg)
 {
-	/* clear the color buffer */
-	glClearColor(0.5, 0.5, 0.5, 1.0);
-	glClear(GL_COLOR_BUFFER_BIT);
+	struct worker *w = arg;
+	uint64_t t0, t1, t2, t3;
+
+	while (!workers_stop && !quit_requested &&
+	       (w->max_cycles < 0 || w->cycles < w->max_cycles)) {
+		t0 = stats_now_ns();
+		w->ret = worker_init(w);
+		t1 = stats_now_ns();
+		if (!w->ret)
+			w->ret = worker_frame(w);
+		t2 = stats_now_ns();
+		worker_exit(w);
+		t3 = stats_now_ns();
+		if (w->ret)
+			break;
+
+		stats_add(&w->init, t1 - t0);
+		stats_add(&w->frame, t2 - t1);
+		stats_add(&w->exit, t3 - t2);
+		stats_add(&w->cycle, t3 - t0);
+		w->cycles++;
+	}
 
+	w->step = "done";
+	eglReleaseThread();
+	w->done = true;
+
+	return NULL;
 }
 
-static void
-drm_fb_destroy_callback(struct gbm_bo *bo, void *data)
+struct stress_result {
+	int threads;
+	double rate;
+	uint64_t p50_ns, p99_ns;
+	unsigned int corrupt;
+};
+
+/*
+ * Run nthreads workers for max_cycles cycles each (-1: unbounded) or
+ * duration_s seconds (0: unbounded).  A worker stuck for WORKER_STALL_S
+ * seconds is reported and the process exits, it can't be joined.
+ */
+static int run_workers(struct worker *workers, int nthreads, int max_cycles,
+		double duration_s, struct stress_result *res)
 {
-	struct drm_fb *fb = data;
-	struct gbm_device *gbm = gbm_bo_get_device(bo);
+	uint64_t last[MAX_WORKERS], last_ns[MAX_WORKERS];
+	uint64_t start, now, deadline = 0, cycles = 0;
+	struct stage_stats init, frame, exit_, cycle;
+	struct worker *w;
+	bool running;
+	char what[32], label[256];
+	double secs;
+	int i, ret = 0;
+
+	workers_stop = false;
+	start = stats_now_ns();
+	if (duration_s > 0)
+		deadline = start + (uint64_t)(duration_s * 1e9);
+
+	for (i = 0; i < nthreads; i++) {
+		w = &workers[i];
+		memset(w, 0, sizeof(*w));
+		w->id = i;
+		w->max_cycles = max_cycles;
+		w->step = "start";
+		snprintf(w->name, sizeof(w->name), "thread%d", i);
+		stats_init(&w->init, "init");
+		stats_init(&w->frame, "frame");
+		stats_init(&w->exit, "exit");
+		stats_init(&w->cycle, w->name);
+		last[i] = 0;
+		last_ns[i] = start;
+		if (pthread_create(&w->thread, NULL, worker_main, w)) {
+			printf("failed to create worker thread %d\n", i);
+			workers_stop = true;
+			nthreads = i;
+			ret = -1;
+			break;
+		}
+	}
 
-	if (fb->fb_id)
-		drmModeRmFB(drm.fd, fb->fb_id);
+	/* watchdog */
+	do {
+		usleep(100000);
+		now = stats_now_ns();
+		if (deadline && now >= deadline)
+			workers_stop = true;
+
+		running = false;
+		for (i = 0; i < nthreads; i++) {
+			w = &workers[i];
+			if (w->done)
+				continue;
+			running = true;
+			if (w->cycles != last[i]) {
+				last[i] = w->cycles;
+				last_ns[i] = now;
+			} else if (now - last_ns[i] > WORKER_STALL_S * 1000000000ull) {
+				printf("### Stress: worker %d made no progress for %d s, stuck in %s: deadlock?\n",
+						i, WORKER_STALL_S, w->step);
+				exit(3);
+			}
+		}
+	} while (running);
+
+	secs = (stats_now_ns() - start) / 1e9;
+
+	stats_init(&init, "init");
+	stats_init(&frame, "frame");
+	stats_init(&exit_, "exit");
+	stats_init(&cycle, "cycle");
+	res->corrupt = 0;
+	for (i = 0; i < nthreads; i++) {
+		w = &workers[i];
+		pthread_join(w->thread, NULL);
+		if (w->ret)
+			ret = w->ret;
+		cycles += w->cycles;
+		res->corrupt += w->corrupt;
+		stats_merge(&init, &w->init);
+		stats_merge(&frame, &w->frame);
+		stats_merge(&exit_, &w->exit);
+		stats_merge(&cycle, &w->cycle);
+	}
 
-	free(fb);
+	res->threads = nthreads;
+	res->rate = secs > 0 ? cycles / secs : 0.0;
+	res->p50_ns = stats_percentile(&cycle, 50.0);
+	res->p99_ns = stats_percentile(&cycle, 99.0);
+
+	printf("### Stress: %d threads, %llu cycles in %.3f s => %.1f cycles/s, %u corrupt frames\n",
+			nthreads, (unsigned long long)cycles, secs, res->rate,
+			res->corrupt);
+	stats_print_header();
+	stats_print(&init);
+	stats_print(&frame);
+	stats_print(&exit_);
+	stats_print(&cycle);
+	for (i = 0; i < nthreads; i++)
+		stats_print(&workers[i].cycle);
+
+	if (report_enabled(&report)) {
+		snprintf(what, sizeof(what), "stress/%d", nthreads);
+		run_label(label, sizeof(label), what);
+		report_run_begin(&report, label);
+		report_config(&report, "scenario", "stress");
+		report_stage(&report, NULL, &init);
+		report_stage(&report, NULL, &frame);
+		report_stage(&report, NULL, &exit_);
+		report_stage(&report, NULL, &cycle);
+		report_counter(&report, "status", ret);
+		report_counter(&report, "threads", nthreads);
+		report_counter(&report, "cycles", cycles);
+		report_counter(&report, "elapsed_s", secs);
+		report_counter(&report, "cycles_per_s", res->rate);
+		report_counter(&report, "corrupt_frames", res->corrupt);
+		report_run_end(&report);
+	}
+
+	return ret;
 }
 
-static struct drm_fb * drm_fb_get_from_bo(struct gbm_bo *bo)
+static int run_stress(int max_threads, int max_cycles, double duration_s)
 {
-	struct drm_fb *fb = gbm_bo_get_user_data(bo);
-	uint32_t width, height, format;
-	uint32_t bo_handles[4] = {0}, offsets[4] = {0}, pitches[4] = {0};
-	int ret;
+	static struct worker workers[MAX_WORKERS];
+	struct stress_result res[8];
+	int i, n, nres = 0, ret = 0;
 
-	if (fb)
-		return fb;
-
-	fb = calloc(1, sizeof *fb);
-	fb->bo = bo;
+	if (max_threads > MAX_WORKERS) {
+		printf("at most %d worker threads\n", MAX_WORKERS);
+		return -1;
+	}
+	if (max_cycles < 0 && duration_s <= 0)
+		max_cycles = WORKER_DEFAULT_CYCLES;
 
-	width = gbm_bo_get_width(bo);
-	height = gbm_bo_get_height(bo);
-	pitches[0] = gbm_bo_get_stride(bo);
-	bo_handles[0] = gbm_bo_get_handle(bo).u32;
-	format = gbm_bo_get_format(bo);
+	/* shared by all workers: the device, the display and its config */
+	gbm.dev = gbm_create_device(drm.fd);
+	if (!gbm.dev || init_egl()) {
+		printf("failed to initialize GBM/EGL for the stress run\n");
+		ret = -1;
+	}
 
-	ret = drmModeAddFB2(drm.fd, width, height, format, bo_handles, pitches, offsets, &fb->fb_id, 0);
-	if (ret) {
-		printf("failed to create fb: %s\n", strerror(errno));
-		free(fb);
-		return NULL;
+	for (n = 1; !ret && !quit_requested; n *= 2) {
+		if (n > max_threads)
+			n = max_threads;
+		ret = run_workers(workers, n, max_cycles, duration_s, &res[nres++]);
+		if (n == max_threads)
+			break;
 	}
 
-	gbm_bo_set_user_data(bo, fb, drm_fb_destroy_callback);
+	if (nres) {
+		printf("### Stress scaling:\n");
+		printf("\t%-8s %12s %8s %12s %12s %8s\n", "threads", "cycles/s",
+				"speedup", "p50(us)", "p99(us)", "corrupt");
+		for (i = 0; i < nres; i++)
+			printf("\t%-8d %12.1f %8.2f %12.1f %12.1f %8u\n",
+					res[i].threads, res[i].rate,
+					res[0].rate > 0 ? res[i].rate / res[0].rate : 0.0,
+					res[i].p50_ns / 1000.0, res[i].p99_ns / 1000.0,
+					res[i].corrupt);
+	}
+	progcache_report(&program_cache);
 
-	return fb;
-}
+	if (gl.context != EGL_NO_CONTEXT)
+		exit_gl_context();
+	if (gbm.dev)
+		exit_gbm_device();
 
-static void page_flip_handler(int fd, unsigned int frame,
-		  unsigned int sec, unsigned int usec, void *data)
-{
-	int *waiting_for_flip = data;
-	*waiting_for_flip = *waiting_for_flip - 1;
+	for (i = 0; i < nres; i++)
+		if (res[i].corrupt)
+			return ret ? ret : 2;
+	return ret;
 }
 
 void print_usage()
 {
 	printf("Usage : kmscube <options>\n");
 	printf("\t-h : Help\n");
-	printf("\t-a : Enable all displays\n");
+	printf("\t-H <w>x<h> : Headless: render <w>x<h> offscreen buffers on a render\n");
+	printf("\t\tnode (-D picks it, e.g. vgem), no display needed; all stages but\n");
+	printf("\t\tflip; LIBGL_ALWAYS_SOFTWARE=1 selects Mesa's software rasterizer\n");
+	printf("\t-a : Drive all connected displays, flipped together every cycle\n");
+	printf("\t-b <dir> : Cache linked program binaries in <dir>\n");
 	printf("\t-c <id> : Display using connector_id [if not specified, use the first connected connector]\n");
-	printf("\t-n <number> (optional): Number of frames to render\n");
+	printf("\t-C <file> : Remember the device, connector, CRTC and mode in <file>\n");
+	printf("\t\tand try them first on the next start\n");
+	printf("\t-D <driver|path> : Use the DRM device with this driver name, device\n");
+	printf("\t\tnode or sysfs path [default: the first one with KMS]\n");
+	printf("\t-d <w>x<h> : Damage tracking: a static scene with a moving <w>x<h>\n");
+	printf("\t\tticker, only changed regions are redrawn (buffer age, partial\n");
+	printf("\t\tupdate), swapped with damage and sent as FB_DAMAGE_CLIPS\n");
+	printf("\t-m <fourcc>[:<modifier>] : Scan out this format (XR24, AR24, RG16)\n");
+	printf("\t\tand modifier (hex or linear) instead of the cheapest pair the\n");
+	printf("\t\tplane's IN_FORMATS and EGL agree on\n");
+	printf("\t-B : Bandwidth sweep: run the flip scenario (-n cycles, 300 by\n");
+	printf("\t\tdefault, or -t seconds) in every mode of the primary connector\n");
+	printf("\t\tand every format and modifier of its plane, and rank them by\n");
+	printf("\t\tframe rate, memory traffic where uncore counters exist, and\n");
+	printf("\t\tframe time variance\n");
+	printf("\t-N <n> : GPU load: draw <n> lit cubes per frame, each with its own\n");
+	printf("\t\ttransform, instanced where the driver supports it\n");
+	printf("\t-o <layers> : Overdraw: repeat the cube grid in <layers> layers\n");
+	printf("\t\tdrawn over each other [default: 1]\n");
+	printf("\t-S <percent> : Fill rate: cube size in percent of its grid cell\n");
+	printf("\t\t[default: 80]\n");
+	printf("\t-i : Draw the cubes one by one even where instancing is supported\n");
+	printf("\t-M <n> : Benchmark the matrices of <n> objects, per object against\n");
+	printf("\t\tthe %s batch path, and exit\n", matrix_simd);
+	printf("\t-n <number> (optional): Number of frames/cycles to run\n");
+	printf("\t-t <seconds> (optional): Run the scenario for a fixed duration\n");
+	printf("\t-s <scenario> : Lifecycle scenario to run [default: test3]\n");
+	printf("\t\tpresets: test1, test2, test3, test4, flip, share, or \"[setup/]loop\"\n");
+	printf("\t\twhere setup and loop are comma separated lists of the stages\n");
+	printf("\t\tinit_gbm, init_gl, draw, swap, lock, share, flip, exit_gl, exit_gbm\n");
+	printf("\t\t(share: export each swapped buffer as a dma-buf and import it\n");
+	printf("\t\tinto a second EGL consumer through an import cache)\n");
+	printf("\t-K <backend> : KMS backend for the flip stage: legacy (default) or\n");
+	printf("\t\tatomic (nonblocking commits, TEST_ONLY validated)\n");
+	printf("\t-k <cycles> : Sample RSS, fds, DRM/GEM/CMA memory every <cycles> cycles\n");
+	printf("\t\tand stop with exit status 2 once one of them keeps growing\n");
+	printf("\t-l <bytes> : Leak threshold in bytes per cycle [default: %d]\n",
+			LEAK_DEFAULT_THRESHOLD);
+	printf("\t-e <mode> : EGL lifecycle: full (default), persistent (keep display,\n");
+	printf("\t\tcontext, program and VBO, recreate only the surfaces), or\n");
+	printf("\t\tcompare (run both and report the difference)\n");
+	printf("\t-R : Render into a ring of cached scanout buffers instead of the\n");
+	printf("\t\tgbm_surface; with -e persistent the ring and its framebuffers\n");
+	printf("\t\tsurvive surface recreation\n");
+	printf("\t-T <threads> : Stress concurrent lifecycles: 1, 2, 4 ... <threads> worker\n");
+	printf("\t\tthreads each create, draw and destroy their own gbm_surface, EGL\n");
+	printf("\t\tsurface and context on the shared device (-n cycles per thread or\n");
+	printf("\t\t-t seconds per step)\n");
+	printf("\t-F <mode> : Fencing with -K atomic: implicit (default), explicit\n");
+	printf("\t\t(native fence fds as IN_FENCE_FD, OUT_FENCE_PTR fences waited\n");
+	printf("\t\ton by the GPU), or compare (run both and report the difference)\n");
+	printf("\t-L <n> : Show 1 to %d extra layers (NV12 video, RGB UI) with -K atomic\n",
+			OVERLAY_MAX_LAYERS);
+	printf("\t-O <mode> : Layers on overlay planes where TEST_ONLY accepts them,\n");
+	printf("\t\tcomposited by GL otherwise: planes (default), gl (compose all),\n");
+	printf("\t\tor compare (run both and report the difference)\n");
+	printf("\t-P : Follow connector hotplug: bring displays up and down without\n");
+	printf("\t\ta restart, and wait for a connector if none is connected\n");
+	printf("\t-X <file> : Record a timeline of the last %d frames: the stages on\n",
+			TIMELINE_FRAMES);
+	printf("\t\tthe CPU, the draw on the GPU (GL_EXT_disjoint_timer_query) and\n");
+	printf("\t\tthe vblank, and why late frames were late; written to <file>\n");
+	printf("\t-j <file> : Write the results of every run to <file>: the environment,\n");
+	printf("\t\tper stage latency distributions and resource counters, as CSV\n");
+	printf("\t\tif <file> ends in .csv and JSON otherwise (see make bench)\n");
+	printf("\t-v : Verbose output\n");
 }
 
 void kms_signalhandler(int signum)
@@ -807,6 +4703,12 @@ void kms_signalhandler(int signum)
 	switch(signum) {
 	case SIGINT:
         case SIGTERM:
+		/* First signal stops the scenario loop so the report gets
+		 * printed, a second one tears everything down right away */
+		if (!quit_requested) {
+			quit_requested = 1;
+			return;
+		}
                 /* Allow the pending page flip requests to be completed before
                  * the teardown sequence */
                 sleep(1);
@@ -822,22 +4724,23 @@ void kms_signalhandler(int signum)
 
 int main(int argc, char *argv[])
 {
-	fd_set fds;
-	drmEventContext evctx = {
-			.version = DRM_EVENT_CONTEXT_VERSION,
-			.page_flip_handler = page_flip_handler,
-	};
-	struct gbm_bo *bo;
-	struct drm_fb *fb;
-	uint32_t i = 0;
 	int ret;
 	int opt;
+	uint64_t start;
 	int frame_count = -1;
+	double duration = 0;
+	int leak_interval = 0;
+	double leak_threshold = LEAK_DEFAULT_THRESHOLD;
+	const char *scenario = NULL;
+	bool egl_compare = false;
+	bool fence_compare = false;
+	bool overlay_compare = false;
+	int stress_threads = 0;
 
 	signal(SIGINT, kms_signalhandler);
 	signal(SIGTERM, kms_signalhandler);
 
-	while ((opt = getopt(argc, argv, "ahc:n:")) != -1) {
+	while ((opt = getopt(argc, argv, "aBb:C:c:D:d:e:F:H:hij:K:k:L:l:M:m:N:n:O:o:PRS:s:T:t:vX:")) != -1) {
 		switch(opt) {
 		case 'a':
 			all_display = 1;
@@ -846,14 +4749,164 @@ int main(int argc, char *argv[])
 		case 'h':
 			print_usage();
 			return 0;
+		case 'H':
+			if (sscanf(optarg, "%hux%hu", &headless_mode.hdisplay,
+					&headless_mode.vdisplay) != 2 ||
+			    !headless_mode.hdisplay || !headless_mode.vdisplay) {
+				printf("Invalid headless size %s\n", optarg);
+				print_usage();
+				return -1;
+			}
+			headless = true;
+			break;
 
+		case 'B':
+			bandwidth_sweep = true;
+			break;
+		case 'b':
+			if (progcache_init(&program_cache, optarg))
+				return -1;
+			break;
+		case 'C':
+			drm_cache_file = optarg;
+			break;
 		case 'c':
 			connector_id = atoi(optarg);
 			break;
+		case 'D':
+			drm_device = optarg;
+			break;
+		case 'd':
+			if (sscanf(optarg, "%dx%d", &damage.ticker.w,
+					&damage.ticker.h) != 2 ||
+			    damage.ticker.w <= 0 || damage.ticker.h <= 0) {
+				printf("Invalid ticker size %s\n", optarg);
+				print_usage();
+				return -1;
+			}
+			damage_tracking = true;
+			break;
+		case 'e':
+			if (!strcmp(optarg, "persistent")) {
+				egl_persistent = true;
+			} else if (!strcmp(optarg, "compare")) {
+				egl_compare = true;
+			} else if (strcmp(optarg, "full")) {
+				printf("Unknown EGL mode %s\n", optarg);
+				print_usage();
+				return -1;
+			}
+			break;
+		case 'F':
+			if (!strcmp(optarg, "explicit")) {
+				explicit_fences = true;
+			} else if (!strcmp(optarg, "compare")) {
+				fence_compare = true;
+			} else if (strcmp(optarg, "implicit")) {
+				printf("Unknown fencing mode %s\n", optarg);
+				print_usage();
+				return -1;
+			}
+			break;
+		case 'K':
+			if (!strcmp(optarg, "atomic")) {
+				kms_atomic = true;
+			} else if (strcmp(optarg, "legacy")) {
+				printf("Unknown KMS backend %s\n", optarg);
+				print_usage();
+				return -1;
+			}
+			break;
+		case 'k':
+			leak_interval = atoi(optarg);
+			break;
+		case 'L':
+			overlay_layers = atoi(optarg);
+			if (overlay_layers < 1 || overlay_layers > OVERLAY_MAX_LAYERS) {
+				printf("Between 1 and %d layers\n", OVERLAY_MAX_LAYERS);
+				return -1;
+			}
+			break;
+		case 'l':
+			leak_threshold = atof(optarg);
+			break;
+		case 'i':
+			load.instanced = false;
+			break;
+		case 'M':
+			if (atoi(optarg) < 1) {
+				printf("At least one object\n");
+				return -1;
+			}
+			return matrix_benchmark(atoi(optarg));
+		case 'm':
+			if (format_mod_parse(optarg, &scanout_choice) ||
+			    !format_scanout_candidate(scanout_choice.format)) {
+				printf("Scanout is XR24, AR24 or RG16, optionally with\n"
+						":<modifier> in hex or :linear\n");
+				return -1;
+			}
+			scanout_override = true;
+			break;
+		case 'N':
+			load.cubes = atoi(optarg);
+			if (load.cubes < 1) {
+				printf("At least one cube\n");
+				return -1;
+			}
+			break;
 		case 'n':
 			frame_count = atoi(optarg);
 			break;
-
+		case 'O':
+			if (!strcmp(optarg, "gl")) {
+				overlay_gl_only = true;
+			} else if (!strcmp(optarg, "compare")) {
+				overlay_compare = true;
+			} else if (strcmp(optarg, "planes")) {
+				printf("Unknown layer mode %s\n", optarg);
+				print_usage();
+				return -1;
+			}
+			break;
+		case 'o':
+			load.layers = atoi(optarg);
+			if (load.layers < 1) {
+				printf("At least one layer of cubes\n");
+				return -1;
+			}
+			break;
+		case 'P':
+			hotplug_enabled = true;
+			break;
+		case 'R':
+			fb_ring = true;
+			break;
+		case 'S':
+			load.size = atoi(optarg);
+			if (load.size < 1) {
+				printf("Cube size is a percentage of the cell\n");
+				return -1;
+			}
+			break;
+		case 's':
+			scenario = optarg;
+			break;
+		case 'T':
+			stress_threads = atoi(optarg);
+			break;
+		case 't':
+			duration = atof(optarg);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'X':
+			timeline_file = optarg;
+			break;
+		case 'j':
+			report_file = optarg;
+			break;
 
 		default:
 			printf("Undefined option %s\n", argv[optind]);
@@ -862,104 +4915,116 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	ret = init_drm();
-	if (ret) {
-		printf("failed to initialize DRM\n");
-		return ret;
+	if (!scenario)
+		scenario = bandwidth_sweep ? "flip" : "test3";
+	if (parse_scenario(scenario)) {
+		print_usage();
+		return -1;
 	}
-	printf("### Primary display => ConnectorId = %d, Resolution = %dx%d\n",
-			drm.connector_id[DISP_ID], drm.mode[DISP_ID]->hdisplay,
-			drm.mode[DISP_ID]->vdisplay);
 
-	FD_ZERO(&fds);
-	FD_SET(drm.fd, &fds);
-
-#define TEST1 0   // success
-#define TEST2 0   // failure
-#define TEST3 1   // failure
-#define TEST4 0   // failure
+	if (headless && (kms_atomic || scenario_has_stage(STAGE_FLIP))) {
+		printf("Headless mode has no KMS: no flip stage, no atomic backend\n");
+		return -1;
+	}
 
-#if TEST1
-	while (1) {
-		struct gbm_bo *next_bo;
-		int cc;
-		
-		ret = init_gbm();
-		if (ret) {
-			printf("failed to initialize GBM\n");
-			return ret;
-		}
-		exit_gbm();
+	if ((explicit_fences || fence_compare) && !kms_atomic) {
+		printf("Explicit fencing needs the atomic backend (-K atomic)\n");
+		return -1;
+	}
+	if (damage_tracking && scenario_has_stage(STAGE_SHARE)) {
+		printf("The share stage needs whole frames, no damage tracking\n");
+		return -1;
+	}
+	if (load.cubes && damage_tracking) {
+		printf("The cube load redraws whole frames, no damage tracking\n");
+		return -1;
+	}
+	if (overlay_layers && (!kms_atomic || damage_tracking)) {
+		printf("Layers need the atomic backend (-K atomic) and whole frames\n");
+		return -1;
+	}
+	if (egl_compare + fence_compare + overlay_compare > 1) {
+		printf("Compare one of EGL, fencing or layer modes at a time\n");
+		return -1;
+	}
+	if (bandwidth_sweep && (headless || all_display || overlay_layers ||
+	    hotplug_enabled || stress_threads > 0 || egl_compare ||
+	    fence_compare || overlay_compare || !scenario_has_stage(STAGE_FLIP))) {
+		printf("The sweep flips the primary display alone: no -H, -a, -L, -P,\n"
+				"-T or compare modes, and a scenario with a flip stage\n");
+		return -1;
 	}
-	
-#elif TEST2
-	while (1) {
-		struct gbm_bo *next_bo;
-		int cc;
-		
-		ret = init_gbm();
-		if (ret) {
-			printf("failed to initialize GBM\n");
-			return ret;
-		}
-		
-		ret = init_gl();
-		if (ret) {
-			printf("failed to initialize EGL\n");
-			return ret;
-		}
 
-		exit_gl(); 
-		exit_gbm();
+	if (timeline_file && timeline_init(&timeline))
+		return -1;
+
+	start = stats_now_ns();
+	ret = init_drm();
+	if (ret) {
+		printf("failed to initialize DRM\n");
+		return ret;
 	}
-	
-#elif TEST3
-	while (1) {
-		struct gbm_bo *next_bo;
-		int cc;
-		
-		ret = init_gbm();
-		if (ret) {
-			printf("failed to initialize GBM\n");
-			return ret;
-		}
-		
-		ret = init_gl();
-		if (ret) {
-			printf("failed to initialize EGL\n");
-			return ret;
-		}
-		
-		draw(i++);
+	printf("### DRM setup took %.2f ms\n", (stats_now_ns() - start) / 1e6);
+	if (!headless)
+		printf("### Primary display => ConnectorId = %d, Resolution = %dx%d\n",
+				drm.connector_id[DISP_ID], drm.mode[DISP_ID]->hdisplay,
+				drm.mode[DISP_ID]->vdisplay);
 
-		eglSwapBuffers(gl.display, gl.surface);
-		next_bo = gbm_surface_lock_front_buffer(gbm.surface);
-		gbm_surface_release_buffer(gbm.surface, next_bo);
+	fb_cache_init(&fb_cache, drm.fd, !headless);
 
-		exit_gl(); 
-		exit_gbm();
+
+	if ((overlay_layers && init_layers()) || init_atomic_outputs()) {
+		overlay_fini(&overlay);
+		atomic_fini(&atomic);
+		exit_drm();
+		return -1;
 	}
 
-#elif TEST4
-	ret = init_gbm();
-	if (ret) {
-		printf("failed to initialize GBM\n");
-		return ret;
+	dmabuf_sharing = scenario_has_stage(STAGE_SHARE);
+	if (dmabuf_sharing && dmabuf_consumer_init(&consumer, drm.fd)) {
+		atomic_fini(&atomic);
+		exit_drm();
+		return -1;
 	}
 
-	while (1) {
-		ret = init_gl();
-		if (ret) {
-			printf("failed to initialize EGL\n");
-			return ret;
+	if (report_file) {
+		if (report_open(&report, report_file)) {
+			if (dmabuf_sharing)
+				dmabuf_consumer_fini(&consumer);
+			atomic_fini(&atomic);
+			exit_drm();
+			return -1;
 		}
-
-		exit_gl();
+		report_drm_env();
 	}
-	exit_gbm();
-#endif
 
+	if (stress_threads > 0)
+		ret = run_stress(stress_threads, frame_count, duration);
+	else if (egl_compare)
+		ret = run_egl_comparison(frame_count, duration, leak_interval, leak_threshold);
+	else if (fence_compare)
+		ret = run_fence_comparison(frame_count, duration, leak_interval, leak_threshold);
+	else if (overlay_compare)
+		ret = run_overlay_comparison(frame_count, duration, leak_interval, leak_threshold);
+	else if (bandwidth_sweep)
+		ret = run_sweep(frame_count, duration);
+	else
+		ret = run_scenario(frame_count, duration, leak_interval, leak_threshold);
+
+	progcache_fini(&program_cache);
+	fb_cache_fini(&fb_cache);
+	if (dmabuf_sharing)
+		dmabuf_consumer_fini(&consumer);
+	atomic_fini(&atomic);
+	overlay_fini(&overlay);
+	prop_cache_report(&prop_cache);
+	if (report_close(&report) && !ret)
+		ret = -1;
 	exit_drm();
+	free(load.modelview);
+	mat4_batch_fini(&load.mv);
+	transform_batch_fini(&load.xf);
+	timeline_fini(&timeline);
 	printf("\n Exiting kmscube \n");
 
 	return ret;
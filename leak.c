@@ -0,0 +1,439 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "leak.h"
+
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+
+static const char *metric_names[LEAK_NMETRICS] = {
+	[LEAK_RSS]	= "rss",
+	[LEAK_FDS]	= "fds",
+	[LEAK_DRM_MEM]	= "drm_mem",
+	[LEAK_GEM]	= "gem",
+	[LEAK_CMA]	= "cma",
+};
+
+/* debugfs files which end with a "<n> objects, <m> bytes" summary */
+static const char *gem_debugfs_files[] = {
+	"i915_gem_objects", "gem", "gem_info",
+};
+
+static int64_t read_rss(void)
+{
+	unsigned long size, resident;
+	FILE *f = fopen("/proc/self/statm", "r");
+
+	if (!f)
+		return -1;
+
+	if (fscanf(f, "%lu %lu", &size, &resident) != 2)
+		resident = 0;
+	fclose(f);
+
+	return (int64_t)resident * sysconf(_SC_PAGESIZE);
+}
+
+static int64_t count_fds(void)
+{
+	DIR *dir = opendir("/proc/self/fd");
+	struct dirent *ent;
+	int64_t n = 0;
+
+	if (!dir)
+		return -1;
+
+	while ((ent = readdir(dir)))
+		if (ent->d_name[0] != '.')
+			n++;
+	closedir(dir);
+
+	/* don't count the fd opendir() itself used */
+	return n - 1;
+}
+
+static int64_t parse_size(const char *p)
+{
+	char unit[8] = "";
+	unsigned long long v;
+
+	if (sscanf(p, "%llu %7s", &v, unit) < 1)
+		return 0;
+
+	if (!strcmp(unit, "KiB") || !strcmp(unit, "kB"))
+		v <<= 10;
+	else if (!strcmp(unit, "MiB"))
+		v <<= 20;
+	else if (!strcmp(unit, "GiB"))
+		v <<= 30;
+
+	return v;
+}
+
+/*
+ * Sum the memory stats the DRM core exports in fdinfo for every DRM fd we
+ * hold.  dup()ed fds share a drm-client-id and are only counted once.
+ */
+static int64_t read_drm_fdinfo(void)
+{
+	DIR *dir = opendir("/proc/self/fdinfo");
+	struct dirent *ent;
+	unsigned long long clients[64];
+	int nclients = 0;
+	int64_t total = -1;
+
+	if (!dir)
+		return -1;
+
+	while ((ent = readdir(dir))) {
+		char path[288], line[256];
+		int64_t fd_total = 0, fd_legacy = 0;
+		unsigned long long client = 0;
+		bool is_drm = false, dup = false;
+		FILE *f;
+		int i;
+
+		if (ent->d_name[0] == '.')
+			continue;
+
+		snprintf(path, sizeof(path), "/proc/self/fdinfo/%s", ent->d_name);
+		f = fopen(path, "r");
+		if (!f)
+			continue;
+
+		while (fgets(line, sizeof(line), f)) {
+			char *val = strchr(line, ':');
+
+			if (!val)
+				continue;
+			val++;
+
+			if (!strncmp(line, "drm-driver:", 11))
+				is_drm = true;
+			else if (!strncmp(line, "drm-client-id:", 14))
+				client = strtoull(val, NULL, 10);
+			else if (!strncmp(line, "drm-total-", 10))
+				fd_total += parse_size(val);
+			else if (!strncmp(line, "drm-memory-", 11))
+				fd_legacy += parse_size(val);
+		}
+		fclose(f);
+
+		if (!is_drm)
+			continue;
+
+		for (i = 0; i < nclients; i++)
+			if (clients[i] == client)
+				dup = true;
+		if (dup)
+			continue;
+		if (nclients < ARRAY_SIZE(clients))
+			clients[nclients++] = client;
+
+		if (total < 0)
+			total = 0;
+		/* drm-memory-* is the pre drm-total-* spelling of the same thing */
+		total += fd_total ? fd_total : fd_legacy;
+	}
+	closedir(dir);
+
+	return total;
+}
+
+static int64_t read_gem(const char *path)
+{
+	char line[256];
+	int64_t bytes = -1;
+	FILE *f;
+
+	if (!path[0])
+		return -1;
+
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+
+	while (fgets(line, sizeof(line), f)) {
+		char *p = strstr(line, "objects, ");
+		unsigned long long v;
+
+		if (p && sscanf(p + 9, "%llu bytes", &v) == 1)
+			bytes = v;
+	}
+	fclose(f);
+
+	return bytes;
+}
+
+static int64_t read_cma(void)
+{
+	char line[128];
+	int64_t total = -1, avail = -1;
+	FILE *f = fopen("/proc/meminfo", "r");
+
+	if (!f)
+		return -1;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (!strncmp(line, "CmaTotal:", 9))
+			total = parse_size(line + 9);
+		else if (!strncmp(line, "CmaFree:", 8))
+			avail = parse_size(line + 8);
+	}
+	fclose(f);
+
+	if (total <= 0 || avail < 0)
+		return -1;
+
+	return total - avail;
+}
+
+void leak_monitor_init(struct leak_monitor *m, int drm_fd, int interval,
+		double threshold, const char * const *stage_names,
+		const int *stage_owner, int nstages)
+{
+	struct stat st;
+	int i;
+
+	memset(m, 0, sizeof(*m));
+	m->drm_fd = drm_fd;
+	m->interval = interval;
+	m->threshold = threshold;
+	m->stage_names = stage_names;
+	m->stage_owner = stage_owner;
+	m->nstages = nstages > LEAK_MAX_STAGES ? LEAK_MAX_STAGES : nstages;
+
+	if (fstat(drm_fd, &st) || !S_ISCHR(st.st_mode))
+		return;
+
+	for (i = 0; i < ARRAY_SIZE(gem_debugfs_files); i++) {
+		snprintf(m->gem_path, sizeof(m->gem_path), "/sys/kernel/debug/dri/%u/%s",
+				minor(st.st_rdev), gem_debugfs_files[i]);
+		if (!access(m->gem_path, R_OK))
+			return;
+	}
+	m->gem_path[0] = '\0';
+}
+
+void leak_sample_read(struct leak_monitor *m, struct leak_sample *s)
+{
+	s->v[LEAK_RSS] = read_rss();
+	s->v[LEAK_FDS] = count_fds();
+	s->v[LEAK_DRM_MEM] = read_drm_fdinfo();
+	s->v[LEAK_GEM] = read_gem(m->gem_path);
+	s->v[LEAK_CMA] = read_cma();
+}
+
+/*
+ * Only cycles after the first windowed sample count, the same ones as
+ * attributed_cycles: the cycle that ends in that sample is the baseline.
+ */
+void leak_stage_account(struct leak_monitor *m, int stage,
+		const struct leak_sample *before, const struct leak_sample *after)
+{
+	int i;
+
+	if (stage >= m->nstages || !m->count)
+		return;
+
+	for (i = 0; i < LEAK_NMETRICS; i++)
+		if (before->v[i] >= 0 && after->v[i] >= 0)
+			m->stage_delta[stage][i] += after->v[i] - before->v[i];
+}
+
+const char *leak_metric_name(int metric)
+{
+	return metric_names[metric];
+}
+
+/* least-squares growth per cycle of metric over the current window */
+double leak_slope(const struct leak_monitor *m, int metric)
+{
+	double sx = 0, sy = 0, sxx = 0, sxy = 0, n = 0, d;
+	int i;
+
+	for (i = 0; i < m->count; i++) {
+		int idx = (m->head + LEAK_WINDOW - m->count + i) % LEAK_WINDOW;
+		double x = m->cycle[idx], y = m->sample[idx].v[metric];
+
+		if (m->sample[idx].v[metric] < 0)
+			return 0;
+
+		/* keep the numbers small to not lose precision */
+		x -= m->cycle[(m->head + LEAK_WINDOW - m->count) % LEAK_WINDOW];
+		sx += x;
+		sy += y;
+		sxx += x * x;
+		sxy += x * y;
+		n++;
+	}
+
+	d = n * sxx - sx * sx;
+	if (n < 2 || d == 0)
+		return 0;
+
+	return (n * sxy - sx * sy) / d;
+}
+
+static double metric_threshold(const struct leak_monitor *m, int metric)
+{
+	return metric == LEAK_FDS ? LEAK_FD_THRESHOLD : m->threshold;
+}
+
+/*
+ * Add a sample taken at the end of cycle.  Returns the first metric whose
+ * growth slope is past the threshold, or -1.
+ */
+int leak_monitor_add(struct leak_monitor *m, uint64_t cycle,
+		const struct leak_sample *s)
+{
+	int i;
+
+	if (m->nsamples++ < LEAK_WARMUP)
+		return -1;
+
+	if (!m->count) {
+		m->first = *s;
+		m->first_cycle = cycle;
+	} else {
+		m->attributed_cycles++;
+	}
+	m->last = *s;
+	m->last_cycle = cycle;
+
+	m->cycle[m->head] = cycle;
+	m->sample[m->head] = *s;
+	m->head = (m->head + 1) % LEAK_WINDOW;
+	if (m->count < LEAK_WINDOW)
+		m->count++;
+
+	if (m->count < LEAK_MIN_SAMPLES)
+		return -1;
+
+	for (i = 0; i < LEAK_NMETRICS; i++)
+		if (leak_slope(m, i) > metric_threshold(m, i))
+			return i;
+
+	return -1;
+}
+
+static double owner_growth(const struct leak_monitor *m, int owner, int metric)
+{
+	int64_t sum = 0;
+	int i;
+
+	for (i = 0; i < m->nstages; i++)
+		if (m->stage_owner[i] == owner)
+			sum += m->stage_delta[i][metric];
+
+	return (double)sum / m->attributed_cycles;
+}
+
+static void owner_name(const struct leak_monitor *m, int owner, char *buf, size_t len)
+{
+	int i, n;
+
+	n = snprintf(buf, len, "%s", m->stage_names[owner]);
+	for (i = 0; i < m->nstages; i++)
+		if (i != owner && m->stage_owner[i] == owner && n < len)
+			n += snprintf(buf + n, len - n, "+%s", m->stage_names[i]);
+}
+
+void leak_monitor_report(const struct leak_monitor *m, int leaking_metric)
+{
+	char name[64];
+	int i, j, worst = -1;
+	double worst_growth = 0;
+
+	if (!m->interval)
+		return;
+
+	printf("### Leak telemetry: %llu samples, one every %d cycles\n",
+			(unsigned long long)m->nsamples, m->interval);
+
+	if (!m->count) {
+		printf("\tnot enough samples\n");
+		return;
+	}
+
+	printf("\t%-12s %14s %14s %16s\n", "metric", "first", "last", "slope/cycle");
+	for (i = 0; i < LEAK_NMETRICS; i++) {
+		if (m->last.v[i] < 0) {
+			printf("\t%-12s %14s %14s %16s\n", metric_names[i], "n/a", "n/a", "n/a");
+			continue;
+		}
+		printf("\t%-12s %14lld %14lld %16.2f\n", metric_names[i],
+				(long long)m->first.v[i], (long long)m->last.v[i],
+				leak_slope(m, i));
+	}
+
+	if (!m->attributed_cycles)
+		return;
+
+	printf("\tgrowth per cycle by stage:\n");
+	printf("\t%-24s", "stage");
+	for (j = 0; j < LEAK_NMETRICS; j++)
+		printf(" %10s", metric_names[j]);
+	printf("\n");
+
+	for (i = 0; i < m->nstages; i++) {
+		if (m->stage_owner[i] != i)
+			continue;
+
+		owner_name(m, i, name, sizeof(name));
+		printf("\t%-24s", name);
+		for (j = 0; j < LEAK_NMETRICS; j++) {
+			if (m->last.v[j] < 0)
+				printf(" %10s", "n/a");
+			else
+				printf(" %10.1f", owner_growth(m, i, j));
+		}
+		printf("\n");
+
+		if (leaking_metric >= 0 &&
+		    owner_growth(m, i, leaking_metric) > worst_growth) {
+			worst_growth = owner_growth(m, i, leaking_metric);
+			worst = i;
+		}
+	}
+
+	if (leaking_metric < 0)
+		return;
+
+	printf("LEAK DETECTED: %s grows %.2f%s per cycle over cycles %llu..%llu",
+			metric_names[leaking_metric], leak_slope(m, leaking_metric),
+			leaking_metric == LEAK_FDS ? "" : " bytes",
+			(unsigned long long)m->first_cycle,
+			(unsigned long long)m->last_cycle);
+	if (worst >= 0) {
+		owner_name(m, worst, name, sizeof(name));
+		printf(", leaking stage: %s (%.2f per cycle)", name, worst_growth);
+	}
+	printf("\n");
+}
@@ -0,0 +1,99 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _KMSCUBE_LEAK_H_
+#define _KMSCUBE_LEAK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Resource telemetry for the lifecycle loops: every few cycles the process
+ * and driver counters are sampled, a least-squares growth slope is fitted
+ * over a sliding window, and a leak is declared once a slope crosses the
+ * threshold.  Counters that cannot be read on this system stay at -1.
+ */
+enum leak_metric {
+	LEAK_RSS,	/* process resident set, bytes */
+	LEAK_FDS,	/* open file descriptors */
+	LEAK_DRM_MEM,	/* drm-total-* / drm-memory-* of our DRM fdinfo, bytes */
+	LEAK_GEM,	/* GEM object bytes from the driver debugfs */
+	LEAK_CMA,	/* system wide CMA in use, bytes */
+	LEAK_NMETRICS
+};
+
+#define LEAK_WINDOW		(32)
+#define LEAK_MIN_SAMPLES	(16)
+#define LEAK_WARMUP		(4)
+#define LEAK_MAX_STAGES		(16)
+#define LEAK_DEFAULT_THRESHOLD	(256)
+
+/* fds are counted, not sized, so they get their own per-cycle threshold */
+#define LEAK_FD_THRESHOLD	(0.01)
+
+struct leak_sample {
+	int64_t v[LEAK_NMETRICS];
+};
+
+struct leak_monitor {
+	int interval;
+	double threshold;
+	int drm_fd;
+	char gem_path[64];
+
+	uint64_t cycle[LEAK_WINDOW];
+	struct leak_sample sample[LEAK_WINDOW];
+	int head, count;
+	uint64_t nsamples;
+
+	struct leak_sample first, last;
+	uint64_t first_cycle, last_cycle;
+
+	/*
+	 * Per stage growth measured on sampled cycles.  stage_owner[] maps a
+	 * teardown stage to the setup stage it balances (exit_gl -> init_gl),
+	 * so a verdict names the lifecycle whose net growth is positive.
+	 */
+	int nstages;
+	const char * const *stage_names;
+	const int *stage_owner;
+	int64_t stage_delta[LEAK_MAX_STAGES][LEAK_NMETRICS];
+	uint64_t attributed_cycles;
+};
+
+void leak_monitor_init(struct leak_monitor *m, int drm_fd, int interval,
+		double threshold, const char * const *stage_names,
+		const int *stage_owner, int nstages);
+void leak_sample_read(struct leak_monitor *m, struct leak_sample *s);
+void leak_stage_account(struct leak_monitor *m, int stage,
+		const struct leak_sample *before, const struct leak_sample *after);
+double leak_slope(const struct leak_monitor *m, int metric);
+const char *leak_metric_name(int metric);
+int leak_monitor_add(struct leak_monitor *m, uint64_t cycle,
+		const struct leak_sample *s);
+void leak_monitor_report(const struct leak_monitor *m, int leaking_metric);
+
+static inline bool leak_sample_due(const struct leak_monitor *m, uint64_t cycle)
+{
+	return m->interval > 0 && cycle % m->interval == 0;
+}
+
+#endif /* _KMSCUBE_LEAK_H_ */
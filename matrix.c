@@ -0,0 +1,580 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "matrix.h"
+#include "stats.h"
+
+/* four floats at a time; the batch loads and stores are 16-byte aligned */
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+
+typedef float32x4_t vf4;
+
+#define vf4_load(p)		vld1q_f32(p)
+#define vf4_store(p, v)		vst1q_f32(p, v)
+#define vf4_storeu(p, v)	vst1q_f32(p, v)
+#define vf4_set1(f)		vdupq_n_f32(f)
+#define vf4_add(a, b)		vaddq_f32(a, b)
+#define vf4_sub(a, b)		vsubq_f32(a, b)
+#define vf4_mul(a, b)		vmulq_f32(a, b)
+#define vf4_neg(a)		vnegq_f32(a)
+
+static inline vf4 vf4_div(vf4 a, vf4 b)
+{
+#if defined(__aarch64__)
+	return vdivq_f32(a, b);
+#else
+	/* ARMv7 NEON has no divide: estimate, then two Newton-Raphson steps */
+	vf4 r = vrecpeq_f32(b);
+
+	r = vmulq_f32(vrecpsq_f32(b, r), r);
+	r = vmulq_f32(vrecpsq_f32(b, r), r);
+	return vmulq_f32(a, r);
+#endif
+}
+
+static inline void vf4_transpose(vf4 *r0, vf4 *r1, vf4 *r2, vf4 *r3)
+{
+	float32x4x2_t t01 = vtrnq_f32(*r0, *r1);
+	float32x4x2_t t23 = vtrnq_f32(*r2, *r3);
+
+	*r0 = vcombine_f32(vget_low_f32(t01.val[0]), vget_low_f32(t23.val[0]));
+	*r1 = vcombine_f32(vget_low_f32(t01.val[1]), vget_low_f32(t23.val[1]));
+	*r2 = vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0]));
+	*r3 = vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1]));
+}
+
+const char *matrix_simd = "NEON";
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+
+typedef __m128 vf4;
+
+#define vf4_load(p)		_mm_load_ps(p)
+#define vf4_store(p, v)		_mm_store_ps(p, v)
+#define vf4_storeu(p, v)	_mm_storeu_ps(p, v)
+#define vf4_set1(f)		_mm_set1_ps(f)
+#define vf4_add(a, b)		_mm_add_ps(a, b)
+#define vf4_sub(a, b)		_mm_sub_ps(a, b)
+#define vf4_mul(a, b)		_mm_mul_ps(a, b)
+#define vf4_div(a, b)		_mm_div_ps(a, b)
+#define vf4_neg(a)		_mm_sub_ps(_mm_setzero_ps(), a)
+
+static inline void vf4_transpose(vf4 *r0, vf4 *r1, vf4 *r2, vf4 *r3)
+{
+	_MM_TRANSPOSE4_PS(*r0, *r1, *r2, *r3);
+}
+
+const char *matrix_simd = "SSE";
+#else
+typedef struct {
+	float f[4];
+} vf4;
+
+#define VF4_OP(name, op) \
+static inline vf4 name(vf4 a, vf4 b) \
+{ \
+	vf4 r; \
+	int i; \
+	for (i = 0; i < 4; i++) \
+		r.f[i] = a.f[i] op b.f[i]; \
+	return r; \
+}
+
+VF4_OP(vf4_add, +)
+VF4_OP(vf4_sub, -)
+VF4_OP(vf4_mul, *)
+VF4_OP(vf4_div, /)
+
+static inline vf4 vf4_load(const float *p)
+{
+	vf4 r;
+
+	memcpy(r.f, p, sizeof(r.f));
+	return r;
+}
+
+static inline void vf4_store(float *p, vf4 v)
+{
+	memcpy(p, v.f, sizeof(v.f));
+}
+
+#define vf4_storeu(p, v)	vf4_store(p, v)
+
+static inline vf4 vf4_set1(float f)
+{
+	vf4 r = { { f, f, f, f } };
+
+	return r;
+}
+
+static inline vf4 vf4_neg(vf4 a)
+{
+	return vf4_sub(vf4_set1(0.0f), a);
+}
+
+static inline void vf4_transpose(vf4 *r0, vf4 *r1, vf4 *r2, vf4 *r3)
+{
+	vf4 *r[4] = { r0, r1, r2, r3 };
+	float t;
+	int i, j;
+
+	for (i = 0; i < 4; i++)
+		for (j = i + 1; j < 4; j++) {
+			t = r[i]->f[j];
+			r[i]->f[j] = r[j]->f[i];
+			r[j]->f[i] = t;
+		}
+}
+
+const char *matrix_simd = "scalar";
+#endif
+
+void mat4_identity(float *m)
+{
+	memset(m, 0, 16 * sizeof(*m));
+	m[0] = m[5] = m[10] = m[15] = 1.0f;
+}
+
+void mat4_multiply(float *r, const float *a, const float *b)
+{
+	float t[16];
+	int i, j;
+
+	for (i = 0; i < 4; i++)
+		for (j = 0; j < 4; j++)
+			t[i * 4 + j] = a[j] * b[i * 4] + a[4 + j] * b[i * 4 + 1] +
+				a[8 + j] * b[i * 4 + 2] + a[12 + j] * b[i * 4 + 3];
+
+	memcpy(r, t, sizeof(t));
+}
+
+void mat4_translate(float *m, float x, float y, float z)
+{
+	int j;
+
+	for (j = 0; j < 4; j++)
+		m[12 + j] += m[j] * x + m[4 + j] * y + m[8 + j] * z;
+}
+
+void mat4_scale(float *m, float x, float y, float z)
+{
+	int j;
+
+	for (j = 0; j < 4; j++) {
+		m[j] *= x;
+		m[4 + j] *= y;
+		m[8 + j] *= z;
+	}
+}
+
+/* rotation about the axis (x, y, z), which need not be normalized */
+void mat4_rotate(float *m, float degrees, float x, float y, float z)
+{
+	float len = sqrtf(x * x + y * y + z * z);
+	float a = degrees * (float)M_PI / 180.0f;
+	float s = sinf(a), c = cosf(a), nc = 1.0f - c;
+	float r[16];
+
+	if (len == 0.0f)
+		return;
+	x /= len;
+	y /= len;
+	z /= len;
+
+	r[0] = x * x * nc + c;
+	r[1] = y * x * nc + z * s;
+	r[2] = z * x * nc - y * s;
+	r[3] = 0.0f;
+	r[4] = x * y * nc - z * s;
+	r[5] = y * y * nc + c;
+	r[6] = z * y * nc + x * s;
+	r[7] = 0.0f;
+	r[8] = x * z * nc + y * s;
+	r[9] = y * z * nc - x * s;
+	r[10] = z * z * nc + c;
+	r[11] = 0.0f;
+	r[12] = r[13] = r[14] = 0.0f;
+	r[15] = 1.0f;
+
+	mat4_multiply(m, m, r);
+}
+
+void mat4_ortho(float *m, float left, float right, float bottom, float top,
+		float near, float far)
+{
+	memset(m, 0, 16 * sizeof(*m));
+	m[0] = 2.0f / (right - left);
+	m[5] = 2.0f / (top - bottom);
+	m[10] = -2.0f / (far - near);
+	m[12] = -(right + left) / (right - left);
+	m[13] = -(top + bottom) / (top - bottom);
+	m[14] = -(far + near) / (far - near);
+	m[15] = 1.0f;
+}
+
+/* inverse transpose of the upper 3x3 of m, as a column-major 3x3 */
+void mat3_normal(float *n, const float *m)
+{
+	float c00 = m[5] * m[10] - m[9] * m[6];
+	float c01 = m[9] * m[2] - m[1] * m[10];
+	float c02 = m[1] * m[6] - m[5] * m[2];
+	float det = m[0] * c00 + m[4] * c01 + m[8] * c02;
+
+	n[0] = c00 / det;
+	n[1] = c01 / det;
+	n[2] = c02 / det;
+	n[3] = (m[8] * m[6] - m[4] * m[10]) / det;
+	n[4] = (m[0] * m[10] - m[8] * m[2]) / det;
+	n[5] = (m[4] * m[2] - m[0] * m[6]) / det;
+	n[6] = (m[4] * m[9] - m[8] * m[5]) / det;
+	n[7] = (m[8] * m[1] - m[0] * m[9]) / det;
+	n[8] = (m[0] * m[5] - m[4] * m[1]) / det;
+}
+
+static float *batch_alloc(int *cap, int n, int arrays)
+{
+	void *p;
+
+	*cap = (n + MATRIX_LANES - 1) & ~(MATRIX_LANES - 1);
+	if (n <= 0 ||
+	    posix_memalign(&p, 4 * MATRIX_LANES, (size_t)*cap * arrays * sizeof(float)))
+		return NULL;
+	memset(p, 0, (size_t)*cap * arrays * sizeof(float));
+
+	return p;
+}
+
+/* set the lanes of the diagonal elements to 1 */
+static void batch_identity(float *e, int cap, int dim)
+{
+	int i, k;
+
+	for (k = 0; k < dim; k++)
+		for (i = 0; i < cap; i++)
+			e[(k * dim + k) * cap + i] = 1.0f;
+}
+
+int mat4_batch_init(struct mat4_batch *b, int n)
+{
+	b->e = batch_alloc(&b->cap, n, 16);
+	if (!b->e)
+		return -1;
+	b->n = n;
+	batch_identity(b->e, b->cap, 4);
+
+	return 0;
+}
+
+void mat4_batch_fini(struct mat4_batch *b)
+{
+	free(b->e);
+	b->e = NULL;
+	b->n = b->cap = 0;
+}
+
+int mat3_batch_init(struct mat3_batch *b, int n)
+{
+	b->e = batch_alloc(&b->cap, n, 9);
+	if (!b->e)
+		return -1;
+	b->n = n;
+	batch_identity(b->e, b->cap, 3);
+
+	return 0;
+}
+
+void mat3_batch_fini(struct mat3_batch *b)
+{
+	free(b->e);
+	b->e = NULL;
+	b->n = b->cap = 0;
+}
+
+int transform_batch_init(struct transform_batch *t, int n)
+{
+	float *e = batch_alloc(&t->cap, n, 10);
+	int i;
+
+	if (!e)
+		return -1;
+
+	t->n = n;
+	t->x = e;
+	t->y = e + t->cap;
+	t->z = e + 2 * t->cap;
+	t->scale = e + 3 * t->cap;
+	t->rx = e + 4 * t->cap;
+	t->ry = e + 5 * t->cap;
+	t->sin_x = e + 6 * t->cap;
+	t->cos_x = e + 7 * t->cap;
+	t->sin_y = e + 8 * t->cap;
+	t->cos_y = e + 9 * t->cap;
+	for (i = 0; i < t->cap; i++)
+		t->scale[i] = t->cos_x[i] = t->cos_y[i] = 1.0f;
+
+	return 0;
+}
+
+void transform_batch_fini(struct transform_batch *t)
+{
+	free(t->x);
+	memset(t, 0, sizeof(*t));
+}
+
+void mat4_batch_compose(struct mat4_batch *b, const struct transform_batch *t)
+{
+	const float rad = (float)M_PI / 180.0f;
+	const vf4 zero = vf4_set1(0.0f), one = vf4_set1(1.0f);
+	float *e = b->e;
+	int cap = b->cap, i;
+	vf4 s, sa, ca, sb, cb;
+
+	/* no vector sin/cos, these stay scalar */
+	for (i = 0; i < t->n; i++) {
+		t->sin_x[i] = sinf(t->rx[i] * rad);
+		t->cos_x[i] = cosf(t->rx[i] * rad);
+		t->sin_y[i] = sinf(t->ry[i] * rad);
+		t->cos_y[i] = cosf(t->ry[i] * rad);
+	}
+
+	b->n = t->n;
+	for (i = 0; i < b->n; i += MATRIX_LANES) {
+		s = vf4_load(t->scale + i);
+		sa = vf4_load(t->sin_x + i);
+		ca = vf4_load(t->cos_x + i);
+		sb = vf4_load(t->sin_y + i);
+		cb = vf4_load(t->cos_y + i);
+
+		vf4_store(e + 0 * cap + i, vf4_mul(s, cb));
+		vf4_store(e + 1 * cap + i, vf4_mul(s, vf4_mul(sa, sb)));
+		vf4_store(e + 2 * cap + i, vf4_neg(vf4_mul(s, vf4_mul(ca, sb))));
+		vf4_store(e + 3 * cap + i, zero);
+		vf4_store(e + 4 * cap + i, zero);
+		vf4_store(e + 5 * cap + i, vf4_mul(s, ca));
+		vf4_store(e + 6 * cap + i, vf4_mul(s, sa));
+		vf4_store(e + 7 * cap + i, zero);
+		vf4_store(e + 8 * cap + i, vf4_mul(s, sb));
+		vf4_store(e + 9 * cap + i, vf4_neg(vf4_mul(s, vf4_mul(sa, cb))));
+		vf4_store(e + 10 * cap + i, vf4_mul(s, vf4_mul(ca, cb)));
+		vf4_store(e + 11 * cap + i, zero);
+		vf4_store(e + 12 * cap + i, vf4_load(t->x + i));
+		vf4_store(e + 13 * cap + i, vf4_load(t->y + i));
+		vf4_store(e + 14 * cap + i, vf4_load(t->z + i));
+		vf4_store(e + 15 * cap + i, one);
+	}
+}
+
+void mat4_batch_premultiply(struct mat4_batch *r, const float *a,
+		const struct mat4_batch *b)
+{
+	const float *be = b->e;
+	float *re = r->e;
+	int cap = b->cap, i, c, j;
+	vf4 b0, b1, b2, b3, acc;
+
+	r->n = b->n;
+	for (i = 0; i < b->n; i += MATRIX_LANES) {
+		/* a column of r only depends on the same column of b */
+		for (c = 0; c < 4; c++) {
+			b0 = vf4_load(be + (c * 4 + 0) * cap + i);
+			b1 = vf4_load(be + (c * 4 + 1) * cap + i);
+			b2 = vf4_load(be + (c * 4 + 2) * cap + i);
+			b3 = vf4_load(be + (c * 4 + 3) * cap + i);
+			for (j = 0; j < 4; j++) {
+				acc = vf4_mul(vf4_set1(a[j]), b0);
+				acc = vf4_add(acc, vf4_mul(vf4_set1(a[4 + j]), b1));
+				acc = vf4_add(acc, vf4_mul(vf4_set1(a[8 + j]), b2));
+				acc = vf4_add(acc, vf4_mul(vf4_set1(a[12 + j]), b3));
+				vf4_store(re + (c * 4 + j) * cap + i, acc);
+			}
+		}
+	}
+}
+
+void mat3_batch_normal(struct mat3_batch *r, const struct mat4_batch *b)
+{
+	const float *be = b->e;
+	float *re = r->e;
+	int cap = b->cap, i;
+	vf4 m0, m1, m2, m4, m5, m6, m8, m9, m10;
+	vf4 c00, c01, c02, det;
+
+	r->n = b->n;
+	for (i = 0; i < b->n; i += MATRIX_LANES) {
+		m0 = vf4_load(be + 0 * cap + i);
+		m1 = vf4_load(be + 1 * cap + i);
+		m2 = vf4_load(be + 2 * cap + i);
+		m4 = vf4_load(be + 4 * cap + i);
+		m5 = vf4_load(be + 5 * cap + i);
+		m6 = vf4_load(be + 6 * cap + i);
+		m8 = vf4_load(be + 8 * cap + i);
+		m9 = vf4_load(be + 9 * cap + i);
+		m10 = vf4_load(be + 10 * cap + i);
+
+		/* the cofactors over the determinant, as in mat3_normal() */
+		c00 = vf4_sub(vf4_mul(m5, m10), vf4_mul(m9, m6));
+		c01 = vf4_sub(vf4_mul(m9, m2), vf4_mul(m1, m10));
+		c02 = vf4_sub(vf4_mul(m1, m6), vf4_mul(m5, m2));
+		det = vf4_add(vf4_add(vf4_mul(m0, c00), vf4_mul(m4, c01)),
+				vf4_mul(m8, c02));
+
+		vf4_store(re + 0 * cap + i, vf4_div(c00, det));
+		vf4_store(re + 1 * cap + i, vf4_div(c01, det));
+		vf4_store(re + 2 * cap + i, vf4_div(c02, det));
+		vf4_store(re + 3 * cap + i, vf4_div(vf4_sub(vf4_mul(m8, m6),
+				vf4_mul(m4, m10)), det));
+		vf4_store(re + 4 * cap + i, vf4_div(vf4_sub(vf4_mul(m0, m10),
+				vf4_mul(m8, m2)), det));
+		vf4_store(re + 5 * cap + i, vf4_div(vf4_sub(vf4_mul(m4, m2),
+				vf4_mul(m0, m6)), det));
+		vf4_store(re + 6 * cap + i, vf4_div(vf4_sub(vf4_mul(m4, m9),
+				vf4_mul(m8, m5)), det));
+		vf4_store(re + 7 * cap + i, vf4_div(vf4_sub(vf4_mul(m8, m1),
+				vf4_mul(m0, m9)), det));
+		vf4_store(re + 8 * cap + i, vf4_div(vf4_sub(vf4_mul(m0, m5),
+				vf4_mul(m4, m1)), det));
+	}
+}
+
+void mat4_batch_store(const struct mat4_batch *b, float *out)
+{
+	const float *e = b->e;
+	int cap = b->cap, i, k, l;
+	vf4 r[4];
+
+	/* 4x4 transposes: the same four elements of four matrices */
+	for (i = 0; i < b->n; i += MATRIX_LANES) {
+		for (k = 0; k < 16; k += 4) {
+			for (l = 0; l < 4; l++)
+				r[l] = vf4_load(e + (k + l) * cap + i);
+			vf4_transpose(&r[0], &r[1], &r[2], &r[3]);
+			for (l = 0; l < 4 && i + l < b->n; l++)
+				vf4_storeu(out + (i + l) * 16 + k, r[l]);
+		}
+	}
+}
+
+/* 9 floats per matrix don't transpose in vectors, plain copies */
+void mat3_batch_store(const struct mat3_batch *b, float *out)
+{
+	int i, k;
+
+	for (i = 0; i < b->n; i++)
+		for (k = 0; k < 9; k++)
+			out[i * 9 + k] = b->e[k * b->cap + i];
+}
+
+/*
+ * The matrices the cube shader takes for n objects: modelview, MVP and
+ * normal matrix, per object with the scalar functions against a batch,
+ * stored for upload either way.
+ */
+int matrix_benchmark(int n)
+{
+	struct transform_batch t = { 0 };
+	struct mat4_batch mv = { 0 }, mvp = { 0 };
+	struct mat3_batch nrm = { 0 };
+	float *out = NULL, *ref = NULL, *m, *p;
+	float projection[16], diff = 0.0f, d;
+	uint64_t start, scalar_ns, batch_ns;
+	int rounds, r, i, ret = -1;
+
+	rounds = 1000000 / n + 1;
+	if (transform_batch_init(&t, n) || mat4_batch_init(&mv, n) ||
+	    mat4_batch_init(&mvp, n) || mat3_batch_init(&nrm, n))
+		goto out;
+	ref = malloc((size_t)n * (16 + 16 + 9) * sizeof(float));
+	out = malloc((size_t)n * (16 + 16 + 9) * sizeof(float));
+	if (!ref || !out)
+		goto out;
+
+	mat4_ortho(projection, -1.0f, 1.0f, -1.0f, 1.0f, 1.0f, 10.0f);
+	for (i = 0; i < n; i++) {
+		t.x[i] = (i % 32) / 16.0f - 1.0f;
+		t.y[i] = (i / 32 % 32) / 16.0f - 1.0f;
+		t.z[i] = -2.0f - i % 4;
+		t.scale[i] = 0.05f;
+		t.rx[i] = 45.0f + 7 * i;
+		t.ry[i] = 45.0f + 11 * i;
+	}
+
+	start = stats_now_ns();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < n; i++) {
+			m = ref + i * 16;
+			p = ref + n * 16 + i * 16;
+			mat4_identity(m);
+			mat4_translate(m, t.x[i], t.y[i], t.z[i]);
+			mat4_scale(m, t.scale[i], t.scale[i], t.scale[i]);
+			mat4_rotate(m, t.rx[i], 1.0f, 0.0f, 0.0f);
+			mat4_rotate(m, t.ry[i], 0.0f, 1.0f, 0.0f);
+			mat4_multiply(p, projection, m);
+			mat3_normal(ref + n * 32 + i * 9, m);
+		}
+	}
+	scalar_ns = stats_now_ns() - start;
+
+	start = stats_now_ns();
+	for (r = 0; r < rounds; r++) {
+		mat4_batch_compose(&mv, &t);
+		mat4_batch_premultiply(&mvp, projection, &mv);
+		mat3_batch_normal(&nrm, &mv);
+		mat4_batch_store(&mv, out);
+		mat4_batch_store(&mvp, out + n * 16);
+		mat3_batch_store(&nrm, out + n * 32);
+	}
+	batch_ns = stats_now_ns() - start;
+
+	/* float rounding differs: the normal matrices are ~20x the rotation */
+	for (i = 0; i < n * (16 + 16 + 9); i++) {
+		d = fabsf(out[i] - ref[i]) / (fabsf(ref[i]) > 1.0f ? fabsf(ref[i]) : 1.0f);
+		if (d > diff)
+			diff = d;
+	}
+
+	printf("### Matrix batch benchmark: %d objects x %d rounds, %s\n",
+			n, rounds, matrix_simd);
+	printf("\tscalar: %.1f ns/object\n", (double)scalar_ns / rounds / n);
+	printf("\tbatch:  %.1f ns/object, %.2fx\n", (double)batch_ns / rounds / n,
+			batch_ns ? (double)scalar_ns / batch_ns : 0.0);
+	printf("\tlargest relative difference: %g\n", diff);
+
+	ret = diff > 1e-3f ? -1 : 0;
+	if (ret)
+		printf("batch and scalar matrices differ\n");
+out:
+	if (ret && !ref)
+		printf("failed to allocate %d matrices\n", n);
+	free(out);
+	free(ref);
+	mat3_batch_fini(&nrm);
+	mat4_batch_fini(&mvp);
+	mat4_batch_fini(&mv);
+	transform_batch_fini(&t);
+
+	return ret;
+}
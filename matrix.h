@@ -0,0 +1,89 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _KMSCUBE_MATRIX_H_
+#define _KMSCUBE_MATRIX_H_
+
+/*
+ * 4x4 matrices as 16 floats in column-major order, the layout GL takes
+ * them in.  The transforms multiply onto m from the right, so the last
+ * one applied is the first the vertices go through.
+ */
+void mat4_identity(float *m);
+void mat4_multiply(float *r, const float *a, const float *b);	/* r = a * b */
+void mat4_translate(float *m, float x, float y, float z);
+void mat4_scale(float *m, float x, float y, float z);
+void mat4_rotate(float *m, float degrees, float x, float y, float z);
+void mat4_ortho(float *m, float left, float right, float bottom, float top,
+		float near, float far);
+void mat3_normal(float *n, const float *m);
+
+/*
+ * Batches of transforms in structure-of-arrays layout: element k of
+ * matrix i is e[k * cap + i], so one vector holds the same element of
+ * consecutive matrices.  cap is n rounded up to MATRIX_LANES; the lanes
+ * past n hold identities and are computed along, never stored.
+ */
+#define MATRIX_LANES	4
+
+struct mat4_batch {
+	int n, cap;
+	float *e;
+};
+
+struct mat3_batch {
+	int n, cap;
+	float *e;
+};
+
+/* per object translation, uniform scale, and rotation about x then y */
+struct transform_batch {
+	int n, cap;
+	float *x, *y, *z;
+	float *scale;
+	float *rx, *ry;			/* degrees */
+	float *sin_x, *cos_x, *sin_y, *cos_y;
+};
+
+extern const char *matrix_simd;		/* "NEON", "SSE" or "scalar" */
+
+int mat4_batch_init(struct mat4_batch *b, int n);
+void mat4_batch_fini(struct mat4_batch *b);
+int mat3_batch_init(struct mat3_batch *b, int n);
+void mat3_batch_fini(struct mat3_batch *b);
+int transform_batch_init(struct transform_batch *t, int n);
+void transform_batch_fini(struct transform_batch *t);
+
+/* b[i] = translate * scale * rotate_x * rotate_y of object i */
+void mat4_batch_compose(struct mat4_batch *b, const struct transform_batch *t);
+/* r[i] = a * b[i], r may be b */
+void mat4_batch_premultiply(struct mat4_batch *r, const float *a,
+		const struct mat4_batch *b);
+/* r[i] = inverse transpose of the upper 3x3 of b[i] */
+void mat3_batch_normal(struct mat3_batch *r, const struct mat4_batch *b);
+
+/* the n matrices one after the other, column-major, ready for upload */
+void mat4_batch_store(const struct mat4_batch *b, float *out);
+void mat3_batch_store(const struct mat3_batch *b, float *out);
+
+int matrix_benchmark(int n);
+
+#endif /* _KMSCUBE_MATRIX_H_ */
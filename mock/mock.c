@@ -0,0 +1,388 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mock.h"
+
+/*
+ * Freed objects stay in the registry, marked dead, for the last
+ * QUARANTINE frees: a second free or a use in that window is told apart
+ * from a pointer that was never handed out, as long as the address was
+ * not handed out again.  Their memory goes back right away and the
+ * registry is allocated up front, so the mock's own footprint stays flat
+ * under the leak monitor.  Ids are never reused at all.
+ */
+#define QUARANTINE	(1024)
+#define MAX_CALLS	(256)
+#define MAX_LATENCIES	(32)
+
+struct mock_obj {
+	const char *kind;
+	uintptr_t key;			/* pointer or id */
+	bool is_id;
+	bool dead;
+	uint64_t serial;
+	const char *origin;		/* call that created it */
+};
+
+static pthread_mutex_t mock_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct mock_obj *objs;
+static int nobjs, cap_objs;
+static struct {
+	uintptr_t key;
+	bool is_id;
+} quarantine[QUARANTINE];
+static int quarantine_head;
+static uint64_t serial;
+static uint32_t next_id = 1;
+static unsigned int errors;
+
+static __thread const char *current_call;
+
+static struct {
+	const char *name;
+	uint64_t count;
+} calls[MAX_CALLS];
+static int ncalls;
+
+static struct {
+	char name[64];
+	uint64_t ns;
+} latencies[MAX_LATENCIES];
+static int nlatencies = -1;
+
+void mock_lock(void)
+{
+	pthread_mutex_lock(&mock_mutex);
+}
+
+void mock_unlock(void)
+{
+	pthread_mutex_unlock(&mock_mutex);
+}
+
+const char *mock_env(const char *name, const char *def)
+{
+	const char *v = getenv(name);
+
+	return v && *v ? v : def;
+}
+
+uint64_t mock_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void mock_sleep_until(uint64_t ns)
+{
+	struct timespec ts = {
+		.tv_sec = ns / 1000000000ull,
+		.tv_nsec = ns % 1000000000ull,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+void mock_error(const char *fmt, ...)
+{
+	va_list ap;
+
+	mock_lock();
+	errors++;
+	mock_unlock();
+
+	fprintf(stderr, "mock: error: ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+}
+
+/* MOCK_LATENCY=<call>=<us>,... parsed on first use */
+static void parse_latencies(void)
+{
+	const char *p = mock_env("MOCK_LATENCY", "");
+	char name[64];
+	unsigned long us;
+	int n;
+
+	nlatencies = 0;
+	while (*p && nlatencies < MAX_LATENCIES) {
+		if (sscanf(p, "%63[^=,]=%lu%n", name, &us, &n) != 2) {
+			fprintf(stderr, "mock: bad MOCK_LATENCY at \"%s\"\n", p);
+			break;
+		}
+		snprintf(latencies[nlatencies].name,
+				sizeof(latencies[nlatencies].name), "%s", name);
+		latencies[nlatencies].ns = us * 1000ull;
+		nlatencies++;
+
+		p += n;
+		if (*p == ',')
+			p++;
+	}
+}
+
+uint64_t mock_latency_ns(const char *name)
+{
+	uint64_t ns = 0;
+	size_t len;
+	int i;
+
+	mock_lock();
+	if (nlatencies < 0)
+		parse_latencies();
+	for (i = 0; i < nlatencies; i++) {
+		len = strlen(latencies[i].name);
+		if (len && latencies[i].name[len - 1] == '*' ?
+		    !strncmp(name, latencies[i].name, len - 1) :
+		    !strcmp(name, latencies[i].name)) {
+			ns = latencies[i].ns;
+			break;
+		}
+	}
+	mock_unlock();
+
+	return ns;
+}
+
+void mock_enter(const char *func)
+{
+	uint64_t ns;
+	int i;
+
+	current_call = func;
+
+	mock_lock();
+	for (i = 0; i < ncalls; i++)
+		if (calls[i].name == func || !strcmp(calls[i].name, func))
+			break;
+	if (i == ncalls && ncalls < MAX_CALLS)
+		calls[ncalls++].name = func;
+	if (i < MAX_CALLS)
+		calls[i].count++;
+	mock_unlock();
+
+	ns = mock_latency_ns(func);
+	if (ns)
+		mock_sleep_until(mock_now_ns() + ns);
+}
+
+static struct mock_obj *find(uintptr_t key, bool is_id, const char *kind)
+{
+	struct mock_obj *o = NULL;
+	int i;
+
+	/* the newest, a reused address matches its live object */
+	for (i = 0; i < nobjs; i++)
+		if (objs[i].key == key && objs[i].is_id == is_id &&
+		    (!is_id || !strcmp(objs[i].kind, kind)) &&
+		    (!o || objs[i].serial > o->serial))
+			o = &objs[i];
+	return o;
+}
+
+static void track(const char *kind, uintptr_t key, bool is_id)
+{
+	struct mock_obj *o;
+
+	if (nobjs == cap_objs) {
+		cap_objs = cap_objs ? cap_objs * 2 : 4 * QUARANTINE;
+		objs = realloc(objs, cap_objs * sizeof(*objs));
+		if (!objs)
+			abort();
+		/* touch it all now, not page by page as the quarantine fills */
+		memset(objs + nobjs, 0, (cap_objs - nobjs) * sizeof(*objs));
+	}
+	o = &objs[nobjs++];
+	o->kind = kind;
+	o->key = key;
+	o->is_id = is_id;
+	o->dead = false;
+	o->serial = ++serial;
+	o->origin = current_call ? current_call : "?";
+}
+
+/* o is dead: quarantine it, and drop the oldest one from the quarantine */
+static void bury(struct mock_obj *o)
+{
+	uintptr_t key = quarantine[quarantine_head].key;
+	bool is_id = quarantine[quarantine_head].is_id;
+	int i;
+
+	o->dead = true;
+	if (!o->is_id)
+		free((void *)o->key);
+	quarantine[quarantine_head].key = o->key;
+	quarantine[quarantine_head].is_id = o->is_id;
+	quarantine_head = (quarantine_head + 1) % QUARANTINE;
+
+	if (!key)
+		return;
+	for (i = 0; i < nobjs; i++) {
+		if (objs[i].key == key && objs[i].is_id == is_id && objs[i].dead) {
+			objs[i] = objs[--nobjs];
+			break;
+		}
+	}
+}
+
+void *mock_alloc(const char *kind, size_t size)
+{
+	void *p = calloc(1, size);
+
+	if (!p)
+		return NULL;
+
+	mock_lock();
+	track(kind, (uintptr_t)p, false);
+	mock_unlock();
+
+	return p;
+}
+
+static int check(struct mock_obj *o, const char *kind, const char *func,
+		const char *what, uintptr_t key, bool is_id)
+{
+	if (!o) {
+		mock_error("%s: %s %s %#lx that was never created", func, what,
+				kind, (unsigned long)key);
+		return -1;
+	}
+	if (o->dead) {
+		mock_error("%s: %s %s %#lx that %s", func, what, o->kind,
+				(unsigned long)key, is_id ? "was freed" :
+				"was freed (double free or use after free)");
+		return -1;
+	}
+	if (strcmp(o->kind, kind)) {
+		mock_error("%s: %s %s %#lx as a %s", func, what, o->kind,
+				(unsigned long)key, kind);
+		return -1;
+	}
+	return 0;
+}
+
+int mock_free(const char *kind, void *p, const char *func)
+{
+	struct mock_obj *o;
+	int ret;
+
+	if (!p)
+		return 0;
+
+	mock_lock();
+	o = find((uintptr_t)p, false, kind);
+	ret = check(o, kind, func, "frees", (uintptr_t)p, false);
+	if (!ret)
+		bury(o);
+	mock_unlock();
+
+	return ret;
+}
+
+bool mock_live(const char *kind, const void *p, const char *func)
+{
+	int ret;
+
+	mock_lock();
+	ret = check(find((uintptr_t)p, false, kind), kind, func, "uses",
+			(uintptr_t)p, false);
+	mock_unlock();
+
+	return !ret;
+}
+
+uint32_t mock_new_id(const char *kind)
+{
+	uint32_t id;
+
+	mock_lock();
+	id = next_id++;
+	track(kind, id, true);
+	mock_unlock();
+
+	return id;
+}
+
+int mock_free_id(const char *kind, uint32_t id, const char *func)
+{
+	struct mock_obj *o;
+	int ret;
+
+	mock_lock();
+	o = find(id, true, kind);
+	ret = check(o, kind, func, "frees", id, true);
+	if (!ret)
+		bury(o);
+	mock_unlock();
+
+	return ret;
+}
+
+bool mock_live_id(const char *kind, uint32_t id, const char *func)
+{
+	int ret;
+
+	mock_lock();
+	ret = check(find(id, true, kind), kind, func, "uses", id, true);
+	mock_unlock();
+
+	return !ret;
+}
+
+/* leaks and errors at exit, and with MOCK_VERBOSE the call counts */
+static void __attribute__((destructor)) mock_report(void)
+{
+	unsigned int leaks = 0;
+	int i;
+
+	fflush(stdout);
+	for (i = 0; i < nobjs; i++) {
+		if (objs[i].dead)
+			continue;
+		fprintf(stderr, "mock: leak: %s %#lx from %s\n", objs[i].kind,
+				(unsigned long)objs[i].key, objs[i].origin);
+		leaks++;
+	}
+
+	if (atoi(mock_env("MOCK_VERBOSE", "0")))
+		for (i = 0; i < ncalls; i++)
+			fprintf(stderr, "mock: %-40s %10llu calls\n", calls[i].name,
+					(unsigned long long)calls[i].count);
+
+	if (leaks || errors) {
+		fprintf(stderr, "mock: %u leaks, %u errors\n", leaks, errors);
+		_exit(MOCK_EXIT_STATUS);
+	}
+}
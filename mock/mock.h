@@ -0,0 +1,105 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _KMSCUBE_MOCK_H_
+#define _KMSCUBE_MOCK_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Stand-in for libdrm, libgbm, libEGL, libGLESv2 and libudev, so the
+ * lifecycle logic of the harness runs on any Linux box (make native).
+ * One simulated device with MOCK_CONNECTORS connected displays, each
+ * with its own CRTC, encoder, primary plane and MOCK_OVERLAYS overlay
+ * planes with a mutable zpos, the modes in MOCK_MODES and vblanks at
+ * their refresh rate.  Atomic commits take IN_FENCE_FD and OUT_FENCE_PTR
+ * fences, signaled right away, and EGL has native fence syncs to match.
+ * Dumb buffers can be created and mapped, the mock's mmap() and munmap()
+ * stand in for the kernel's at their offsets.  The device node is
+ * MOCK_DEVNODE, /dev/null by default: the fd is real so select() and
+ * close() work, but nothing is ever read from it.
+ *
+ * Every object handed out is tracked.  Freeing one twice, freeing it as
+ * the wrong kind or using it after it was freed is reported as an error
+ * when it happens, and whatever is still alive at exit as a leak; either
+ * turns the exit status into MOCK_EXIT_STATUS.
+ *
+ * Environment:
+ *	MOCK_CONNECTORS=<n>		connected displays [1]
+ *	MOCK_MODES=<w>x<h>@<hz>,...	modes of each connector [1920x1080@60,1280x720@60]
+ *	MOCK_OVERLAYS=<n>		overlay planes per CRTC, up to 3 [2]
+ *	MOCK_ATOMIC=0			no DRM_CLIENT_CAP_ATOMIC
+ *	MOCK_MODIFIERS=0		no IN_FORMATS, implicit modifiers only
+ *	MOCK_LATENCY=<call>=<us>,...	time a call takes; <call> may end in
+ *					'*', "flip" delays flip completion and
+ *					"gpu" is the GPU time of each draw
+ *	MOCK_DEVNODE=<path>		device node to open [/dev/null]
+ *	MOCK_VERBOSE=1			call counts at exit
+ */
+#define MOCK_EXIT_STATUS	(3)
+
+/* object lifetime tracking, kind is a string literal naming the type */
+void *mock_alloc(const char *kind, size_t size);
+int mock_free(const char *kind, void *p, const char *func);
+bool mock_live(const char *kind, const void *p, const char *func);
+uint32_t mock_new_id(const char *kind);
+int mock_free_id(const char *kind, uint32_t id, const char *func);
+bool mock_live_id(const char *kind, uint32_t id, const char *func);
+
+/* entry of every stand-in call: counts it and takes its latency */
+void mock_enter(const char *func);
+uint64_t mock_latency_ns(const char *name);
+
+void mock_error(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void mock_lock(void);
+void mock_unlock(void);
+
+const char *mock_env(const char *name, const char *def);
+uint64_t mock_now_ns(void);
+void mock_sleep_until(uint64_t ns);
+
+/* window surfaces of the EGL stand-in on the gbm_surfaces, see mock_gbm.c */
+struct gbm_surface;
+int mock_surface_bind(struct gbm_surface *s, uint32_t format,
+		uint32_t *width, uint32_t *height);
+void mock_surface_unbind(struct gbm_surface *s);
+int mock_surface_swap(struct gbm_surface *s);
+
+/* GL state of the calling thread's current context, see mock_egl.c */
+#define MOCK_QUERIES	(64)
+
+struct mock_gl {
+	float clear[4];
+	uint64_t gpu_ns;		/* GPU time of the draws so far */
+	uint32_t next_name;
+	uint64_t query_start[MOCK_QUERIES];
+	uint64_t query_ns[MOCK_QUERIES];
+};
+
+struct mock_gl *mock_gl_current(const char *func);
+
+/* the simulated device, see mock_drm.c */
+int mock_connectors(void);
+const char *mock_devnode(void);
+
+#endif /* _KMSCUBE_MOCK_H_ */
@@ -0,0 +1,1358 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+
+#include "mock.h"
+
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+
+#define MAX_CONNECTORS	(4)
+#define MAX_OVERLAYS	(3)
+#define MAX_PLANES	(MAX_CONNECTORS * (1 + MAX_OVERLAYS))
+#define MAX_MODES	(8)
+#define MAX_BLOBS	(64)
+#define MAX_DUMBS	(16)
+
+/*
+ * The fixed objects: one CRTC, connector and encoder per display, and
+ * its primary plane followed by its overlay planes.
+ */
+#define CRTC_ID(i)	(100 + (i))
+#define CONNECTOR_ID(i)	(200 + (i))
+#define ENCODER_ID(i)	(300 + (i))
+#define PLANE_ID(i)	(400 + (i))
+#define IN_FORMATS_ID	(500)
+#define OVERLAY_IN_FORMATS_ID	(501)
+
+/* the fake mmap() offset of dumb buffer i */
+#define DUMB_OFFSET(i)	((uint64_t)((i) + 1) << 32)
+
+struct mock_mode {
+	uint16_t w, h;
+	uint32_t hz;
+};
+
+enum {
+	PROP_TYPE = 1,
+	PROP_FB_ID,
+	PROP_CRTC_ID,
+	PROP_SRC_X,
+	PROP_SRC_Y,
+	PROP_SRC_W,
+	PROP_SRC_H,
+	PROP_CRTC_X,
+	PROP_CRTC_Y,
+	PROP_CRTC_W,
+	PROP_CRTC_H,
+	PROP_IN_FORMATS,
+	PROP_FB_DAMAGE_CLIPS,
+	PROP_MODE_ID,
+	PROP_ACTIVE,
+	PROP_ZPOS,
+	PROP_IN_FENCE_FD,
+	PROP_OUT_FENCE_PTR,
+	PROP_COUNT
+};
+
+static const struct {
+	const char *name;
+	uint32_t flags;
+} props[PROP_COUNT] = {
+	[PROP_TYPE]		= { "type", DRM_MODE_PROP_ENUM | DRM_MODE_PROP_IMMUTABLE },
+	[PROP_FB_ID]		= { "FB_ID", DRM_MODE_PROP_OBJECT | DRM_MODE_PROP_ATOMIC },
+	[PROP_CRTC_ID]		= { "CRTC_ID", DRM_MODE_PROP_OBJECT | DRM_MODE_PROP_ATOMIC },
+	[PROP_SRC_X]		= { "SRC_X", DRM_MODE_PROP_RANGE | DRM_MODE_PROP_ATOMIC },
+	[PROP_SRC_Y]		= { "SRC_Y", DRM_MODE_PROP_RANGE | DRM_MODE_PROP_ATOMIC },
+	[PROP_SRC_W]		= { "SRC_W", DRM_MODE_PROP_RANGE | DRM_MODE_PROP_ATOMIC },
+	[PROP_SRC_H]		= { "SRC_H", DRM_MODE_PROP_RANGE | DRM_MODE_PROP_ATOMIC },
+	[PROP_CRTC_X]		= { "CRTC_X", DRM_MODE_PROP_SIGNED_RANGE | DRM_MODE_PROP_ATOMIC },
+	[PROP_CRTC_Y]		= { "CRTC_Y", DRM_MODE_PROP_SIGNED_RANGE | DRM_MODE_PROP_ATOMIC },
+	[PROP_CRTC_W]		= { "CRTC_W", DRM_MODE_PROP_RANGE | DRM_MODE_PROP_ATOMIC },
+	[PROP_CRTC_H]		= { "CRTC_H", DRM_MODE_PROP_RANGE | DRM_MODE_PROP_ATOMIC },
+	[PROP_IN_FORMATS]	= { "IN_FORMATS", DRM_MODE_PROP_BLOB | DRM_MODE_PROP_IMMUTABLE },
+	[PROP_FB_DAMAGE_CLIPS]	= { "FB_DAMAGE_CLIPS", DRM_MODE_PROP_BLOB | DRM_MODE_PROP_ATOMIC },
+	[PROP_MODE_ID]		= { "MODE_ID", DRM_MODE_PROP_BLOB | DRM_MODE_PROP_ATOMIC },
+	[PROP_ACTIVE]		= { "ACTIVE", DRM_MODE_PROP_RANGE | DRM_MODE_PROP_ATOMIC },
+	[PROP_ZPOS]		= { "zpos", DRM_MODE_PROP_RANGE | DRM_MODE_PROP_ATOMIC },
+	[PROP_IN_FENCE_FD]	= { "IN_FENCE_FD", DRM_MODE_PROP_SIGNED_RANGE | DRM_MODE_PROP_ATOMIC },
+	[PROP_OUT_FENCE_PTR]	= { "OUT_FENCE_PTR", DRM_MODE_PROP_RANGE | DRM_MODE_PROP_ATOMIC },
+};
+
+/* IN_FORMATS last, it goes away with MOCK_MODIFIERS=0 */
+static const int plane_props[] = {
+	PROP_TYPE, PROP_FB_ID, PROP_CRTC_ID, PROP_SRC_X, PROP_SRC_Y,
+	PROP_SRC_W, PROP_SRC_H, PROP_CRTC_X, PROP_CRTC_Y, PROP_CRTC_W,
+	PROP_CRTC_H, PROP_FB_DAMAGE_CLIPS, PROP_ZPOS, PROP_IN_FENCE_FD,
+	PROP_IN_FORMATS,
+};
+static const int crtc_props[] = { PROP_MODE_ID, PROP_ACTIVE, PROP_OUT_FENCE_PTR };
+static const int connector_props[] = { PROP_CRTC_ID };
+
+static const uint32_t plane_formats[] = {
+	DRM_FORMAT_XRGB8888, DRM_FORMAT_ARGB8888, DRM_FORMAT_RGB565,
+};
+
+/* video goes on the overlays */
+static const uint32_t overlay_formats[] = {
+	DRM_FORMAT_XRGB8888, DRM_FORMAT_ARGB8888, DRM_FORMAT_NV12,
+};
+
+struct crtc {
+	uint64_t prop[PROP_COUNT];	/* MODE_ID, ACTIVE */
+	drmModeModeInfo mode;
+	bool mode_valid;
+	uint32_t fb;
+	uint64_t t0, period;		/* vblank k is at t0 + k * period */
+	bool pending;
+	uint64_t due;
+	unsigned int seq;
+	void *user_data;
+};
+
+static struct {
+	pthread_once_t once;
+	int nconn;
+	struct mock_mode modes[MAX_MODES];
+	int nmodes;
+	int noverlays;
+	bool atomic, modifiers;
+	const char *devnode;
+
+	struct crtc crtc[MAX_CONNECTORS];
+	uint64_t plane[MAX_PLANES][PROP_COUNT];
+	uint64_t connector[MAX_CONNECTORS][PROP_COUNT];
+
+	struct {
+		uint32_t id;
+		size_t len;
+		void *data;
+	} blob[MAX_BLOBS];
+
+	/* a destroyed dumb buffer lives on until its last munmap() */
+	struct {
+		uint32_t handle;
+		uint64_t size;
+		void *data;
+		int maps;
+		bool destroyed;
+	} dumb[MAX_DUMBS];
+} kms = { .once = PTHREAD_ONCE_INIT };
+
+static int plane_crtc(int p)
+{
+	return p / (1 + kms.noverlays);
+}
+
+static bool plane_primary(int p)
+{
+	return !(p % (1 + kms.noverlays));
+}
+
+static int primary_plane(int crtc)
+{
+	return crtc * (1 + kms.noverlays);
+}
+
+static void parse_config(void)
+{
+	const char *p = mock_env("MOCK_MODES", "1920x1080@60,1280x720@60");
+	unsigned int w, h, hz;
+	int i, n;
+
+	kms.nconn = atoi(mock_env("MOCK_CONNECTORS", "1"));
+	if (kms.nconn < 0)
+		kms.nconn = 0;
+	if (kms.nconn > MAX_CONNECTORS)
+		kms.nconn = MAX_CONNECTORS;
+
+	while (*p && kms.nmodes < MAX_MODES &&
+	       sscanf(p, "%ux%u@%u%n", &w, &h, &hz, &n) == 3) {
+		kms.modes[kms.nmodes].w = w;
+		kms.modes[kms.nmodes].h = h;
+		kms.modes[kms.nmodes].hz = hz ? hz : 60;
+		kms.nmodes++;
+		p += n;
+		if (*p == ',')
+			p++;
+	}
+
+	kms.noverlays = atoi(mock_env("MOCK_OVERLAYS", "2"));
+	if (kms.noverlays < 0)
+		kms.noverlays = 0;
+	if (kms.noverlays > MAX_OVERLAYS)
+		kms.noverlays = MAX_OVERLAYS;
+
+	kms.atomic = atoi(mock_env("MOCK_ATOMIC", "1"));
+	kms.modifiers = atoi(mock_env("MOCK_MODIFIERS", "1"));
+	kms.devnode = mock_env("MOCK_DEVNODE", "/dev/null");
+
+	/* stacked in plane order, the primary at the bottom */
+	for (i = 0; i < kms.nconn * (1 + kms.noverlays); i++) {
+		kms.plane[i][PROP_TYPE] = plane_primary(i) ?
+				DRM_PLANE_TYPE_PRIMARY : DRM_PLANE_TYPE_OVERLAY;
+		kms.plane[i][PROP_IN_FORMATS] = plane_primary(i) ?
+				IN_FORMATS_ID : OVERLAY_IN_FORMATS_ID;
+		kms.plane[i][PROP_ZPOS] = i % (1 + kms.noverlays);
+		kms.plane[i][PROP_IN_FENCE_FD] = (uint64_t)-1;
+	}
+}
+
+static void config(void)
+{
+	pthread_once(&kms.once, parse_config);
+}
+
+int mock_connectors(void)
+{
+	config();
+	return kms.nconn;
+}
+
+const char *mock_devnode(void)
+{
+	config();
+	return kms.devnode;
+}
+
+/* CVT-ish blanking, only the refresh rate it gives matters */
+static void fill_mode(drmModeModeInfo *m, const struct mock_mode *mm, bool preferred)
+{
+	memset(m, 0, sizeof(*m));
+	m->hdisplay = mm->w;
+	m->hsync_start = mm->w + 48;
+	m->hsync_end = mm->w + 80;
+	m->htotal = mm->w + 160;
+	m->vdisplay = mm->h;
+	m->vsync_start = mm->h + 3;
+	m->vsync_end = mm->h + 8;
+	m->vtotal = mm->h + 30;
+	m->vrefresh = mm->hz;
+	m->clock = (uint64_t)m->htotal * m->vtotal * mm->hz / 1000;
+	m->type = preferred ? 0x48 : 0x40;	/* DRIVER | PREFERRED */
+	snprintf(m->name, sizeof(m->name), "%ux%u", mm->w, mm->h);
+}
+
+/* libdrm returns -errno and leaves errno set */
+static int fail(int err)
+{
+	errno = err;
+	return -err;
+}
+
+static int index_of(uint32_t id, uint32_t base)
+{
+	config();
+	if (id < base || id >= base + kms.nconn)
+		return -1;
+	return id - base;
+}
+
+static int plane_index(uint32_t id)
+{
+	config();
+	if (id < PLANE_ID(0) || id >= PLANE_ID(kms.nconn * (1 + kms.noverlays)))
+		return -1;
+	return id - PLANE_ID(0);
+}
+
+/* the values a property takes, as the kernel reports and checks them */
+static void prop_range(int prop, uint64_t *min, uint64_t *max)
+{
+	*min = 0;
+	*max = UINT32_MAX;
+	if (prop == PROP_ACTIVE) {
+		*max = 1;
+	} else if (prop == PROP_ZPOS) {
+		*max = kms.noverlays;
+	} else if (prop == PROP_OUT_FENCE_PTR) {
+		*max = UINT64_MAX;
+	} else if (prop == PROP_IN_FENCE_FD) {
+		*min = (uint64_t)-1;
+		*max = INT32_MAX;
+	} else if (props[prop].flags & DRM_MODE_PROP_SIGNED_RANGE) {
+		*min = (uint64_t)(int64_t)INT32_MIN;
+		*max = INT32_MAX;
+	}
+}
+
+static bool prop_valid(int prop, uint64_t value)
+{
+	uint64_t min, max;
+
+	if (!(props[prop].flags & (DRM_MODE_PROP_RANGE | DRM_MODE_PROP_SIGNED_RANGE)))
+		return true;
+	prop_range(prop, &min, &max);
+	if (props[prop].flags & DRM_MODE_PROP_SIGNED_RANGE)
+		return (int64_t)value >= (int64_t)min && (int64_t)value <= (int64_t)max;
+	return value >= min && value <= max;
+}
+
+/* property blobs created by the client */
+static int find_blob(uint32_t id)
+{
+	int i;
+
+	for (i = 0; i < MAX_BLOBS; i++)
+		if (kms.blob[i].id == id)
+			return i;
+	return -1;
+}
+
+static void *in_formats(bool overlay, size_t *len)
+{
+	static struct {
+		struct drm_format_modifier_blob head;
+		uint32_t formats[ARRAY_SIZE(plane_formats)];
+		struct drm_format_modifier mods[2];
+	} blobs[2];
+	const uint32_t *formats = overlay ? overlay_formats : plane_formats;
+	typeof(&blobs[0]) blob = &blobs[overlay];
+	int i;
+
+	blob->head.version = FORMAT_BLOB_CURRENT;
+	blob->head.count_formats = ARRAY_SIZE(plane_formats);
+	blob->head.formats_offset = offsetof(typeof(*blob), formats);
+	blob->head.count_modifiers = 2;
+	blob->head.modifiers_offset = offsetof(typeof(*blob), mods);
+	for (i = 0; i < ARRAY_SIZE(plane_formats); i++)
+		blob->formats[i] = formats[i];
+	/* linear for all, X tiling for the 32 bpp formats */
+	blob->mods[0].formats = 0x7;
+	blob->mods[0].modifier = DRM_FORMAT_MOD_LINEAR;
+	blob->mods[1].formats = 0x3;
+	blob->mods[1].modifier = I915_FORMAT_MOD_X_TILED;
+
+	*len = sizeof(*blob);
+	return blob;
+}
+
+static uint64_t *object_props(uint32_t obj_id, uint32_t obj_type,
+		const int **list, int *count)
+{
+	int i;
+
+	if ((obj_type == DRM_MODE_OBJECT_ANY || obj_type == DRM_MODE_OBJECT_CRTC) &&
+	    (i = index_of(obj_id, CRTC_ID(0))) >= 0) {
+		*list = crtc_props;
+		*count = ARRAY_SIZE(crtc_props);
+		return kms.crtc[i].prop;
+	}
+	if ((obj_type == DRM_MODE_OBJECT_ANY || obj_type == DRM_MODE_OBJECT_PLANE) &&
+	    (i = plane_index(obj_id)) >= 0) {
+		*list = plane_props;
+		*count = ARRAY_SIZE(plane_props) - !kms.modifiers;
+		return kms.plane[i];
+	}
+	if ((obj_type == DRM_MODE_OBJECT_ANY || obj_type == DRM_MODE_OBJECT_CONNECTOR) &&
+	    (i = index_of(obj_id, CONNECTOR_ID(0))) >= 0) {
+		*list = connector_props;
+		*count = ARRAY_SIZE(connector_props);
+		return kms.connector[i];
+	}
+	return NULL;
+}
+
+static uint64_t vblank_period(const drmModeModeInfo *m)
+{
+	if (!m->htotal || !m->vtotal || !m->clock)
+		return 1000000000ull / 60;
+	/* clock is in kHz */
+	return 1000000ull * m->htotal * m->vtotal / m->clock;
+}
+
+static void set_mode(struct crtc *c, const drmModeModeInfo *mode)
+{
+	if (mode) {
+		c->mode = *mode;
+		c->mode_valid = true;
+		c->period = vblank_period(mode);
+		c->t0 = mock_now_ns();
+	} else {
+		c->mode_valid = false;
+	}
+}
+
+/* the flip completes at the first vblank after the flip latency */
+static void queue_flip(struct crtc *c, void *user_data)
+{
+	uint64_t at = mock_now_ns() + mock_latency_ns("flip");
+	uint64_t k = (at - c->t0) / c->period + 1;
+
+	c->pending = true;
+	c->due = c->t0 + k * c->period;
+	c->seq = k;
+	c->user_data = user_data;
+}
+
+int drmSetClientCap(int fd, uint64_t capability, uint64_t value)
+{
+	mock_enter(__func__);
+	config();
+
+	if (capability == DRM_CLIENT_CAP_ATOMIC && !kms.atomic)
+		return fail(EOPNOTSUPP);
+	return 0;
+}
+
+int drmGetCap(int fd, uint64_t capability, uint64_t *value)
+{
+	mock_enter(__func__);
+
+	switch (capability) {
+	case DRM_CAP_DUMB_BUFFER:
+	case DRM_CAP_PRIME:
+	case DRM_CAP_TIMESTAMP_MONOTONIC:
+	case DRM_CAP_ADDFB2_MODIFIERS:
+	case DRM_CAP_CRTC_IN_VBLANK_EVENT:
+		*value = 1;
+		return 0;
+	default:
+		*value = 0;
+		return fail(EINVAL);
+	}
+}
+
+drmVersionPtr drmGetVersion(int fd)
+{
+	static char name[] = "mock", date[] = "20260101", desc[] = "kmscube stand-in";
+	drmVersionPtr v;
+
+	mock_enter(__func__);
+	v = mock_alloc("drmVersion", sizeof(*v));
+	if (!v)
+		return NULL;
+	v->version_major = 1;
+	v->name = name;
+	v->name_len = strlen(name);
+	v->date = date;
+	v->date_len = strlen(date);
+	v->desc = desc;
+	v->desc_len = strlen(desc);
+	return v;
+}
+
+void drmFreeVersion(drmVersionPtr v)
+{
+	mock_enter(__func__);
+	mock_free("drmVersion", v, __func__);
+}
+
+int drmClose(int fd)
+{
+	mock_enter(__func__);
+	return close(fd);
+}
+
+/* the only node there is, primary and render */
+char *drmGetDeviceNameFromFd2(int fd)
+{
+	mock_enter(__func__);
+	return strdup(mock_devnode());
+}
+
+char *drmGetRenderDeviceNameFromFd(int fd)
+{
+	mock_enter(__func__);
+	return strdup(mock_devnode());
+}
+
+static int find_dumb(uint32_t handle)
+{
+	int i;
+
+	for (i = 0; i < MAX_DUMBS; i++)
+		if (kms.dumb[i].handle == handle && !kms.dumb[i].destroyed)
+			return i;
+	return -1;
+}
+
+/* the memory of dumb buffer i once it is neither alive nor mapped, locked */
+static void *dumb_gone(int i)
+{
+	void *data = kms.dumb[i].data;
+
+	if (!kms.dumb[i].destroyed || kms.dumb[i].maps)
+		return NULL;
+	memset(&kms.dumb[i], 0, sizeof(kms.dumb[i]));
+	return data;
+}
+
+static int create_dumb(struct drm_mode_create_dumb *create)
+{
+	void *data;
+	int i;
+
+	if (!create->width || !create->height || !create->bpp) {
+		errno = EINVAL;
+		return -1;
+	}
+	create->pitch = (create->width * ((create->bpp + 7) / 8) + 63) & ~63;
+	create->size = (uint64_t)create->pitch * create->height;
+
+	data = mock_alloc("dumb buffer", create->size);
+	if (!data) {
+		errno = ENOMEM;
+		return -1;
+	}
+	create->handle = mock_new_id("GEM handle");
+
+	mock_lock();
+	i = find_dumb(0);
+	if (i >= 0) {
+		kms.dumb[i].handle = create->handle;
+		kms.dumb[i].size = create->size;
+		kms.dumb[i].data = data;
+	}
+	mock_unlock();
+
+	if (i < 0) {
+		mock_error("drmIoctl: more than %d dumb buffers", MAX_DUMBS);
+		mock_free_id("GEM handle", create->handle, "drmIoctl");
+		mock_free("dumb buffer", data, "drmIoctl");
+		errno = ENOSPC;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int map_dumb(struct drm_mode_map_dumb *map)
+{
+	int i;
+
+	mock_lock();
+	i = find_dumb(map->handle);
+	mock_unlock();
+	if (i < 0 || !mock_live_id("GEM handle", map->handle, "drmIoctl")) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	map->offset = DUMB_OFFSET(i);
+	return 0;
+}
+
+static int destroy_dumb(struct drm_mode_destroy_dumb *destroy)
+{
+	void *data;
+	int i;
+
+	mock_lock();
+	i = find_dumb(destroy->handle);
+	mock_unlock();
+	if (i < 0 || mock_free_id("GEM handle", destroy->handle, "drmIoctl")) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	mock_lock();
+	kms.dumb[i].destroyed = true;
+	data = dumb_gone(i);
+	mock_unlock();
+	mock_free("dumb buffer", data, "drmIoctl");
+
+	return 0;
+}
+
+/* dumb buffers, the only ioctls the harness issues itself */
+int drmIoctl(int fd, unsigned long request, void *arg)
+{
+	mock_enter(__func__);
+
+	switch (request) {
+	case DRM_IOCTL_MODE_CREATE_DUMB:
+		return create_dumb(arg);
+	case DRM_IOCTL_MODE_MAP_DUMB:
+		return map_dumb(arg);
+	case DRM_IOCTL_MODE_DESTROY_DUMB:
+		return destroy_dumb(arg);
+	default:
+		errno = ENOTTY;
+		return -1;
+	}
+}
+
+/*
+ * A dumb buffer's offset maps its memory, whatever the fd; any other
+ * mapping goes to the kernel.
+ */
+void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+	void *ptr = MAP_FAILED;
+	int i;
+
+	for (i = 0; i < MAX_DUMBS; i++)
+		if ((uint64_t)offset == DUMB_OFFSET(i))
+			break;
+	if (i == MAX_DUMBS)
+		return (void *)syscall(SYS_mmap, addr, length, prot, flags, fd, offset);
+
+	mock_enter(__func__);
+	mock_lock();
+	if (!kms.dumb[i].data || kms.dumb[i].destroyed) {
+		errno = EINVAL;
+	} else if (length > kms.dumb[i].size) {
+		errno = ENXIO;
+	} else {
+		kms.dumb[i].maps++;
+		ptr = kms.dumb[i].data;
+	}
+	mock_unlock();
+
+	return ptr;
+}
+
+int munmap(void *addr, size_t length)
+{
+	void *data;
+	int i;
+
+	mock_lock();
+	for (i = 0; i < MAX_DUMBS; i++) {
+		if (!kms.dumb[i].maps || kms.dumb[i].data != addr)
+			continue;
+		kms.dumb[i].maps--;
+		data = dumb_gone(i);
+		mock_unlock();
+		mock_enter(__func__);
+		mock_free("dumb buffer", data, __func__);
+		return 0;
+	}
+	mock_unlock();
+
+	return syscall(SYS_munmap, addr, length);
+}
+
+int drmPrimeHandleToFD(int fd, uint32_t handle, uint32_t flags, int *prime_fd)
+{
+	mock_enter(__func__);
+	if (!mock_live_id("GEM handle", handle, __func__))
+		return fail(ENOENT);
+	*prime_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+	return *prime_fd < 0 ? fail(errno) : 0;
+}
+
+drmModeResPtr drmModeGetResources(int fd)
+{
+	drmModeResPtr res;
+	uint32_t *ids;
+	int i, n;
+
+	mock_enter(__func__);
+	n = mock_connectors();
+
+	res = mock_alloc("drmModeRes", sizeof(*res) + 3 * n * sizeof(uint32_t));
+	if (!res)
+		return NULL;
+	ids = (uint32_t *)(res + 1);
+	res->count_crtcs = res->count_connectors = res->count_encoders = n;
+	res->crtcs = ids;
+	res->connectors = ids + n;
+	res->encoders = ids + 2 * n;
+	for (i = 0; i < n; i++) {
+		res->crtcs[i] = CRTC_ID(i);
+		res->connectors[i] = CONNECTOR_ID(i);
+		res->encoders[i] = ENCODER_ID(i);
+	}
+	res->min_width = res->min_height = 1;
+	res->max_width = res->max_height = 8192;
+
+	return res;
+}
+
+void drmModeFreeResources(drmModeResPtr ptr)
+{
+	mock_enter(__func__);
+	mock_free("drmModeRes", ptr, __func__);
+}
+
+drmModeConnectorPtr drmModeGetConnector(int fd, uint32_t connector_id)
+{
+	const int n = ARRAY_SIZE(connector_props);
+	drmModeConnectorPtr c;
+	int i = index_of(connector_id, CONNECTOR_ID(0)), j;
+
+	mock_enter(__func__);
+	if (i < 0) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	c = mock_alloc("drmModeConnector", sizeof(*c) +
+			kms.nmodes * sizeof(*c->modes) +
+			n * (sizeof(*c->props) + sizeof(*c->prop_values)) +
+			sizeof(*c->encoders));
+	if (!c)
+		return NULL;
+	c->modes = (drmModeModeInfoPtr)(c + 1);
+	c->prop_values = (uint64_t *)(c->modes + kms.nmodes);
+	c->props = (uint32_t *)(c->prop_values + n);
+	c->encoders = c->props + n;
+
+	c->connector_id = connector_id;
+	c->connector_type = DRM_MODE_CONNECTOR_HDMIA;
+	c->connector_type_id = i + 1;
+	c->connection = DRM_MODE_CONNECTED;
+	c->mmWidth = 520;
+	c->mmHeight = 290;
+	c->subpixel = DRM_MODE_SUBPIXEL_UNKNOWN;
+	c->count_modes = kms.nmodes;
+	for (j = 0; j < kms.nmodes; j++)
+		fill_mode(&c->modes[j], &kms.modes[j], !j);
+	c->count_props = n;
+	for (j = 0; j < n; j++) {
+		c->props[j] = connector_props[j];
+		c->prop_values[j] = kms.connector[i][connector_props[j]];
+	}
+	c->count_encoders = 1;
+	c->encoders[0] = ENCODER_ID(i);
+	c->encoder_id = kms.crtc[i].mode_valid ? ENCODER_ID(i) : 0;
+
+	return c;
+}
+
+void drmModeFreeConnector(drmModeConnectorPtr ptr)
+{
+	mock_enter(__func__);
+	mock_free("drmModeConnector", ptr, __func__);
+}
+
+drmModeEncoderPtr drmModeGetEncoder(int fd, uint32_t encoder_id)
+{
+	drmModeEncoderPtr e;
+	int i = index_of(encoder_id, ENCODER_ID(0));
+
+	mock_enter(__func__);
+	if (i < 0) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	e = mock_alloc("drmModeEncoder", sizeof(*e));
+	if (!e)
+		return NULL;
+	e->encoder_id = encoder_id;
+	e->encoder_type = 2;		/* TMDS */
+	e->crtc_id = kms.crtc[i].mode_valid ? CRTC_ID(i) : 0;
+	e->possible_crtcs = (1 << kms.nconn) - 1;
+
+	return e;
+}
+
+void drmModeFreeEncoder(drmModeEncoderPtr ptr)
+{
+	mock_enter(__func__);
+	mock_free("drmModeEncoder", ptr, __func__);
+}
+
+drmModeCrtcPtr drmModeGetCrtc(int fd, uint32_t crtc_id)
+{
+	drmModeCrtcPtr c;
+	int i = index_of(crtc_id, CRTC_ID(0));
+
+	mock_enter(__func__);
+	if (i < 0) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	c = mock_alloc("drmModeCrtc", sizeof(*c));
+	if (!c)
+		return NULL;
+	c->crtc_id = crtc_id;
+	c->buffer_id = kms.crtc[i].fb;
+	c->mode_valid = kms.crtc[i].mode_valid;
+	if (c->mode_valid) {
+		c->mode = kms.crtc[i].mode;
+		c->width = c->mode.hdisplay;
+		c->height = c->mode.vdisplay;
+	}
+	c->gamma_size = 256;
+
+	return c;
+}
+
+void drmModeFreeCrtc(drmModeCrtcPtr ptr)
+{
+	mock_enter(__func__);
+	mock_free("drmModeCrtc", ptr, __func__);
+}
+
+drmModePlaneResPtr drmModeGetPlaneResources(int fd)
+{
+	drmModePlaneResPtr res;
+	int i, n;
+
+	mock_enter(__func__);
+	n = mock_connectors() * (1 + kms.noverlays);
+
+	res = mock_alloc("drmModePlaneRes", sizeof(*res) + n * sizeof(uint32_t));
+	if (!res)
+		return NULL;
+	res->planes = (uint32_t *)(res + 1);
+	res->count_planes = n;
+	for (i = 0; i < n; i++)
+		res->planes[i] = PLANE_ID(i);
+
+	return res;
+}
+
+void drmModeFreePlaneResources(drmModePlaneResPtr ptr)
+{
+	mock_enter(__func__);
+	mock_free("drmModePlaneRes", ptr, __func__);
+}
+
+drmModePlanePtr drmModeGetPlane(int fd, uint32_t plane_id)
+{
+	drmModePlanePtr p;
+	int i = plane_index(plane_id), c;
+
+	mock_enter(__func__);
+	if (i < 0) {
+		errno = ENOENT;
+		return NULL;
+	}
+	c = plane_crtc(i);
+
+	p = mock_alloc("drmModePlane", sizeof(*p) + sizeof(plane_formats));
+	if (!p)
+		return NULL;
+	p->formats = (uint32_t *)(p + 1);
+	p->count_formats = ARRAY_SIZE(plane_formats);
+	memcpy(p->formats, plane_primary(i) ? plane_formats : overlay_formats,
+			sizeof(plane_formats));
+	p->plane_id = plane_id;
+	if (plane_primary(i)) {
+		p->crtc_id = kms.crtc[c].fb ? CRTC_ID(c) : 0;
+		p->fb_id = kms.crtc[c].fb;
+	} else {
+		p->crtc_id = kms.plane[i][PROP_CRTC_ID];
+		p->fb_id = kms.plane[i][PROP_FB_ID];
+	}
+	p->possible_crtcs = 1 << c;
+
+	return p;
+}
+
+void drmModeFreePlane(drmModePlanePtr ptr)
+{
+	mock_enter(__func__);
+	mock_free("drmModePlane", ptr, __func__);
+}
+
+drmModeObjectPropertiesPtr drmModeObjectGetProperties(int fd,
+		uint32_t object_id, uint32_t object_type)
+{
+	drmModeObjectPropertiesPtr p;
+	const int *list;
+	uint64_t *values;
+	int i, n;
+
+	mock_enter(__func__);
+	values = object_props(object_id, object_type, &list, &n);
+	if (!values) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	p = mock_alloc("drmModeObjectProperties", sizeof(*p) +
+			n * (sizeof(*p->props) + sizeof(*p->prop_values)));
+	if (!p)
+		return NULL;
+	p->prop_values = (uint64_t *)(p + 1);
+	p->props = (uint32_t *)(p->prop_values + n);
+	p->count_props = n;
+	for (i = 0; i < n; i++) {
+		p->props[i] = list[i];
+		p->prop_values[i] = values[list[i]];
+	}
+
+	return p;
+}
+
+void drmModeFreeObjectProperties(drmModeObjectPropertiesPtr ptr)
+{
+	mock_enter(__func__);
+	mock_free("drmModeObjectProperties", ptr, __func__);
+}
+
+drmModePropertyPtr drmModeGetProperty(int fd, uint32_t property_id)
+{
+	static const char *type_names[] = { "Overlay", "Primary", "Cursor" };
+	drmModePropertyPtr p;
+	int i;
+
+	mock_enter(__func__);
+	if (!property_id || property_id >= PROP_COUNT) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	p = mock_alloc("drmModeProperty", sizeof(*p) + 2 * sizeof(uint64_t) +
+			ARRAY_SIZE(type_names) * sizeof(*p->enums));
+	if (!p)
+		return NULL;
+	p->values = (uint64_t *)(p + 1);
+	p->enums = (struct drm_mode_property_enum *)(p->values + 2);
+
+	p->prop_id = property_id;
+	p->flags = props[property_id].flags;
+	snprintf(p->name, sizeof(p->name), "%s", props[property_id].name);
+
+	if (property_id == PROP_TYPE) {
+		p->count_enums = ARRAY_SIZE(type_names);
+		for (i = 0; i < p->count_enums; i++) {
+			p->enums[i].value = i;
+			snprintf(p->enums[i].name, sizeof(p->enums[i].name), "%s",
+					type_names[i]);
+		}
+	} else if (p->flags & (DRM_MODE_PROP_RANGE | DRM_MODE_PROP_SIGNED_RANGE)) {
+		p->count_values = 2;
+		prop_range(property_id, &p->values[0], &p->values[1]);
+	}
+
+	return p;
+}
+
+void drmModeFreeProperty(drmModePropertyPtr ptr)
+{
+	mock_enter(__func__);
+	mock_free("drmModeProperty", ptr, __func__);
+}
+
+drmModePropertyBlobPtr drmModeGetPropertyBlob(int fd, uint32_t blob_id)
+{
+	drmModePropertyBlobPtr b;
+	const void *data;
+	size_t len;
+	int i;
+
+	mock_enter(__func__);
+	if (blob_id == IN_FORMATS_ID || blob_id == OVERLAY_IN_FORMATS_ID) {
+		data = in_formats(blob_id == OVERLAY_IN_FORMATS_ID, &len);
+	} else {
+		mock_lock();
+		i = find_blob(blob_id);
+		mock_unlock();
+		if (i < 0 || !mock_live_id("property blob", blob_id, __func__)) {
+			errno = ENOENT;
+			return NULL;
+		}
+		data = kms.blob[i].data;
+		len = kms.blob[i].len;
+	}
+
+	b = mock_alloc("drmModePropertyBlob", sizeof(*b) + len);
+	if (!b)
+		return NULL;
+	b->id = blob_id;
+	b->length = len;
+	b->data = b + 1;
+	memcpy(b->data, data, len);
+
+	return b;
+}
+
+void drmModeFreePropertyBlob(drmModePropertyBlobPtr ptr)
+{
+	mock_enter(__func__);
+	mock_free("drmModePropertyBlob", ptr, __func__);
+}
+
+int drmModeCreatePropertyBlob(int fd, const void *data, size_t size, uint32_t *id)
+{
+	int i;
+
+	mock_enter(__func__);
+	mock_lock();
+	i = find_blob(0);
+	if (i >= 0) {
+		kms.blob[i].data = malloc(size);
+		kms.blob[i].len = size;
+		if (kms.blob[i].data)
+			memcpy(kms.blob[i].data, data, size);
+	}
+	mock_unlock();
+
+	if (i < 0) {
+		mock_error("%s: more than %d property blobs", __func__, MAX_BLOBS);
+		return fail(ENOSPC);
+	}
+	if (!kms.blob[i].data)
+		return fail(ENOMEM);
+
+	*id = kms.blob[i].id = mock_new_id("property blob");
+	return 0;
+}
+
+int drmModeDestroyPropertyBlob(int fd, uint32_t id)
+{
+	int i;
+
+	mock_enter(__func__);
+	if (mock_free_id("property blob", id, __func__))
+		return fail(ENOENT);
+
+	mock_lock();
+	i = find_blob(id);
+	if (i >= 0) {
+		free(kms.blob[i].data);
+		memset(&kms.blob[i], 0, sizeof(kms.blob[i]));
+	}
+	mock_unlock();
+
+	return 0;
+}
+
+static int add_fb(uint32_t width, uint32_t height, uint32_t format,
+		const uint32_t handles[4], const uint32_t pitches[4],
+		uint32_t *buf_id, const char *func)
+{
+	if (!width || !height || !pitches[0])
+		return fail(EINVAL);
+	if (!mock_live_id("GEM handle", handles[0], func))
+		return fail(ENOENT);
+
+	*buf_id = mock_new_id("framebuffer");
+	return 0;
+}
+
+int drmModeAddFB2(int fd, uint32_t width, uint32_t height, uint32_t pixel_format,
+		const uint32_t bo_handles[4], const uint32_t pitches[4],
+		const uint32_t offsets[4], uint32_t *buf_id, uint32_t flags)
+{
+	mock_enter(__func__);
+	return add_fb(width, height, pixel_format, bo_handles, pitches, buf_id,
+			__func__);
+}
+
+int drmModeAddFB2WithModifiers(int fd, uint32_t width, uint32_t height,
+		uint32_t pixel_format, const uint32_t bo_handles[4],
+		const uint32_t pitches[4], const uint32_t offsets[4],
+		const uint64_t modifier[4], uint32_t *buf_id, uint32_t flags)
+{
+	mock_enter(__func__);
+	return add_fb(width, height, pixel_format, bo_handles, pitches, buf_id,
+			__func__);
+}
+
+int drmModeRmFB(int fd, uint32_t buffer_id)
+{
+	int i;
+
+	mock_enter(__func__);
+	if (mock_free_id("framebuffer", buffer_id, __func__))
+		return fail(ENOENT);
+
+	/*
+	 * Like the kernel, removing the scanout buffer turns the CRTC off,
+	 * and removing an overlay's buffer the overlay.
+	 */
+	for (i = 0; i < kms.nconn; i++) {
+		if (kms.crtc[i].fb != buffer_id)
+			continue;
+		kms.crtc[i].fb = 0;
+		kms.plane[primary_plane(i)][PROP_FB_ID] = 0;
+		set_mode(&kms.crtc[i], NULL);
+	}
+	for (i = 0; i < kms.nconn * (1 + kms.noverlays); i++) {
+		if (plane_primary(i) || kms.plane[i][PROP_FB_ID] != buffer_id)
+			continue;
+		kms.plane[i][PROP_FB_ID] = 0;
+		kms.plane[i][PROP_CRTC_ID] = 0;
+	}
+
+	return 0;
+}
+
+int drmModeSetCrtc(int fd, uint32_t crtc_id, uint32_t buffer_id, uint32_t x,
+		uint32_t y, uint32_t *connectors, int count, drmModeModeInfoPtr mode)
+{
+	int i = index_of(crtc_id, CRTC_ID(0));
+	struct crtc *c;
+
+	mock_enter(__func__);
+	if (i < 0)
+		return fail(ENOENT);
+	c = &kms.crtc[i];
+
+	if (!buffer_id) {
+		c->fb = 0;
+		set_mode(c, NULL);
+		return 0;
+	}
+	if (!mode || !count)
+		return fail(EINVAL);
+	if (!mock_live_id("framebuffer", buffer_id, __func__))
+		return fail(ENOENT);
+	if (c->pending)
+		return fail(EBUSY);
+
+	c->fb = buffer_id;
+	set_mode(c, mode);
+	return 0;
+}
+
+int drmModePageFlip(int fd, uint32_t crtc_id, uint32_t fb_id, uint32_t flags,
+		void *user_data)
+{
+	int i = index_of(crtc_id, CRTC_ID(0));
+	struct crtc *c;
+
+	mock_enter(__func__);
+	if (i < 0)
+		return fail(ENOENT);
+	c = &kms.crtc[i];
+
+	if (!c->mode_valid)
+		return fail(EINVAL);
+	if (!mock_live_id("framebuffer", fb_id, __func__))
+		return fail(ENOENT);
+	if (c->pending)
+		return fail(EBUSY);
+
+	c->fb = fb_id;
+	if (flags & DRM_MODE_PAGE_FLIP_EVENT)
+		queue_flip(c, user_data);
+	return 0;
+}
+
+/* sleep to the next flip completion, and deliver those that are due */
+int drmHandleEvent(int fd, drmEventContextPtr evctx)
+{
+	uint64_t due = 0;
+	struct crtc *c;
+	int i;
+
+	mock_enter(__func__);
+	for (i = 0; i < kms.nconn; i++)
+		if (kms.crtc[i].pending && (!due || kms.crtc[i].due < due))
+			due = kms.crtc[i].due;
+	if (!due)
+		return 0;
+	mock_sleep_until(due);
+
+	for (i = 0; i < kms.nconn; i++) {
+		c = &kms.crtc[i];
+		if (!c->pending || c->due > mock_now_ns())
+			continue;
+		c->pending = false;
+		if (evctx->version >= 3 && evctx->page_flip_handler2)
+			evctx->page_flip_handler2(fd, c->seq, c->due / 1000000000ull,
+					c->due % 1000000000ull / 1000, CRTC_ID(i),
+					c->user_data);
+		else if (evctx->page_flip_handler)
+			evctx->page_flip_handler(fd, c->seq, c->due / 1000000000ull,
+					c->due % 1000000000ull / 1000, c->user_data);
+	}
+
+	return 0;
+}
+
+struct _drmModeAtomicReq {
+	int count, cap;
+	struct {
+		uint32_t obj, prop;
+		uint64_t value;
+	} *items;
+};
+
+drmModeAtomicReqPtr drmModeAtomicAlloc(void)
+{
+	mock_enter(__func__);
+	return mock_alloc("drmModeAtomicReq", sizeof(struct _drmModeAtomicReq));
+}
+
+void drmModeAtomicFree(drmModeAtomicReqPtr req)
+{
+	mock_enter(__func__);
+	if (req && mock_live("drmModeAtomicReq", req, __func__))
+		free(req->items);
+	mock_free("drmModeAtomicReq", req, __func__);
+}
+
+int drmModeAtomicAddProperty(drmModeAtomicReqPtr req, uint32_t object_id,
+		uint32_t property_id, uint64_t value)
+{
+	void *items;
+
+	mock_enter(__func__);
+	if (!mock_live("drmModeAtomicReq", req, __func__))
+		return fail(EINVAL);
+
+	if (req->count == req->cap) {
+		req->cap = req->cap ? req->cap * 2 : 16;
+		items = realloc(req->items, req->cap * sizeof(*req->items));
+		if (!items)
+			return fail(ENOMEM);
+		req->items = items;
+	}
+	req->items[req->count].obj = object_id;
+	req->items[req->count].prop = property_id;
+	req->items[req->count].value = value;
+
+	return ++req->count;
+}
+
+/* the value a property of an object has once req is applied */
+static uint64_t value_after(drmModeAtomicReqPtr req, uint32_t obj, int prop,
+		uint64_t value)
+{
+	int i;
+
+	for (i = 0; i < req->count; i++)
+		if (req->items[i].obj == obj && req->items[i].prop == prop)
+			value = req->items[i].value;
+	return value;
+}
+
+/*
+ * Check the request against the objects and properties there are, the
+ * values against their ranges, the framebuffers, blobs and fence fds it
+ * names against those alive, and the overlays it sets up against their
+ * CRTCs; apply it unless it is TEST_ONLY.  Out fences are signaled
+ * right away.
+ */
+int drmModeAtomicCommit(int fd, drmModeAtomicReqPtr req, uint32_t flags,
+		void *user_data)
+{
+	bool touched[MAX_CONNECTORS] = { false }, modeset = false;
+	uint64_t *values, fb, crtc;
+	const int *list;
+	int32_t fence_fd;
+	int i, j, n, k;
+
+	mock_enter(__func__);
+	if (!mock_live("drmModeAtomicReq", req, __func__))
+		return fail(EINVAL);
+
+	for (i = 0; i < req->count; i++) {
+		uint32_t prop = req->items[i].prop;
+		uint64_t value = req->items[i].value;
+
+		values = object_props(req->items[i].obj, DRM_MODE_OBJECT_ANY, &list, &n);
+		if (!values)
+			return fail(ENOENT);
+		for (j = 0; j < n && list[j] != prop; j++)
+			;
+		if (j == n || props[prop].flags & DRM_MODE_PROP_IMMUTABLE ||
+		    !prop_valid(prop, value))
+			return fail(EINVAL);
+
+		if (prop == PROP_FB_ID && value &&
+		    !mock_live_id("framebuffer", value, __func__))
+			return fail(ENOENT);
+		if ((prop == PROP_MODE_ID || prop == PROP_FB_DAMAGE_CLIPS) && value &&
+		    !mock_live_id("property blob", value, __func__))
+			return fail(ENOENT);
+		if (prop == PROP_IN_FENCE_FD && (int64_t)value >= 0 &&
+		    fcntl(value, F_GETFD) < 0) {
+			mock_error("%s: in fence fd %d is not open", __func__, (int)value);
+			return fail(EINVAL);
+		}
+		/* a new mode, or a connector moving to another CRTC */
+		if (prop == PROP_MODE_ID || prop == PROP_ACTIVE ||
+		    (prop == PROP_CRTC_ID &&
+		     index_of(req->items[i].obj, CONNECTOR_ID(0)) >= 0))
+			modeset |= values[prop] != value;
+
+		if ((k = plane_index(req->items[i].obj)) >= 0)
+			touched[plane_crtc(k)] = true;
+		else if ((k = index_of(req->items[i].obj, CRTC_ID(0))) >= 0)
+			touched[k] = true;
+	}
+
+	/* an overlay shows a framebuffer on its CRTC, or nothing */
+	for (k = 0; k < kms.nconn * (1 + kms.noverlays); k++) {
+		if (plane_primary(k))
+			continue;
+		fb = value_after(req, PLANE_ID(k), PROP_FB_ID, kms.plane[k][PROP_FB_ID]);
+		crtc = value_after(req, PLANE_ID(k), PROP_CRTC_ID, kms.plane[k][PROP_CRTC_ID]);
+		if (!fb != !crtc || (crtc && crtc != CRTC_ID(plane_crtc(k))))
+			return fail(EINVAL);
+	}
+
+	if (modeset && !(flags & DRM_MODE_ATOMIC_ALLOW_MODESET))
+		return fail(EINVAL);
+	for (k = 0; k < kms.nconn; k++)
+		if (touched[k] && kms.crtc[k].pending &&
+		    (flags & DRM_MODE_ATOMIC_NONBLOCK))
+			return fail(EBUSY);
+	if (flags & DRM_MODE_ATOMIC_TEST_ONLY)
+		return 0;
+
+	for (i = 0; i < req->count; i++) {
+		uint32_t prop = req->items[i].prop;
+		uint64_t value = req->items[i].value;
+
+		values = object_props(req->items[i].obj, DRM_MODE_OBJECT_ANY, &list, &n);
+		/* the fence properties read back as unset */
+		if (prop == PROP_IN_FENCE_FD || prop == PROP_OUT_FENCE_PTR)
+			continue;
+		values[prop] = value;
+	}
+
+	for (i = 0; i < req->count; i++) {
+		if (req->items[i].prop != PROP_OUT_FENCE_PTR || !req->items[i].value)
+			continue;
+		fence_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+		if (fence_fd < 0)
+			return fail(errno);
+		*(int32_t *)(uintptr_t)req->items[i].value = fence_fd;
+	}
+
+	for (k = 0; k < kms.nconn; k++) {
+		struct crtc *c = &kms.crtc[k];
+
+		if (!touched[k])
+			continue;
+		c->fb = kms.plane[primary_plane(k)][PROP_FB_ID];
+		if (!c->prop[PROP_ACTIVE] || !c->fb) {
+			set_mode(c, NULL);
+			continue;
+		}
+		if (modeset || !c->mode_valid) {
+			j = find_blob(c->prop[PROP_MODE_ID]);
+			set_mode(c, j >= 0 ? kms.blob[j].data : NULL);
+		}
+		if (c->mode_valid && (flags & DRM_MODE_PAGE_FLIP_EVENT))
+			queue_flip(c, user_data);
+		/* blocking: back when the new state is on screen */
+		if (c->pending && !(flags & DRM_MODE_ATOMIC_NONBLOCK))
+			mock_sleep_until(c->due);
+	}
+
+	return 0;
+}
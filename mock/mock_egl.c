@@ -0,0 +1,699 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gbm.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+#include "mock.h"
+
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+
+#define MAX_EGL_DISPLAYS	(8)
+
+static const char egl_extensions[] =
+	"EGL_KHR_image_base EGL_KHR_image_pixmap EGL_EXT_image_dma_buf_import "
+	"EGL_KHR_surfaceless_context EGL_KHR_no_config_context "
+	"EGL_KHR_fence_sync EGL_KHR_wait_sync EGL_ANDROID_native_fence_sync";
+
+struct mock_display {
+	void *native;
+	bool initialized;
+};
+
+struct mock_config {
+	EGLint id;
+	EGLint red, green, blue, alpha;
+	EGLint depth, stencil, samples;
+	uint32_t visual;
+};
+
+struct mock_context {
+	struct mock_display *display;
+	struct mock_gl gl;
+};
+
+struct mock_surface {
+	struct mock_display *display;
+	struct gbm_surface *window;
+	uint32_t width, height;
+};
+
+struct mock_image {
+	struct mock_display *display;
+};
+
+struct mock_sync {
+	struct mock_display *display;
+	int fd;				/* owned, -1 until there is one */
+};
+
+/*
+ * In EGL's own sort order for "at least 1 bit of red, green and blue".
+ * The first one is not the one without depth and stencil, and the
+ * XRGB8888 ones come with and without them.
+ */
+static const struct mock_config configs[] = {
+	{ 1, 8, 8, 8, 0, 24, 8, 0, GBM_FORMAT_XRGB8888 },
+	{ 2, 8, 8, 8, 0, 0, 0, 0, GBM_FORMAT_XRGB8888 },
+	{ 3, 8, 8, 8, 0, 24, 8, 4, GBM_FORMAT_XRGB8888 },
+	{ 4, 8, 8, 8, 8, 0, 0, 0, GBM_FORMAT_ARGB8888 },
+	{ 5, 8, 8, 8, 8, 24, 8, 0, GBM_FORMAT_ARGB8888 },
+	{ 6, 5, 6, 5, 0, 0, 0, 0, GBM_FORMAT_RGB565 },
+};
+
+static pthread_mutex_t egl_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct mock_display displays[MAX_EGL_DISPLAYS];
+
+static __thread EGLint last_error = EGL_SUCCESS;
+static __thread struct mock_context *current_context;
+static __thread struct mock_surface *current_surface;
+
+static EGLBoolean error(EGLint err)
+{
+	last_error = err;
+	return EGL_FALSE;
+}
+
+static struct mock_display *initialized(EGLDisplay dpy)
+{
+	struct mock_display *d = dpy;
+
+	if (d < displays || d >= displays + MAX_EGL_DISPLAYS) {
+		error(EGL_BAD_DISPLAY);
+		return NULL;
+	}
+	if (!d->initialized) {
+		error(EGL_NOT_INITIALIZED);
+		return NULL;
+	}
+	return d;
+}
+
+static const struct mock_config *config_of(EGLConfig config)
+{
+	const struct mock_config *c = config;
+
+	if (c < configs || c >= configs + ARRAY_SIZE(configs)) {
+		error(EGL_BAD_CONFIG);
+		return NULL;
+	}
+	return c;
+}
+
+struct mock_gl *mock_gl_current(const char *func)
+{
+	if (!current_context) {
+		mock_error("%s: no current context", func);
+		return NULL;
+	}
+	return &current_context->gl;
+}
+
+EGLint eglGetError(void)
+{
+	EGLint err = last_error;
+
+	mock_enter(__func__);
+	last_error = EGL_SUCCESS;
+	return err;
+}
+
+EGLDisplay eglGetDisplay(EGLNativeDisplayType native)
+{
+	struct mock_display *d = NULL;
+	int i;
+
+	mock_enter(__func__);
+	if (!mock_live("gbm_device", native, __func__))
+		return EGL_NO_DISPLAY;
+
+	pthread_mutex_lock(&egl_mutex);
+	for (i = 0; i < MAX_EGL_DISPLAYS && !d; i++)
+		if (displays[i].native == native)
+			d = &displays[i];
+	for (i = 0; i < MAX_EGL_DISPLAYS && !d; i++)
+		if (!displays[i].native || !displays[i].initialized)
+			d = &displays[i];
+	if (d && d->native != native) {
+		d->native = native;
+		d->initialized = false;
+	}
+	pthread_mutex_unlock(&egl_mutex);
+
+	return d ? (EGLDisplay)d : EGL_NO_DISPLAY;
+}
+
+EGLBoolean eglInitialize(EGLDisplay dpy, EGLint *major, EGLint *minor)
+{
+	struct mock_display *d = dpy;
+
+	mock_enter(__func__);
+	if (d < displays || d >= displays + MAX_EGL_DISPLAYS)
+		return error(EGL_BAD_DISPLAY);
+	if (!mock_live("gbm_device", d->native, __func__))
+		return error(EGL_BAD_DISPLAY);
+
+	d->initialized = true;
+	if (major)
+		*major = 1;
+	if (minor)
+		*minor = 5;
+	return EGL_TRUE;
+}
+
+EGLBoolean eglTerminate(EGLDisplay dpy)
+{
+	struct mock_display *d = dpy;
+
+	mock_enter(__func__);
+	if (d < displays || d >= displays + MAX_EGL_DISPLAYS)
+		return error(EGL_BAD_DISPLAY);
+	d->initialized = false;
+	return EGL_TRUE;
+}
+
+const char *eglQueryString(EGLDisplay dpy, EGLint name)
+{
+	mock_enter(__func__);
+	if (!initialized(dpy))
+		return NULL;
+
+	switch (name) {
+	case EGL_VENDOR:
+		return "kmscube mock";
+	case EGL_VERSION:
+		return "1.5 mock";
+	case EGL_CLIENT_APIS:
+		return "OpenGL_ES";
+	case EGL_EXTENSIONS:
+		return egl_extensions;
+	default:
+		error(EGL_BAD_PARAMETER);
+		return NULL;
+	}
+}
+
+EGLBoolean eglBindAPI(EGLenum api)
+{
+	mock_enter(__func__);
+	return api == EGL_OPENGL_ES_API ? EGL_TRUE : error(EGL_BAD_PARAMETER);
+}
+
+static EGLint attrib(const struct mock_config *c, EGLint name)
+{
+	switch (name) {
+	case EGL_CONFIG_ID:		return c->id;
+	case EGL_RED_SIZE:		return c->red;
+	case EGL_GREEN_SIZE:		return c->green;
+	case EGL_BLUE_SIZE:		return c->blue;
+	case EGL_ALPHA_SIZE:		return c->alpha;
+	case EGL_BUFFER_SIZE:		return c->red + c->green + c->blue + c->alpha;
+	case EGL_DEPTH_SIZE:		return c->depth;
+	case EGL_STENCIL_SIZE:		return c->stencil;
+	case EGL_SAMPLES:		return c->samples;
+	case EGL_SAMPLE_BUFFERS:	return c->samples > 0;
+	case EGL_NATIVE_VISUAL_ID:	return c->visual;
+	case EGL_NATIVE_RENDERABLE:	return EGL_TRUE;
+	case EGL_CONFIG_CAVEAT:		return EGL_NONE;
+	case EGL_SURFACE_TYPE:		return EGL_WINDOW_BIT | EGL_PBUFFER_BIT;
+	case EGL_RENDERABLE_TYPE:
+	case EGL_CONFORMANT:		return EGL_OPENGL_ES2_BIT;
+	default:			return -1;
+	}
+}
+
+EGLBoolean eglGetConfigAttrib(EGLDisplay dpy, EGLConfig config,
+		EGLint name, EGLint *value)
+{
+	const struct mock_config *c;
+	EGLint v;
+
+	mock_enter(__func__);
+	if (!initialized(dpy) || !(c = config_of(config)))
+		return EGL_FALSE;
+	v = attrib(c, name);
+	if (v < 0)
+		return error(EGL_BAD_ATTRIBUTE);
+	*value = v;
+	return EGL_TRUE;
+}
+
+/* minimum sizes and bit masks, the only attributes the harness asks for */
+static bool config_matches(const struct mock_config *c, const EGLint *list)
+{
+	for (; list && list[0] != EGL_NONE; list += 2) {
+		EGLint v = attrib(c, list[0]);
+
+		if (list[1] == EGL_DONT_CARE)
+			continue;
+		switch (list[0]) {
+		case EGL_SURFACE_TYPE:
+		case EGL_RENDERABLE_TYPE:
+		case EGL_CONFORMANT:
+			if ((v & list[1]) != list[1])
+				return false;
+			break;
+		case EGL_CONFIG_ID:
+		case EGL_NATIVE_VISUAL_ID:
+			/* not a selection criterion for eglChooseConfig */
+			break;
+		default:
+			if (v < list[1])
+				return false;
+		}
+	}
+	return true;
+}
+
+EGLBoolean eglChooseConfig(EGLDisplay dpy, const EGLint *attrib_list,
+		EGLConfig *out, EGLint size, EGLint *num)
+{
+	EGLint n = 0;
+	int i;
+
+	mock_enter(__func__);
+	if (!initialized(dpy))
+		return EGL_FALSE;
+	if (!num)
+		return error(EGL_BAD_PARAMETER);
+
+	for (i = 0; i < ARRAY_SIZE(configs); i++) {
+		if (!config_matches(&configs[i], attrib_list))
+			continue;
+		if (out && n < size)
+			out[n] = (EGLConfig)&configs[i];
+		n++;
+	}
+	*num = out && n > size ? size : n;
+	return EGL_TRUE;
+}
+
+EGLContext eglCreateContext(EGLDisplay dpy, EGLConfig config,
+		EGLContext share, const EGLint *attrib_list)
+{
+	struct mock_context *ctx;
+	struct mock_display *d;
+
+	mock_enter(__func__);
+	if (!(d = initialized(dpy)))
+		return EGL_NO_CONTEXT;
+	if (config != EGL_NO_CONFIG_KHR && !config_of(config))
+		return EGL_NO_CONTEXT;
+	if (share != EGL_NO_CONTEXT && !mock_live("EGLContext", share, __func__)) {
+		error(EGL_BAD_CONTEXT);
+		return EGL_NO_CONTEXT;
+	}
+
+	ctx = mock_alloc("EGLContext", sizeof(*ctx));
+	if (!ctx) {
+		error(EGL_BAD_ALLOC);
+		return EGL_NO_CONTEXT;
+	}
+	ctx->display = d;
+	ctx->gl.next_name = 1;
+	return ctx;
+}
+
+EGLBoolean eglDestroyContext(EGLDisplay dpy, EGLContext context)
+{
+	mock_enter(__func__);
+	if (!initialized(dpy))
+		return EGL_FALSE;
+	if (current_context == context)
+		current_context = NULL;
+	return mock_free("EGLContext", context, __func__) ?
+		error(EGL_BAD_CONTEXT) : EGL_TRUE;
+}
+
+EGLSurface eglCreateWindowSurface(EGLDisplay dpy, EGLConfig config,
+		EGLNativeWindowType win, const EGLint *attrib_list)
+{
+	const struct mock_config *c;
+	struct mock_surface *s;
+	struct mock_display *d;
+	uint32_t width, height;
+	int ret;
+
+	mock_enter(__func__);
+	if (!(d = initialized(dpy)) || !(c = config_of(config)))
+		return EGL_NO_SURFACE;
+
+	ret = mock_surface_bind((struct gbm_surface *)win, c->visual,
+			&width, &height);
+	if (ret) {
+		error(ret == -EINVAL ? EGL_BAD_MATCH :
+		      ret == -EBUSY ? EGL_BAD_ALLOC : EGL_BAD_NATIVE_WINDOW);
+		return EGL_NO_SURFACE;
+	}
+
+	s = mock_alloc("EGLSurface", sizeof(*s));
+	if (!s) {
+		mock_surface_unbind((struct gbm_surface *)win);
+		error(EGL_BAD_ALLOC);
+		return EGL_NO_SURFACE;
+	}
+	s->display = d;
+	s->window = (struct gbm_surface *)win;
+	s->width = width;
+	s->height = height;
+	return s;
+}
+
+EGLBoolean eglDestroySurface(EGLDisplay dpy, EGLSurface surface)
+{
+	struct mock_surface *s = surface;
+
+	mock_enter(__func__);
+	if (!initialized(dpy))
+		return EGL_FALSE;
+	if (!mock_live("EGLSurface", s, __func__))
+		return error(EGL_BAD_SURFACE);
+	if (current_surface == s)
+		current_surface = NULL;
+	mock_surface_unbind(s->window);
+	mock_free("EGLSurface", s, __func__);
+	return EGL_TRUE;
+}
+
+EGLBoolean eglQuerySurface(EGLDisplay dpy, EGLSurface surface,
+		EGLint name, EGLint *value)
+{
+	struct mock_surface *s = surface;
+
+	mock_enter(__func__);
+	if (!initialized(dpy))
+		return EGL_FALSE;
+	if (!mock_live("EGLSurface", s, __func__))
+		return error(EGL_BAD_SURFACE);
+
+	switch (name) {
+	case EGL_WIDTH:
+		*value = s->width;
+		return EGL_TRUE;
+	case EGL_HEIGHT:
+		*value = s->height;
+		return EGL_TRUE;
+	default:
+		return error(EGL_BAD_ATTRIBUTE);
+	}
+}
+
+EGLBoolean eglMakeCurrent(EGLDisplay dpy, EGLSurface draw, EGLSurface read,
+		EGLContext context)
+{
+	mock_enter(__func__);
+	if (!initialized(dpy))
+		return EGL_FALSE;
+
+	if (context == EGL_NO_CONTEXT) {
+		if (draw != EGL_NO_SURFACE || read != EGL_NO_SURFACE)
+			return error(EGL_BAD_MATCH);
+		current_context = NULL;
+		current_surface = NULL;
+		return EGL_TRUE;
+	}
+
+	if (!mock_live("EGLContext", context, __func__))
+		return error(EGL_BAD_CONTEXT);
+	if (draw != read)
+		return error(EGL_BAD_MATCH);
+	if (draw != EGL_NO_SURFACE && !mock_live("EGLSurface", draw, __func__))
+		return error(EGL_BAD_SURFACE);
+
+	current_context = context;
+	current_surface = draw;
+	return EGL_TRUE;
+}
+
+EGLContext eglGetCurrentContext(void)
+{
+	mock_enter(__func__);
+	return current_context ? (EGLContext)current_context : EGL_NO_CONTEXT;
+}
+
+EGLBoolean eglSwapBuffers(EGLDisplay dpy, EGLSurface surface)
+{
+	struct mock_surface *s = surface;
+
+	mock_enter(__func__);
+	if (!initialized(dpy))
+		return EGL_FALSE;
+	if (!mock_live("EGLSurface", s, __func__))
+		return error(EGL_BAD_SURFACE);
+	if (s != current_surface) {
+		mock_error("%s: surface %p is not current", __func__, (void *)s);
+		return error(EGL_BAD_SURFACE);
+	}
+
+	return mock_surface_swap(s->window) ? error(EGL_BAD_ALLOC) : EGL_TRUE;
+}
+
+EGLBoolean eglReleaseThread(void)
+{
+	mock_enter(__func__);
+	current_context = NULL;
+	current_surface = NULL;
+	last_error = EGL_SUCCESS;
+	return EGL_TRUE;
+}
+
+static EGLImageKHR create_image(EGLDisplay dpy, EGLContext ctx, EGLenum target,
+		EGLClientBuffer buffer, const EGLint *attrib_list)
+{
+	struct mock_image *image;
+	struct mock_display *d;
+	const EGLint *a;
+
+	mock_enter("eglCreateImageKHR");
+	if (!(d = initialized(dpy)))
+		return EGL_NO_IMAGE_KHR;
+
+	switch (target) {
+	case EGL_NATIVE_PIXMAP_KHR:
+		if (!mock_live("gbm_bo", buffer, "eglCreateImageKHR")) {
+			error(EGL_BAD_PARAMETER);
+			return EGL_NO_IMAGE_KHR;
+		}
+		break;
+	case EGL_LINUX_DMA_BUF_EXT:
+		for (a = attrib_list; a && a[0] != EGL_NONE; a += 2) {
+			if (a[0] != EGL_DMA_BUF_PLANE0_FD_EXT &&
+			    a[0] != EGL_DMA_BUF_PLANE1_FD_EXT)
+				continue;
+			if (fcntl(a[1], F_GETFD) < 0) {
+				mock_error("eglCreateImageKHR: dma-buf fd %d is not open",
+						a[1]);
+				error(EGL_BAD_PARAMETER);
+				return EGL_NO_IMAGE_KHR;
+			}
+		}
+		break;
+	default:
+		error(EGL_BAD_PARAMETER);
+		return EGL_NO_IMAGE_KHR;
+	}
+
+	image = mock_alloc("EGLImage", sizeof(*image));
+	if (!image) {
+		error(EGL_BAD_ALLOC);
+		return EGL_NO_IMAGE_KHR;
+	}
+	image->display = d;
+	return image;
+}
+
+static EGLBoolean destroy_image(EGLDisplay dpy, EGLImageKHR image)
+{
+	mock_enter("eglDestroyImageKHR");
+	if (!initialized(dpy))
+		return EGL_FALSE;
+	return mock_free("EGLImage", image, "eglDestroyImageKHR") ?
+		error(EGL_BAD_PARAMETER) : EGL_TRUE;
+}
+
+static void image_target_texture(GLenum target, GLeglImageOES image)
+{
+	mock_enter("glEGLImageTargetTexture2DOES");
+	mock_gl_current("glEGLImageTargetTexture2DOES");
+	mock_live("EGLImage", image, "glEGLImageTargetTexture2DOES");
+}
+
+static void image_target_renderbuffer(GLenum target, GLeglImageOES image)
+{
+	mock_enter("glEGLImageTargetRenderbufferStorageOES");
+	mock_gl_current("glEGLImageTargetRenderbufferStorageOES");
+	mock_live("EGLImage", image, "glEGLImageTargetRenderbufferStorageOES");
+}
+
+/*
+ * Native fence syncs.  One made from a fence fd takes the fd over, one
+ * for the GL commands so far gets its fd when that is first dup'ed.  The
+ * fences are signaled right away, like the draws they stand for.
+ */
+static EGLSyncKHR create_sync(EGLDisplay dpy, EGLenum type,
+		const EGLint *attrib_list)
+{
+	struct mock_sync *sync;
+	struct mock_display *d;
+	const EGLint *a;
+	int fd = EGL_NO_NATIVE_FENCE_FD_ANDROID;
+
+	mock_enter("eglCreateSyncKHR");
+	if (!(d = initialized(dpy)))
+		return EGL_NO_SYNC_KHR;
+	if (type != EGL_SYNC_NATIVE_FENCE_ANDROID) {
+		error(EGL_BAD_ATTRIBUTE);
+		return EGL_NO_SYNC_KHR;
+	}
+
+	for (a = attrib_list; a && a[0] != EGL_NONE; a += 2) {
+		if (a[0] != EGL_SYNC_NATIVE_FENCE_FD_ANDROID) {
+			error(EGL_BAD_ATTRIBUTE);
+			return EGL_NO_SYNC_KHR;
+		}
+		fd = a[1];
+	}
+	if (fd != EGL_NO_NATIVE_FENCE_FD_ANDROID && fcntl(fd, F_GETFD) < 0) {
+		mock_error("eglCreateSyncKHR: fence fd %d is not open", fd);
+		error(EGL_BAD_ATTRIBUTE);
+		return EGL_NO_SYNC_KHR;
+	}
+	/* a fence for the GL commands needs the context they went to */
+	if (fd == EGL_NO_NATIVE_FENCE_FD_ANDROID &&
+	    !mock_gl_current("eglCreateSyncKHR")) {
+		error(EGL_BAD_MATCH);
+		return EGL_NO_SYNC_KHR;
+	}
+
+	sync = mock_alloc("EGLSync", sizeof(*sync));
+	if (!sync) {
+		error(EGL_BAD_ALLOC);
+		return EGL_NO_SYNC_KHR;
+	}
+	sync->display = d;
+	sync->fd = fd;
+	return sync;
+}
+
+static EGLBoolean destroy_sync(EGLDisplay dpy, EGLSyncKHR sync)
+{
+	struct mock_sync *s = sync;
+
+	mock_enter("eglDestroySyncKHR");
+	if (!initialized(dpy))
+		return EGL_FALSE;
+	if (!mock_live("EGLSync", s, "eglDestroySyncKHR"))
+		return error(EGL_BAD_PARAMETER);
+	if (s->fd >= 0)
+		close(s->fd);
+	mock_free("EGLSync", s, "eglDestroySyncKHR");
+	return EGL_TRUE;
+}
+
+static EGLint wait_sync(EGLDisplay dpy, EGLSyncKHR sync, EGLint flags)
+{
+	mock_enter("eglWaitSyncKHR");
+	if (!initialized(dpy))
+		return EGL_FALSE;
+	if (!mock_gl_current("eglWaitSyncKHR"))
+		return error(EGL_BAD_MATCH);
+	if (!mock_live("EGLSync", sync, "eglWaitSyncKHR") || flags)
+		return error(EGL_BAD_PARAMETER);
+	return EGL_TRUE;
+}
+
+static EGLint dup_native_fence_fd(EGLDisplay dpy, EGLSyncKHR sync)
+{
+	struct mock_sync *s = sync;
+	int fd;
+
+	mock_enter("eglDupNativeFenceFDANDROID");
+	if (!initialized(dpy))
+		return EGL_NO_NATIVE_FENCE_FD_ANDROID;
+	if (!mock_live("EGLSync", s, "eglDupNativeFenceFDANDROID")) {
+		error(EGL_BAD_PARAMETER);
+		return EGL_NO_NATIVE_FENCE_FD_ANDROID;
+	}
+
+	if (s->fd < 0)
+		s->fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+	fd = s->fd < 0 ? -1 : fcntl(s->fd, F_DUPFD_CLOEXEC, 0);
+	if (fd < 0) {
+		error(EGL_BAD_PARAMETER);
+		return EGL_NO_NATIVE_FENCE_FD_ANDROID;
+	}
+	return fd;
+}
+
+/* the extension entry points of mock_gles.c */
+void mock_vertex_attrib_divisor(GLuint index, GLuint divisor);
+void mock_draw_elements_instanced(GLenum mode, GLsizei count, GLenum type,
+		const void *indices, GLsizei instances);
+void mock_gen_queries(GLsizei n, GLuint *ids);
+void mock_delete_queries(GLsizei n, const GLuint *ids);
+void mock_begin_query(GLenum target, GLuint id);
+void mock_end_query(GLenum target);
+void mock_get_query_uiv(GLuint id, GLenum pname, GLuint *params);
+void mock_get_query_ui64v(GLuint id, GLenum pname, GLuint64 *params);
+
+static const struct {
+	const char *name;
+	void (*proc)(void);
+} procs[] = {
+	{ "eglCreateImageKHR", (void (*)(void))create_image },
+	{ "eglDestroyImageKHR", (void (*)(void))destroy_image },
+	{ "eglCreateSyncKHR", (void (*)(void))create_sync },
+	{ "eglDestroySyncKHR", (void (*)(void))destroy_sync },
+	{ "eglWaitSyncKHR", (void (*)(void))wait_sync },
+	{ "eglDupNativeFenceFDANDROID", (void (*)(void))dup_native_fence_fd },
+	{ "glEGLImageTargetTexture2DOES", (void (*)(void))image_target_texture },
+	{ "glEGLImageTargetRenderbufferStorageOES", (void (*)(void))image_target_renderbuffer },
+	{ "glVertexAttribDivisorANGLE", (void (*)(void))mock_vertex_attrib_divisor },
+	{ "glDrawElementsInstancedANGLE", (void (*)(void))mock_draw_elements_instanced },
+	{ "glGenQueriesEXT", (void (*)(void))mock_gen_queries },
+	{ "glDeleteQueriesEXT", (void (*)(void))mock_delete_queries },
+	{ "glBeginQueryEXT", (void (*)(void))mock_begin_query },
+	{ "glEndQueryEXT", (void (*)(void))mock_end_query },
+	{ "glGetQueryObjectuivEXT", (void (*)(void))mock_get_query_uiv },
+	{ "glGetQueryObjectui64vEXT", (void (*)(void))mock_get_query_ui64v },
+};
+
+__eglMustCastToProperFunctionPointerType eglGetProcAddress(const char *name)
+{
+	int i;
+
+	mock_enter(__func__);
+	for (i = 0; i < ARRAY_SIZE(procs); i++)
+		if (!strcmp(procs[i].name, name))
+			return procs[i].proc;
+	return NULL;
+}
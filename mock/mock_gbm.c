@@ -0,0 +1,453 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gbm.h>
+#include <drm_fourcc.h>
+
+#include "mock.h"
+
+#define SURFACE_BOS	(3)
+
+enum bo_state {
+	BO_FREE,
+	BO_QUEUED,	/* swapped, the front buffer until locked */
+	BO_LOCKED,	/* locked by the client */
+};
+
+struct gbm_device {
+	int fd;
+	int nbos, nsurfaces;
+};
+
+struct gbm_bo {
+	struct gbm_device *dev;
+	struct gbm_surface *surface;	/* NULL: created on its own */
+	uint32_t width, height, format, stride;
+	uint64_t modifier;
+	uint32_t handle;
+	enum bo_state state;
+	void *user_data;
+	void (*destroy_user_data)(struct gbm_bo *, void *);
+};
+
+struct gbm_surface {
+	struct gbm_device *dev;
+	uint32_t width, height, format;
+	uint64_t modifier;
+	struct gbm_bo *bo[SURFACE_BOS];
+	bool egl_surface;
+};
+
+static pthread_mutex_t gbm_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void add(int *counter, int delta)
+{
+	pthread_mutex_lock(&gbm_mutex);
+	*counter += delta;
+	pthread_mutex_unlock(&gbm_mutex);
+}
+
+static uint32_t format_cpp(uint32_t format)
+{
+	switch (format) {
+	case GBM_FORMAT_RGB565:
+		return 2;
+	case GBM_FORMAT_NV12:
+	case GBM_FORMAT_R8:
+		return 1;
+	default:
+		return 4;
+	}
+}
+
+static bool format_supported(uint32_t format)
+{
+	switch (format) {
+	case GBM_FORMAT_XRGB8888:
+	case GBM_FORMAT_ARGB8888:
+	case GBM_FORMAT_XBGR8888:
+	case GBM_FORMAT_ABGR8888:
+	case GBM_FORMAT_RGB565:
+	case GBM_FORMAT_NV12:
+	case GBM_FORMAT_R8:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* linear, and X tiling for 32 bpp, like the planes' IN_FORMATS */
+static bool modifier_supported(uint32_t format, uint64_t modifier)
+{
+	return modifier == DRM_FORMAT_MOD_LINEAR ||
+		(modifier == I915_FORMAT_MOD_X_TILED && format_cpp(format) == 4);
+}
+
+static int pick_modifier(uint32_t format, const uint64_t *modifiers,
+		unsigned int count, uint64_t *modifier)
+{
+	unsigned int i;
+
+	if (!modifiers || !count) {
+		*modifier = DRM_FORMAT_MOD_LINEAR;
+		return 0;
+	}
+	for (i = 0; i < count; i++) {
+		if (modifier_supported(format, modifiers[i])) {
+			*modifier = modifiers[i];
+			return 0;
+		}
+	}
+	return -1;
+}
+
+struct gbm_device *gbm_create_device(int fd)
+{
+	struct gbm_device *dev;
+
+	mock_enter(__func__);
+	dev = mock_alloc("gbm_device", sizeof(*dev));
+	if (dev)
+		dev->fd = fd;
+	return dev;
+}
+
+void gbm_device_destroy(struct gbm_device *dev)
+{
+	mock_enter(__func__);
+	if (!mock_live("gbm_device", dev, __func__))
+		return;
+	if (dev->nbos || dev->nsurfaces)
+		mock_error("%s: %d buffers and %d surfaces still alive", __func__,
+				dev->nbos, dev->nsurfaces);
+	mock_free("gbm_device", dev, __func__);
+}
+
+int gbm_device_get_fd(struct gbm_device *dev)
+{
+	mock_enter(__func__);
+	return mock_live("gbm_device", dev, __func__) ? dev->fd : -1;
+}
+
+static struct gbm_bo *new_bo(struct gbm_device *dev, uint32_t width,
+		uint32_t height, uint32_t format, uint64_t modifier)
+{
+	struct gbm_bo *bo;
+
+	bo = mock_alloc("gbm_bo", sizeof(*bo));
+	if (!bo)
+		return NULL;
+	bo->dev = dev;
+	bo->width = width;
+	bo->height = height;
+	bo->format = format;
+	bo->modifier = modifier;
+	bo->stride = (width * format_cpp(format) + 63) & ~63;
+	bo->handle = mock_new_id("GEM handle");
+	add(&dev->nbos, 1);
+
+	return bo;
+}
+
+static void free_bo(struct gbm_bo *bo, const char *func)
+{
+	if (bo->destroy_user_data)
+		bo->destroy_user_data(bo, bo->user_data);
+	mock_free_id("GEM handle", bo->handle, func);
+	add(&bo->dev->nbos, -1);
+	mock_free("gbm_bo", bo, func);
+}
+
+struct gbm_bo *gbm_bo_create_with_modifiers(struct gbm_device *dev,
+		uint32_t width, uint32_t height, uint32_t format,
+		const uint64_t *modifiers, const unsigned int count)
+{
+	uint64_t modifier;
+
+	mock_enter(__func__);
+	if (!mock_live("gbm_device", dev, __func__))
+		return NULL;
+	if (!width || !height || !format_supported(format) ||
+	    pick_modifier(format, modifiers, count, &modifier)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	return new_bo(dev, width, height, format, modifier);
+}
+
+struct gbm_bo *gbm_bo_create(struct gbm_device *dev, uint32_t width,
+		uint32_t height, uint32_t format, uint32_t flags)
+{
+	mock_enter(__func__);
+	if (!mock_live("gbm_device", dev, __func__))
+		return NULL;
+	if (!width || !height || !format_supported(format)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	return new_bo(dev, width, height, format, DRM_FORMAT_MOD_LINEAR);
+}
+
+void gbm_bo_destroy(struct gbm_bo *bo)
+{
+	mock_enter(__func__);
+	if (!mock_live("gbm_bo", bo, __func__))
+		return;
+	if (bo->surface) {
+		mock_error("%s: buffer %p belongs to surface %p", __func__,
+				(void *)bo, (void *)bo->surface);
+		return;
+	}
+	free_bo(bo, __func__);
+}
+
+#define BO_GETTER(type, name, expr, fallback)			\
+type gbm_bo_get_##name(struct gbm_bo *bo)			\
+{								\
+	mock_enter(__func__);					\
+	return mock_live("gbm_bo", bo, __func__) ? (expr) : (fallback); \
+}
+
+BO_GETTER(uint32_t, width, bo->width, 0)
+BO_GETTER(uint32_t, height, bo->height, 0)
+BO_GETTER(uint32_t, stride, bo->stride, 0)
+BO_GETTER(uint32_t, format, bo->format, 0)
+BO_GETTER(uint32_t, bpp, format_cpp(bo->format) * 8, 0)
+BO_GETTER(uint64_t, modifier, bo->modifier, DRM_FORMAT_MOD_INVALID)
+BO_GETTER(int, plane_count, 1, 0)
+BO_GETTER(struct gbm_device *, device, bo->dev, NULL)
+BO_GETTER(void *, user_data, bo->user_data, NULL)
+
+uint32_t gbm_bo_get_stride_for_plane(struct gbm_bo *bo, int plane)
+{
+	mock_enter(__func__);
+	return mock_live("gbm_bo", bo, __func__) && !plane ? bo->stride : 0;
+}
+
+uint32_t gbm_bo_get_offset(struct gbm_bo *bo, int plane)
+{
+	mock_enter(__func__);
+	return 0;
+}
+
+union gbm_bo_handle gbm_bo_get_handle(struct gbm_bo *bo)
+{
+	union gbm_bo_handle h = { .u64 = 0 };
+
+	mock_enter(__func__);
+	if (mock_live("gbm_bo", bo, __func__))
+		h.u32 = bo->handle;
+	return h;
+}
+
+union gbm_bo_handle gbm_bo_get_handle_for_plane(struct gbm_bo *bo, int plane)
+{
+	union gbm_bo_handle h = { .u64 = 0 };
+
+	mock_enter(__func__);
+	if (mock_live("gbm_bo", bo, __func__) && !plane)
+		h.u32 = bo->handle;
+	else
+		h.s32 = -1;
+	return h;
+}
+
+int gbm_bo_get_fd(struct gbm_bo *bo)
+{
+	mock_enter(__func__);
+	if (!mock_live("gbm_bo", bo, __func__))
+		return -1;
+	return open("/dev/null", O_RDWR | O_CLOEXEC);
+}
+
+void gbm_bo_set_user_data(struct gbm_bo *bo, void *data,
+		void (*destroy_user_data)(struct gbm_bo *, void *))
+{
+	mock_enter(__func__);
+	if (!mock_live("gbm_bo", bo, __func__))
+		return;
+	bo->user_data = data;
+	bo->destroy_user_data = destroy_user_data;
+}
+
+struct gbm_surface *gbm_surface_create_with_modifiers(struct gbm_device *dev,
+		uint32_t width, uint32_t height, uint32_t format,
+		const uint64_t *modifiers, const unsigned int count)
+{
+	struct gbm_surface *s;
+	uint64_t modifier;
+
+	mock_enter(__func__);
+	if (!mock_live("gbm_device", dev, __func__))
+		return NULL;
+	if (!width || !height || !format_supported(format) ||
+	    pick_modifier(format, modifiers, count, &modifier)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	s = mock_alloc("gbm_surface", sizeof(*s));
+	if (!s)
+		return NULL;
+	s->dev = dev;
+	s->width = width;
+	s->height = height;
+	s->format = format;
+	s->modifier = modifier;
+	add(&dev->nsurfaces, 1);
+
+	return s;
+}
+
+struct gbm_surface *gbm_surface_create(struct gbm_device *dev, uint32_t width,
+		uint32_t height, uint32_t format, uint32_t flags)
+{
+	return gbm_surface_create_with_modifiers(dev, width, height, format,
+			NULL, 0);
+}
+
+void gbm_surface_destroy(struct gbm_surface *s)
+{
+	int i;
+
+	mock_enter(__func__);
+	if (!mock_live("gbm_surface", s, __func__))
+		return;
+	if (s->egl_surface)
+		mock_error("%s: surface %p still has an EGL surface", __func__,
+				(void *)s);
+
+	for (i = 0; i < SURFACE_BOS; i++)
+		if (s->bo[i])
+			free_bo(s->bo[i], __func__);
+	add(&s->dev->nsurfaces, -1);
+	mock_free("gbm_surface", s, __func__);
+}
+
+struct gbm_bo *gbm_surface_lock_front_buffer(struct gbm_surface *s)
+{
+	int i;
+
+	mock_enter(__func__);
+	if (!mock_live("gbm_surface", s, __func__))
+		return NULL;
+
+	for (i = 0; i < SURFACE_BOS; i++) {
+		if (s->bo[i] && s->bo[i]->state == BO_QUEUED) {
+			s->bo[i]->state = BO_LOCKED;
+			return s->bo[i];
+		}
+	}
+
+	mock_error("%s: surface %p has no front buffer, nothing was swapped",
+			__func__, (void *)s);
+	return NULL;
+}
+
+void gbm_surface_release_buffer(struct gbm_surface *s, struct gbm_bo *bo)
+{
+	mock_enter(__func__);
+	if (!mock_live("gbm_surface", s, __func__) ||
+	    !mock_live("gbm_bo", bo, __func__))
+		return;
+	if (bo->surface != s || bo->state != BO_LOCKED) {
+		mock_error("%s: buffer %p is not a locked buffer of surface %p",
+				__func__, (void *)bo, (void *)s);
+		return;
+	}
+	bo->state = BO_FREE;
+}
+
+int gbm_surface_has_free_buffers(struct gbm_surface *s)
+{
+	int i;
+
+	mock_enter(__func__);
+	if (!mock_live("gbm_surface", s, __func__))
+		return 0;
+	for (i = 0; i < SURFACE_BOS; i++)
+		if (!s->bo[i] || s->bo[i]->state == BO_FREE)
+			return 1;
+	return 0;
+}
+
+/*
+ * eglSwapBuffers() on a surface: the frame goes into a free buffer, which
+ * becomes the front buffer; a front buffer nobody locked is dropped.
+ */
+int mock_surface_swap(struct gbm_surface *s)
+{
+	struct gbm_bo *back = NULL;
+	int i;
+
+	for (i = 0; i < SURFACE_BOS && !back; i++) {
+		if (!s->bo[i]) {
+			s->bo[i] = new_bo(s->dev, s->width, s->height, s->format,
+					s->modifier);
+			if (!s->bo[i])
+				return -1;
+			s->bo[i]->surface = s;
+		}
+		if (s->bo[i]->state == BO_FREE)
+			back = s->bo[i];
+	}
+	if (!back) {
+		mock_error("eglSwapBuffers: all %d buffers of surface %p are locked",
+				SURFACE_BOS, (void *)s);
+		return -1;
+	}
+
+	for (i = 0; i < SURFACE_BOS; i++)
+		if (s->bo[i] && s->bo[i]->state == BO_QUEUED)
+			s->bo[i]->state = BO_FREE;
+	back->state = BO_QUEUED;
+
+	return 0;
+}
+
+/* the EGL window surface of s: -ENOENT dead, -EBUSY has one, -EINVAL other format */
+int mock_surface_bind(struct gbm_surface *s, uint32_t format,
+		uint32_t *width, uint32_t *height)
+{
+	if (!mock_live("gbm_surface", s, "eglCreateWindowSurface"))
+		return -ENOENT;
+	if (s->egl_surface)
+		return -EBUSY;
+	if (s->format != format)
+		return -EINVAL;
+	s->egl_surface = true;
+	*width = s->width;
+	*height = s->height;
+	return 0;
+}
+
+void mock_surface_unbind(struct gbm_surface *s)
+{
+	if (mock_live("gbm_surface", s, "eglDestroySurface"))
+		s->egl_surface = false;
+}
@@ -0,0 +1,341 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+#include "mock.h"
+
+/*
+ * Nothing is drawn: the calls only check that a context is current and
+ * hand out names.  Draws add the "gpu" latency to the context's GPU
+ * clock, which is what the timer queries measure.
+ */
+
+#define GL_ENTER(gl) \
+	struct mock_gl *gl; \
+	mock_enter(__func__); \
+	gl = mock_gl_current(__func__); \
+	(void)gl
+
+static void gen_names(struct mock_gl *gl, GLsizei n, GLuint *names)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		names[i] = gl ? gl->next_name++ : 0;
+}
+
+static void draw(struct mock_gl *gl, unsigned count)
+{
+	if (gl)
+		gl->gpu_ns += mock_latency_ns("gpu") * count;
+}
+
+void glActiveTexture(GLenum texture) { GL_ENTER(gl); }
+void glAttachShader(GLuint program, GLuint shader) { GL_ENTER(gl); }
+void glBindAttribLocation(GLuint program, GLuint index, const GLchar *name) { GL_ENTER(gl); }
+void glBindBuffer(GLenum target, GLuint buffer) { GL_ENTER(gl); }
+void glBindFramebuffer(GLenum target, GLuint framebuffer) { GL_ENTER(gl); }
+void glBindRenderbuffer(GLenum target, GLuint renderbuffer) { GL_ENTER(gl); }
+void glBindTexture(GLenum target, GLuint texture) { GL_ENTER(gl); }
+void glBufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage) { GL_ENTER(gl); }
+void glCompileShader(GLuint shader) { GL_ENTER(gl); }
+void glDeleteBuffers(GLsizei n, const GLuint *buffers) { GL_ENTER(gl); }
+void glDeleteFramebuffers(GLsizei n, const GLuint *framebuffers) { GL_ENTER(gl); }
+void glDeleteProgram(GLuint program) { GL_ENTER(gl); }
+void glDeleteRenderbuffers(GLsizei n, const GLuint *renderbuffers) { GL_ENTER(gl); }
+void glDeleteShader(GLuint shader) { GL_ENTER(gl); }
+void glDeleteTextures(GLsizei n, const GLuint *textures) { GL_ENTER(gl); }
+void glDisable(GLenum cap) { GL_ENTER(gl); }
+void glDisableVertexAttribArray(GLuint index) { GL_ENTER(gl); }
+void glEnable(GLenum cap) { GL_ENTER(gl); }
+void glEnableVertexAttribArray(GLuint index) { GL_ENTER(gl); }
+void glFinish(void) { GL_ENTER(gl); }
+void glFlush(void) { GL_ENTER(gl); }
+void glFramebufferRenderbuffer(GLenum target, GLenum attachment, GLenum rbtarget, GLuint renderbuffer) { GL_ENTER(gl); }
+void glFramebufferTexture2D(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level) { GL_ENTER(gl); }
+void glLinkProgram(GLuint program) { GL_ENTER(gl); }
+void glScissor(GLint x, GLint y, GLsizei width, GLsizei height) { GL_ENTER(gl); }
+void glShaderSource(GLuint shader, GLsizei count, const GLchar *const *string, const GLint *length) { GL_ENTER(gl); }
+void glTexImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void *pixels) { GL_ENTER(gl); }
+void glTexParameteri(GLenum target, GLenum pname, GLint param) { GL_ENTER(gl); }
+void glUniform1f(GLint location, GLfloat v0) { GL_ENTER(gl); }
+void glUniform1i(GLint location, GLint v0) { GL_ENTER(gl); }
+void glUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value) { GL_ENTER(gl); }
+void glUseProgram(GLuint program) { GL_ENTER(gl); }
+void glVertexAttrib4fv(GLuint index, const GLfloat *v) { GL_ENTER(gl); }
+void glVertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void *pointer) { GL_ENTER(gl); }
+void glViewport(GLint x, GLint y, GLsizei width, GLsizei height) { GL_ENTER(gl); }
+
+GLenum glGetError(void)
+{
+	mock_enter(__func__);
+	return GL_NO_ERROR;
+}
+
+void glGenBuffers(GLsizei n, GLuint *buffers)
+{
+	GL_ENTER(gl);
+	gen_names(gl, n, buffers);
+}
+
+void glGenFramebuffers(GLsizei n, GLuint *framebuffers)
+{
+	GL_ENTER(gl);
+	gen_names(gl, n, framebuffers);
+}
+
+void glGenRenderbuffers(GLsizei n, GLuint *renderbuffers)
+{
+	GL_ENTER(gl);
+	gen_names(gl, n, renderbuffers);
+}
+
+void glGenTextures(GLsizei n, GLuint *textures)
+{
+	GL_ENTER(gl);
+	gen_names(gl, n, textures);
+}
+
+GLuint glCreateProgram(void)
+{
+	GL_ENTER(gl);
+	return gl ? gl->next_name++ : 0;
+}
+
+GLuint glCreateShader(GLenum type)
+{
+	GL_ENTER(gl);
+	return gl ? gl->next_name++ : 0;
+}
+
+GLint glGetUniformLocation(GLuint program, const GLchar *name)
+{
+	GL_ENTER(gl);
+	return gl ? 0 : -1;
+}
+
+GLenum glCheckFramebufferStatus(GLenum target)
+{
+	GL_ENTER(gl);
+	return gl ? GL_FRAMEBUFFER_COMPLETE : 0;
+}
+
+void glGetShaderiv(GLuint shader, GLenum pname, GLint *params)
+{
+	GL_ENTER(gl);
+	*params = pname == GL_COMPILE_STATUS ? GL_TRUE : 0;
+}
+
+void glGetProgramiv(GLuint program, GLenum pname, GLint *params)
+{
+	GL_ENTER(gl);
+	*params = pname == GL_LINK_STATUS ? GL_TRUE : 0;
+}
+
+void glGetShaderInfoLog(GLuint shader, GLsizei size, GLsizei *length, GLchar *log)
+{
+	GL_ENTER(gl);
+	if (length)
+		*length = 0;
+	if (size > 0)
+		log[0] = '\0';
+}
+
+void glGetProgramInfoLog(GLuint program, GLsizei size, GLsizei *length, GLchar *log)
+{
+	GL_ENTER(gl);
+	if (length)
+		*length = 0;
+	if (size > 0)
+		log[0] = '\0';
+}
+
+void glGetIntegerv(GLenum pname, GLint *data)
+{
+	GL_ENTER(gl);
+	switch (pname) {
+	case GL_MAX_VERTEX_ATTRIBS:
+		*data = 16;
+		break;
+	case GL_MAX_TEXTURE_SIZE:
+		*data = 8192;
+		break;
+	default:
+		/* GL_NUM_PROGRAM_BINARY_FORMATS_OES, GL_GPU_DISJOINT_EXT, ... */
+		*data = 0;
+	}
+}
+
+const GLubyte *glGetString(GLenum name)
+{
+	GL_ENTER(gl);
+	if (!gl)
+		return NULL;
+
+	switch (name) {
+	case GL_VENDOR:
+	case GL_RENDERER:
+		return (const GLubyte *)"mock";
+	case GL_VERSION:
+		return (const GLubyte *)"OpenGL ES 2.0 mock";
+	case GL_SHADING_LANGUAGE_VERSION:
+		return (const GLubyte *)"OpenGL ES GLSL ES 1.00 mock";
+	case GL_EXTENSIONS:
+		return (const GLubyte *)"GL_OES_EGL_image GL_ANGLE_instanced_arrays "
+				"GL_EXT_disjoint_timer_query";
+	default:
+		return NULL;
+	}
+}
+
+void glClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha)
+{
+	GL_ENTER(gl);
+	if (!gl)
+		return;
+	gl->clear[0] = red;
+	gl->clear[1] = green;
+	gl->clear[2] = blue;
+	gl->clear[3] = alpha;
+}
+
+void glClear(GLbitfield mask)
+{
+	GL_ENTER(gl);
+	draw(gl, 1);
+}
+
+void glDrawArrays(GLenum mode, GLint first, GLsizei count)
+{
+	GL_ENTER(gl);
+	draw(gl, 1);
+}
+
+void glDrawElements(GLenum mode, GLsizei count, GLenum type, const void *indices)
+{
+	GL_ENTER(gl);
+	draw(gl, 1);
+}
+
+/* whatever was cleared last, a draw is not rasterized */
+void glReadPixels(GLint x, GLint y, GLsizei width, GLsizei height,
+		GLenum format, GLenum type, void *pixels)
+{
+	GLubyte *px = pixels;
+	int i, n = width * height;
+
+	GL_ENTER(gl);
+	if (!gl || format != GL_RGBA || type != GL_UNSIGNED_BYTE)
+		return;
+	for (i = 0; i < 4 * n; i++)
+		px[i] = gl->clear[i % 4] * 255.0f + 0.5f;
+}
+
+/* the extension entry points, handed out by eglGetProcAddress() */
+
+void mock_vertex_attrib_divisor(GLuint index, GLuint divisor)
+{
+	mock_enter("glVertexAttribDivisorANGLE");
+	mock_gl_current("glVertexAttribDivisorANGLE");
+}
+
+void mock_draw_elements_instanced(GLenum mode, GLsizei count, GLenum type,
+		const void *indices, GLsizei instances)
+{
+	struct mock_gl *gl;
+
+	mock_enter("glDrawElementsInstancedANGLE");
+	gl = mock_gl_current("glDrawElementsInstancedANGLE");
+	draw(gl, instances);
+}
+
+void mock_gen_queries(GLsizei n, GLuint *ids)
+{
+	struct mock_gl *gl;
+
+	mock_enter("glGenQueriesEXT");
+	gl = mock_gl_current("glGenQueriesEXT");
+	gen_names(gl, n, ids);
+}
+
+void mock_delete_queries(GLsizei n, const GLuint *ids)
+{
+	mock_enter("glDeleteQueriesEXT");
+	mock_gl_current("glDeleteQueriesEXT");
+}
+
+static __thread GLuint active_query;
+
+void mock_begin_query(GLenum target, GLuint id)
+{
+	struct mock_gl *gl;
+
+	mock_enter("glBeginQueryEXT");
+	gl = mock_gl_current("glBeginQueryEXT");
+	if (!gl)
+		return;
+	if (active_query)
+		mock_error("glBeginQueryEXT: query %u is still active", active_query);
+	active_query = id;
+	gl->query_start[id % MOCK_QUERIES] = gl->gpu_ns;
+}
+
+void mock_end_query(GLenum target)
+{
+	struct mock_gl *gl;
+
+	mock_enter("glEndQueryEXT");
+	gl = mock_gl_current("glEndQueryEXT");
+	if (!gl)
+		return;
+	if (!active_query) {
+		mock_error("glEndQueryEXT: no active query");
+		return;
+	}
+	gl->query_ns[active_query % MOCK_QUERIES] =
+		gl->gpu_ns - gl->query_start[active_query % MOCK_QUERIES];
+	active_query = 0;
+}
+
+/* the GPU is infinitely fast at finishing, results are always there */
+void mock_get_query_uiv(GLuint id, GLenum pname, GLuint *params)
+{
+	mock_enter("glGetQueryObjectuivEXT");
+	if (!mock_gl_current("glGetQueryObjectuivEXT"))
+		return;
+	*params = pname == GL_QUERY_RESULT_AVAILABLE_EXT ? GL_TRUE : 0;
+}
+
+void mock_get_query_ui64v(GLuint id, GLenum pname, GLuint64 *params)
+{
+	struct mock_gl *gl;
+
+	mock_enter("glGetQueryObjectui64vEXT");
+	gl = mock_gl_current("glGetQueryObjectui64vEXT");
+	if (!gl)
+		return;
+	*params = gl->query_ns[id % MOCK_QUERIES];
+}
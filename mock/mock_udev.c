@@ -0,0 +1,332 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <libudev.h>
+
+#include "mock.h"
+
+/*
+ * The simulated device as udev sees it: a primary and a render node of
+ * a "mock" driver, both backed by MOCK_DEVNODE.  The monitor never has
+ * an event, its fd is an eventfd nobody writes to.
+ */
+
+#define SYS_PARENT	"/sys/devices/mock/0000:00:02.0"
+
+static const char *const sysnames[] = { "card0", "renderD128" };
+
+struct udev {
+	int unused;
+};
+
+struct udev_list_entry {
+	char name[64];
+	struct udev_list_entry *next;
+};
+
+struct udev_enumerate {
+	struct udev *udev;
+	char sysname[32];
+	struct udev_list_entry entries[2];
+	struct udev_list_entry *first;
+};
+
+struct udev_device {
+	char syspath[64];
+	bool is_parent;
+	struct udev_device *parent;
+};
+
+struct udev_monitor {
+	int fd;
+};
+
+struct udev *udev_new(void)
+{
+	mock_enter(__func__);
+	return mock_alloc("udev", sizeof(struct udev));
+}
+
+struct udev *udev_unref(struct udev *udev)
+{
+	mock_enter(__func__);
+	mock_free("udev", udev, __func__);
+	return NULL;
+}
+
+struct udev_list_entry *udev_list_entry_get_next(struct udev_list_entry *entry)
+{
+	return entry->next;
+}
+
+const char *udev_list_entry_get_name(struct udev_list_entry *entry)
+{
+	return entry->name;
+}
+
+struct udev_enumerate *udev_enumerate_new(struct udev *udev)
+{
+	struct udev_enumerate *en;
+
+	mock_enter(__func__);
+	if (!mock_live("udev", udev, __func__))
+		return NULL;
+	en = mock_alloc("udev_enumerate", sizeof(*en));
+	if (en)
+		en->udev = udev;
+	return en;
+}
+
+struct udev_enumerate *udev_enumerate_unref(struct udev_enumerate *en)
+{
+	mock_enter(__func__);
+	mock_free("udev_enumerate", en, __func__);
+	return NULL;
+}
+
+int udev_enumerate_add_match_subsystem(struct udev_enumerate *en,
+		const char *subsystem)
+{
+	mock_enter(__func__);
+	if (!mock_live("udev_enumerate", en, __func__))
+		return -EINVAL;
+	/* everything here is drm, anything else matches nothing */
+	if (strcmp(subsystem, "drm"))
+		snprintf(en->sysname, sizeof(en->sysname), "/");
+	return 0;
+}
+
+int udev_enumerate_add_match_sysname(struct udev_enumerate *en,
+		const char *sysname)
+{
+	mock_enter(__func__);
+	if (!mock_live("udev_enumerate", en, __func__))
+		return -EINVAL;
+	if (strcmp(en->sysname, "/"))
+		snprintf(en->sysname, sizeof(en->sysname), "%s", sysname);
+	return 0;
+}
+
+int udev_enumerate_scan_devices(struct udev_enumerate *en)
+{
+	struct udev_list_entry **tail;
+	int i;
+
+	mock_enter(__func__);
+	if (!mock_live("udev_enumerate", en, __func__))
+		return -EINVAL;
+
+	tail = &en->first;
+	for (i = 0; i < 2; i++) {
+		if (en->sysname[0] && fnmatch(en->sysname, sysnames[i], 0))
+			continue;
+		snprintf(en->entries[i].name, sizeof(en->entries[i].name),
+				SYS_PARENT "/drm/%s", sysnames[i]);
+		*tail = &en->entries[i];
+		tail = &en->entries[i].next;
+	}
+	*tail = NULL;
+	return 0;
+}
+
+struct udev_list_entry *udev_enumerate_get_list_entry(struct udev_enumerate *en)
+{
+	mock_enter(__func__);
+	if (!mock_live("udev_enumerate", en, __func__))
+		return NULL;
+	return en->first;
+}
+
+static struct udev_device *new_device(const char *syspath, bool is_parent)
+{
+	struct udev_device *dev = mock_alloc("udev_device", sizeof(*dev));
+
+	if (!dev)
+		return NULL;
+	snprintf(dev->syspath, sizeof(dev->syspath), "%s", syspath);
+	dev->is_parent = is_parent;
+	return dev;
+}
+
+struct udev_device *udev_device_new_from_syspath(struct udev *udev,
+		const char *syspath)
+{
+	mock_enter(__func__);
+	if (!mock_live("udev", udev, __func__))
+		return NULL;
+	if (strncmp(syspath, SYS_PARENT "/drm/", strlen(SYS_PARENT "/drm/")))
+		return NULL;
+	return new_device(syspath, false);
+}
+
+/* owned by the child like the real one, not to be unreferenced */
+struct udev_device *udev_device_get_parent(struct udev_device *dev)
+{
+	mock_enter(__func__);
+	if (!mock_live("udev_device", dev, __func__) || dev->is_parent)
+		return NULL;
+	if (!dev->parent)
+		dev->parent = new_device(SYS_PARENT, true);
+	return dev->parent;
+}
+
+struct udev_device *udev_device_unref(struct udev_device *dev)
+{
+	mock_enter(__func__);
+	if (!mock_live("udev_device", dev, __func__))
+		return NULL;
+	if (dev->is_parent)
+		mock_error("%s: the parent %s belongs to its child", __func__,
+				dev->syspath);
+	else if (dev->parent)
+		mock_free("udev_device", dev->parent, __func__);
+	mock_free("udev_device", dev, __func__);
+	return NULL;
+}
+
+const char *udev_device_get_devnode(struct udev_device *dev)
+{
+	mock_enter(__func__);
+	if (!mock_live("udev_device", dev, __func__) || dev->is_parent)
+		return NULL;
+	return mock_devnode();
+}
+
+const char *udev_device_get_syspath(struct udev_device *dev)
+{
+	mock_enter(__func__);
+	if (!mock_live("udev_device", dev, __func__))
+		return NULL;
+	return dev->syspath;
+}
+
+const char *udev_device_get_sysname(struct udev_device *dev)
+{
+	mock_enter(__func__);
+	if (!mock_live("udev_device", dev, __func__))
+		return NULL;
+	return strrchr(dev->syspath, '/') + 1;
+}
+
+const char *udev_device_get_driver(struct udev_device *dev)
+{
+	mock_enter(__func__);
+	if (!mock_live("udev_device", dev, __func__))
+		return NULL;
+	return dev->is_parent ? "mock" : NULL;
+}
+
+const char *udev_device_get_action(struct udev_device *dev)
+{
+	mock_enter(__func__);
+	return NULL;
+}
+
+const char *udev_device_get_property_value(struct udev_device *dev,
+		const char *key)
+{
+	mock_enter(__func__);
+	mock_live("udev_device", dev, __func__);
+	return NULL;
+}
+
+const char *udev_device_get_sysattr_value(struct udev_device *dev,
+		const char *sysattr)
+{
+	mock_enter(__func__);
+	mock_live("udev_device", dev, __func__);
+	return NULL;
+}
+
+dev_t udev_device_get_devnum(struct udev_device *dev)
+{
+	struct stat st;
+
+	mock_enter(__func__);
+	if (!mock_live("udev_device", dev, __func__) || dev->is_parent ||
+	    stat(mock_devnode(), &st))
+		return 0;
+	return st.st_rdev;
+}
+
+struct udev_monitor *udev_monitor_new_from_netlink(struct udev *udev,
+		const char *name)
+{
+	struct udev_monitor *mon;
+
+	mock_enter(__func__);
+	if (!mock_live("udev", udev, __func__))
+		return NULL;
+	mon = mock_alloc("udev_monitor", sizeof(*mon));
+	if (!mon)
+		return NULL;
+	mon->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (mon->fd < 0) {
+		mock_free("udev_monitor", mon, __func__);
+		return NULL;
+	}
+	return mon;
+}
+
+struct udev_monitor *udev_monitor_unref(struct udev_monitor *mon)
+{
+	mock_enter(__func__);
+	if (!mock_live("udev_monitor", mon, __func__))
+		return NULL;
+	close(mon->fd);
+	mock_free("udev_monitor", mon, __func__);
+	return NULL;
+}
+
+int udev_monitor_filter_add_match_subsystem_devtype(struct udev_monitor *mon,
+		const char *subsystem, const char *devtype)
+{
+	mock_enter(__func__);
+	return mock_live("udev_monitor", mon, __func__) ? 0 : -EINVAL;
+}
+
+int udev_monitor_enable_receiving(struct udev_monitor *mon)
+{
+	mock_enter(__func__);
+	return mock_live("udev_monitor", mon, __func__) ? 0 : -EINVAL;
+}
+
+int udev_monitor_get_fd(struct udev_monitor *mon)
+{
+	mock_enter(__func__);
+	return mock_live("udev_monitor", mon, __func__) ? mon->fd : -EINVAL;
+}
+
+struct udev_device *udev_monitor_receive_device(struct udev_monitor *mon)
+{
+	mock_enter(__func__);
+	mock_live("udev_monitor", mon, __func__);
+	return NULL;
+}
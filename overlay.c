@@ -0,0 +1,326 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+
+#include "formats.h"
+#include "overlay.h"
+
+static const char *plane_type_names[] = {
+	[DRM_PLANE_TYPE_OVERLAY]	= "overlay",
+	[DRM_PLANE_TYPE_PRIMARY]	= "primary",
+	[DRM_PLANE_TYPE_CURSOR]		= "cursor",
+};
+
+int overlay_init(struct overlay *o, int fd, struct prop_cache *props)
+{
+	const struct drm_prop *zpos;
+	drmModePlaneRes *res;
+	drmModePlane *plane;
+	struct kms_plane *p;
+	uint64_t type;
+	uint32_t i;
+
+	memset(o, 0, sizeof(*o));
+	o->fd = fd;
+
+	res = drmModeGetPlaneResources(fd);
+	if (!res) {
+		printf("drmModeGetPlaneResources failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	o->planes = calloc(res->count_planes, sizeof(*o->planes));
+	if (!o->planes) {
+		drmModeFreePlaneResources(res);
+		return -1;
+	}
+
+	for (i = 0; i < res->count_planes; i++) {
+		plane = drmModeGetPlane(fd, res->planes[i]);
+		if (!plane)
+			continue;
+
+		p = &o->planes[o->nplanes];
+		p->id = plane->plane_id;
+		p->possible_crtcs = plane->possible_crtcs;
+		p->type = DRM_PLANE_TYPE_OVERLAY;
+		if (!prop_cache_value(props, p->id, DRM_MODE_OBJECT_PLANE, "type", &type))
+			p->type = type;
+
+		/* zpos is optional, and mutable or not */
+		zpos = prop_cache_find(props, p->id, DRM_MODE_OBJECT_PLANE, "zpos");
+		if (zpos) {
+			p->has_zpos = true;
+			p->zpos_immutable = zpos->flags & DRM_MODE_PROP_IMMUTABLE;
+			p->zpos = zpos->value;
+			p->zpos_min = zpos->min;
+			p->zpos_max = zpos->max;
+		}
+
+		p->formats = malloc(plane->count_formats * sizeof(*p->formats));
+		if (p->formats) {
+			memcpy(p->formats, plane->formats,
+					plane->count_formats * sizeof(*p->formats));
+			p->count_formats = plane->count_formats;
+		}
+
+		drmModeFreePlane(plane);
+		o->nplanes++;
+	}
+
+	drmModeFreePlaneResources(res);
+	return 0;
+}
+
+void overlay_print_planes(const struct overlay *o, uint32_t crtc_index)
+{
+	const struct kms_plane *p;
+	char zpos[32], fourcc[5];
+	uint32_t j;
+	int i;
+
+	printf("### Planes of CRTC %u:\n", crtc_index);
+	printf("\t%-6s %-8s %-16s %s\n", "plane", "type", "zpos", "formats");
+	for (i = 0; i < o->nplanes; i++) {
+		p = &o->planes[i];
+		if (!(p->possible_crtcs & (1 << crtc_index)))
+			continue;
+
+		if (!p->has_zpos)
+			snprintf(zpos, sizeof(zpos), "-");
+		else if (p->zpos_immutable)
+			snprintf(zpos, sizeof(zpos), "%llu (fixed)",
+					(unsigned long long)p->zpos);
+		else
+			snprintf(zpos, sizeof(zpos), "%llu [%lld..%lld]",
+					(unsigned long long)p->zpos,
+					(long long)p->zpos_min, (long long)p->zpos_max);
+
+		printf("\t%-6u %-8s %-16s", p->id,
+				p->type < 3 ? plane_type_names[p->type] : "?", zpos);
+		for (j = 0; j < p->count_formats; j++)
+			printf(" %s", fourcc_str(p->formats[j], fourcc));
+		printf("\n");
+	}
+}
+
+static bool plane_has_format(const struct kms_plane *p, uint32_t format)
+{
+	uint32_t i;
+
+	for (i = 0; i < p->count_formats; i++)
+		if (p->formats[i] == format)
+			return true;
+
+	return false;
+}
+
+/* a static test picture: gradients in a colour of its own for every layer */
+static void fill_layer(struct layer *l, uint8_t *map, int index)
+{
+	uint32_t *row;
+	uint8_t *y, *uv;
+	uint32_t i, j;
+
+	if (l->format == DRM_FORMAT_NV12) {
+		for (j = 0; j < l->height; j++) {
+			y = map + l->offsets[0] + j * l->pitches[0];
+			for (i = 0; i < l->width; i++)
+				y[i] = 16 + (i + j) * 219 / (l->width + l->height);
+		}
+		for (j = 0; j < l->height / 2; j++) {
+			uv = map + l->offsets[1] + j * l->pitches[1];
+			for (i = 0; i < l->width / 2; i++) {
+				uv[2 * i] = 64 + index * 64;
+				uv[2 * i + 1] = 192 - index * 64;
+			}
+		}
+		return;
+	}
+
+	for (j = 0; j < l->height; j++) {
+		row = (uint32_t *)(map + j * l->pitches[0]);
+		for (i = 0; i < l->width; i++)
+			row[i] = 0xff000000 | (i * 255 / l->width) << 16 |
+					(j * 255 / l->height) << 8 |
+					((index * 96 + 64) & 0xff);
+	}
+}
+
+/* NV12 and 32 bpp RGB layers */
+int overlay_add_layer(struct overlay *o, uint32_t format, uint32_t width,
+		uint32_t height, int32_t x, int32_t y)
+{
+	struct drm_mode_create_dumb create = { 0 };
+	struct drm_mode_map_dumb map = { 0 };
+	struct drm_mode_destroy_dumb destroy = { 0 };
+	uint32_t handles[4] = { 0 };
+	struct layer *l;
+	void *ptr;
+	int i;
+
+	if (o->nlayers == OVERLAY_MAX_LAYERS)
+		return -1;
+
+	l = &o->layer[o->nlayers];
+	memset(l, 0, sizeof(*l));
+	l->format = format;
+	l->width = width & ~1;
+	l->height = height & ~1;
+	l->x = x;
+	l->y = y;
+
+	/* the chroma plane goes below the luma one in the same buffer */
+	create.width = l->width;
+	create.height = format == DRM_FORMAT_NV12 ? l->height * 3 / 2 : l->height;
+	create.bpp = format == DRM_FORMAT_NV12 ? 8 : 32;
+	if (drmIoctl(o->fd, DRM_IOCTL_MODE_CREATE_DUMB, &create)) {
+		printf("failed to create a %ux%u layer buffer: %s\n",
+				l->width, l->height, strerror(errno));
+		return -1;
+	}
+	l->handle = create.handle;
+	l->size = create.size;
+	l->nplanes = format == DRM_FORMAT_NV12 ? 2 : 1;
+	for (i = 0; i < l->nplanes; i++) {
+		handles[i] = l->handle;
+		l->pitches[i] = create.pitch;
+	}
+	if (format == DRM_FORMAT_NV12)
+		l->offsets[1] = create.pitch * l->height;
+
+	map.handle = l->handle;
+	if (drmIoctl(o->fd, DRM_IOCTL_MODE_MAP_DUMB, &map))
+		goto fail;
+	ptr = mmap(NULL, l->size, PROT_READ | PROT_WRITE, MAP_SHARED, o->fd,
+			map.offset);
+	if (ptr == MAP_FAILED)
+		goto fail;
+	fill_layer(l, ptr, o->nlayers);
+	munmap(ptr, l->size);
+
+	if (drmModeAddFB2(o->fd, l->width, l->height, format, handles,
+			l->pitches, l->offsets, &l->fb_id, 0)) {
+		printf("failed to create a layer framebuffer: %s\n", strerror(errno));
+		goto fail;
+	}
+
+	return o->nlayers++;
+
+fail:
+	destroy.handle = l->handle;
+	drmIoctl(o->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+	memset(l, 0, sizeof(*l));
+	return -1;
+}
+
+/*
+ * Give the layers, bottom to top, free overlay planes of the CRTC that
+ * scan out their formats, stacked above the primary plane.  A plane with
+ * a fixed zpos below the primary one can't show a layer.  Returns how
+ * many layers got a plane, the others are left to GL.
+ */
+int overlay_assign(struct overlay *o, uint32_t crtc_index, uint32_t primary_id)
+{
+	struct kms_plane *p;
+	uint64_t base = 0, z;
+	int i, k, n = 0;
+
+	for (k = 0; k < o->nplanes; k++) {
+		o->planes[k].taken = false;
+		if (o->planes[k].id == primary_id && o->planes[k].has_zpos)
+			base = o->planes[k].zpos;
+	}
+
+	for (i = 0; i < o->nlayers; i++) {
+		struct layer *l = &o->layer[i];
+
+		l->plane_id = 0;
+		l->set_zpos = false;
+		for (k = 0; k < o->nplanes; k++) {
+			p = &o->planes[k];
+			if (p->taken || p->type != DRM_PLANE_TYPE_OVERLAY ||
+			    !(p->possible_crtcs & (1 << crtc_index)) ||
+			    !plane_has_format(p, l->format))
+				continue;
+
+			z = base + 1 + i;
+			if (!p->has_zpos)
+				z = 0;
+			else if (p->zpos_immutable && p->zpos <= base)
+				continue;
+			else if (p->zpos_immutable)
+				z = p->zpos;
+			else if (z > (uint64_t)p->zpos_max)
+				continue;
+			else if (z < (uint64_t)p->zpos_min)
+				z = p->zpos_min;
+
+			p->taken = true;
+			l->plane_id = p->id;
+			l->zpos = z;
+			l->set_zpos = p->has_zpos && !p->zpos_immutable;
+			n++;
+			break;
+		}
+	}
+
+	return n;
+}
+
+/* a dma-buf of the layer buffer for GL composition, or -1 */
+int overlay_export(const struct overlay *o, const struct layer *l)
+{
+	int fd;
+
+	if (drmPrimeHandleToFD(o->fd, l->handle, DRM_CLOEXEC, &fd)) {
+		printf("failed to export a layer buffer: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return fd;
+}
+
+void overlay_fini(struct overlay *o)
+{
+	struct drm_mode_destroy_dumb destroy = { 0 };
+	int i;
+
+	for (i = 0; i < o->nlayers; i++) {
+		drmModeRmFB(o->fd, o->layer[i].fb_id);
+		destroy.handle = o->layer[i].handle;
+		drmIoctl(o->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+	}
+
+	for (i = 0; i < o->nplanes; i++)
+		free(o->planes[i].formats);
+	free(o->planes);
+	memset(o, 0, sizeof(*o));
+}
@@ -0,0 +1,80 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _KMSCUBE_OVERLAY_H_
+#define _KMSCUBE_OVERLAY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "propcache.h"
+
+#define OVERLAY_MAX_LAYERS	(3)
+
+/* a KMS plane as far as layer placement cares */
+struct kms_plane {
+	uint32_t id;
+	uint32_t type;			/* DRM_PLANE_TYPE_* */
+	uint32_t possible_crtcs;
+	bool has_zpos, zpos_immutable;
+	uint64_t zpos;
+	int64_t zpos_min, zpos_max;
+	uint32_t count_formats;
+	uint32_t *formats;
+	bool taken;			/* by a layer */
+};
+
+/*
+ * An extra content layer on top of the rendered frame, e.g. a video
+ * frame or a UI element.  Its buffer is a dumb buffer filled once by the
+ * CPU, so it can be scanned out by an overlay plane, or imported by GL
+ * as a dma-buf and composited into the frame when no plane takes it.
+ */
+struct layer {
+	uint32_t format;
+	uint32_t width, height;
+	int32_t x, y;			/* on the CRTC */
+	uint32_t handle, fb_id;
+	uint32_t pitches[4], offsets[4];
+	int nplanes;
+	uint64_t size;
+	uint32_t plane_id;		/* 0: composited by GL */
+	uint64_t zpos;
+	bool set_zpos;			/* the plane's zpos is ours to set */
+};
+
+struct overlay {
+	int fd;
+	int nplanes;
+	struct kms_plane *planes;
+	int nlayers;
+	struct layer layer[OVERLAY_MAX_LAYERS];
+};
+
+int overlay_init(struct overlay *o, int fd, struct prop_cache *props);
+void overlay_print_planes(const struct overlay *o, uint32_t crtc_index);
+int overlay_add_layer(struct overlay *o, uint32_t format, uint32_t width,
+		uint32_t height, int32_t x, int32_t y);
+int overlay_assign(struct overlay *o, uint32_t crtc_index, uint32_t primary_id);
+int overlay_export(const struct overlay *o, const struct layer *l);
+void overlay_fini(struct overlay *o);
+
+#endif /* _KMSCUBE_OVERLAY_H_ */
@@ -0,0 +1,255 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "perfmem.h"
+
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+
+#define PMU_DIR	"/sys/bus/event_source/devices"
+
+static const char *event_names[][2] = {
+	{ "data_read", "data_write" },		/* uncore_imc */
+	{ "data_reads", "data_writes" },	/* uncore_imc_free_running */
+};
+
+static int read_line(const char *path, char *buf, int size)
+{
+	FILE *f = fopen(path, "r");
+	int len;
+
+	if (!f)
+		return -1;
+
+	if (!fgets(buf, size, f)) {
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+
+	len = strlen(buf);
+	while (len && (buf[len - 1] == '\n' || buf[len - 1] == ' '))
+		buf[--len] = 0;
+
+	return 0;
+}
+
+/*
+ * Place a term value into the config field its format file names, e.g.
+ * "config:0-7" or "config:0-7,32-35"; the ranges are filled from the
+ * least significant bit of the value up.
+ */
+static int apply_term(const char *pmu, const char *term, uint64_t value,
+		struct perf_event_attr *attr)
+{
+	char path[256], fmt[128], *p;
+	__u64 *config;
+	int shift = 0;
+
+	snprintf(path, sizeof(path), PMU_DIR "/%s/format/%s", pmu, term);
+	if (read_line(path, fmt, sizeof(fmt)))
+		return -1;
+
+	if (!strncmp(fmt, "config:", 7))
+		config = &attr->config;
+	else if (!strncmp(fmt, "config1:", 8))
+		config = &attr->config1;
+	else if (!strncmp(fmt, "config2:", 8))
+		config = &attr->config2;
+	else
+		return -1;
+
+	p = strchr(fmt, ':') + 1;
+	while (*p) {
+		int lo, hi, n;
+
+		if (sscanf(p, "%d-%d%n", &lo, &hi, &n) != 2) {
+			if (sscanf(p, "%d%n", &lo, &n) != 1)
+				return -1;
+			hi = lo;
+		}
+		if (lo > hi || hi > 63)
+			return -1;
+
+		*config |= ((value >> shift) &
+				(hi - lo == 63 ? ~0ull : (1ull << (hi - lo + 1)) - 1)) << lo;
+		shift += hi - lo + 1;
+
+		p += n;
+		if (*p == ',')
+			p++;
+	}
+
+	return 0;
+}
+
+/* Parse events/<name> ("event=0xff,umask=0x20") into attr, bytes per count into scale. */
+static int parse_event(const char *pmu, const char *name,
+		struct perf_event_attr *attr, double *scale)
+{
+	char path[256], buf[128], *term, *save;
+
+	snprintf(path, sizeof(path), PMU_DIR "/%s/events/%s.unit", pmu, name);
+	if (read_line(path, buf, sizeof(buf)) || strcmp(buf, "MiB"))
+		return -1;
+
+	snprintf(path, sizeof(path), PMU_DIR "/%s/events/%s.scale", pmu, name);
+	if (read_line(path, buf, sizeof(buf)))
+		return -1;
+	*scale = strtod(buf, NULL) * 1024 * 1024;
+
+	snprintf(path, sizeof(path), PMU_DIR "/%s/events/%s", pmu, name);
+	if (read_line(path, buf, sizeof(buf)))
+		return -1;
+
+	for (term = strtok_r(buf, ",", &save); term; term = strtok_r(NULL, ",", &save)) {
+		char *eq = strchr(term, '=');
+		uint64_t value = 1;
+
+		if (eq) {
+			*eq = 0;
+			value = strtoull(eq + 1, NULL, 0);
+		}
+		if (apply_term(pmu, term, value, attr))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int open_event(const char *pmu, const char *name, double *scale)
+{
+	struct perf_event_attr attr;
+	char path[256], buf[64];
+	int cpu = 0;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.disabled = 1;
+
+	snprintf(path, sizeof(path), PMU_DIR "/%s/type", pmu);
+	if (read_line(path, buf, sizeof(buf)))
+		return -1;
+	attr.type = strtoul(buf, NULL, 10);
+
+	if (parse_event(pmu, name, &attr, scale))
+		return -1;
+
+	/* uncore counters are read from one CPU of their socket */
+	snprintf(path, sizeof(path), PMU_DIR "/%s/cpumask", pmu);
+	if (!read_line(path, buf, sizeof(buf)))
+		cpu = atoi(buf);
+
+	return syscall(__NR_perf_event_open, &attr, -1, cpu, -1, 0);
+}
+
+int perf_mem_open(struct perf_mem *p)
+{
+	DIR *dir = opendir(PMU_DIR);
+	struct dirent *ent;
+	int i;
+
+	memset(p, 0, sizeof(*p));
+	p->fd[0] = p->fd[1] = -1;
+
+	if (!dir)
+		return -1;
+
+	while ((ent = readdir(dir))) {
+		/* a name cut to fit pmu[] would point at another PMU */
+		if (ent->d_name[0] == '.' || strlen(ent->d_name) >= sizeof(p->pmu))
+			continue;
+
+		for (i = 0; i < ARRAY_SIZE(event_names); i++) {
+			p->fd[0] = open_event(ent->d_name, event_names[i][0], &p->scale[0]);
+			if (p->fd[0] < 0)
+				continue;
+			p->fd[1] = open_event(ent->d_name, event_names[i][1], &p->scale[1]);
+			if (p->fd[1] >= 0)
+				break;
+			close(p->fd[0]);
+			p->fd[0] = -1;
+		}
+
+		if (p->fd[0] >= 0) {
+			snprintf(p->pmu, sizeof(p->pmu), "%.63s", ent->d_name);
+			break;
+		}
+	}
+	closedir(dir);
+
+	return p->fd[0] >= 0 ? 0 : -1;
+}
+
+void perf_mem_start(struct perf_mem *p)
+{
+	int i;
+
+	if (p->fd[0] < 0)
+		return;
+
+	for (i = 0; i < 2; i++) {
+		ioctl(p->fd[i], PERF_EVENT_IOC_RESET, 0);
+		ioctl(p->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+	p->running = true;
+}
+
+/* Bytes read and written since perf_mem_start(), -1 when not counted. */
+int64_t perf_mem_stop(struct perf_mem *p)
+{
+	double bytes = 0;
+	uint64_t count;
+	int i;
+
+	if (!p->running)
+		return -1;
+	p->running = false;
+
+	for (i = 0; i < 2; i++) {
+		ioctl(p->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(p->fd[i], &count, sizeof(count)) != sizeof(count))
+			return -1;
+		bytes += count * p->scale[i];
+	}
+
+	return (int64_t)bytes;
+}
+
+void perf_mem_close(struct perf_mem *p)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (p->fd[i] >= 0)
+			close(p->fd[i]);
+		p->fd[i] = -1;
+	}
+	p->running = false;
+}
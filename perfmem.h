@@ -0,0 +1,48 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _KMSCUBE_PERFMEM_H_
+#define _KMSCUBE_PERFMEM_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * System wide memory traffic from the uncore PMU events the kernel
+ * exports under /sys/bus/event_source/devices: the first PMU with a
+ * data_read(s)/data_write(s) event pair reported in MiB is used, as the
+ * Intel and AMD memory controller PMUs do.  The counts include every
+ * client of the memory controller, not only the display pipeline, so
+ * they are only comparable between runs on an otherwise idle system.
+ */
+struct perf_mem {
+	char pmu[64];
+	int fd[2];		/* read, write */
+	double scale[2];	/* count to bytes */
+	bool running;
+};
+
+int perf_mem_open(struct perf_mem *p);
+void perf_mem_start(struct perf_mem *p);
+int64_t perf_mem_stop(struct perf_mem *p);
+void perf_mem_close(struct perf_mem *p);
+
+#endif /* _KMSCUBE_PERFMEM_H_ */
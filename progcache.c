@@ -0,0 +1,272 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <EGL/egl.h>
+
+#include "progcache.h"
+
+#define PROGCACHE_MAGIC		"GBMTPBIN"
+
+struct progcache_header {
+	char magic[8];
+	uint64_t key;
+	uint32_t format;
+	uint32_t length;
+};
+
+static uint64_t fnv1a(uint64_t h, const char *s)
+{
+	if (!s)
+		s = "";
+
+	/* hash the terminator too, so that "ab"+"c" != "a"+"bc" */
+	do {
+		h ^= (unsigned char)*s;
+		h *= 0x100000001b3ull;
+	} while (*s++);
+
+	return h;
+}
+
+int progcache_init(struct program_cache *c, const char *dir)
+{
+	memset(c, 0, sizeof(*c));
+	c->supported = -1;
+
+	if (strlen(dir) >= sizeof(c->dir) - 24) {
+		printf("program cache path too long: %s\n", dir);
+		return -1;
+	}
+	strcpy(c->dir, dir);
+
+	if (mkdir(dir, 0755) && errno != EEXIST) {
+		printf("failed to create program cache %s: %s\n", dir, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static bool progcache_probe(struct program_cache *c)
+{
+	const char *exts;
+	GLint formats = 0;
+
+	if (c->supported >= 0)
+		return c->supported;
+
+	c->supported = 0;
+
+	exts = (const char *)glGetString(GL_EXTENSIONS);
+	if (!exts || !strstr(exts, "GL_OES_get_program_binary")) {
+		printf("program cache: GL_OES_get_program_binary not supported\n");
+		return false;
+	}
+
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &formats);
+	if (formats <= 0) {
+		printf("program cache: driver exposes no program binary formats\n");
+		return false;
+	}
+
+	c->get_program_binary = (PFNGLGETPROGRAMBINARYOESPROC)
+			eglGetProcAddress("glGetProgramBinaryOES");
+	c->program_binary = (PFNGLPROGRAMBINARYOESPROC)
+			eglGetProcAddress("glProgramBinaryOES");
+	if (!c->get_program_binary || !c->program_binary)
+		return false;
+
+	c->supported = 1;
+	return true;
+}
+
+static void progcache_path(const struct program_cache *c, uint64_t key,
+		char *path, size_t len)
+{
+	snprintf(path, len, "%s/%016llx.bin", c->dir, (unsigned long long)key);
+}
+
+static void progcache_set(struct program_cache *c, uint64_t key,
+		GLenum format, void *binary, GLint length)
+{
+	free(c->binary);
+	c->key = key;
+	c->format = format;
+	c->binary = binary;
+	c->length = length;
+}
+
+/* read the binary for key from disk into the in-memory slot */
+static bool progcache_read(struct program_cache *c, uint64_t key)
+{
+	struct progcache_header hdr;
+	char path[sizeof(c->dir) + 24];
+	void *binary;
+	FILE *f;
+
+	progcache_path(c, key, path, sizeof(path));
+	f = fopen(path, "rb");
+	if (!f)
+		return false;
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    memcmp(hdr.magic, PROGCACHE_MAGIC, sizeof(hdr.magic)) ||
+	    hdr.key != key || !hdr.length) {
+		fclose(f);
+		return false;
+	}
+
+	binary = malloc(hdr.length);
+	if (!binary || fread(binary, hdr.length, 1, f) != 1) {
+		free(binary);
+		fclose(f);
+		return false;
+	}
+	fclose(f);
+
+	progcache_set(c, key, hdr.format, binary, hdr.length);
+	return true;
+}
+
+/*
+ * Try to load program from the cache.  The caller must have bound the
+ * attribute locations already.  Returns false on a miss or when the driver
+ * rejected the binary, in which case the program has to be compiled.
+ */
+bool progcache_load(struct program_cache *c, GLuint program,
+		const char *vs_source, const char *fs_source)
+{
+	char path[sizeof(c->dir) + 24];
+	uint64_t key = 0xcbf29ce484222325ull;
+	GLint linked = 0;
+
+	if (!progcache_probe(c))
+		return false;
+
+	key = fnv1a(key, vs_source);
+	key = fnv1a(key, fs_source);
+	key = fnv1a(key, (const char *)glGetString(GL_VENDOR));
+	key = fnv1a(key, (const char *)glGetString(GL_RENDERER));
+	key = fnv1a(key, (const char *)glGetString(GL_VERSION));
+
+	if (!(c->binary && c->key == key) && !progcache_read(c, key)) {
+		progcache_set(c, key, 0, NULL, 0);
+		c->misses++;
+		return false;
+	}
+
+	c->program_binary(program, c->format, c->binary, c->length);
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if (!linked) {
+		/* stale or foreign binary, drop it so it gets rewritten */
+		progcache_path(c, key, path, sizeof(path));
+		unlink(path);
+		progcache_set(c, key, 0, NULL, 0);
+		c->rejects++;
+		c->misses++;
+		return false;
+	}
+
+	c->hits++;
+	return true;
+}
+
+/* save the freshly linked program under the key of the last load */
+void progcache_store(struct program_cache *c, GLuint program)
+{
+	struct progcache_header hdr;
+	char path[sizeof(c->dir) + 24], tmp[sizeof(path) + 8];
+	GLint length = 0;
+	GLsizei written = 0;
+	GLenum format;
+	void *binary;
+	FILE *f;
+
+	if (c->supported != 1)
+		return;
+
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+	if (length <= 0)
+		return;
+
+	binary = malloc(length);
+	if (!binary)
+		return;
+
+	c->get_program_binary(program, length, &written, &format, binary);
+	if (written <= 0) {
+		free(binary);
+		return;
+	}
+
+	progcache_set(c, c->key, format, binary, written);
+
+	memcpy(hdr.magic, PROGCACHE_MAGIC, sizeof(hdr.magic));
+	hdr.key = c->key;
+	hdr.format = format;
+	hdr.length = written;
+
+	/* write to a temporary and rename, so readers never see half a file */
+	progcache_path(c, c->key, path, sizeof(path));
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	f = fopen(tmp, "wb");
+	if (!f) {
+		printf("program cache: cannot write %s: %s\n", tmp, strerror(errno));
+		return;
+	}
+
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    fwrite(binary, written, 1, f) != 1) {
+		fclose(f);
+		unlink(tmp);
+		return;
+	}
+
+	if (fclose(f) || rename(tmp, path)) {
+		unlink(tmp);
+		return;
+	}
+
+	c->stores++;
+}
+
+void progcache_report(const struct program_cache *c)
+{
+	if (!c->dir[0])
+		return;
+
+	printf("### Program binary cache %s: %u hits, %u misses (%u rejected), %u stored\n",
+			c->dir, c->hits, c->misses, c->rejects, c->stores);
+}
+
+void progcache_fini(struct program_cache *c)
+{
+	free(c->binary);
+	c->binary = NULL;
+}
@@ -0,0 +1,59 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _KMSCUBE_PROGCACHE_H_
+#define _KMSCUBE_PROGCACHE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+/*
+ * On-disk cache of linked program binaries (GL_OES_get_program_binary).
+ * Entries are keyed by a hash of the shader sources and the GL vendor,
+ * renderer and version strings, so a driver update invalidates them.
+ * The last binary is also kept in memory for the re-init cycles.
+ */
+struct program_cache {
+	char dir[256];
+	int supported;		/* -1: not probed yet */
+
+	PFNGLGETPROGRAMBINARYOESPROC get_program_binary;
+	PFNGLPROGRAMBINARYOESPROC program_binary;
+
+	uint64_t key;
+	GLenum format;
+	void *binary;
+	GLint length;
+
+	unsigned int hits, misses, rejects, stores;
+};
+
+int progcache_init(struct program_cache *c, const char *dir);
+bool progcache_load(struct program_cache *c, GLuint program,
+		const char *vs_source, const char *fs_source);
+void progcache_store(struct program_cache *c, GLuint program);
+void progcache_report(const struct program_cache *c);
+void progcache_fini(struct program_cache *c);
+
+#endif /* _KMSCUBE_PROGCACHE_H_ */
@@ -0,0 +1,273 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "propcache.h"
+
+static struct drm_prop_object *cache_object(struct prop_cache *c,
+		uint32_t obj_id, uint32_t obj_type)
+{
+	drmModeObjectProperties *props;
+	struct drm_prop_object *obj, *objs;
+	uint32_t i;
+
+	props = drmModeObjectGetProperties(c->fd, obj_id, obj_type);
+	c->queries++;
+	if (!props)
+		return NULL;
+
+	objs = realloc(c->objs, (c->count + 1) * sizeof(*objs));
+	if (!objs) {
+		drmModeFreeObjectProperties(props);
+		return NULL;
+	}
+	c->objs = objs;
+
+	obj = &c->objs[c->count];
+	obj->id = obj_id;
+	obj->type = obj_type;
+	obj->count = 0;
+	obj->props = calloc(props->count_props, sizeof(*obj->props));
+	if (!obj->props && props->count_props) {
+		drmModeFreeObjectProperties(props);
+		return NULL;
+	}
+
+	for (i = 0; i < props->count_props; i++) {
+		struct drm_prop *p = &obj->props[obj->count];
+		drmModePropertyPtr prop;
+
+		prop = drmModeGetProperty(c->fd, props->props[i]);
+		c->queries++;
+		if (!prop)
+			continue;
+
+		p->id = prop->prop_id;
+		p->flags = prop->flags;
+		memcpy(p->name, prop->name, sizeof(p->name));
+		p->name[sizeof(p->name) - 1] = '\0';
+		p->value = props->prop_values[i];
+		p->index = i;
+
+		if ((drm_property_type_is(prop, DRM_MODE_PROP_RANGE) ||
+		     drm_property_type_is(prop, DRM_MODE_PROP_SIGNED_RANGE)) &&
+		    prop->count_values == 2) {
+			p->min = prop->values[0];
+			p->max = prop->values[1];
+		}
+
+		if (prop->count_enums) {
+			p->enums = malloc(prop->count_enums * sizeof(*p->enums));
+			if (p->enums) {
+				memcpy(p->enums, prop->enums,
+						prop->count_enums * sizeof(*p->enums));
+				p->count_enums = prop->count_enums;
+			}
+		}
+
+		drmModeFreeProperty(prop);
+		obj->count++;
+	}
+
+	drmModeFreeObjectProperties(props);
+	c->count++;
+
+	return obj;
+}
+
+/* read the properties of all CRTCs, planes and connectors */
+int prop_cache_init(struct prop_cache *c, int fd)
+{
+	drmModeRes *res;
+	drmModePlaneRes *plane_res;
+	uint32_t j;
+	int i;
+
+	memset(c, 0, sizeof(*c));
+	c->fd = fd;
+
+	res = drmModeGetResources(fd);
+	if (!res) {
+		printf("drmModeGetResources failed: %s\n", strerror(errno));
+		return -1;
+	}
+	for (i = 0; i < res->count_crtcs; i++)
+		cache_object(c, res->crtcs[i], DRM_MODE_OBJECT_CRTC);
+	for (i = 0; i < res->count_connectors; i++)
+		cache_object(c, res->connectors[i], DRM_MODE_OBJECT_CONNECTOR);
+	drmModeFreeResources(res);
+
+	plane_res = drmModeGetPlaneResources(fd);
+	if (plane_res) {
+		for (j = 0; j < plane_res->count_planes; j++)
+			cache_object(c, plane_res->planes[j], DRM_MODE_OBJECT_PLANE);
+		drmModeFreePlaneResources(plane_res);
+	}
+
+	return 0;
+}
+
+static struct drm_prop_object *find_object(struct prop_cache *c,
+		uint32_t obj_id, uint32_t obj_type)
+{
+	int i;
+
+	for (i = 0; i < c->count; i++)
+		if (c->objs[i].id == obj_id && c->objs[i].type == obj_type)
+			return &c->objs[i];
+
+	/* created after the cache was filled */
+	return cache_object(c, obj_id, obj_type);
+}
+
+const struct drm_prop *prop_cache_find(struct prop_cache *c, uint32_t obj_id,
+		uint32_t obj_type, const char *name)
+{
+	struct drm_prop_object *obj;
+	int i;
+
+	obj = find_object(c, obj_id, obj_type);
+	if (!obj)
+		return NULL;
+
+	c->lookups++;
+	for (i = 0; i < obj->count; i++) {
+		if (!strcmp(obj->props[i].name, name)) {
+			/* a scan gets the list, then each property up to the match */
+			c->uncached += 1 + obj->props[i].index + 1;
+			return &obj->props[i];
+		}
+	}
+	c->uncached += 1 + obj->count;
+
+	return NULL;
+}
+
+/* returns 0 if the object has no such property */
+uint32_t prop_cache_id(struct prop_cache *c, uint32_t obj_id,
+		uint32_t obj_type, const char *name)
+{
+	const struct drm_prop *p = prop_cache_find(c, obj_id, obj_type, name);
+
+	return p ? p->id : 0;
+}
+
+int prop_cache_value(struct prop_cache *c, uint32_t obj_id, uint32_t obj_type,
+		const char *name, uint64_t *value)
+{
+	const struct drm_prop *p = prop_cache_find(c, obj_id, obj_type, name);
+
+	if (!p)
+		return -1;
+
+	*value = p->value;
+	return 0;
+}
+
+const char *prop_enum_name(const struct drm_prop *p, uint64_t value)
+{
+	int i;
+
+	for (i = 0; i < p->count_enums; i++)
+		if (p->enums[i].value == value)
+			return p->enums[i].name;
+
+	return NULL;
+}
+
+static const char *prop_type_name(uint32_t flags)
+{
+	if (flags & DRM_MODE_PROP_RANGE)
+		return "range";
+	if (flags & DRM_MODE_PROP_ENUM)
+		return "enum";
+	if (flags & DRM_MODE_PROP_BLOB)
+		return "blob";
+	if (flags & DRM_MODE_PROP_BITMASK)
+		return "bitmask";
+	switch (flags & DRM_MODE_PROP_EXTENDED_TYPE) {
+	case DRM_MODE_PROP_OBJECT:
+		return "object";
+	case DRM_MODE_PROP_SIGNED_RANGE:
+		return "signed range";
+	}
+
+	return "unknown";
+}
+
+void prop_cache_dump(struct prop_cache *c, uint32_t obj_id, uint32_t obj_type)
+{
+	struct drm_prop_object *obj = find_object(c, obj_id, obj_type);
+	const struct drm_prop *p;
+	const char *name;
+	int i;
+
+	if (!obj)
+		return;
+
+	printf("\tobject %u properties:\n", obj_id);
+	for (i = 0; i < obj->count; i++) {
+		p = &obj->props[i];
+		printf("\t\t%-16s id %-4u %-12s%s = %" PRIu64, p->name, p->id,
+				prop_type_name(p->flags),
+				p->flags & DRM_MODE_PROP_IMMUTABLE ? " (immutable)" : "",
+				p->value);
+
+		name = prop_enum_name(p, p->value);
+		if (name)
+			printf(" (%s)", name);
+		else if (p->min || p->max)
+			printf(" [%" PRId64 "..%" PRId64 "]", p->min, p->max);
+		printf("\n");
+	}
+}
+
+void prop_cache_report(const struct prop_cache *c)
+{
+	printf("### Property cache: %d objects, %u queries to fill, %u lookups that would have cost %u queries",
+			c->count, c->queries, c->lookups, c->uncached);
+	if (c->uncached > c->queries)
+		printf(", %u saved\n", c->uncached - c->queries);
+	else
+		printf("\n");
+}
+
+void prop_cache_fini(struct prop_cache *c)
+{
+	int i, j;
+
+	for (i = 0; i < c->count; i++) {
+		for (j = 0; j < c->objs[i].count; j++)
+			free(c->objs[i].props[j].enums);
+		free(c->objs[i].props);
+	}
+	free(c->objs);
+	c->objs = NULL;
+	c->count = 0;
+}
@@ -0,0 +1,75 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _KMSCUBE_PROPCACHE_H_
+#define _KMSCUBE_PROPCACHE_H_
+
+#include <stdint.h>
+
+#include <xf86drmMode.h>
+
+/*
+ * DRM property cache: the properties of every CRTC, plane and connector
+ * are read once, so a lookup by name costs no ioctls.  Values are a
+ * snapshot from when the object was cached, which is what immutable
+ * properties such as a plane's "type" need; mutable state has to be
+ * read from the kernel.
+ */
+struct drm_prop {
+	uint32_t id;
+	uint32_t flags;			/* DRM_MODE_PROP_* */
+	char name[DRM_PROP_NAME_LEN];
+	uint64_t value;
+	int64_t min, max;		/* range and signed range properties */
+	int count_enums;		/* enum and bitmask properties */
+	struct drm_mode_property_enum *enums;
+	int index;			/* position in the object's property list */
+};
+
+struct drm_prop_object {
+	uint32_t id, type;
+	int count;
+	struct drm_prop *props;
+};
+
+struct prop_cache {
+	int fd;
+	int count;
+	struct drm_prop_object *objs;
+
+	unsigned int queries;		/* property queries issued by the cache */
+	unsigned int lookups;
+	unsigned int uncached;		/* queries the lookups cost without it */
+};
+
+int prop_cache_init(struct prop_cache *c, int fd);
+const struct drm_prop *prop_cache_find(struct prop_cache *c, uint32_t obj_id,
+		uint32_t obj_type, const char *name);
+uint32_t prop_cache_id(struct prop_cache *c, uint32_t obj_id,
+		uint32_t obj_type, const char *name);
+int prop_cache_value(struct prop_cache *c, uint32_t obj_id, uint32_t obj_type,
+		const char *name, uint64_t *value);
+const char *prop_enum_name(const struct drm_prop *p, uint64_t value);
+void prop_cache_dump(struct prop_cache *c, uint32_t obj_id, uint32_t obj_type);
+void prop_cache_report(const struct prop_cache *c);
+void prop_cache_fini(struct prop_cache *c);
+
+#endif /* _KMSCUBE_PROPCACHE_H_ */
@@ -0,0 +1,298 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
+
+#include "report.h"
+
+enum {
+	SECTION_NONE,
+	SECTION_CONFIG,
+	SECTION_STAGES,
+	SECTION_COUNTERS,
+};
+
+static const char *section_names[] = {
+	[SECTION_CONFIG]	= "config",
+	[SECTION_STAGES]	= "stages",
+	[SECTION_COUNTERS]	= "counters",
+};
+
+static void put_json_string(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(f, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(f, "\\u%04x", *s);
+		else
+			fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+static void put_csv_string(FILE *f, const char *s)
+{
+	if (!strpbrk(s, ",\"\n")) {
+		fputs(s, f);
+		return;
+	}
+	fputc('"', f);
+	for (; *s; s++) {
+		if (*s == '"')
+			fputc('"', f);
+		fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+/* the board a BSP runs on, device tree systems name it */
+static void read_board(struct report *r)
+{
+	char model[128];
+	size_t len;
+	FILE *f;
+
+	f = fopen("/proc/device-tree/model", "r");
+	if (!f)
+		return;
+	len = fread(model, 1, sizeof(model) - 1, f);
+	fclose(f);
+	model[len] = '\0';
+	if (len)
+		report_env(r, "board", model);
+}
+
+int report_open(struct report *r, const char *path)
+{
+	const char *dot = strrchr(path, '.');
+	struct utsname u;
+
+	memset(r, 0, sizeof(*r));
+	r->format = dot && !strcmp(dot, ".csv") ? REPORT_CSV : REPORT_JSON;
+	r->f = fopen(path, "w");
+	if (!r->f) {
+		printf("failed to open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if (r->format == REPORT_CSV)
+		fprintf(r->f, "run,label,metric,value\n");
+	else
+		fprintf(r->f, "{\n\t\"runs\": [");
+
+	if (!uname(&u)) {
+		report_env(r, "host", u.nodename);
+		report_env(r, "kernel", u.release);
+		report_env(r, "machine", u.machine);
+	}
+	read_board(r);
+
+	return 0;
+}
+
+int report_close(struct report *r)
+{
+	int i, ret;
+
+	if (!r->f)
+		return 0;
+
+	if (r->format == REPORT_JSON)
+		fprintf(r->f, "\n\t],\n\t\"environment\": {");
+	for (i = 0; i < r->nenv; i++) {
+		if (r->format == REPORT_CSV) {
+			fprintf(r->f, "0,,env.%s,", r->env_key[i]);
+			put_csv_string(r->f, r->env_value[i]);
+			fputc('\n', r->f);
+		} else {
+			fprintf(r->f, "%s\n\t\t\"%s\": ", i ? "," : "",
+					r->env_key[i]);
+			put_json_string(r->f, r->env_value[i]);
+		}
+		free(r->env_key[i]);
+		free(r->env_value[i]);
+	}
+	if (r->format == REPORT_JSON)
+		fprintf(r->f, "\n\t}\n}\n");
+
+	ret = fclose(r->f) ? -1 : 0;
+	if (ret)
+		printf("failed to write the results: %s\n", strerror(errno));
+	r->f = NULL;
+	r->nenv = 0;
+
+	return ret;
+}
+
+void report_env(struct report *r, const char *key, const char *value)
+{
+	char *v;
+	int i;
+
+	if (!r->f)
+		return;
+
+	/* one line, no trailing whitespace: sysfs and driver strings have it */
+	v = strdup(value);
+	if (!v)
+		return;
+	v[strcspn(v, "\n")] = '\0';
+	for (i = strlen(v); i > 0 && isspace((unsigned char)v[i - 1]); i--)
+		v[i - 1] = '\0';
+
+	for (i = 0; i < r->nenv; i++) {
+		if (!strcmp(r->env_key[i], key)) {
+			free(r->env_value[i]);
+			r->env_value[i] = v;
+			return;
+		}
+	}
+	if (r->nenv == REPORT_MAX_ENV) {
+		free(v);
+		return;
+	}
+	r->env_key[r->nenv] = strdup(key);
+	r->env_value[r->nenv] = v;
+	if (r->env_key[r->nenv])
+		r->nenv++;
+	else
+		free(v);
+}
+
+void report_run_begin(struct report *r, const char *label)
+{
+	if (!r->f)
+		return;
+
+	r->runs++;
+	r->label = label;
+	r->section = SECTION_NONE;
+	if (r->format == REPORT_JSON) {
+		fprintf(r->f, "%s\n\t\t{\n\t\t\t\"label\": ", r->runs > 1 ? "," : "");
+		put_json_string(r->f, label);
+	}
+}
+
+/* JSON: open the section's object if it isn't already, and the next item */
+static void json_item(struct report *r, int section, const char *key)
+{
+	if (r->section != section) {
+		if (r->section != SECTION_NONE)
+			fprintf(r->f, "\n\t\t\t}");
+		fprintf(r->f, ",\n\t\t\t\"%s\": {", section_names[section]);
+		r->section = section;
+		r->first_item = true;
+	}
+	fprintf(r->f, "%s\n\t\t\t\t", r->first_item ? "" : ",");
+	put_json_string(r->f, key);
+	fprintf(r->f, ": ");
+	r->first_item = false;
+}
+
+static void csv_metric(struct report *r, const char *kind, const char *key)
+{
+	fprintf(r->f, "%d,", r->runs);
+	put_csv_string(r->f, r->label);
+	fprintf(r->f, ",%s.%s,", kind, key);
+}
+
+void report_config(struct report *r, const char *key, const char *value)
+{
+	if (!r->f)
+		return;
+
+	if (r->format == REPORT_CSV) {
+		csv_metric(r, "config", key);
+		put_csv_string(r->f, value);
+		fputc('\n', r->f);
+	} else {
+		json_item(r, SECTION_CONFIG, key);
+		put_json_string(r->f, value);
+	}
+}
+
+void report_stage(struct report *r, const char *prefix,
+		const struct stage_stats *s)
+{
+	static const char *fields[] = {
+		"count", "min_us", "mean_us", "p50_us", "p99_us", "max_us",
+		"stddev_us",
+	};
+	double v[7];
+	char key[96], metric[128];
+	int i;
+
+	if (!r->f || !s->count)
+		return;
+
+	v[0] = s->count;
+	v[1] = s->min_ns / 1e3;
+	v[2] = (double)s->total_ns / s->count / 1e3;
+	v[3] = stats_percentile(s, 50.0) / 1e3;
+	v[4] = stats_percentile(s, 99.0) / 1e3;
+	v[5] = s->max_ns / 1e3;
+	v[6] = stats_stddev(s) / 1e3;
+
+	snprintf(key, sizeof(key), "%s%s", prefix ? prefix : "", s->name);
+	if (r->format == REPORT_JSON) {
+		json_item(r, SECTION_STAGES, key);
+		fprintf(r->f, "{ \"count\": %.0f", v[0]);
+		for (i = 1; i < 7; i++)
+			fprintf(r->f, ", \"%s\": %.3f", fields[i], v[i]);
+		fprintf(r->f, " }");
+		return;
+	}
+
+	for (i = 0; i < 7; i++) {
+		snprintf(metric, sizeof(metric), "%s.%s", key, fields[i]);
+		csv_metric(r, "stage", metric);
+		fprintf(r->f, "%.*f\n", i ? 3 : 0, v[i]);
+	}
+}
+
+void report_counter(struct report *r, const char *key, double value)
+{
+	if (!r->f)
+		return;
+
+	if (r->format == REPORT_CSV)
+		csv_metric(r, "counter", key);
+	else
+		json_item(r, SECTION_COUNTERS, key);
+	fprintf(r->f, "%.10g%s", value, r->format == REPORT_CSV ? "\n" : "");
+}
+
+void report_run_end(struct report *r)
+{
+	if (!r->f || r->format != REPORT_JSON)
+		return;
+
+	if (r->section != SECTION_NONE)
+		fprintf(r->f, "\n\t\t\t}");
+	fprintf(r->f, "\n\t\t}");
+}
@@ -0,0 +1,88 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _KMSCUBE_REPORT_H_
+#define _KMSCUBE_REPORT_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "stats.h"
+
+#define REPORT_MAX_ENV	(24)
+
+enum report_format {
+	REPORT_JSON,
+	REPORT_CSV,
+};
+
+/*
+ * Machine-readable results (-j), next to the printed reports.  The file
+ * holds the environment (device, driver, EGL and GL strings, the board)
+ * and one record per scenario run: its configuration, the latency
+ * distribution of each stage and the resource counters.
+ *
+ * CSV is one value per line, "run,label,metric,value", so that results
+ * concatenate and diff line by line; JSON has the same metrics nested
+ * as {"environment": {...}, "runs": [{"label", "config", "stages",
+ * "counters"}]}.  Times are in microseconds.
+ *
+ * The runs are written as they finish, the environment when the report
+ * is closed, so that strings learned late (EGL, GL) still make it in.
+ */
+struct report {
+	FILE *f;
+	enum report_format format;
+	int runs;
+	const char *label;		/* of the run being written */
+	int section;			/* of the run being written, JSON */
+	bool first_item;
+	int nenv;
+	char *env_key[REPORT_MAX_ENV];
+	char *env_value[REPORT_MAX_ENV];
+};
+
+/* the format follows the file name: .csv is CSV, anything else JSON */
+int report_open(struct report *r, const char *path);
+int report_close(struct report *r);
+
+static inline bool report_enabled(const struct report *r)
+{
+	return r->f != NULL;
+}
+
+/* set or replace an environment string */
+void report_env(struct report *r, const char *key, const char *value);
+
+/*
+ * A run is begun, then given its config strings, its stages and its
+ * counters in that order, and ended.  label names the run, it is what
+ * a baseline comparison matches runs by.
+ */
+void report_run_begin(struct report *r, const char *label);
+void report_config(struct report *r, const char *key, const char *value);
+/* prefix, if not NULL, goes before the stage name, e.g. "display0." */
+void report_stage(struct report *r, const char *prefix,
+		const struct stage_stats *s);
+void report_counter(struct report *r, const char *key, double value);
+void report_run_end(struct report *r);
+
+#endif /* _KMSCUBE_REPORT_H_ */
@@ -0,0 +1,166 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+uint64_t stats_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int bucket_index(uint64_t v)
+{
+	int exp;
+
+	if (v < STATS_SUB_BUCKETS)
+		return v;
+
+	exp = 63 - __builtin_clzll(v);
+	if (exp > STATS_MAX_EXP)
+		return STATS_NBUCKETS - 1;
+
+	return (exp - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS +
+		((v >> (exp - STATS_SUB_BITS)) & (STATS_SUB_BUCKETS - 1));
+}
+
+/* midpoint of the values falling in bucket idx */
+static uint64_t bucket_value(int idx)
+{
+	int exp, sub, shift;
+
+	if (idx < STATS_SUB_BUCKETS)
+		return idx;
+
+	exp = idx / STATS_SUB_BUCKETS + STATS_SUB_BITS - 1;
+	sub = idx % STATS_SUB_BUCKETS;
+	shift = exp - STATS_SUB_BITS;
+
+	return ((uint64_t)(STATS_SUB_BUCKETS + sub) << shift) + ((1ull << shift) >> 1);
+}
+
+void stats_init(struct stage_stats *s, const char *name)
+{
+	memset(s, 0, sizeof(*s));
+	s->name = name;
+	s->min_ns = UINT64_MAX;
+}
+
+void stats_add(struct stage_stats *s, uint64_t ns)
+{
+	double delta = (double)ns - s->mean_ns;
+
+	s->count++;
+	s->mean_ns += delta / s->count;
+	s->m2 += delta * ((double)ns - s->mean_ns);
+	s->total_ns += ns;
+	if (ns < s->min_ns)
+		s->min_ns = ns;
+	if (ns > s->max_ns)
+		s->max_ns = ns;
+	s->buckets[bucket_index(ns)]++;
+}
+
+void stats_merge(struct stage_stats *dst, const struct stage_stats *src)
+{
+	double delta = src->mean_ns - dst->mean_ns;
+	uint64_t n = dst->count + src->count;
+	int i;
+
+	if (!src->count)
+		return;
+
+	dst->m2 += src->m2 + delta * delta * dst->count * src->count / n;
+	dst->mean_ns += delta * src->count / n;
+	dst->count = n;
+	dst->total_ns += src->total_ns;
+	if (src->min_ns < dst->min_ns)
+		dst->min_ns = src->min_ns;
+	if (src->max_ns > dst->max_ns)
+		dst->max_ns = src->max_ns;
+	for (i = 0; i < STATS_NBUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+}
+
+uint64_t stats_percentile(const struct stage_stats *s, double pct)
+{
+	uint64_t rank, seen = 0;
+	int i;
+
+	if (!s->count)
+		return 0;
+
+	rank = (uint64_t)(pct / 100.0 * s->count + 0.5);
+	if (rank < 1)
+		rank = 1;
+
+	for (i = 0; i < STATS_NBUCKETS; i++) {
+		seen += s->buckets[i];
+		if (seen >= rank) {
+			uint64_t v = bucket_value(i);
+
+			if (v < s->min_ns)
+				return s->min_ns;
+			return v > s->max_ns ? s->max_ns : v;
+		}
+	}
+
+	return s->max_ns;
+}
+
+/*
+ * Sample standard deviation from the running sums (Welford), exact: the
+ * buckets are ~3% wide, too coarse for the jitter of a steady frame rate.
+ */
+double stats_stddev(const struct stage_stats *s)
+{
+	if (s->count < 2)
+		return 0;
+
+	return sqrt(s->m2 / (s->count - 1));
+}
+
+void stats_print_header(void)
+{
+	printf("\t%-12s %10s %10s %10s %10s %10s %10s\n", "stage", "count",
+			"min(us)", "mean(us)", "p50(us)", "p99(us)", "max(us)");
+}
+
+void stats_print(const struct stage_stats *s)
+{
+	if (!s->count)
+		return;
+
+	printf("\t%-12s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f\n", s->name,
+			(unsigned long long)s->count,
+			s->min_ns / 1000.0,
+			(double)s->total_ns / s->count / 1000.0,
+			stats_percentile(s, 50.0) / 1000.0,
+			stats_percentile(s, 99.0) / 1000.0,
+			s->max_ns / 1000.0);
+}
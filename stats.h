@@ -0,0 +1,58 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _KMSCUBE_STATS_H_
+#define _KMSCUBE_STATS_H_
+
+#include <stdint.h>
+
+/*
+ * Latency samples are kept in a fixed log-linear histogram rather than in a
+ * growing array, so that a long-running scenario does not grow the process
+ * RSS it is trying to measure.  Each power of two is split in
+ * STATS_SUB_BUCKETS linear steps, which bounds the percentile error to ~1.5%.
+ */
+#define STATS_SUB_BITS		5
+#define STATS_SUB_BUCKETS	(1 << STATS_SUB_BITS)
+#define STATS_MAX_EXP		48
+#define STATS_NBUCKETS		((STATS_MAX_EXP - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS)
+
+struct stage_stats {
+	const char *name;
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t min_ns, max_ns;
+	double mean_ns, m2;		/* exact running mean and squared deviations */
+	uint32_t buckets[STATS_NBUCKETS];
+};
+
+uint64_t stats_now_ns(void);
+
+void stats_init(struct stage_stats *s, const char *name);
+void stats_add(struct stage_stats *s, uint64_t ns);
+void stats_merge(struct stage_stats *dst, const struct stage_stats *src);
+uint64_t stats_percentile(const struct stage_stats *s, double pct);
+double stats_stddev(const struct stage_stats *s);
+
+void stats_print_header(void);
+void stats_print(const struct stage_stats *s);
+
+#endif /* _KMSCUBE_STATS_H_ */
@@ -0,0 +1,254 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timeline.h"
+
+static const char *event_names[TL_EVENTS] = {
+	[TL_DRAW] = "draw",
+	[TL_SWAP] = "swap",
+	[TL_LOCK] = "lock",
+	[TL_FLIP] = "flip",
+};
+
+int timeline_init(struct timeline *t)
+{
+	t->ring = calloc(TIMELINE_FRAMES, sizeof(*t->ring));
+	if (!t->ring) {
+		printf("failed to allocate the timeline\n");
+		return -1;
+	}
+	timeline_reset(t);
+
+	return 0;
+}
+
+void timeline_reset(struct timeline *t)
+{
+	if (t->ring)
+		memset(t->ring, 0, TIMELINE_FRAMES * sizeof(*t->ring));
+	t->next = 0;
+	t->gpu_results = t->gpu_skipped = 0;
+	stats_init(&t->gpu, "gpu_draw");
+}
+
+void timeline_fini(struct timeline *t)
+{
+	free(t->ring);
+	t->ring = NULL;
+}
+
+/* the frame seq if the ring still holds it */
+static struct timeline_frame *lookup(struct timeline *t, uint32_t seq)
+{
+	struct timeline_frame *f;
+
+	if (!t->ring || !t->next)
+		return NULL;
+	f = &t->ring[seq % TIMELINE_FRAMES];
+	return f->seq == seq && seq < t->next ? f : NULL;
+}
+
+uint32_t timeline_begin(struct timeline *t, uint64_t now_ns)
+{
+	struct timeline_frame *f;
+
+	if (!t->ring)
+		return 0;
+
+	f = &t->ring[t->next % TIMELINE_FRAMES];
+	memset(f, 0, sizeof(*f));
+	f->seq = t->next;
+	f->begin_ns = now_ns;
+
+	return t->next++;
+}
+
+void timeline_mark(struct timeline *t, int event, uint64_t start_ns,
+		uint64_t end_ns)
+{
+	struct timeline_frame *f;
+
+	if (event == TL_NONE || !(f = lookup(t, t->next - 1)))
+		return;
+	f->start_ns[event] = start_ns;
+	f->end_ns[event] = end_ns;
+}
+
+void timeline_gpu(struct timeline *t, uint32_t seq, uint64_t ns)
+{
+	struct timeline_frame *f = lookup(t, seq);
+
+	stats_add(&t->gpu, ns);
+	t->gpu_results++;
+	if (f)
+		f->gpu_ns = ns;
+}
+
+void timeline_vblank(struct timeline *t, uint32_t seq, uint64_t vblank_ns)
+{
+	struct timeline_frame *f = lookup(t, seq);
+
+	if (f && !f->vblank_ns)
+		f->vblank_ns = vblank_ns;
+}
+
+static uint64_t duration(const struct timeline_frame *f, int event)
+{
+	return f->end_ns[event] - f->start_ns[event];
+}
+
+/*
+ * Why frame f (after prev) missed its vblank, NULL if it did not or
+ * there is no telling: the GPU or the CPU took longer than a refresh
+ * period, or neither did and it waited on the display side.  Without
+ * vblanks a frame is late when the CPU or GPU alone overran the period.
+ */
+static const char *late_cause(const struct timeline_frame *f,
+		const struct timeline_frame *prev, uint64_t period_ns)
+{
+	uint64_t cpu_ns;
+	bool late;
+
+	if (!period_ns)
+		return NULL;
+
+	cpu_ns = duration(f, TL_DRAW) + duration(f, TL_SWAP) + duration(f, TL_LOCK);
+	if (f->vblank_ns && prev && prev->vblank_ns)
+		late = f->vblank_ns - prev->vblank_ns > period_ns * 3 / 2;
+	else
+		late = cpu_ns > period_ns || f->gpu_ns > period_ns;
+	if (!late)
+		return NULL;
+
+	if (f->gpu_ns > period_ns && f->gpu_ns >= cpu_ns)
+		return "gpu";
+	if (cpu_ns > period_ns)
+		return "cpu";
+	return "display";
+}
+
+static uint32_t first_seq(const struct timeline *t)
+{
+	return t->next > TIMELINE_FRAMES ? t->next - TIMELINE_FRAMES : 0;
+}
+
+/* us from the start of the frame, "-" for none */
+static void print_offset(FILE *f, uint64_t ns, uint64_t begin_ns)
+{
+	if (ns)
+		fprintf(f, "\t%.1f", ns > begin_ns ? (ns - begin_ns) / 1e3 :
+				-((begin_ns - ns) / 1e3));
+	else
+		fprintf(f, "\t-");
+}
+
+/*
+ * One line per frame: its start in ms since the first frame kept, the
+ * start and end of each stage and the vblank in us from its start, the
+ * GPU draw time in us and, if late, why.
+ */
+int timeline_write(const struct timeline *t, const char *path,
+		uint64_t period_ns)
+{
+	const struct timeline_frame *fr, *prev = NULL;
+	const char *cause;
+	uint64_t origin;
+	uint32_t seq;
+	FILE *f;
+	int e;
+
+	if (!t->ring || !t->next)
+		return 0;
+
+	f = fopen(path, "w");
+	if (!f) {
+		printf("failed to write the timeline to %s: %s\n", path,
+				strerror(errno));
+		return -1;
+	}
+
+	fprintf(f, "# stage times and vblank in us from the frame begin\n");
+	fprintf(f, "# frame\tbegin_ms");
+	for (e = 0; e < TL_EVENTS; e++)
+		fprintf(f, "\t%s_start\t%s_end", event_names[e], event_names[e]);
+	fprintf(f, "\tvblank\tgpu_us\tlate\n");
+
+	origin = t->ring[first_seq(t) % TIMELINE_FRAMES].begin_ns;
+	for (seq = first_seq(t); seq < t->next; seq++) {
+		fr = &t->ring[seq % TIMELINE_FRAMES];
+		fprintf(f, "%u\t%.3f", fr->seq, (fr->begin_ns - origin) / 1e6);
+		for (e = 0; e < TL_EVENTS; e++) {
+			print_offset(f, fr->start_ns[e], fr->begin_ns);
+			print_offset(f, fr->end_ns[e], fr->begin_ns);
+		}
+		print_offset(f, fr->vblank_ns, fr->begin_ns);
+		if (fr->gpu_ns)
+			fprintf(f, "\t%.1f", fr->gpu_ns / 1e3);
+		else
+			fprintf(f, "\t-");
+		cause = late_cause(fr, prev, period_ns);
+		fprintf(f, "\t%s\n", cause ? cause : "-");
+		prev = fr;
+	}
+
+	fclose(f);
+	printf("Timeline of %u frames written to %s\n", t->next - first_seq(t), path);
+
+	return 0;
+}
+
+void timeline_report(const struct timeline *t, uint64_t period_ns)
+{
+	const struct timeline_frame *fr, *prev = NULL;
+	uint64_t gpu = 0, cpu = 0, display = 0;
+	const char *cause;
+	uint32_t seq;
+
+	if (!t->ring || !t->next)
+		return;
+
+	for (seq = first_seq(t); seq < t->next; seq++) {
+		fr = &t->ring[seq % TIMELINE_FRAMES];
+		cause = late_cause(fr, prev, period_ns);
+		if (cause && !strcmp(cause, "gpu"))
+			gpu++;
+		else if (cause && !strcmp(cause, "cpu"))
+			cpu++;
+		else if (cause)
+			display++;
+		prev = fr;
+	}
+
+	printf("### Timeline: last %u frames, late: %llu GPU-bound, %llu CPU-bound, %llu waiting on the display\n",
+			t->next - first_seq(t), (unsigned long long)gpu,
+			(unsigned long long)cpu, (unsigned long long)display);
+	if (t->gpu_results || t->gpu_skipped) {
+		printf("\tGPU draw time, %llu frames without a free query:\n",
+				(unsigned long long)t->gpu_skipped);
+		stats_print_header();
+		stats_print(&t->gpu);
+	}
+}
@@ -0,0 +1,82 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _KMSCUBE_TIMELINE_H_
+#define _KMSCUBE_TIMELINE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stats.h"
+
+#define TIMELINE_FRAMES	(4096)
+
+enum timeline_event {
+	TL_NONE = -1,
+	TL_DRAW,
+	TL_SWAP,
+	TL_LOCK,
+	TL_FLIP,
+	TL_EVENTS
+};
+
+/*
+ * One cycle of the scenario loop.  The CPU side is stamped as the stages
+ * run; the GPU time of the draw and the vblank that put the frame on
+ * screen arrive later and find their frame again by its sequence number.
+ * All times are CLOCK_MONOTONIC, 0 when there is none.
+ */
+struct timeline_frame {
+	uint32_t seq;
+	uint64_t begin_ns;
+	uint64_t start_ns[TL_EVENTS], end_ns[TL_EVENTS];
+	uint64_t gpu_ns;		/* draw time on the GPU */
+	uint64_t vblank_ns;		/* first vblank showing the frame */
+};
+
+/*
+ * A ring of the last TIMELINE_FRAMES frames, allocated up front so that
+ * recording costs a few stores per stage and nothing else.
+ */
+struct timeline {
+	struct timeline_frame *ring;
+	uint32_t next;			/* frames begun */
+	uint64_t gpu_results, gpu_skipped;
+	struct stage_stats gpu;
+};
+
+int timeline_init(struct timeline *t);
+void timeline_reset(struct timeline *t);
+void timeline_fini(struct timeline *t);
+
+/* start the next frame, returns its sequence number */
+uint32_t timeline_begin(struct timeline *t, uint64_t now_ns);
+void timeline_mark(struct timeline *t, int event, uint64_t start_ns,
+		uint64_t end_ns);
+void timeline_gpu(struct timeline *t, uint32_t seq, uint64_t ns);
+void timeline_vblank(struct timeline *t, uint32_t seq, uint64_t vblank_ns);
+
+/* period_ns: the refresh period, 0 without a display */
+int timeline_write(const struct timeline *t, const char *path,
+		uint64_t period_ns);
+void timeline_report(const struct timeline *t, uint64_t period_ns);
+
+#endif /* _KMSCUBE_TIMELINE_H_ */